@@ -0,0 +1,57 @@
+# Host simulation build for the STM32F411 USB Host to PS/2 Converter
+# Builds the portable PS/2 and translation modules against a simulated GPIO
+# layer (src/sim/) so the PS/2 link can be exercised on a Linux workstation.
+#
+# Usage: cmake -S . -B build-sim -DPS2_HOST_SIM=ON
+
+# Source files
+set(HOST_SIM_SOURCES
+    # PS/2 implementation
+    src/ps2/ps2_init.c
+    src/ps2/ps2_protocol.c
+    src/ps2/ps2_queue.c
+    src/ps2/ps2_sequence.c
+    src/ps2/ps2_command.c
+    src/ps2/ps2_shadow.c
+    src/ps2/scancode_translator.c
+    src/ps2/macro_engine.c
+    src/ps2/chord_detector.c
+
+    # USB keyboard report handling
+    src/usb/keyboard_handler.c
+    src/usb/hid_keys.c
+    src/usb/key_remap.c
+    src/usb/tap_hold.c
+    ${CMAKE_CURRENT_BINARY_DIR}/key_remap_layers.c
+
+    # Settings store
+    src/config_store.c
+
+    # Simulation
+    src/sim/ps2_line_sim.c
+    src/sim/i8042_sim.c
+    src/sim/flash_sim.c
+    src/sim/ps2_sim_main.c
+)
+
+# The remap check needs layers, so the simulation always uses the example keymap
+keymap_generate(${CMAKE_CURRENT_SOURCE_DIR}/keymap/example.keymap ${CMAKE_CURRENT_BINARY_DIR}/key_remap_layers.c)
+
+# Create host executable
+add_executable(ps2_sim ${HOST_SIM_SOURCES})
+
+target_include_directories(ps2_sim PRIVATE
+    ${CMAKE_CURRENT_SOURCE_DIR}/include
+    ${CMAKE_CURRENT_SOURCE_DIR}/include/usb
+    ${CMAKE_CURRENT_SOURCE_DIR}/include/ps2
+    ${CMAKE_CURRENT_SOURCE_DIR}/include/sim
+)
+
+target_compile_definitions(ps2_sim PRIVATE
+    PS2_HOST_SIM
+    STM32F411xE
+    PS2_QUEUE_RAM_BUDGET=${PS2_QUEUE_RAM_BUDGET}
+    PS2_DEFAULT_SCAN_CODE_SET=${PS2_DEFAULT_SCAN_CODE_SET}
+)
+
+target_compile_options(ps2_sim PRIVATE -Wall -Wextra -Wpedantic)
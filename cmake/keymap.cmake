@@ -0,0 +1,17 @@
+# Key remap layers for the STM32F411 USB Host to PS/2 Converter
+# keymap_generate(<keymap file> <output .c>) compiles a keymap file into the
+# layer tables of src/usb/key_remap.c at build time (see cmake/keymap_gen.cmake)
+
+function(keymap_generate keymap_file output)
+    set(generator ${CMAKE_CURRENT_SOURCE_DIR}/cmake/keymap_gen.cmake)
+    set(header ${CMAKE_CURRENT_SOURCE_DIR}/include/usb/keyboard_handler.h)
+
+    add_custom_command(
+        OUTPUT ${output}
+        COMMAND ${CMAKE_COMMAND} -DKEYMAP_FILE=${keymap_file} -DKEYMAP_HEADER=${header}
+                -DOUTPUT=${output} -P ${generator}
+        DEPENDS ${keymap_file} ${generator} ${header}
+        COMMENT "Generating key remap layers from ${keymap_file}"
+        VERBATIM
+    )
+endfunction()
@@ -0,0 +1,494 @@
+# Key remap layer generator for the STM32F411 USB Host to PS/2 Converter
+# Compiles a keymap file into the direct-indexed layer tables of
+# src/usb/key_remap.c, the dual-role keys of src/usb/tap_hold.c and the chord
+# tables of src/ps2/chord_detector.c. Run at build time by keymap_generate() (cmake/keymap.cmake):
+#
+#   cmake -DKEYMAP_FILE=<keymap> -DKEYMAP_HEADER=<keyboard_handler.h> -DOUTPUT=<file.c> -P keymap_gen.cmake
+#
+# Keymap syntax, one statement per line, '#' starts a comment:
+#   map <key> <key>     Send the second key for the first (NONE disables it)
+#   macro <key> "text"  Type the text when <key> is pressed
+#   layer <key>         Following maps and macros apply while <key> is held
+#   chord <key>+<key> <action> [argument]
+#                       Converter hotkey, the last key pressed while the
+#                       others are held: scan_set <1-3>, lock_layer <layer
+#                       key>, release_all, diagnostics or save_config
+#   tap_hold <key> <tap key> <hold key>
+#                       Tapped, <key> sends the tap key; held past the
+#                       tapping term or while another key is pressed, it
+#                       holds the hold key (a modifier or a layer key)
+#   one_shot <key> <modifier>
+#                       Held, <key> holds the modifier; tapped, it applies
+#                       the modifier to the next key only
+#   tapping_term <ms>   Tap/hold decision time, 200 ms if not given
+# Maps before the first layer statement form the base layer. Keys are the
+# USB_HID_KEY_* and USB_HID_MODIFIER_* names of keyboard_handler.h without
+# the prefix (A, CAPS_LOCK, LEFT_CTRL) or HID usages (0x39).
+#
+# Macro text is ASCII, typed on a US layout. \n, \t, \" and \\ are escapes;
+# {KEY} taps a key and {LEFT_CTRL+LEFT_ALT+DELETE} taps it with modifiers.
+#
+# Chords match the keys of the USB keyboard, before remapping. Each key
+# triggers at most one chord; lock_layer names a key of an earlier layer.
+# Dual-role keys act before chords and remapping: the tap and hold keys go
+# through both.
+
+cmake_minimum_required(VERSION 3.16)
+
+foreach(var KEYMAP_FILE KEYMAP_HEADER OUTPUT)
+    if(NOT DEFINED ${var})
+        message(FATAL_ERROR "keymap_gen.cmake: ${var} not set")
+    endif()
+endforeach()
+
+set(KEYMAP_MAX_LAYERS 8)        # KEY_REMAP_MAX_LAYERS
+set(KEYMAP_LAYER_KEY 240)       # KEY_REMAP_LAYER_KEY
+set(KEYMAP_FIRST_RESERVED 232)  # HID usages from 0xE8 are reserved
+set(KEYMAP_MACRO_KEY 232)       # KEY_REMAP_MACRO_KEY
+set(KEYMAP_MAX_MACROS 8)        # KEY_REMAP_MAX_MACROS
+set(KEYMAP_MACRO_CODE_KEY 1)    # MACRO_CODE_KEY
+set(KEYMAP_MAX_CHORDS 16)       # CHORD_MAX_CHORDS
+set(KEYMAP_MAX_TAP_HOLD 8)      # TAP_HOLD_MAX_KEYS
+set(KEYMAP_TAPPING_TERM 200)    # TAP_HOLD_TERM_DEFAULT_MS
+
+# Key names from keyboard_handler.h
+file(STRINGS ${KEYMAP_HEADER} key_defines REGEX "^#define USB_HID_KEY_[A-Z0-9_]+[ \t]+0x[0-9A-Fa-f]+")
+foreach(line IN LISTS key_defines)
+    string(REGEX MATCH "^#define USB_HID_KEY_([A-Z0-9_]+)[ \t]+(0x[0-9A-Fa-f]+)" unused "${line}")
+    math(EXPR usage "${CMAKE_MATCH_2}")
+    set(key_${CMAKE_MATCH_1} ${usage})
+endforeach()
+
+# Modifiers are usage 0xE0 + bit of their USB_HID_MODIFIER_* mask
+file(STRINGS ${KEYMAP_HEADER} modifier_defines REGEX "^#define USB_HID_MODIFIER_(LEFT|RIGHT)_[A-Z]+[ \t]+0x[0-9A-Fa-f]+")
+foreach(line IN LISTS modifier_defines)
+    string(REGEX MATCH "^#define USB_HID_MODIFIER_([A-Z_]+)[ \t]+(0x[0-9A-Fa-f]+)" unused "${line}")
+    math(EXPR mask "${CMAKE_MATCH_2}")
+    set(usage 224)
+    while(mask GREATER 1)
+        math(EXPR mask "${mask} >> 1")
+        math(EXPR usage "${usage} + 1")
+    endwhile()
+    set(key_${CMAKE_MATCH_1} ${usage})
+endforeach()
+
+# Resolve a key name or HID usage
+function(keymap_key token line_number result)
+    if(token STREQUAL "NONE")
+        set(usage 0)
+    elseif(token MATCHES "^0[xX][0-9A-Fa-f]+$")
+        math(EXPR usage "${token}")
+    elseif(DEFINED key_${token})
+        set(usage ${key_${token}})
+    else()
+        message(FATAL_ERROR "${KEYMAP_FILE}:${line_number}: unknown key '${token}'")
+    endif()
+    if(usage GREATER_EQUAL KEYMAP_FIRST_RESERVED)
+        message(FATAL_ERROR "${KEYMAP_FILE}:${line_number}: '${token}' is not a key usage")
+    endif()
+    set(${result} ${usage} PARENT_SCOPE)
+endfunction()
+
+# Encode a {KEY} or {MODIFIER+...+KEY} tap as MACRO_CODE_KEY, modifier bits, usage
+function(keymap_macro_key spec line_number result)
+    string(REPLACE "+" ";" names "${spec}")
+    set(modifiers 0)
+    set(usage 0)
+    foreach(name IN LISTS names)
+        keymap_key(${name} ${line_number} name_usage)
+        if(usage GREATER 0)
+            if(usage LESS 224 OR usage GREATER 231)
+                message(FATAL_ERROR "${KEYMAP_FILE}:${line_number}: only the last key of {${spec}} may be a non-modifier")
+            endif()
+            math(EXPR modifiers "${modifiers} | (1 << (${usage} - 224))")
+        endif()
+        set(usage ${name_usage})
+    endforeach()
+    if(usage EQUAL 0)
+        message(FATAL_ERROR "${KEYMAP_FILE}:${line_number}: {${spec}} taps no key")
+    endif()
+    set(${result} ${KEYMAP_MACRO_CODE_KEY} ${modifiers} ${usage} PARENT_SCOPE)
+endfunction()
+
+# Encode macro text as bytes ending with MACRO_END
+function(keymap_macro_text text line_number result)
+    set(bytes "")
+    string(LENGTH "${text}" length)
+    set(i 0)
+    while(i LESS length)
+        string(SUBSTRING "${text}" ${i} 1 c)
+        math(EXPR i "${i} + 1")
+        if(c STREQUAL "\\")
+            if(i EQUAL length)
+                message(FATAL_ERROR "${KEYMAP_FILE}:${line_number}: '\\' at end of macro")
+            endif()
+            string(SUBSTRING "${text}" ${i} 1 c)
+            math(EXPR i "${i} + 1")
+            if(c STREQUAL "n")
+                list(APPEND bytes 10)
+                continue()
+            elseif(c STREQUAL "t")
+                list(APPEND bytes 9)
+                continue()
+            endif()
+        elseif(c STREQUAL "{")
+            string(SUBSTRING "${text}" ${i} -1 rest)
+            string(FIND "${rest}" "}" end)
+            if(end LESS 1)
+                message(FATAL_ERROR "${KEYMAP_FILE}:${line_number}: unterminated {KEY} in macro")
+            endif()
+            string(SUBSTRING "${rest}" 0 ${end} spec)
+            math(EXPR i "${i} + ${end} + 1")
+            keymap_macro_key(${spec} ${line_number} key_bytes)
+            list(APPEND bytes ${key_bytes})
+            continue()
+        endif()
+        string(FIND "${KEYMAP_PRINTABLE}" "${c}" code)
+        if(code LESS 0)
+            message(FATAL_ERROR "${KEYMAP_FILE}:${line_number}: macros can only type ASCII text")
+        endif()
+        math(EXPR code "${code} + 32")
+        list(APPEND bytes ${code})
+    endwhile()
+    list(APPEND bytes 0)
+    set(${result} ${bytes} PARENT_SCOPE)
+endfunction()
+
+# Printable ASCII, character n standing for code n + 32
+set(KEYMAP_PRINTABLE "")
+foreach(code RANGE 32 126)
+    string(ASCII ${code} c)
+    string(APPEND KEYMAP_PRINTABLE "${c}")
+endforeach()
+
+# Format a byte as 0xNN
+function(keymap_hex value result)
+    math(EXPR hex "${value}" OUTPUT_FORMAT HEXADECIMAL)
+    string(SUBSTRING "${hex}" 2 -1 digits)
+    string(TOUPPER "${digits}" digits)
+    if(value LESS 16)
+        set(digits "0${digits}")
+    endif()
+    set(${result} "0x${digits}" PARENT_SCOPE)
+endfunction()
+
+# Parse the keymap line by line; macro text may hold list separators
+file(READ ${KEYMAP_FILE} keymap_text)
+string(APPEND keymap_text "\n")
+set(layer 0)
+set(layer_count 1)
+set(macro_count 0)
+set(chord_count 0)
+set(tap_hold_count 0)
+set(remaps 0)
+set(line_number 0)
+while(1)
+    string(FIND "${keymap_text}" "\n" end)
+    if(end LESS 0)
+        break()
+    endif()
+    string(SUBSTRING "${keymap_text}" 0 ${end} line)
+    math(EXPR end "${end} + 1")
+    string(SUBSTRING "${keymap_text}" ${end} -1 keymap_text)
+    math(EXPR line_number "${line_number} + 1")
+    string(REGEX REPLACE "\r$" "" line "${line}")
+
+    if(line MATCHES "^[ \t]*macro[ \t]+([^ \t]+)[ \t]+\"(.*)\"[ \t]*(#.*)?$")
+        set(key ${CMAKE_MATCH_1})
+        set(text "${CMAKE_MATCH_2}")
+        if(macro_count EQUAL KEYMAP_MAX_MACROS)
+            message(FATAL_ERROR "${KEYMAP_FILE}:${line_number}: more than ${KEYMAP_MAX_MACROS} macros")
+        endif()
+        keymap_key(${key} ${line_number} key_usage)
+        if(key_usage EQUAL 0)
+            message(FATAL_ERROR "${KEYMAP_FILE}:${line_number}: macro needs a key")
+        endif()
+        keymap_macro_text("${text}" ${line_number} macro_${macro_count})
+        math(EXPR map_${layer}_${key_usage} "${KEYMAP_MACRO_KEY} | ${macro_count}")
+        math(EXPR macro_count "${macro_count} + 1")
+        math(EXPR remaps "${remaps} + 1")
+        continue()
+    endif()
+
+    string(REGEX REPLACE "#.*$" "" line "${line}")
+    string(REGEX MATCHALL "[^ \t]+" words "${line}")
+    list(LENGTH words word_count)
+    if(word_count EQUAL 0)
+        continue()
+    endif()
+    list(GET words 0 statement)
+
+    if(statement STREQUAL "map" AND word_count EQUAL 3)
+        list(GET words 1 from)
+        list(GET words 2 to)
+        keymap_key(${from} ${line_number} from_usage)
+        keymap_key(${to} ${line_number} to_usage)
+        if(from_usage EQUAL 0)
+            message(FATAL_ERROR "${KEYMAP_FILE}:${line_number}: cannot map NONE")
+        endif()
+        set(map_${layer}_${from_usage} ${to_usage})
+        math(EXPR remaps "${remaps} + 1")
+    elseif(statement STREQUAL "layer" AND word_count EQUAL 2)
+        if(layer_count EQUAL KEYMAP_MAX_LAYERS)
+            message(FATAL_ERROR "${KEYMAP_FILE}:${line_number}: more than ${KEYMAP_MAX_LAYERS} layers")
+        endif()
+        list(GET words 1 key)
+        keymap_key(${key} ${line_number} key_usage)
+        if(key_usage EQUAL 0)
+            message(FATAL_ERROR "${KEYMAP_FILE}:${line_number}: layer needs a key")
+        endif()
+        set(layer ${layer_count})
+        math(EXPR layer_count "${layer_count} + 1")
+        math(EXPR layer_key_${key_usage} "${KEYMAP_LAYER_KEY} | ${layer}")
+        math(EXPR remaps "${remaps} + 1")
+    elseif(statement STREQUAL "chord" AND word_count GREATER_EQUAL 3 AND word_count LESS_EQUAL 4)
+        if(chord_count EQUAL KEYMAP_MAX_CHORDS)
+            message(FATAL_ERROR "${KEYMAP_FILE}:${line_number}: more than ${KEYMAP_MAX_CHORDS} chords")
+        endif()
+        list(GET words 1 keys)
+        list(GET words 2 action)
+        string(REPLACE "+" ";" names "${keys}")
+        set(chord_keys "")
+        foreach(name IN LISTS names)
+            keymap_key(${name} ${line_number} chord_usage)
+            if(chord_usage EQUAL 0)
+                message(FATAL_ERROR "${KEYMAP_FILE}:${line_number}: a chord cannot hold NONE")
+            endif()
+            list(APPEND chord_keys ${chord_usage})
+        endforeach()
+        list(GET chord_keys -1 trigger)
+        if(DEFINED chord_trigger_${trigger})
+            message(FATAL_ERROR "${KEYMAP_FILE}:${line_number}: the last key already triggers a chord")
+        endif()
+
+        set(argument 0)
+        if(action STREQUAL "scan_set" AND word_count EQUAL 4)
+            list(GET words 3 argument)
+            if(NOT argument MATCHES "^[123]$")
+                message(FATAL_ERROR "${KEYMAP_FILE}:${line_number}: scan_set takes 1, 2 or 3")
+            endif()
+            set(action CHORD_ACTION_SCAN_SET)
+        elseif(action STREQUAL "lock_layer" AND word_count EQUAL 4)
+            list(GET words 3 key)
+            keymap_key(${key} ${line_number} key_usage)
+            if(NOT DEFINED layer_key_${key_usage})
+                message(FATAL_ERROR "${KEYMAP_FILE}:${line_number}: ${key} is not the key of an earlier layer")
+            endif()
+            math(EXPR argument "${layer_key_${key_usage}} - ${KEYMAP_LAYER_KEY}")
+            set(action CHORD_ACTION_LOCK_LAYER)
+        elseif(action STREQUAL "release_all" AND word_count EQUAL 3)
+            set(action CHORD_ACTION_RELEASE_ALL)
+        elseif(action STREQUAL "diagnostics" AND word_count EQUAL 3)
+            set(action CHORD_ACTION_DIAGNOSTICS)
+        elseif(action STREQUAL "save_config" AND word_count EQUAL 3)
+            set(action CHORD_ACTION_SAVE_CONFIG)
+        else()
+            message(FATAL_ERROR "${KEYMAP_FILE}:${line_number}: unknown chord action '${action}' or wrong argument count")
+        endif()
+
+        math(EXPR chord_trigger_${trigger} "${chord_count} + 1")
+        set(chord_${chord_count}_name "${keys}")
+        set(chord_${chord_count}_keys ${chord_keys})
+        set(chord_${chord_count}_action ${action})
+        set(chord_${chord_count}_argument ${argument})
+        math(EXPR chord_count "${chord_count} + 1")
+    elseif((statement STREQUAL "tap_hold" AND word_count EQUAL 4) OR
+           (statement STREQUAL "one_shot" AND word_count EQUAL 3))
+        if(tap_hold_count EQUAL KEYMAP_MAX_TAP_HOLD)
+            message(FATAL_ERROR "${KEYMAP_FILE}:${line_number}: more than ${KEYMAP_MAX_TAP_HOLD} tap_hold and one_shot keys")
+        endif()
+        list(GET words 1 key)
+        keymap_key(${key} ${line_number} key_usage)
+        if(key_usage EQUAL 0)
+            message(FATAL_ERROR "${KEYMAP_FILE}:${line_number}: ${statement} needs a key")
+        endif()
+        if(DEFINED tap_hold_key_${key_usage})
+            message(FATAL_ERROR "${KEYMAP_FILE}:${line_number}: ${key} already has a tap_hold or one_shot")
+        endif()
+        if(statement STREQUAL "tap_hold")
+            list(GET words 2 tap)
+            list(GET words 3 hold)
+            keymap_key(${tap} ${line_number} tap_usage)
+            keymap_key(${hold} ${line_number} hold_usage)
+            set(flags 0)
+        else()
+            list(GET words 2 hold)
+            keymap_key(${hold} ${line_number} hold_usage)
+            if(hold_usage LESS 224 OR hold_usage GREATER 231)
+                message(FATAL_ERROR "${KEYMAP_FILE}:${line_number}: one_shot needs a modifier")
+            endif()
+            set(tap_usage 0)
+            set(flags TAP_HOLD_ONE_SHOT)
+        endif()
+        if(hold_usage EQUAL 0 OR (statement STREQUAL "tap_hold" AND tap_usage EQUAL 0))
+            message(FATAL_ERROR "${KEYMAP_FILE}:${line_number}: ${statement} cannot send NONE")
+        endif()
+        math(EXPR tap_hold_key_${key_usage} "${tap_hold_count} + 1")
+        set(tap_hold_${tap_hold_count}_name ${key})
+        set(tap_hold_${tap_hold_count}_tap ${tap_usage})
+        set(tap_hold_${tap_hold_count}_hold ${hold_usage})
+        set(tap_hold_${tap_hold_count}_flags ${flags})
+        math(EXPR tap_hold_count "${tap_hold_count} + 1")
+    elseif(statement STREQUAL "tapping_term" AND word_count EQUAL 2)
+        list(GET words 1 KEYMAP_TAPPING_TERM)
+        if(NOT KEYMAP_TAPPING_TERM MATCHES "^[0-9]+$" OR KEYMAP_TAPPING_TERM EQUAL 0 OR
+           KEYMAP_TAPPING_TERM GREATER 10000)
+            message(FATAL_ERROR "${KEYMAP_FILE}:${line_number}: tapping_term takes 1 to 10000 ms")
+        endif()
+    else()
+        message(FATAL_ERROR "${KEYMAP_FILE}:${line_number}: expected 'map <key> <key>', 'macro <key> \"text\"', 'layer <key>', 'chord <keys> <action>', 'tap_hold <key> <key> <key>', 'one_shot <key> <modifier>' or 'tapping_term <ms>'")
+    endif()
+endwhile()
+
+# A keymap that remaps nothing generates one unused identity table
+if(remaps EQUAL 0)
+    set(generated_layer_count 0)
+else()
+    set(generated_layer_count ${layer_count})
+endif()
+
+# Layer tables: layer key, else this layer's map, else the base map, else the
+# key itself; reserved usages are disabled so none reads as a layer key
+get_filename_component(keymap_name ${KEYMAP_FILE} NAME)
+set(source "/* Generated from ${keymap_name} by cmake/keymap_gen.cmake - do not edit */\n\n")
+string(APPEND source "#include \"key_remap.h\"\n")
+string(APPEND source "#include \"chord_detector.h\"\n")
+string(APPEND source "#include \"tap_hold.h\"\n\n")
+string(APPEND source "const uint8_t key_remap_layer_count = ${generated_layer_count};\n\n")
+string(APPEND source "const uint8_t key_remap_layers[][KEY_REMAP_TABLE_SIZE] = {\n")
+math(EXPR last_layer "${layer_count} - 1")
+foreach(n RANGE ${last_layer})
+    string(APPEND source "    {\n")
+    foreach(row RANGE 0 255 16)
+        set(entries "")
+        math(EXPR row_end "${row} + 15")
+        foreach(usage RANGE ${row} ${row_end})
+            if(DEFINED layer_key_${usage})
+                set(value ${layer_key_${usage}})
+            elseif(DEFINED map_${n}_${usage})
+                set(value ${map_${n}_${usage}})
+            elseif(DEFINED map_0_${usage})
+                set(value ${map_0_${usage}})
+            elseif(usage GREATER_EQUAL KEYMAP_FIRST_RESERVED)
+                set(value 0)
+            else()
+                set(value ${usage})
+            endif()
+            keymap_hex(${value} hex)
+            string(APPEND entries " ${hex},")
+        endforeach()
+        string(APPEND source "       ${entries}\n")
+    endforeach()
+    string(APPEND source "    },\n")
+endforeach()
+string(APPEND source "};\n")
+
+# Macros, each ending with MACRO_END
+string(APPEND source "\n")
+if(macro_count GREATER 0)
+    math(EXPR last_macro "${macro_count} - 1")
+    foreach(n RANGE ${last_macro})
+        set(entries "")
+        set(column 0)
+        string(APPEND source "static const uint8_t key_remap_macro_${n}[] = {\n")
+        foreach(value IN LISTS macro_${n})
+            keymap_hex(${value} hex)
+            string(APPEND entries " ${hex},")
+            math(EXPR column "${column} + 1")
+            if(column EQUAL 16)
+                string(APPEND source "   ${entries}\n")
+                set(entries "")
+                set(column 0)
+            endif()
+        endforeach()
+        if(column GREATER 0)
+            string(APPEND source "   ${entries}\n")
+        endif()
+        string(APPEND source "};\n\n")
+    endforeach()
+    string(APPEND source "const uint8_t *const key_remap_macros[] = {\n")
+    foreach(n RANGE ${last_macro})
+        string(APPEND source "    key_remap_macro_${n},\n")
+    endforeach()
+    string(APPEND source "};\n")
+else()
+    string(APPEND source "const uint8_t *const key_remap_macros[] = { NULL };\n")
+endif()
+
+# Chords: trigger table indexed by usage, then one key bitmap per chord
+string(APPEND source "\nconst uint8_t chord_count = ${chord_count};\n\n")
+string(APPEND source "const uint8_t chord_triggers[CHORD_TRIGGER_TABLE_SIZE] = {\n")
+foreach(row RANGE 0 255 16)
+    set(entries "")
+    math(EXPR row_end "${row} + 15")
+    foreach(usage RANGE ${row} ${row_end})
+        if(DEFINED chord_trigger_${usage})
+            keymap_hex(${chord_trigger_${usage}} hex)
+        else()
+            set(hex "0x00")
+        endif()
+        string(APPEND entries " ${hex},")
+    endforeach()
+    string(APPEND source "   ${entries}\n")
+endforeach()
+string(APPEND source "};\n\n")
+if(chord_count GREATER 0)
+    math(EXPR last_chord "${chord_count} - 1")
+    string(APPEND source "const ChordDefinition_t chord_definitions[] = {\n")
+    foreach(n RANGE ${last_chord})
+        foreach(byte RANGE 31)
+            set(bits_${byte} 0)
+        endforeach()
+        foreach(usage IN LISTS chord_${n}_keys)
+            math(EXPR byte "${usage} >> 3")
+            math(EXPR bits_${byte} "${bits_${byte}} | (1 << (${usage} & 7))")
+        endforeach()
+        string(APPEND source "    /* ${chord_${n}_name} */\n    {\n        {\n")
+        foreach(row RANGE 0 31 16)
+            set(entries "")
+            math(EXPR row_end "${row} + 15")
+            foreach(byte RANGE ${row} ${row_end})
+                keymap_hex(${bits_${byte}} hex)
+                string(APPEND entries " ${hex},")
+            endforeach()
+            string(APPEND source "           ${entries}\n")
+        endforeach()
+        string(APPEND source "        },\n        ${chord_${n}_action}, ${chord_${n}_argument}\n    },\n")
+    endforeach()
+    string(APPEND source "};\n")
+else()
+    string(APPEND source "const ChordDefinition_t chord_definitions[] = { { { 0 }, CHORD_ACTION_NONE, 0 } };\n")
+endif()
+
+# Dual-role keys: definition number + 1 indexed by usage, then definitions
+string(APPEND source "\nconst uint16_t tap_hold_term_ms = ${KEYMAP_TAPPING_TERM};\n\n")
+string(APPEND source "const uint8_t tap_hold_count = ${tap_hold_count};\n\n")
+string(APPEND source "const uint8_t tap_hold_keys[TAP_HOLD_TABLE_SIZE] = {\n")
+foreach(row RANGE 0 255 16)
+    set(entries "")
+    math(EXPR row_end "${row} + 15")
+    foreach(usage RANGE ${row} ${row_end})
+        if(DEFINED tap_hold_key_${usage})
+            keymap_hex(${tap_hold_key_${usage}} hex)
+        else()
+            set(hex "0x00")
+        endif()
+        string(APPEND entries " ${hex},")
+    endforeach()
+    string(APPEND source "   ${entries}\n")
+endforeach()
+string(APPEND source "};\n\n")
+if(tap_hold_count GREATER 0)
+    math(EXPR last_tap_hold "${tap_hold_count} - 1")
+    string(APPEND source "const TapHoldDefinition_t tap_hold_definitions[] = {\n")
+    foreach(n RANGE ${last_tap_hold})
+        keymap_hex(${tap_hold_${n}_tap} tap_hex)
+        keymap_hex(${tap_hold_${n}_hold} hold_hex)
+        string(APPEND source "    { ${tap_hex}, ${hold_hex}, ${tap_hold_${n}_flags} },    /* ${tap_hold_${n}_name} */\n")
+    endforeach()
+    string(APPEND source "};\n")
+else()
+    string(APPEND source "const TapHoldDefinition_t tap_hold_definitions[] = { { 0, 0, 0 } };\n")
+endif()
+
+file(WRITE ${OUTPUT} "${source}")
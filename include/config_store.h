@@ -0,0 +1,87 @@
+/**
+ ******************************************************************************
+ * @file    config_store.h
+ * @brief   Header for config_store.c - settings kept in flash
+ * @author  STM32F411 USB-PS2 Project
+ * @version 1.0.0
+ * @date    2024
+ ******************************************************************************
+ */
+
+#ifndef __CONFIG_STORE_H
+#define __CONFIG_STORE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+
+/* Exported types ------------------------------------------------------------*/
+/**
+ * @brief Configuration store status enumeration
+ */
+typedef enum {
+    CONFIG_STORE_OK = 0,            ///< Operation successful
+    CONFIG_STORE_ERROR              ///< Flash erase or program failed
+} ConfigStoreStatus_t;
+
+/**
+ * @brief Settings kept in the store
+ * @note   Append new keys at the end; a key's number is its place in
+ *         every record already written
+ */
+typedef enum {
+    CONFIG_KEY_SCAN_CODE_SET = 0,   ///< Scan code set after power-up and host reset
+    CONFIG_KEY_PS2_CLOCK_HZ,        ///< PS/2 device clock rate
+    CONFIG_KEY_PS2_AUTO_TUNE,       ///< PS/2 link auto-tuning on (1) or off (0)
+    CONFIG_KEY_LOCKED_LAYERS,       ///< Remap layers locked on, bit n for layer n
+    CONFIG_KEY_COUNT
+} ConfigKey_t;
+
+/* Exported constants --------------------------------------------------------*/
+#define CONFIG_STORE_ADDRESS        0x08060000U ///< Sector 7, the CONFIG region of STM32F411CEUx_FLASH.ld
+#define CONFIG_STORE_SIZE           0x20000U    ///< 128 KB
+#define CONFIG_STORE_VALUES         14          ///< Values per record, room for new keys
+#define CONFIG_VALUE_UNSET          0xFFFFFFFFU ///< Value of a key never set, the caller's default applies
+
+/**
+ * @brief One record: every value, written as a whole
+ */
+typedef struct {
+    uint32_t magic;                             ///< CONFIG_STORE_MAGIC once the record is started
+    uint32_t values[CONFIG_STORE_VALUES];       ///< Value of each ConfigKey_t
+    uint32_t crc;                               ///< CRC-32 of magic and values, written last
+} ConfigRecord_t;
+
+#define CONFIG_STORE_SLOTS          (CONFIG_STORE_SIZE / sizeof(ConfigRecord_t))   ///< Records per erase
+
+/**
+ * @brief Configuration store statistics
+ */
+typedef struct {
+    uint32_t slot;                  ///< Slot of the record in use, CONFIG_STORE_SLOTS if none
+    uint32_t probes;                ///< Slots read by the last config_store_init()
+    uint32_t torn_records;          ///< Records skipped by config_store_init() for a bad CRC
+    uint32_t appends;               ///< Records written
+    uint32_t erases;                ///< Sector erases
+} ConfigStoreStats_t;
+
+/* Exported macro ------------------------------------------------------------*/
+
+/* Exported functions prototypes ---------------------------------------------*/
+ConfigStoreStatus_t config_store_init(void);
+uint32_t config_store_get(ConfigKey_t key, uint32_t default_value);
+void config_store_set(ConfigKey_t key, uint32_t value);
+ConfigStoreStatus_t config_store_commit(void);
+const ConfigRecord_t *config_store_get_record(void);
+void config_store_get_stats(ConfigStoreStats_t *stats);
+void config_store_load_settings(void);
+ConfigStoreStatus_t config_store_save_settings(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __CONFIG_STORE_H */
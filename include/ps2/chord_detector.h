@@ -0,0 +1,67 @@
+/**
+ ******************************************************************************
+ * @file    chord_detector.h
+ * @brief   Header for chord_detector.c - converter control hotkeys
+ * @author  STM32F411 USB-PS2 Project
+ * @version 1.0.0
+ * @date    2024
+ ******************************************************************************
+ */
+
+#ifndef __CHORD_DETECTOR_H
+#define __CHORD_DETECTOR_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+#include "keyboard_handler.h"
+
+/* Exported types ------------------------------------------------------------*/
+/**
+ * @brief Converter action triggered by a chord
+ */
+typedef enum {
+    CHORD_ACTION_NONE = 0,
+    CHORD_ACTION_SCAN_SET,          ///< Switch to the scan code set in the argument
+    CHORD_ACTION_LOCK_LAYER,        ///< Lock the remap layer in the argument on, or unlock it
+    CHORD_ACTION_RELEASE_ALL,       ///< Release every key the host holds
+    CHORD_ACTION_DIAGNOSTICS,       ///< Type a converter status line
+    CHORD_ACTION_SAVE_CONFIG        ///< Store the scan code set, link timing and locked layers in flash
+} ChordAction_t;
+
+/**
+ * @brief Chord: keys held together, the trigger pressed last
+ */
+typedef struct {
+    uint8_t keys[USB_HID_USAGE_BITMAP_SIZE];   ///< Usages that must be down, trigger included
+    uint8_t action;                             ///< ChordAction_t
+    uint8_t argument;                           ///< Action argument
+} ChordDefinition_t;
+
+/* Exported constants --------------------------------------------------------*/
+#define CHORD_TRIGGER_TABLE_SIZE    256     ///< Trigger table entries, one per HID usage
+#define CHORD_MAX_CHORDS            16      ///< Chords a keymap can define
+
+/* Exported macro ------------------------------------------------------------*/
+
+/* Exported variables --------------------------------------------------------*/
+/* Generated from the keymap file by cmake/keymap_gen.cmake */
+extern const uint8_t chord_count;
+extern const uint8_t chord_triggers[CHORD_TRIGGER_TABLE_SIZE];  ///< Chord number + 1 each usage triggers, 0 if none
+extern const ChordDefinition_t chord_definitions[];
+
+/* Exported functions prototypes ---------------------------------------------*/
+void chord_detector_init(void);
+void chord_detector_reset(void);
+uint8_t chord_detector_active(void);
+uint8_t chord_detector_events(const KeyboardEvent_t *events, uint8_t count, KeyboardEvent_t *passed);
+uint8_t chord_detector_service(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __CHORD_DETECTOR_H */
@@ -0,0 +1,49 @@
+/**
+ ******************************************************************************
+ * @file    macro_engine.h
+ * @brief   Header for macro_engine.c - text and key sequence injection
+ * @author  STM32F411 USB-PS2 Project
+ * @version 1.0.0
+ * @date    2024
+ ******************************************************************************
+ */
+
+#ifndef __MACRO_ENGINE_H
+#define __MACRO_ENGINE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+
+/* Exported types ------------------------------------------------------------*/
+/**
+ * @brief Macro engine status enumeration
+ */
+typedef enum {
+    MACRO_OK = 0,               ///< Macro started
+    MACRO_ERROR,                ///< Invalid parameter
+    MACRO_BUSY                  ///< Another macro is still typing
+} MacroStatus_t;
+
+/* Exported constants --------------------------------------------------------*/
+#define MACRO_END                   0x00    ///< Ends a macro
+#define MACRO_CODE_KEY              0x01    ///< Followed by HID modifier bits and a usage: tap that key
+#define MACRO_LOOKAHEAD_BYTES       8       ///< Typing pauses while the PS/2 queue holds this many bytes
+
+/* Exported macro ------------------------------------------------------------*/
+
+/* Exported functions prototypes ---------------------------------------------*/
+void macro_engine_init(void);
+MacroStatus_t macro_engine_start(const uint8_t *macro);
+void macro_engine_cancel(void);
+uint8_t macro_engine_service(void);
+uint8_t macro_engine_busy(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __MACRO_ENGINE_H */
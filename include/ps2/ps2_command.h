@@ -0,0 +1,71 @@
+/**
+ ******************************************************************************
+ * @file    ps2_command.h
+ * @brief   Header for ps2_command.c - PS/2 host command handling
+ * @author  STM32F411 USB-PS2 Project
+ * @version 1.0.0
+ * @date    2024
+ ******************************************************************************
+ */
+
+#ifndef __PS2_COMMAND_H
+#define __PS2_COMMAND_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+
+/* Exported types ------------------------------------------------------------*/
+/**
+ * @brief PS/2 command handler status enumeration
+ */
+typedef enum {
+    PS2_COMMAND_OK = 0,         ///< Command handled
+    PS2_COMMAND_ERROR           ///< Response could not be queued
+} PS2_CommandStatus_t;
+
+/* Exported constants --------------------------------------------------------*/
+/* Host-to-keyboard commands */
+#define PS2_CMD_SET_LEDS            0xED   ///< Set LEDs (1 argument)
+#define PS2_CMD_ECHO                0xEE   ///< Echo
+#define PS2_CMD_SCAN_CODE_SET       0xF0   ///< Get/set scan code set (1 argument)
+#define PS2_CMD_IDENTIFY            0xF2   ///< Read keyboard ID
+#define PS2_CMD_SET_TYPEMATIC       0xF3   ///< Set typematic rate/delay (1 argument)
+#define PS2_CMD_ENABLE              0xF4   ///< Enable scanning
+#define PS2_CMD_DISABLE             0xF5   ///< Disable scanning, restore defaults
+#define PS2_CMD_SET_DEFAULT         0xF6   ///< Restore defaults
+#define PS2_CMD_SET_ALL_TYPEMATIC   0xF7   ///< Set 3: all keys typematic
+#define PS2_CMD_SET_ALL_MAKE_BREAK  0xF8   ///< Set 3: all keys make/break
+#define PS2_CMD_SET_ALL_MAKE        0xF9   ///< Set 3: all keys make only
+#define PS2_CMD_SET_ALL_TMB         0xFA   ///< Set 3: all keys typematic/make/break
+#define PS2_CMD_SET_KEY_TYPEMATIC   0xFB   ///< Set 3: listed keys typematic
+#define PS2_CMD_SET_KEY_MAKE_BREAK  0xFC   ///< Set 3: listed keys make/break
+#define PS2_CMD_SET_KEY_MAKE        0xFD   ///< Set 3: listed keys make only
+#define PS2_CMD_RESEND              0xFE   ///< Resend last byte
+#define PS2_CMD_RESET               0xFF   ///< Reset and self-test
+
+/* Set LEDs argument bits */
+#define PS2_LED_SCROLL_LOCK         0x01
+#define PS2_LED_NUM_LOCK            0x02
+#define PS2_LED_CAPS_LOCK           0x04
+
+/* Exported macro ------------------------------------------------------------*/
+
+/* Exported functions prototypes ---------------------------------------------*/
+PS2_CommandStatus_t ps2_command_init(void);
+PS2_CommandStatus_t ps2_command_process(uint8_t byte);
+PS2_CommandStatus_t ps2_command_receive_error(void);
+uint8_t ps2_command_get_leds(void);
+uint8_t ps2_command_scanning_enabled(void);
+void ps2_command_get_typematic(uint16_t *delay_ms, uint16_t *period_ms);
+void ps2_command_select_set(uint8_t set);
+void ps2_command_set_default_set(uint8_t set);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __PS2_COMMAND_H */
@@ -28,10 +28,40 @@ typedef enum {
     PS2_ERROR,              ///< PS/2 operation failed
     PS2_INIT,               ///< PS/2 initialization in progress
     PS2_READY,              ///< PS/2 ready for operation
-    PS2_TRANSMITTING        ///< PS/2 transmission in progress
+    PS2_TRANSMITTING,       ///< PS/2 transmission in progress
+    PS2_INHIBITED,          ///< Host is holding the clock line low
+    PS2_HOST_REQUEST        ///< Host requests to send (data low, clock high)
 } PS2_Status_t;
 
+/**
+ * @brief PS/2 link statistics
+ */
+typedef struct {
+    uint32_t bytes_sent;        ///< Bytes clocked out completely
+    uint32_t inhibits;          ///< Host inhibit periods observed
+    uint32_t aborts;            ///< Frames aborted by a host inhibit mid-frame
+    uint32_t retransmits;       ///< Aborted bytes sent again
+    uint32_t host_requests;     ///< Bytes received from the host
+    uint32_t receive_errors;    ///< Host bytes with parity or stop bit errors
+} PS2_Stats_t;
+
+/**
+ * @brief PS/2 link timing configuration
+ */
+typedef struct {
+    uint16_t clock_freq_hz;     ///< Device clock rate (PS2_CLOCK_FREQ_MIN_HZ..PS2_CLOCK_FREQ_MAX_HZ)
+    uint16_t byte_gap_us;       ///< Minimum bus idle time between bytes (0..PS2_BYTE_GAP_MAX_US)
+    uint16_t scancode_gap_us;   ///< Minimum bus idle time between scan codes (0..PS2_SCANCODE_GAP_MAX_US)
+    uint8_t auto_tune;          ///< Adjust rate and gap from inhibits and resend requests
+} PS2_LinkConfig_t;
+
 /* Exported constants --------------------------------------------------------*/
+#define PS2_CLOCK_FREQ_MIN_HZ       10000   ///< Slowest clock allowed by the PS/2 spec
+#define PS2_CLOCK_FREQ_MAX_HZ       16700   ///< Fastest clock allowed by the PS/2 spec
+#define PS2_CLOCK_FREQ_DEFAULT_HZ   12000   ///< Clock rate after ps2_init()
+#define PS2_BYTE_GAP_MAX_US         1000    ///< Longest configurable inter-byte gap
+#define PS2_SCANCODE_GAP_MAX_US     10000   ///< Longest configurable gap between scan codes
+#define PS2_PROCESS_SLICE_US        4000    ///< Transmit time per ps2_process() call before it returns
 
 /* Exported macro------------------------------------------------------------*/
 
@@ -39,8 +69,17 @@ typedef enum {
 PS2_Status_t ps2_init(void);
 PS2_Status_t ps2_send_scancode(const PS2_ScanCode_t *scancode);
 PS2_Status_t ps2_send_byte(uint8_t data);
-void ps2_send_bit(uint8_t bit_value);
+PS2_Status_t ps2_send_bit(uint8_t bit_value);
+PS2_Status_t ps2_receive_byte(uint8_t *data);
+void ps2_process(void);
+void ps2_kick(void);
+uint8_t ps2_get_last_byte(void);
+void ps2_get_stats(PS2_Stats_t *stats);
+void ps2_clear_stats(void);
+PS2_Status_t ps2_set_link_config(const PS2_LinkConfig_t *config);
+void ps2_get_link_config(PS2_LinkConfig_t *config);
 void ps2_delay_us(uint32_t microseconds);
+uint32_t ps2_get_time_us(void);
 PS2_Status_t ps2_get_status(void);
 void ps2_tick(void);
 void ps2_timer_callback(void);
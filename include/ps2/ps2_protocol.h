@@ -17,6 +17,7 @@ extern "C" {
 
 /* Includes ------------------------------------------------------------------*/
 #include <stdint.h>
+#include <stddef.h>
 
 /* Exported types ------------------------------------------------------------*/
 /**
@@ -71,6 +72,24 @@ typedef enum {
 /* Exported constants --------------------------------------------------------*/
 #define PS2_BREAK_CODE_PREFIX       0xF0   ///< Prefix for break codes (key release)
 #define PS2_EXTENDED_CODE_PREFIX    0xE0   ///< Prefix for extended keys
+#define PS2_PAUSE_CODE_PREFIX       0xE1   ///< Prefix of the Pause key sequence
+#define PS2_LEFT_SHIFT_CODE         0x12   ///< Left Shift; E0 12 is a fake Left Shift
+#define PS2_RIGHT_SHIFT_CODE        0x59   ///< Right Shift; E0 59 is a fake Right Shift
+
+/* Scan code sets */
+#define PS2_SCAN_CODE_SET_1         1
+#define PS2_SCAN_CODE_SET_2         2
+#define PS2_SCAN_CODE_SET_3         3
+#ifndef PS2_DEFAULT_SCAN_CODE_SET
+#define PS2_DEFAULT_SCAN_CODE_SET   PS2_SCAN_CODE_SET_2    ///< Set after reset (set from CMake)
+#endif
+#define PS2_SET1_BREAK_BIT          0x80   ///< Set 1 break code: make code with bit 7 set
+#define PS2_SET1_LEFT_SHIFT_CODE    0x2A   ///< Set 1 Left Shift; E0 2A is a fake Left Shift
+#define PS2_SET1_RIGHT_SHIFT_CODE   0x36   ///< Set 1 Right Shift; E0 36 is a fake Right Shift
+
+/* Set 3 per-key attributes */
+#define PS2_SET3_ATTR_BREAK         0x01   ///< Key sends a break code
+#define PS2_SET3_ATTR_TYPEMATIC     0x02   ///< Key repeats while held
 
 /* Special PS/2 scan codes */
 #define PS2_SCANCODE_BAT_SUCCESS    0xAA   ///< Basic Assurance Test success
@@ -94,6 +113,16 @@ PS2_ProtocolStatus_t ps2_validate_scancode(const PS2_ScanCode_t *scancode);
 uint8_t ps2_get_common_key_scancode(PS2_CommonKey_t key);
 uint8_t ps2_is_extended_key(PS2_CommonKey_t key);
 PS2_ProtocolStatus_t ps2_copy_scancode(PS2_ScanCode_t *dest, const PS2_ScanCode_t *src);
+uint8_t ps2_is_break_code(const PS2_ScanCode_t *scancode);
+uint8_t ps2_is_modifier_code(const PS2_ScanCode_t *scancode);
+uint8_t ps2_get_key_code(const PS2_ScanCode_t *scancode);
+PS2_ProtocolStatus_t ps2_set_scan_code_set(uint8_t set);
+uint8_t ps2_get_scan_code_set(void);
+void ps2_set3_default_attributes(void);
+void ps2_set3_set_all_attributes(uint8_t attributes);
+void ps2_set3_set_key_attributes(uint8_t key_code, uint8_t attributes);
+uint8_t ps2_set3_key_breaks(uint8_t key_code);
+uint8_t ps2_set3_key_repeats(uint8_t key_code);
 
 #ifdef __cplusplus
 }
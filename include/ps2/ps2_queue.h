@@ -0,0 +1,103 @@
+/**
+ ******************************************************************************
+ * @file    ps2_queue.h
+ * @brief   Header for ps2_queue.c - PS/2 transmit byte queue
+ * @author  STM32F411 USB-PS2 Project
+ * @version 1.0.0
+ * @date    2024
+ ******************************************************************************
+ */
+
+#ifndef __PS2_QUEUE_H
+#define __PS2_QUEUE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+#include "ps2_protocol.h"
+
+/* Exported types ------------------------------------------------------------*/
+/**
+ * @brief PS/2 queue status enumeration
+ */
+typedef enum {
+    PS2_QUEUE_OK = 0,           ///< Queue operation successful
+    PS2_QUEUE_ERROR,            ///< Invalid parameter
+    PS2_QUEUE_FULL,             ///< Not enough free space
+    PS2_QUEUE_EMPTY             ///< Nothing to send
+} PS2_QueueStatus_t;
+
+/**
+ * @brief Kind of queued byte
+ */
+typedef enum {
+    PS2_QUEUE_TAG_SCANCODE = 0, ///< Part of a key scan code
+    PS2_QUEUE_TAG_RESPONSE      ///< Response to a host command
+} PS2_QueueTag_t;
+
+/**
+ * @brief Scan code priority classes, highest priority first
+ */
+typedef enum {
+    PS2_QUEUE_CLASS_RELEASE = 0, ///< Key releases and modifier changes
+    PS2_QUEUE_CLASS_MAKE,       ///< Key presses
+    PS2_QUEUE_CLASS_REPEAT,     ///< Typematic repeats
+    PS2_QUEUE_CLASS_INJECT,     ///< Injected text
+    PS2_QUEUE_CLASS_COUNT
+} PS2_QueueClass_t;
+
+/**
+ * @brief Per-class queue statistics
+ */
+typedef struct {
+    uint32_t events;            ///< Scan codes transmitted
+    uint32_t bytes;             ///< Bytes transmitted
+    uint32_t ordered;           ///< Scan codes placed in this lower class to keep key order
+    uint32_t total_delay_us;    ///< Sum of queueing delays (enqueue to start of transmission)
+    uint32_t max_delay_us;      ///< Longest queueing delay
+} PS2_QueueClassStats_t;
+
+/* Exported constants --------------------------------------------------------*/
+#ifndef PS2_QUEUE_RAM_BUDGET
+#define PS2_QUEUE_RAM_BUDGET    1024    ///< RAM for queued events in bytes (set from CMake)
+#endif
+#define PS2_QUEUE_EVENT_BYTES   16      ///< RAM taken by one queued scan code or response
+#define PS2_QUEUE_EVENTS        (PS2_QUEUE_RAM_BUDGET / PS2_QUEUE_EVENT_BYTES) ///< Queued scan codes and responses
+#define PS2_QUEUE_AVG_SCANCODE_BYTES 2  ///< Bytes per event on average: a make is 1, its break 2, E0 keys 1 more
+#define PS2_QUEUE_SIZE          (PS2_QUEUE_EVENTS * PS2_QUEUE_AVG_SCANCODE_BYTES) ///< Transmit queue size in bytes
+#define PS2_QUEUE_REPORT_HEADROOM 24    ///< Free bytes and events kept for the scan codes of one USB report
+#define PS2_QUEUE_HIGH_WATER    (PS2_QUEUE_SIZE - PS2_QUEUE_REPORT_HEADROOM) ///< Congested at or above this depth
+#define PS2_QUEUE_LOW_WATER     (PS2_QUEUE_SIZE / 4) ///< Congestion clears at or below this depth
+#define PS2_QUEUE_EVENT_HIGH_WATER (PS2_QUEUE_EVENTS - PS2_QUEUE_REPORT_HEADROOM) ///< Congested at or above this many events
+#define PS2_QUEUE_EVENT_LOW_WATER (PS2_QUEUE_EVENTS / 4) ///< Congestion clears at or below this many events
+
+/* Exported macro ------------------------------------------------------------*/
+
+/* Exported functions prototypes ---------------------------------------------*/
+PS2_QueueStatus_t ps2_queue_init(void);
+PS2_QueueStatus_t ps2_queue_push(const uint8_t *data, uint8_t length);
+PS2_QueueStatus_t ps2_queue_push_scancodes(const PS2_ScanCode_t *scancodes, uint8_t count,
+                                           PS2_QueueClass_t queue_class);
+PS2_QueueStatus_t ps2_queue_push_response(const uint8_t *data, uint8_t length);
+PS2_QueueStatus_t ps2_queue_peek(uint8_t *data);
+PS2_QueueTag_t ps2_queue_peek_tag(void);
+uint8_t ps2_queue_pop(void);
+void ps2_queue_clear(void);
+void ps2_queue_flush(void);
+uint8_t ps2_queue_in_progress(void);
+uint16_t ps2_queue_count(void);
+uint16_t ps2_queue_free(void);
+uint8_t ps2_queue_congested(void);
+PS2_QueueStatus_t ps2_queue_set_class_budget(PS2_QueueClass_t queue_class, uint16_t bytes_per_second,
+                                             uint8_t burst_bytes);
+PS2_QueueStatus_t ps2_queue_get_class_stats(PS2_QueueClass_t queue_class, PS2_QueueClassStats_t *stats);
+void ps2_queue_clear_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __PS2_QUEUE_H */
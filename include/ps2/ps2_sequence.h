@@ -0,0 +1,54 @@
+/**
+ ******************************************************************************
+ * @file    ps2_sequence.h
+ * @brief   Header for ps2_sequence.c - pooled long scan code sequences
+ * @author  STM32F411 USB-PS2 Project
+ * @version 1.0.0
+ * @date    2024
+ ******************************************************************************
+ */
+
+#ifndef __PS2_SEQUENCE_H
+#define __PS2_SEQUENCE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+#include "ps2_protocol.h"
+
+/* Exported types ------------------------------------------------------------*/
+
+/* Exported constants --------------------------------------------------------*/
+/* Sequence descriptors: sequence number, PS2_SEQUENCE_BREAK for the release */
+#define PS2_SEQUENCE_PRINT_SCREEN   0x00    ///< Set 2: E0 12 E0 7C / E0 F0 7C E0 F0 12
+#define PS2_SEQUENCE_PAUSE          0x01    ///< Set 2: E1 14 77 E1 F0 14 F0 77, no release
+#define PS2_SEQUENCE_NUM_LOCK       0x02    ///< E0 key wrapped in E0 12 / E0 F0 12 (Num Lock on)
+#define PS2_SEQUENCE_LEFT_SHIFT     0x03    ///< E0 key wrapped in E0 F0 12 / E0 12 (Left Shift held)
+#define PS2_SEQUENCE_RIGHT_SHIFT    0x04    ///< E0 key wrapped in E0 F0 59 / E0 59 (Right Shift held)
+#define PS2_SEQUENCE_BOTH_SHIFTS    0x05    ///< E0 key wrapped for both Shift keys held
+#define PS2_SEQUENCE_COUNT          6
+#define PS2_SEQUENCE_BREAK          0x80    ///< Descriptor flag: release sequence
+#define PS2_SEQUENCE_SET1           0x40    ///< Descriptor flag: Set 1 template, set by ps2_sequence_create()
+
+#define PS2_SEQUENCE_CODE           0x00    ///< data[0] of a scan code standing for a pooled sequence
+#define PS2_SEQUENCE_CODE_LENGTH    3       ///< PS2_SEQUENCE_CODE, descriptor, wrapped key
+#define PS2_SEQUENCE_MAX_LENGTH     8       ///< Longest sequence in bytes
+
+/* Exported macro ------------------------------------------------------------*/
+
+/* Exported functions prototypes ---------------------------------------------*/
+PS2_ProtocolStatus_t ps2_sequence_create(PS2_ScanCode_t *scancode, uint8_t descriptor, uint8_t key);
+uint8_t ps2_sequence_is_code(const PS2_ScanCode_t *scancode);
+uint8_t ps2_sequence_length(uint8_t descriptor);
+uint8_t ps2_sequence_byte(uint8_t descriptor, uint8_t key, uint8_t position);
+uint8_t ps2_sequence_copy(uint8_t descriptor, uint8_t key, uint8_t *data);
+uint16_t ps2_sequence_key(uint8_t descriptor, uint8_t key);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __PS2_SEQUENCE_H */
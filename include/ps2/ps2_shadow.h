@@ -0,0 +1,43 @@
+/**
+ ******************************************************************************
+ * @file    ps2_shadow.h
+ * @brief   Header for ps2_shadow.c - host-believed PS/2 key state
+ * @author  STM32F411 USB-PS2 Project
+ * @version 1.0.0
+ * @date    2024
+ ******************************************************************************
+ */
+
+#ifndef __PS2_SHADOW_H
+#define __PS2_SHADOW_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+
+/* Exported types ------------------------------------------------------------*/
+
+/* Exported constants --------------------------------------------------------*/
+#define PS2_SHADOW_KEYS         512     ///< Set 2 codes tracked (256 normal + 256 E0)
+#define PS2_SHADOW_BYTES        (PS2_SHADOW_KEYS / 8)   ///< Bitmap size in bytes
+
+/* Exported macro ------------------------------------------------------------*/
+/** Bitmap index of a Set 2 key code */
+#define PS2_SHADOW_INDEX(code, extended)    ((uint16_t)((extended) ? 256U : 0U) + (uint16_t)(code))
+
+/* Exported functions prototypes ---------------------------------------------*/
+void ps2_shadow_init(void);
+void ps2_shadow_byte_sent(uint8_t data);
+void ps2_shadow_decode(uint8_t *state, const uint8_t *data, uint8_t length);
+void ps2_shadow_clear(void);
+uint8_t ps2_shadow_is_held(uint8_t code, uint8_t extended);
+const uint8_t *ps2_shadow_get_state(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __PS2_SHADOW_H */
@@ -33,13 +33,20 @@ typedef enum {
 } TranslatorStatus_t;
 
 /* Exported constants --------------------------------------------------------*/
+#define TRANSLATOR_SERVICE_ALL      0xFF    ///< scancode_translator_service(): no report limit
 
 /* Exported macro ------------------------------------------------------------*/
 
 /* Exported functions prototypes ---------------------------------------------*/
 TranslatorStatus_t scancode_translator_init(void);
-TranslatorStatus_t scancode_translator_usb_to_ps2(const USB_HID_KeyboardData_t *usb_data, 
-                                                  PS2_ScanCode_t *ps2_scancode);
+TranslatorStatus_t scancode_translator_process_events(const KeyboardEvent_t *events, uint8_t count);
+TranslatorStatus_t scancode_translator_release_all(void);
+uint8_t scancode_translator_reconcile(void);
+uint8_t scancode_translator_typematic(void);
+uint8_t scancode_translator_translate(uint8_t usage, uint8_t press, uint8_t modifiers, PS2_ScanCode_t *scancode);
+uint8_t scancode_translator_get_modifiers(void);
+TranslatorStatus_t scancode_translator_service(uint8_t max_reports, uint8_t *translated);
+uint8_t scancode_translator_check_overflow(void);
 TranslatorStatus_t scancode_translator_get_status(void);
 void scancode_translator_reset(void);
 
@@ -0,0 +1,38 @@
+/**
+ ******************************************************************************
+ * @file    flash_sim.h
+ * @brief   Header for flash_sim.c - Simulated configuration flash sector (host build)
+ * @author  STM32F411 USB-PS2 Project
+ * @version 1.0.0
+ * @date    2024
+ ******************************************************************************
+ */
+
+#ifndef __FLASH_SIM_H
+#define __FLASH_SIM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+
+/* Exported types ------------------------------------------------------------*/
+
+/* Exported constants --------------------------------------------------------*/
+#define FLASH_SIM_POWER_ON          0xFFFFFFFFU ///< flash_sim_cut_power() argument: never cut
+
+/* Exported macro ------------------------------------------------------------*/
+
+/* Exported functions prototypes ---------------------------------------------*/
+const uint8_t *flash_sim_sector(void);
+void flash_sim_reset(void);
+void flash_sim_cut_power(uint32_t words);
+uint32_t flash_sim_get_programmed_words(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __FLASH_SIM_H */
@@ -0,0 +1,81 @@
+/**
+ ******************************************************************************
+ * @file    i8042_sim.h
+ * @brief   Header for i8042_sim.c - Simulated i8042 keyboard controller
+ * @author  STM32F411 USB-PS2 Project
+ * @version 1.0.0
+ * @date    2024
+ ******************************************************************************
+ */
+
+#ifndef __I8042_SIM_H
+#define __I8042_SIM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+
+/* Exported types ------------------------------------------------------------*/
+/**
+ * @brief i8042 model status enumeration
+ */
+typedef enum {
+    I8042_SIM_OK = 0,           ///< Operation successful
+    I8042_SIM_ERROR,            ///< Operation failed
+    I8042_SIM_EMPTY             ///< No received byte available
+} I8042_SimStatus_t;
+
+/**
+ * @brief i8042 model configuration
+ * @note  All times are in microseconds, 0 disables the feature
+ */
+typedef struct {
+    uint32_t inhibit_offset_us;     ///< Time of the first periodic inhibit
+    uint32_t inhibit_period_us;     ///< Interval between periodic inhibits
+    uint32_t inhibit_duration_us;   ///< Length of each periodic inhibit
+    uint32_t inhibit_after_byte_us; ///< Hold CLK low after each received byte
+    uint32_t response_timeout_us;   ///< Wait for device clock after request-to-send
+} I8042_SimConfig_t;
+
+/**
+ * @brief i8042 model statistics
+ */
+typedef struct {
+    uint32_t bytes_received;        ///< Frames accepted (good parity and stop bit)
+    uint32_t parity_errors;         ///< Frames rejected for parity
+    uint32_t framing_errors;        ///< Frames rejected for start or stop bit
+    uint32_t aborted_frames;        ///< Frames cut short by an inhibit or timeout
+    uint32_t inhibits;              ///< Inhibits issued (periodic and post-byte)
+    uint32_t commands_sent;         ///< Host-to-device bytes started
+    uint32_t commands_acked;        ///< Host-to-device bytes acknowledged by the device
+    uint32_t command_timeouts;      ///< Host-to-device bytes the device never clocked
+    uint32_t first_byte_us;         ///< Time the first byte was accepted
+    uint32_t last_byte_us;          ///< Time the last byte was accepted
+} I8042_SimStats_t;
+
+/* Exported constants --------------------------------------------------------*/
+#define I8042_SIM_RX_LOG_SIZE           4096U   ///< Received byte log capacity
+#define I8042_SIM_CMD_QUEUE_SIZE        16U     ///< Pending host command capacity
+#define I8042_SIM_RTS_CLOCK_LOW_US      100U    ///< CLK low before request-to-send
+#define I8042_SIM_DEFAULT_TIMEOUT_US    15000U  ///< Device must start clocking within 15 ms
+
+/* Exported macro ------------------------------------------------------------*/
+
+/* Exported functions prototypes ---------------------------------------------*/
+void i8042_sim_init(const I8042_SimConfig_t *config);
+void i8042_sim_attach(void);
+void i8042_sim_detach(void);
+I8042_SimStatus_t i8042_sim_send_command(uint8_t command);
+I8042_SimStatus_t i8042_sim_read_byte(uint8_t *data, uint32_t *time_us);
+void i8042_sim_get_stats(I8042_SimStats_t *stats);
+uint32_t i8042_sim_get_bytes_per_second(void);
+uint8_t i8042_sim_is_idle(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __I8042_SIM_H */
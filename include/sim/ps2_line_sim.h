@@ -0,0 +1,115 @@
+/**
+ ******************************************************************************
+ * @file    ps2_line_sim.h
+ * @brief   Header for ps2_line_sim.c - Simulated PS/2 GPIO lines (host build)
+ * @author  STM32F411 USB-PS2 Project
+ * @version 1.0.0
+ * @date    2024
+ ******************************************************************************
+ */
+
+#ifndef __PS2_LINE_SIM_H
+#define __PS2_LINE_SIM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+
+/* Exported types ------------------------------------------------------------*/
+/**
+ * @brief Simulation status enumeration
+ */
+typedef enum {
+    PS2_SIM_OK = 0,             ///< Simulation operation successful
+    PS2_SIM_ERROR               ///< Simulation operation failed
+} PS2_SimStatus_t;
+
+/**
+ * @brief Simulated PS/2 line identifiers
+ */
+typedef enum {
+    PS2_SIM_LINE_CLOCK = 0,     ///< PS2_CLK (PA0)
+    PS2_SIM_LINE_DATA,          ///< PS2_DATA (PA1)
+    PS2_SIM_LINE_COUNT
+} PS2_SimLine_t;
+
+/**
+ * @brief Side of the open-drain bus driving a line
+ */
+typedef enum {
+    PS2_SIM_DRIVER_DEVICE = 0,  ///< Converter firmware (HAL_GPIO_WritePin)
+    PS2_SIM_DRIVER_HOST,        ///< Simulated PS/2 host
+    PS2_SIM_DRIVER_COUNT
+} PS2_SimDriver_t;
+
+/**
+ * @brief Recorded drive change on one line
+ */
+typedef struct {
+    uint32_t time_us;           ///< Virtual timestamp in microseconds
+    uint8_t line;               ///< PS2_SimLine_t
+    uint8_t driver;             ///< PS2_SimDriver_t
+    uint8_t level;              ///< New drive level of that driver (1 = released)
+    uint8_t bus_level;          ///< Resulting wired-AND bus level
+} PS2_SimEdge_t;
+
+/**
+ * @brief Result of the device timing conformance check
+ */
+typedef struct {
+    uint32_t frames;                    ///< Device-to-host frames seen
+    uint32_t clock_edges;               ///< Device clock falling edges checked
+    uint32_t min_clock_period_us;       ///< Shortest falling-to-falling period
+    uint32_t max_clock_period_us;       ///< Longest falling-to-falling period
+    uint32_t clock_period_violations;   ///< Period outside 10-16.7 kHz
+    uint32_t clock_phase_violations;    ///< Low/high phase outside 30-50 us
+    uint32_t data_setup_violations;     ///< Data changed < 5 us before falling clock
+    uint32_t data_hold_violations;      ///< Data changed while clock low or < 5 us after rising clock
+    uint32_t inhibits;                  ///< Host inhibits seen during a device frame
+    uint32_t inhibit_response_violations; ///< Device kept driving > 100 us into an inhibit
+    uint32_t max_inhibit_response_us;   ///< Slowest release after an inhibit
+    uint8_t  log_overflow;              ///< 1 if the edge log filled up
+} PS2_SimTimingReport_t;
+
+/**
+ * @brief Host model hook, called once per simulated microsecond
+ */
+typedef void (*PS2_SimHostHook_t)(uint32_t now_us);
+
+/* Exported constants --------------------------------------------------------*/
+#define PS2_SIM_MAX_EDGES               262144U ///< Edge log capacity
+
+/* PS/2 device timing limits (device-to-host) */
+#define PS2_SIM_MIN_CLOCK_PERIOD_US     60U     ///< 16.7 kHz
+#define PS2_SIM_MAX_CLOCK_PERIOD_US     100U    ///< 10 kHz
+#define PS2_SIM_MIN_CLOCK_PHASE_US      30U     ///< Minimum clock low/high time
+#define PS2_SIM_MAX_CLOCK_PHASE_US      50U     ///< Maximum clock low/high time
+#define PS2_SIM_MIN_DATA_SETUP_US       5U      ///< Data valid before falling clock
+#define PS2_SIM_MIN_DATA_HOLD_US        5U      ///< Data held after rising clock
+#define PS2_SIM_MAX_INHIBIT_RESPONSE_US 100U    ///< Release lines after host inhibit
+
+/* Exported macro ------------------------------------------------------------*/
+
+/* Exported functions prototypes ---------------------------------------------*/
+void ps2_sim_reset(void);
+void ps2_sim_delay_us(uint32_t microseconds);
+uint32_t ps2_sim_get_time_us(void);
+void ps2_sim_set_host_hook(PS2_SimHostHook_t hook);
+
+void ps2_sim_drive(PS2_SimDriver_t driver, PS2_SimLine_t line, uint8_t level);
+uint8_t ps2_sim_get_line(PS2_SimLine_t line);
+uint8_t ps2_sim_get_drive(PS2_SimDriver_t driver, PS2_SimLine_t line);
+
+uint32_t ps2_sim_get_edge_count(void);
+const PS2_SimEdge_t *ps2_sim_get_edges(void);
+PS2_SimStatus_t ps2_sim_write_vcd(const char *path);
+PS2_SimStatus_t ps2_sim_check_timing(PS2_SimTimingReport_t *report);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __PS2_LINE_SIM_H */
@@ -16,6 +16,7 @@ extern "C" {
 
 /* Includes ------------------------------------------------------------------*/
 #include <stdint.h>
+#include <stddef.h>
 
 /* Exported types ------------------------------------------------------------*/
 typedef enum {
@@ -138,6 +139,15 @@ typedef enum {
   HAL_HCD_STATE_TIMEOUT = 0x04
 } HCD_StateTypeDef;
 
+/* Flash definitions */
+typedef struct {
+  uint32_t TypeErase;
+  uint32_t Banks;
+  uint32_t Sector;
+  uint32_t NbSectors;
+  uint32_t VoltageRange;
+} FLASH_EraseInitTypeDef;
+
 /* Constants */
 #define GPIO_MODE_OUTPUT_PP        0x00000001U
 #define GPIO_MODE_OUTPUT_OD        0x00000011U
@@ -153,11 +163,17 @@ typedef enum {
 #define TIM_AUTORELOAD_PRELOAD_DISABLE  0x00000000U
 
 #define HCD_SPEED_FULL             0x00000002U
+#define EP_TYPE_INTR               0x03U
 #define DISABLE                    0U
 #define ENABLE                     1U
 
 #define GPIO_AF10_OTG_FS           ((uint8_t)0x0A)
 
+#define FLASH_TYPEERASE_SECTORS    0x00000000U
+#define FLASH_TYPEPROGRAM_WORD     0x00000002U
+#define FLASH_VOLTAGE_RANGE_3      0x00000002U
+#define FLASH_SECTOR_7             7U
+
 /* Peripheral base addresses (dummy values) */
 #define GPIOA_BASE            (0x40020000UL)
 #define GPIOC_BASE            (0x40020800UL)
@@ -194,6 +210,15 @@ HAL_StatusTypeDef HAL_HCD_Init(HCD_HandleTypeDef *hhcd);
 HAL_StatusTypeDef HAL_HCD_Start(HCD_HandleTypeDef *hhcd);
 HCD_StateTypeDef HAL_HCD_GetState(HCD_HandleTypeDef *hhcd);
 void HAL_HCD_IRQHandler(HCD_HandleTypeDef *hhcd);
+HAL_StatusTypeDef HAL_HCD_HC_SubmitRequest(HCD_HandleTypeDef *hhcd, uint8_t ch_num, uint8_t direction,
+                                           uint8_t ep_type, uint8_t token, uint8_t *pbuff,
+                                           uint16_t length, uint8_t do_ping);
+uint32_t HAL_HCD_HC_GetXferCount(HCD_HandleTypeDef *hhcd, uint8_t chnum);
+
+HAL_StatusTypeDef HAL_FLASH_Unlock(void);
+HAL_StatusTypeDef HAL_FLASH_Lock(void);
+HAL_StatusTypeDef HAL_FLASH_Program(uint32_t TypeProgram, uint32_t Address, uint64_t Data);
+HAL_StatusTypeDef HAL_FLASHEx_Erase(FLASH_EraseInitTypeDef *pEraseInit, uint32_t *SectorError);
 
 /* Callback functions */
 void HAL_TIM_PeriodElapsedCallback(TIM_HandleTypeDef *htim);
@@ -208,6 +233,15 @@ void HAL_HCD_Disconnect_Callback(HCD_HandleTypeDef *hhcd);
 #define PendSV_IRQn           -2
 #define SysTick_IRQn          -1
 
+/* System control block */
+typedef struct {
+  volatile uint32_t CPUID;
+  volatile uint32_t ICSR;
+} SCB_Type;
+
+#define SCB                     ((SCB_Type *)0xE000ED00UL)
+#define SCB_ICSR_PENDSVSET_Msk  (1UL << 28)
+
 /* NVIC functions */
 void HAL_NVIC_SetPriority(int32_t IRQn, uint32_t PreemptPriority, uint32_t SubPriority);
 void HAL_NVIC_EnableIRQ(int32_t IRQn);
@@ -0,0 +1,42 @@
+/**
+ ******************************************************************************
+ * @file    hid_keys.h
+ * @brief   Header for hid_keys.c - boot protocol key array kernels
+ * @author  STM32F411 USB-PS2 Project
+ * @version 1.0.0
+ * @date    2024
+ ******************************************************************************
+ */
+
+#ifndef __HID_KEYS_H
+#define __HID_KEYS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+
+/* Exported types ------------------------------------------------------------*/
+
+/* Exported constants --------------------------------------------------------*/
+#define HID_KEYS_COUNT              6       ///< Key bytes in a boot protocol report
+#define HID_KEYS_ERROR_ROLLOVER      0x01    ///< Reported in every key slot while too many keys are down
+#define HID_KEYS_FIRST_USAGE        0x02    ///< Lowest real key usage (0x00 none, 0x01 ErrorRollOver)
+
+/* Exported macro ------------------------------------------------------------*/
+
+/* Exported functions prototypes ---------------------------------------------*/
+uint8_t hid_keys_valid_mask(const uint8_t *keys);
+uint8_t hid_keys_match_mask(const uint8_t *keys, const uint8_t *other, uint8_t valid);
+uint8_t hid_keys_rollover(const uint8_t *keys);
+uint8_t hid_keys_valid_mask_c(const uint8_t *keys);
+uint8_t hid_keys_match_mask_c(const uint8_t *keys, const uint8_t *other, uint8_t valid);
+uint8_t hid_keys_rollover_c(const uint8_t *keys);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __HID_KEYS_H */
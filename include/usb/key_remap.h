@@ -0,0 +1,67 @@
+/**
+ ******************************************************************************
+ * @file    key_remap.h
+ * @brief   Header for key_remap.c - key remapping and layers
+ * @author  STM32F411 USB-PS2 Project
+ * @version 1.0.0
+ * @date    2024
+ ******************************************************************************
+ */
+
+#ifndef __KEY_REMAP_H
+#define __KEY_REMAP_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+#include "keyboard_handler.h"
+
+/* Exported types ------------------------------------------------------------*/
+#ifdef PS2_HOST_SIM
+/**
+ * @brief Interrupt model hook, called where an interrupt may preempt key_remap_events()
+ */
+typedef void (*KeyRemapSimHook_t)(void);
+#endif
+
+/* Exported constants --------------------------------------------------------*/
+#define KEY_REMAP_TABLE_SIZE        256     ///< Entries per layer table, one per HID usage
+#define KEY_REMAP_MAX_LAYERS        8       ///< Base layer plus seven held layers
+#define KEY_REMAP_NONE              0x00    ///< Table entry of a disabled key
+#define KEY_REMAP_LAYER_KEY         0xF0    ///< Table entry of the key holding layer n is 0xF0 | n
+#define KEY_REMAP_MACRO_KEY         0xE8    ///< Table entry of the key typing macro n is 0xE8 | n
+#define KEY_REMAP_MACRO_MASK        0x07    ///< Macro number in a macro key entry
+#define KEY_REMAP_MAX_MACROS        8       ///< Macros a keymap can bind
+
+/* Exported macro ------------------------------------------------------------*/
+
+/* Exported variables --------------------------------------------------------*/
+/* Generated from the keymap file by cmake/keymap_gen.cmake */
+extern const uint8_t key_remap_layer_count;
+extern const uint8_t key_remap_layers[][KEY_REMAP_TABLE_SIZE];
+extern const uint8_t *const key_remap_macros[];   ///< Macro bytes (see macro_engine.h)
+
+/* Exported functions prototypes ---------------------------------------------*/
+void key_remap_init(void);
+void key_remap_reset(void);
+uint8_t key_remap_events(const KeyboardEvent_t *events, uint8_t count, KeyboardEvent_t *remapped);
+void key_remap_toggle_layer(uint8_t layer);
+void key_remap_set_locked_layers(uint8_t layers);
+uint8_t key_remap_get_locked_layers(void);
+uint8_t key_remap_edit_begin(void);
+void key_remap_edit_map(uint8_t layer, uint8_t usage, uint8_t entry);
+void key_remap_publish(void);
+uint8_t key_remap_get_layer(void);
+#ifdef PS2_HOST_SIM
+void key_remap_sim_set_hook(KeyRemapSimHook_t hook);
+void key_remap_sim_drop_keymap(void);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __KEY_REMAP_H */
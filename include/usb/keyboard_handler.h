@@ -31,14 +31,6 @@ typedef enum {
     KEYBOARD_HANDLER_BUFFER_FULL    ///< Handler buffer is full
 } KeyboardHandlerStatus_t;
 
-/**
- * @brief Keyboard data availability status
- */
-typedef enum {
-    KEYBOARD_NO_DATA = 0,           ///< No keyboard data available
-    KEYBOARD_DATA_AVAILABLE         ///< Keyboard data is available
-} KeyboardDataStatus_t;
-
 /**
  * @brief USB HID keyboard data structure
  */
@@ -50,7 +42,36 @@ typedef struct {
     uint8_t key_count;                         ///< Number of pressed keys
 } USB_HID_KeyboardData_t;
 
+/**
+ * @brief Key press or release passed from the keyboard handler to the translator
+ */
+typedef struct {
+    uint8_t usage;                  ///< HID usage, modifiers as USB_HID_MODIFIER_USAGE + bit
+    uint8_t flags;                  ///< KEYBOARD_EVENT_* flags
+    uint16_t time_ms;               ///< HAL tick of the report, low 16 bits
+} KeyboardEvent_t;
+
+/**
+ * @brief Keyboard handler statistics
+ */
+typedef struct {
+    uint32_t reports;               ///< Reports that changed the keyboard state
+    uint32_t coalesced_reports;     ///< Reports folded while the buffer was saturated
+    uint32_t held_reports;          ///< Reports held back until a repeated tap could be passed on
+    uint32_t rollover_events;       ///< Times the keyboard entered ErrorRollOver
+    uint32_t rollover_reports;      ///< ErrorRollOver reports whose key bytes were ignored
+} KeyboardHandlerStats_t;
+
 /* Exported constants --------------------------------------------------------*/
+#define USB_HID_USAGE_BITMAP_SIZE       32      ///< Bytes in a 256-usage key bitmap
+#define USB_HID_MODIFIER_USAGE          0xE0    ///< HID usage of Left Ctrl; modifier bit n is usage 0xE0 + n
+#define USB_HID_MODIFIER_COUNT          8       ///< Modifier bits in a HID report
+
+/* Key event flags */
+#define KEYBOARD_EVENT_PRESS            0x01    ///< Key went down (up if clear)
+#define KEYBOARD_EVENT_LAST             0x02    ///< Last event of a report
+#define KEYBOARD_REPORT_MAX_EVENTS      (USB_HID_MODIFIER_COUNT + 2 * USB_HID_MAX_KEYS) ///< Events one report can produce
+
 /* USB HID modifier key bitmasks */
 #define USB_HID_MODIFIER_LEFT_CTRL      0x01
 #define USB_HID_MODIFIER_LEFT_SHIFT     0x02
@@ -105,6 +126,18 @@ typedef struct {
 #define USB_HID_KEY_BACKSPACE           0x2A
 #define USB_HID_KEY_TAB                 0x2B
 #define USB_HID_KEY_SPACE               0x2C
+#define USB_HID_KEY_MINUS               0x2D
+#define USB_HID_KEY_EQUAL               0x2E
+#define USB_HID_KEY_LEFT_BRACKET        0x2F
+#define USB_HID_KEY_RIGHT_BRACKET       0x30
+#define USB_HID_KEY_BACKSLASH           0x31
+#define USB_HID_KEY_SEMICOLON           0x33
+#define USB_HID_KEY_APOSTROPHE          0x34
+#define USB_HID_KEY_GRAVE               0x35
+#define USB_HID_KEY_COMMA               0x36
+#define USB_HID_KEY_PERIOD              0x37
+#define USB_HID_KEY_SLASH               0x38
+#define USB_HID_KEY_CAPS_LOCK           0x39
 
 #define USB_HID_KEY_F1                  0x3A
 #define USB_HID_KEY_F2                  0x3B
@@ -119,6 +152,9 @@ typedef struct {
 #define USB_HID_KEY_F11                 0x44
 #define USB_HID_KEY_F12                 0x45
 
+#define USB_HID_KEY_PRINT_SCREEN        0x46
+#define USB_HID_KEY_SCROLL_LOCK         0x47
+#define USB_HID_KEY_PAUSE               0x48
 #define USB_HID_KEY_INSERT              0x49
 #define USB_HID_KEY_HOME                0x4A
 #define USB_HID_KEY_PAGE_UP             0x4B
@@ -129,16 +165,21 @@ typedef struct {
 #define USB_HID_KEY_LEFT_ARROW          0x50
 #define USB_HID_KEY_DOWN_ARROW          0x51
 #define USB_HID_KEY_UP_ARROW            0x52
+#define USB_HID_KEY_APPLICATION         0x65
 
 /* Exported macro ------------------------------------------------------------*/
 
 /* Exported functions prototypes ---------------------------------------------*/
 KeyboardHandlerStatus_t keyboard_handler_init(void);
 KeyboardHandlerStatus_t keyboard_handler_process_report(const uint8_t *report, uint16_t report_size);
-KeyboardDataStatus_t keyboard_handler_get_data(USB_HID_KeyboardData_t *keyboard_data);
+uint8_t keyboard_handler_get_events(KeyboardEvent_t *events, uint8_t max_events);
 KeyboardHandlerStatus_t keyboard_handler_get_status(void);
 void keyboard_handler_tick(void);
 void keyboard_handler_clear_buffer(void);
+uint8_t keyboard_handler_check_overflow(void);
+uint8_t keyboard_handler_congested(void);
+void keyboard_handler_reset(void);
+void keyboard_handler_get_stats(KeyboardHandlerStats_t *stats);
 
 /* Utility functions */
 uint8_t keyboard_is_key_pressed(const USB_HID_KeyboardData_t *keyboard_data, uint8_t key_code);
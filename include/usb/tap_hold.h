@@ -0,0 +1,64 @@
+/**
+ ******************************************************************************
+ * @file    tap_hold.h
+ * @brief   Header for tap_hold.c - dual-role keys and one-shot modifiers
+ * @author  STM32F411 USB-PS2 Project
+ * @version 1.0.0
+ * @date    2024
+ ******************************************************************************
+ */
+
+#ifndef __TAP_HOLD_H
+#define __TAP_HOLD_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+#include "keyboard_handler.h"
+
+/* Exported types ------------------------------------------------------------*/
+/**
+ * @brief Dual-role key: one usage when tapped, another while held
+ */
+typedef struct {
+    uint8_t tap;                    ///< Usage sent when tapped, unused for a one-shot key
+    uint8_t hold;                   ///< Usage held once the key counts as held
+    uint8_t flags;                  ///< TAP_HOLD_* flags
+} TapHoldDefinition_t;
+
+/* Exported constants --------------------------------------------------------*/
+#define TAP_HOLD_TABLE_SIZE         256     ///< Key table entries, one per HID usage
+#define TAP_HOLD_MAX_KEYS           8       ///< Dual-role keys a keymap can define
+#define TAP_HOLD_ONE_SHOT           0x01    ///< Tapping arms the hold modifier for the next key
+#define TAP_HOLD_TERM_DEFAULT_MS    200     ///< Tapping term without a tapping_term statement
+
+/* Events tap_hold_events() can add to a report: a held key, a tap's press,
+ * the one-shot modifiers of one key released and those of the next pressed,
+ * and a modifier armed within the report pressed and released */
+#define TAP_HOLD_EXTRA_EVENTS       (4 + 2 * USB_HID_MODIFIER_COUNT)
+#define TAP_HOLD_TICK_EVENTS        1       ///< Events tap_hold_tick() can produce
+
+/* Exported macro ------------------------------------------------------------*/
+
+/* Exported variables --------------------------------------------------------*/
+/* Generated from the keymap file by cmake/keymap_gen.cmake */
+extern const uint16_t tap_hold_term_ms;
+extern const uint8_t tap_hold_count;
+extern const uint8_t tap_hold_keys[TAP_HOLD_TABLE_SIZE];    ///< Definition number + 1 of each usage, 0 if none
+extern const TapHoldDefinition_t tap_hold_definitions[];
+
+/* Exported functions prototypes ---------------------------------------------*/
+void tap_hold_reset(void);
+uint8_t tap_hold_active(void);
+uint8_t tap_hold_pending(void);
+uint8_t tap_hold_events(const KeyboardEvent_t *events, uint8_t count, uint16_t time_ms, KeyboardEvent_t *out);
+uint8_t tap_hold_tick(uint16_t time_ms, KeyboardEvent_t *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __TAP_HOLD_H */
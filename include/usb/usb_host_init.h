@@ -30,6 +30,15 @@ typedef enum {
     USB_HOST_ERROR                  ///< USB Host error state
 } USB_HostStatus_t;
 
+/**
+ * @brief Keyboard polling flow control statistics
+ */
+typedef struct {
+    uint32_t reports;               ///< Interrupt IN transfers completed with a report
+    uint32_t pauses;                ///< Times polling was paused by PS/2 backpressure
+    uint32_t skipped_polls;         ///< Poll intervals the IN transfer was held back by backpressure
+} USB_HostFlowStats_t;
+
 /* Exported constants --------------------------------------------------------*/
 
 /* Exported macro ------------------------------------------------------------*/
@@ -39,7 +48,10 @@ USB_HostStatus_t usb_host_init(void);
 void usb_host_process(void);
 USB_HostStatus_t usb_host_get_status(void);
 uint8_t usb_host_device_connected(void);
+uint8_t usb_host_check_input_lost(void);
 USB_HostStatus_t usb_host_read_keyboard_data(uint8_t *data, uint16_t length);
+void usb_host_pause_keyboard_in(uint8_t pause);
+void usb_host_get_flow_stats(USB_HostFlowStats_t *stats);
 
 /* HAL callback functions */
 void usb_host_urb_change_callback(HCD_HandleTypeDef *hhcd, uint8_t chnum, HCD_URBStateTypeDef urb_state);
@@ -0,0 +1,374 @@
+/**
+ ******************************************************************************
+ * @file    config_store.c
+ * @brief   Wear-levelled settings store in flash for STM32F411
+ * @author  STM32F411 USB-PS2 Project
+ * @version 1.0.0
+ * @date    2024
+ *
+ * @description
+ * Keeps the runtime settings (scan code set, PS/2 link timing, locked remap
+ * layers) in flash sector 7, reserved by STM32F411CEUx_FLASH.ld. The sector
+ * is a log of fixed-size records, each holding every value; a change
+ * appends a record after the last one, so each of the 2048 slots is
+ * programmed once per sector erase.
+ *
+ * A record is written magic word first and CRC last. Used slots are thus
+ * always a prefix of the sector: boot finds its end with a binary search
+ * (at most 12 slot reads) and uses the record before it in place, checking
+ * only its CRC. A record torn by a power loss fails the CRC and the one before it
+ * is used. Reading a value is a load from flash; nothing is copied or
+ * parsed, however many settings or records there are.
+ *
+ * When the sector is full it is erased and the settings are written again
+ * at its start. The erase stalls the CPU for 1-2 s, once per 2048 saves;
+ * power lost during it leaves the compile-time defaults in effect.
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include "config_store.h"
+#include "main.h"
+#include "ps2_init.h"
+#include "ps2_protocol.h"
+#include "ps2_command.h"
+#include "key_remap.h"
+#include <stddef.h>
+#include <string.h>
+#ifdef PS2_HOST_SIM
+#include "flash_sim.h"
+#endif
+
+/* Private typedef -----------------------------------------------------------*/
+
+/* Private define ------------------------------------------------------------*/
+#define CONFIG_STORE_MAGIC          0x3156534BU ///< "KSV1", a started record
+#define CONFIG_STORE_ERASED         0xFFFFFFFFU ///< Erased flash word
+#define CONFIG_STORE_SECTOR         FLASH_SECTOR_7
+#define CONFIG_STORE_WORDS          (sizeof(ConfigRecord_t) / sizeof(uint32_t))
+#define CONFIG_STORE_CRC_BYTES      offsetof(ConfigRecord_t, crc)
+
+/* Private macro -------------------------------------------------------------*/
+_Static_assert(CONFIG_KEY_COUNT <= CONFIG_STORE_VALUES, "CONFIG_STORE_VALUES too small for the keys");
+_Static_assert(CONFIG_STORE_SIZE % sizeof(ConfigRecord_t) == 0, "records must tile the sector");
+
+/* Private variables ---------------------------------------------------------*/
+static const ConfigRecord_t *records = NULL;   ///< Slot 0 of the sector
+static const ConfigRecord_t *current = NULL;   ///< Record in use, NULL while every key is unset
+static uint32_t next_slot = 0;                  ///< First slot not known to be used
+static ConfigRecord_t staged;                   ///< Values for the next record
+static uint8_t staged_dirty = 0;                ///< staged differs from current
+static ConfigStoreStats_t store_stats;
+
+/* CRC-32 (IEEE 802.3, reflected), one nibble per step */
+static const uint32_t crc_nibble_table[16] = {
+    0x00000000U, 0x1DB71064U, 0x3B6E20C8U, 0x26D930ACU,
+    0x76DC4190U, 0x6B6B51F4U, 0x4DB26158U, 0x5005713CU,
+    0xEDB88320U, 0xF00F9344U, 0xD6D6A3E8U, 0xCB61B38CU,
+    0x9B64C2B0U, 0x86D3D2D4U, 0xA00AE278U, 0xBDBDF21CU
+};
+
+/* Private function prototypes -----------------------------------------------*/
+static uint32_t config_store_crc(const ConfigRecord_t *record);
+static uint8_t config_store_valid(const ConfigRecord_t *record);
+static uint8_t config_store_slot_erased(const ConfigRecord_t *record);
+static ConfigStoreStatus_t config_store_erase(void);
+static ConfigStoreStatus_t config_store_program(uint32_t slot, const ConfigRecord_t *record);
+
+/* Exported functions --------------------------------------------------------*/
+
+/**
+ * @brief  Find the record in use
+ * @note   A binary search for the first erased slot, then a CRC check of
+ *         the record before it. Bad records are skipped going back.
+ * @retval CONFIG_STORE_OK
+ */
+ConfigStoreStatus_t config_store_init(void)
+{
+    uint32_t low = 0;
+    uint32_t high = CONFIG_STORE_SLOTS;
+    uint32_t slot;
+
+#ifdef PS2_HOST_SIM
+    records = (const ConfigRecord_t *)flash_sim_sector();
+#else
+    records = (const ConfigRecord_t *)CONFIG_STORE_ADDRESS;
+#endif
+    memset(&store_stats, 0, sizeof(store_stats));
+    current = NULL;
+
+    /* Used slots are a prefix: find its end */
+    while (low < high) {
+        uint32_t middle = low + (high - low) / 2U;
+
+        store_stats.probes++;
+        if (records[middle].magic == CONFIG_STORE_ERASED) {
+            high = middle;
+        } else {
+            low = middle + 1U;
+        }
+    }
+    next_slot = low;
+
+    for (slot = low; slot > 0; slot--) {
+        store_stats.probes++;
+        if (config_store_valid(&records[slot - 1U])) {
+            current = &records[slot - 1U];
+            break;
+        }
+        store_stats.torn_records++;
+    }
+    store_stats.slot = (current != NULL) ? (uint32_t)(current - records) : CONFIG_STORE_SLOTS;
+
+    if (current != NULL) {
+        staged = *current;
+    } else {
+        memset(&staged, 0xFF, sizeof(staged));
+    }
+    staged_dirty = 0;
+
+    return CONFIG_STORE_OK;
+}
+
+/**
+ * @brief  Get a stored value
+ * @note   Reads the record in place; values set but not committed are not seen
+ * @param  key: Setting
+ * @param  default_value: Returned if the key was never set
+ * @retval Value
+ */
+uint32_t config_store_get(ConfigKey_t key, uint32_t default_value)
+{
+    uint32_t value;
+
+    if (current == NULL || (uint32_t)key >= CONFIG_KEY_COUNT) {
+        return default_value;
+    }
+
+    value = current->values[key];
+    return (value == CONFIG_VALUE_UNSET) ? default_value : value;
+}
+
+/**
+ * @brief  Set a value for the next config_store_commit()
+ * @param  key: Setting
+ * @param  value: Value, CONFIG_VALUE_UNSET to go back to the default
+ * @retval None
+ */
+void config_store_set(ConfigKey_t key, uint32_t value)
+{
+    if ((uint32_t)key >= CONFIG_KEY_COUNT || staged.values[key] == value) {
+        return;
+    }
+
+    staged.values[key] = value;
+    staged_dirty = 1;
+}
+
+/**
+ * @brief  Write the values set as a new record
+ * @note   Nothing is written if no value changed. Erases the sector first
+ *         when it is full. Called from the main loop only; the CPU stalls
+ *         while the flash is busy.
+ * @retval CONFIG_STORE_OK if the record is in use, CONFIG_STORE_ERROR if
+ *         the flash failed (the values stay set for another commit)
+ */
+ConfigStoreStatus_t config_store_commit(void)
+{
+    uint32_t slot;
+
+    if (!staged_dirty) {
+        return CONFIG_STORE_OK;
+    }
+
+    /* Skip slots a power loss left half written */
+    while (next_slot < CONFIG_STORE_SLOTS && !config_store_slot_erased(&records[next_slot])) {
+        next_slot++;
+    }
+
+    if (next_slot == CONFIG_STORE_SLOTS) {
+        current = NULL;
+        store_stats.slot = CONFIG_STORE_SLOTS;
+        if (config_store_erase() != CONFIG_STORE_OK) {
+            return CONFIG_STORE_ERROR;
+        }
+        next_slot = 0;
+    }
+
+    slot = next_slot++;
+    staged.magic = CONFIG_STORE_MAGIC;
+    staged.crc = config_store_crc(&staged);
+
+    if (config_store_program(slot, &staged) != CONFIG_STORE_OK || !config_store_valid(&records[slot])) {
+        return CONFIG_STORE_ERROR;
+    }
+
+    current = &records[slot];
+    staged_dirty = 0;
+    store_stats.slot = slot;
+    store_stats.appends++;
+    return CONFIG_STORE_OK;
+}
+
+/**
+ * @brief  Get the record in use
+ * @retval Record in flash, NULL if none was written or the last is torn
+ */
+const ConfigRecord_t *config_store_get_record(void)
+{
+    return current;
+}
+
+/**
+ * @brief  Get store statistics
+ * @param  stats: Pointer to store the statistics
+ * @retval None
+ */
+void config_store_get_stats(ConfigStoreStats_t *stats)
+{
+    if (stats != NULL) {
+        *stats = store_stats;
+    }
+}
+
+/**
+ * @brief  Apply the stored settings
+ * @note   Called once after the PS/2 and translator modules are
+ *         initialized; keys never set keep their compile-time defaults
+ * @retval None
+ */
+void config_store_load_settings(void)
+{
+    PS2_LinkConfig_t link;
+    uint32_t clock_hz;
+
+    ps2_command_set_default_set((uint8_t)config_store_get(CONFIG_KEY_SCAN_CODE_SET, PS2_DEFAULT_SCAN_CODE_SET));
+
+    ps2_get_link_config(&link);
+    clock_hz = config_store_get(CONFIG_KEY_PS2_CLOCK_HZ, link.clock_freq_hz);
+    if (clock_hz >= PS2_CLOCK_FREQ_MIN_HZ && clock_hz <= PS2_CLOCK_FREQ_MAX_HZ) {
+        link.clock_freq_hz = (uint16_t)clock_hz;
+    }
+    link.auto_tune = (config_store_get(CONFIG_KEY_PS2_AUTO_TUNE, link.auto_tune) != 0);
+    (void)ps2_set_link_config(&link);
+
+    key_remap_set_locked_layers((uint8_t)config_store_get(CONFIG_KEY_LOCKED_LAYERS, 0));
+}
+
+/**
+ * @brief  Store the settings in use
+ * @note   The scan code set in use becomes the one restored by a reset
+ * @retval CONFIG_STORE_OK if stored, CONFIG_STORE_ERROR otherwise
+ */
+ConfigStoreStatus_t config_store_save_settings(void)
+{
+    PS2_LinkConfig_t link;
+
+    ps2_get_link_config(&link);
+
+    config_store_set(CONFIG_KEY_SCAN_CODE_SET, ps2_get_scan_code_set());
+    config_store_set(CONFIG_KEY_PS2_CLOCK_HZ, link.clock_freq_hz);
+    config_store_set(CONFIG_KEY_PS2_AUTO_TUNE, link.auto_tune);
+    config_store_set(CONFIG_KEY_LOCKED_LAYERS, key_remap_get_locked_layers());
+
+    return config_store_commit();
+}
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+ * @brief  CRC-32 of a record's magic word and values
+ * @param  record: Record
+ * @retval CRC
+ */
+static uint32_t config_store_crc(const ConfigRecord_t *record)
+{
+    const uint8_t *bytes = (const uint8_t *)record;
+    uint32_t crc = 0xFFFFFFFFU;
+
+    for (uint32_t i = 0; i < CONFIG_STORE_CRC_BYTES; i++) {
+        crc ^= bytes[i];
+        crc = (crc >> 4) ^ crc_nibble_table[crc & 0x0FU];
+        crc = (crc >> 4) ^ crc_nibble_table[crc & 0x0FU];
+    }
+
+    return ~crc;
+}
+
+/**
+ * @brief  Check that a record was written completely
+ * @param  record: Record in flash
+ * @retval 1 if the magic word and CRC match, 0 otherwise
+ */
+static uint8_t config_store_valid(const ConfigRecord_t *record)
+{
+    return record->magic == CONFIG_STORE_MAGIC && record->crc == config_store_crc(record);
+}
+
+/**
+ * @brief  Check that every word of a slot is erased
+ * @param  record: Slot in flash
+ * @retval 1 if the slot can be programmed, 0 otherwise
+ */
+static uint8_t config_store_slot_erased(const ConfigRecord_t *record)
+{
+    const uint32_t *words = (const uint32_t *)record;
+
+    for (uint32_t i = 0; i < CONFIG_STORE_WORDS; i++) {
+        if (words[i] != CONFIG_STORE_ERASED) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * @brief  Erase the store sector
+ * @retval CONFIG_STORE_OK if erased, CONFIG_STORE_ERROR otherwise
+ */
+static ConfigStoreStatus_t config_store_erase(void)
+{
+    FLASH_EraseInitTypeDef erase = {0};
+    uint32_t sector_error = 0;
+    HAL_StatusTypeDef status;
+
+    erase.TypeErase = FLASH_TYPEERASE_SECTORS;
+    erase.Sector = CONFIG_STORE_SECTOR;
+    erase.NbSectors = 1;
+    erase.VoltageRange = FLASH_VOLTAGE_RANGE_3;
+
+    HAL_FLASH_Unlock();
+    status = HAL_FLASHEx_Erase(&erase, &sector_error);
+    HAL_FLASH_Lock();
+
+    if (status != HAL_OK) {
+        return CONFIG_STORE_ERROR;
+    }
+
+    store_stats.erases++;
+    return CONFIG_STORE_OK;
+}
+
+/**
+ * @brief  Program a record into an erased slot
+ * @note   Word by word in address order: the magic word first marks the
+ *         slot used, the CRC last marks the record complete
+ * @param  slot: Slot number
+ * @param  record: Record to write
+ * @retval CONFIG_STORE_OK if programmed, CONFIG_STORE_ERROR otherwise
+ */
+static ConfigStoreStatus_t config_store_program(uint32_t slot, const ConfigRecord_t *record)
+{
+    const uint32_t *words = (const uint32_t *)record;
+    uint32_t address = CONFIG_STORE_ADDRESS + slot * (uint32_t)sizeof(ConfigRecord_t);
+    HAL_StatusTypeDef status = HAL_OK;
+
+    HAL_FLASH_Unlock();
+    for (uint32_t i = 0; i < CONFIG_STORE_WORDS && status == HAL_OK; i++) {
+        status = HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, address + i * 4U, words[i]);
+    }
+    HAL_FLASH_Lock();
+
+    return (status == HAL_OK) ? CONFIG_STORE_OK : CONFIG_STORE_ERROR;
+}
@@ -37,7 +37,12 @@ void HAL_MspInit(void)
     HAL_NVIC_SetPriority(PendSV_IRQn, 15, 0);
     
     /* SysTick_IRQn interrupt configuration */
+#ifdef PS2_ISR_FAST_PATH
+    /* Above PendSV so the tick keeps counting while PendSV sends PS/2 bytes */
+    HAL_NVIC_SetPriority(SysTick_IRQn, 14, 0);
+#else
     HAL_NVIC_SetPriority(SysTick_IRQn, 15, 0);
+#endif
 }
 
 /**
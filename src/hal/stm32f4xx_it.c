@@ -11,6 +11,7 @@
 /* Includes ------------------------------------------------------------------*/
 #include "main.h"
 #include "stm32f4xx_it.h"
+#include "ps2_init.h"
 
 /* Private typedef -----------------------------------------------------------*/
 
@@ -108,7 +109,10 @@ void DebugMon_Handler(void)
  */
 void PendSV_Handler(void)
 {
-    /* PendSV handler */
+#ifdef PS2_ISR_FAST_PATH
+    /* PS/2 transmit kicked from the USB completion interrupt */
+    ps2_process();
+#endif
 }
 
 /**
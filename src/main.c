@@ -23,8 +23,12 @@
 #include "system_init.h"
 #include "usb_host_init.h"
 #include "ps2_init.h"
+#include "ps2_queue.h"
 #include "keyboard_handler.h"
 #include "scancode_translator.h"
+#include "macro_engine.h"
+#include "chord_detector.h"
+#include "config_store.h"
 
 /* Private typedef -----------------------------------------------------------*/
 /**
@@ -101,6 +105,10 @@ int main(void)
         error_handler();
     }
     
+    /* Apply the settings stored in flash over the compile-time defaults */
+    (void)config_store_init();
+    config_store_load_settings();
+    
     /* System ready - start main application loop */
     app_state = APP_STATE_READY;
     
@@ -118,8 +126,8 @@ int main(void)
  */
 static void main_application_loop(void)
 {
-    USB_HID_KeyboardData_t usb_keyboard_data;
-    PS2_ScanCode_t ps2_scancode;
+    uint8_t flow_paused;
+    uint8_t reports_translated;
     
     app_state = APP_STATE_RUNNING;
     
@@ -131,22 +139,59 @@ static void main_application_loop(void)
         /* Process USB Host events and keyboard input */
         usb_host_process();
         
-        /* Check for new keyboard data from USB */
-        if (keyboard_handler_get_data(&usb_keyboard_data) == KEYBOARD_DATA_AVAILABLE) {
+#ifdef PS2_ISR_FAST_PATH
+        /* The USB interrupt translates reports too; keep it out while the
+         * main loop works on translator state */
+        HAL_NVIC_DisableIRQ(OTG_FS_IRQn);
+#endif
+        
+        /* Keyboard gone, USB error or dropped reports: release held keys */
+        if (usb_host_check_input_lost() || keyboard_handler_check_overflow() ||
+            scancode_translator_check_overflow()) {
+            keyboard_handler_reset();
+            scancode_translator_release_all();
+        }
+        
+        /* PS/2 link backlogged: stop polling the keyboard until the queue drains */
+        flow_paused = ps2_queue_congested();
+        usb_host_pause_keyboard_in(flow_paused);
+        
+        /* Move every buffered report into the PS/2 queue while it has room,
+         * so a scanner burst never waits in the small report buffer */
+        if (!flow_paused) {
+            if (scancode_translator_service(TRANSLATOR_SERVICE_ALL, &reports_translated) != TRANSLATOR_OK) {
+                /* Translation error or queue overflow - held keys are released next pass */
+            }
             
-            /* Translate USB HID scan codes to PS/2 scan codes */
-            if (scancode_translator_usb_to_ps2(&usb_keyboard_data, &ps2_scancode) == TRANSLATOR_OK) {
-                
-                /* Send PS/2 scan code via PS/2 interface */
-                if (ps2_send_scancode(&ps2_scancode) != PS2_OK) {
-                    /* Handle PS/2 transmission error */
-                    // Error handling could include retry logic or status reporting
-                }
+            if (reports_translated == 0) {
+                /* Idle - heal any drift between host and keyboard key state */
+                scancode_translator_reconcile();
             }
+            
+            /* Repeat the last key still held, as a native keyboard does */
+            scancode_translator_typematic();
+            
+            /* Type the next characters of a running macro */
+            macro_engine_service();
+            
+            /* Act on a converter hotkey chord */
+            chord_detector_service();
         }
         
-        /* Small delay to prevent overwhelming the system */
-        HAL_Delay(MAIN_LOOP_DELAY_MS);
+#ifdef PS2_ISR_FAST_PATH
+        HAL_NVIC_EnableIRQ(OTG_FS_IRQn);
+#endif
+        
+        /* Send queued bytes for one time slice, answer host commands and
+         * retransmit bytes interrupted by the host */
+        ps2_process();
+        
+        /* Small delay to prevent overwhelming the system; none while there
+         * is still data to send or a macro to type so the link runs at
+         * full rate */
+        if (ps2_queue_count() == 0 && !macro_engine_busy()) {
+            HAL_Delay(MAIN_LOOP_DELAY_MS);
+        }
         system_tick_counter++;
     }
 }
@@ -0,0 +1,292 @@
+/**
+ ******************************************************************************
+ * @file    chord_detector.c
+ * @brief   Converter control hotkeys for STM32F411
+ * @author  STM32F411 USB-PS2 Project
+ * @version 1.0.0
+ * @date    2024
+ *
+ * @description
+ * Watches the key events of each report for chords that control the
+ * converter at runtime: switching the scan code set, locking a remap
+ * layer, releasing every key, typing a status line and storing the
+ * settings in flash. Chords come from
+ * the keymap file and are compiled at build time into a trigger table
+ * indexed by HID usage and one key bitmap per chord.
+ *
+ * A chord fires when its trigger key is pressed while every other key of
+ * the chord is down. Checking a press costs one table load and, for a
+ * trigger key, one 32-byte bitmap compare against the keys down, however
+ * many chords the keymap defines. The trigger press and its release are
+ * swallowed so the host never sees them; the other keys of the chord,
+ * normally modifiers, reach the host as usual. Each usage triggers at
+ * most one chord.
+ *
+ * Events are checked where they are translated, possibly in the USB
+ * interrupt; the action itself runs from the main loop. A scan code set
+ * switch waits until no scan code is part way out, as it flushes the
+ * PS/2 queue.
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include "chord_detector.h"
+#include "scancode_translator.h"
+#include "macro_engine.h"
+#include "key_remap.h"
+#include "ps2_command.h"
+#include "ps2_queue.h"
+#include "ps2_protocol.h"
+#include "config_store.h"
+#include <string.h>
+
+/* Private typedef -----------------------------------------------------------*/
+
+/* Private define ------------------------------------------------------------*/
+#define CHORD_NONE                  0       ///< No chord pending
+#define CHORD_DIAGNOSTICS_SIZE      96      ///< Status line buffer, MACRO_END included
+
+/* Private macro -------------------------------------------------------------*/
+
+/* Private variables ---------------------------------------------------------*/
+static uint8_t keys_down[USB_HID_USAGE_BITMAP_SIZE];   ///< Usages down on the USB keyboard
+static uint8_t swallowed[USB_HID_USAGE_BITMAP_SIZE];   ///< Trigger keys whose release is swallowed
+static volatile uint8_t pending_chord = CHORD_NONE;    ///< Chord number + 1 waiting for its action
+static uint8_t diagnostics_text[CHORD_DIAGNOSTICS_SIZE];  ///< Status line being typed
+
+/* Private function prototypes -----------------------------------------------*/
+static uint8_t chord_detector_match(const ChordDefinition_t *chord);
+static void chord_detector_run(const ChordDefinition_t *chord);
+static void chord_detector_type_diagnostics(void);
+static uint8_t *chord_detector_append_text(uint8_t *out, const char *text);
+static uint8_t *chord_detector_append_number(uint8_t *out, uint32_t value);
+
+/* Exported functions --------------------------------------------------------*/
+
+/**
+ * @brief  Initialize the chord detector
+ * @retval None
+ */
+void chord_detector_init(void)
+{
+    memset(swallowed, 0, sizeof(swallowed));
+    pending_chord = CHORD_NONE;
+    chord_detector_reset();
+}
+
+/**
+ * @brief  Forget the keys down
+ * @note   Called when the keyboard handler is reset; the next report
+ *         presses the keys still down again. Swallowed triggers stay
+ *         swallowed until released, so a trigger pressed again by the
+ *         reset does not fire its chord a second time.
+ * @retval None
+ */
+void chord_detector_reset(void)
+{
+    memset(keys_down, 0, sizeof(keys_down));
+}
+
+/**
+ * @brief  Check if the keymap defines any chord
+ * @retval 1 if events must go through chord_detector_events(), 0 otherwise
+ */
+uint8_t chord_detector_active(void)
+{
+    return chord_count != 0;
+}
+
+/**
+ * @brief  Check the key events of one report for chords
+ * @note   A trigger press that completes its chord and the release of that
+ *         key produce no event; the chord's action is left for
+ *         chord_detector_service()
+ * @param  events: Key events from the keyboard handler
+ * @param  count: Number of events
+ * @param  passed: Array of at least count events to store the events passed on
+ * @retval Number of events stored
+ */
+uint8_t chord_detector_events(const KeyboardEvent_t *events, uint8_t count, KeyboardEvent_t *passed)
+{
+    uint8_t passed_count = 0;
+
+    for (uint8_t i = 0; i < count; i++) {
+        uint8_t usage = events[i].usage;
+        uint8_t index = usage >> 3;
+        uint8_t bit = (uint8_t)(1U << (usage & 7U));
+
+        if (events[i].flags & KEYBOARD_EVENT_PRESS) {
+            uint8_t trigger = chord_triggers[usage];
+
+            keys_down[index] |= bit;
+            if (swallowed[index] & bit) {
+                /* Pressed again after a reset, still held since it fired */
+                continue;
+            }
+            if (trigger != CHORD_NONE && chord_detector_match(&chord_definitions[trigger - 1U])) {
+                swallowed[index] |= bit;
+                pending_chord = trigger;
+                continue;
+            }
+        } else {
+            keys_down[index] &= (uint8_t)~bit;
+            if (swallowed[index] & bit) {
+                swallowed[index] &= (uint8_t)~bit;
+                continue;
+            }
+        }
+
+        passed[passed_count++] = events[i];
+    }
+
+    return passed_count;
+}
+
+/**
+ * @brief  Run the action of a chord that fired
+ * @note   Called on every main loop pass, with the USB interrupt masked
+ *         when it translates reports
+ * @retval 1 if an action ran, 0 otherwise
+ */
+uint8_t chord_detector_service(void)
+{
+    uint8_t chord = pending_chord;
+
+    if (chord == CHORD_NONE) {
+        return 0;
+    }
+
+    if (chord_definitions[chord - 1U].action == CHORD_ACTION_SCAN_SET && ps2_queue_in_progress()) {
+        /* Switching flushes the queue: let the scan code on the wire finish first */
+        return 0;
+    }
+
+    pending_chord = CHORD_NONE;
+    chord_detector_run(&chord_definitions[chord - 1U]);
+    return 1;
+}
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+ * @brief  Check if every key of a chord is down
+ * @note   Always compares the whole bitmap so the time taken is fixed
+ * @param  chord: Chord definition
+ * @retval 1 if the chord is complete, 0 otherwise
+ */
+static uint8_t chord_detector_match(const ChordDefinition_t *chord)
+{
+    uint8_t missing = 0;
+
+    for (uint8_t i = 0; i < USB_HID_USAGE_BITMAP_SIZE; i++) {
+        missing |= (uint8_t)(chord->keys[i] & ~keys_down[i]);
+    }
+
+    return missing == 0;
+}
+
+/**
+ * @brief  Perform a chord's converter action
+ * @param  chord: Chord definition
+ * @retval None
+ */
+static void chord_detector_run(const ChordDefinition_t *chord)
+{
+    switch (chord->action) {
+        case CHORD_ACTION_SCAN_SET:
+            ps2_command_select_set(chord->argument);
+            break;
+
+        case CHORD_ACTION_LOCK_LAYER:
+            key_remap_toggle_layer(chord->argument);
+            break;
+
+        case CHORD_ACTION_RELEASE_ALL:
+            keyboard_handler_reset();
+            (void)scancode_translator_release_all();
+            break;
+
+        case CHORD_ACTION_DIAGNOSTICS:
+            chord_detector_type_diagnostics();
+            break;
+
+        case CHORD_ACTION_SAVE_CONFIG:
+            (void)config_store_save_settings();
+            break;
+
+        default:
+            break;
+    }
+}
+
+/**
+ * @brief  Type the converter status through the macro engine
+ * @note   Scan code set, remap layer and keyboard handler statistics, e.g.
+ *         "set 2 layer 0 reports 42 coalesced 0 rollover 0". Nothing is
+ *         typed while another macro is typing.
+ * @retval None
+ */
+static void chord_detector_type_diagnostics(void)
+{
+    KeyboardHandlerStats_t stats;
+    uint8_t *out = diagnostics_text;
+
+    if (macro_engine_busy()) {
+        return;
+    }
+
+    keyboard_handler_get_stats(&stats);
+
+    out = chord_detector_append_text(out, "set ");
+    out = chord_detector_append_number(out, ps2_get_scan_code_set());
+    out = chord_detector_append_text(out, " layer ");
+    out = chord_detector_append_number(out, key_remap_get_layer());
+    out = chord_detector_append_text(out, " reports ");
+    out = chord_detector_append_number(out, stats.reports);
+    out = chord_detector_append_text(out, " coalesced ");
+    out = chord_detector_append_number(out, stats.coalesced_reports);
+    out = chord_detector_append_text(out, " rollover ");
+    out = chord_detector_append_number(out, stats.rollover_events);
+    out = chord_detector_append_text(out, "\n");
+    *out = MACRO_END;
+
+    (void)macro_engine_start(diagnostics_text);
+}
+
+/**
+ * @brief  Append text to the status line
+ * @param  out: Next free byte
+ * @param  text: Text to append
+ * @retval Next free byte
+ */
+static uint8_t *chord_detector_append_text(uint8_t *out, const char *text)
+{
+    while (*text != '\0') {
+        *out++ = (uint8_t)*text++;
+    }
+
+    return out;
+}
+
+/**
+ * @brief  Append a decimal number to the status line
+ * @param  out: Next free byte
+ * @param  value: Number to append
+ * @retval Next free byte
+ */
+static uint8_t *chord_detector_append_number(uint8_t *out, uint32_t value)
+{
+    uint8_t digits[10];
+    uint8_t count = 0;
+
+    do {
+        digits[count++] = (uint8_t)('0' + value % 10U);
+        value /= 10U;
+    } while (value != 0);
+
+    while (count > 0) {
+        *out++ = digits[--count];
+    }
+
+    return out;
+}
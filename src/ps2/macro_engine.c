@@ -0,0 +1,225 @@
+/**
+ ******************************************************************************
+ * @file    macro_engine.c
+ * @brief   Text and key sequence injection for STM32F411
+ * @author  STM32F411 USB-PS2 Project
+ * @version 1.0.0
+ * @date    2024
+ *
+ * @description
+ * Types a stored macro: ASCII text, typed on a US layout, mixed with key
+ * taps (MACRO_CODE_KEY, modifier bits, usage). Macros live in flash and
+ * are expanded one character at a time as the PS/2 queue drains, never
+ * up front, so a long macro takes no RAM and no queue space.
+ *
+ * Each character goes out in the injection class with the modifiers it
+ * needs: Shift is pressed around it, and modifiers held on the keyboard
+ * are released around it and pressed again afterwards. The queue never
+ * lets a live modifier change or press overtake a queued modifier change,
+ * so live typing interleaves between characters without changing their
+ * case. At most MACRO_LOOKAHEAD_BYTES stay queued, which keeps the link
+ * busy while live keys wait behind at most one character.
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include "macro_engine.h"
+#include "scancode_translator.h"
+#include "ps2_queue.h"
+#include "ps2_command.h"
+
+/* Private typedef -----------------------------------------------------------*/
+
+/* Private define ------------------------------------------------------------*/
+#define MACRO_SHIFT                 0x80    ///< ASCII table: character needs Shift
+#define MACRO_USAGE_MASK            0x7F    ///< ASCII table: HID usage
+#define MACRO_MAX_SCANCODES         (2 * USB_HID_MODIFIER_COUNT + 2)  ///< Modifier changes around a key tap
+
+/* Private macro -------------------------------------------------------------*/
+
+/* Private variables ---------------------------------------------------------*/
+static const uint8_t *macro_position = NULL;   ///< Next character, NULL while idle
+
+/* ASCII to HID usage on a US layout; 0 if the character cannot be typed */
+static const uint8_t ascii_usage_table[128] = {
+    ['\b'] = USB_HID_KEY_BACKSPACE, ['\t'] = USB_HID_KEY_TAB,
+    ['\n'] = USB_HID_KEY_ENTER,     [0x1B] = USB_HID_KEY_ESCAPE,
+    [' '] = USB_HID_KEY_SPACE,
+
+    /* Letters */
+    ['a'] = USB_HID_KEY_A, ['b'] = USB_HID_KEY_B, ['c'] = USB_HID_KEY_C, ['d'] = USB_HID_KEY_D,
+    ['e'] = USB_HID_KEY_E, ['f'] = USB_HID_KEY_F, ['g'] = USB_HID_KEY_G, ['h'] = USB_HID_KEY_H,
+    ['i'] = USB_HID_KEY_I, ['j'] = USB_HID_KEY_J, ['k'] = USB_HID_KEY_K, ['l'] = USB_HID_KEY_L,
+    ['m'] = USB_HID_KEY_M, ['n'] = USB_HID_KEY_N, ['o'] = USB_HID_KEY_O, ['p'] = USB_HID_KEY_P,
+    ['q'] = USB_HID_KEY_Q, ['r'] = USB_HID_KEY_R, ['s'] = USB_HID_KEY_S, ['t'] = USB_HID_KEY_T,
+    ['u'] = USB_HID_KEY_U, ['v'] = USB_HID_KEY_V, ['w'] = USB_HID_KEY_W, ['x'] = USB_HID_KEY_X,
+    ['y'] = USB_HID_KEY_Y, ['z'] = USB_HID_KEY_Z,
+    ['A'] = MACRO_SHIFT | USB_HID_KEY_A, ['B'] = MACRO_SHIFT | USB_HID_KEY_B,
+    ['C'] = MACRO_SHIFT | USB_HID_KEY_C, ['D'] = MACRO_SHIFT | USB_HID_KEY_D,
+    ['E'] = MACRO_SHIFT | USB_HID_KEY_E, ['F'] = MACRO_SHIFT | USB_HID_KEY_F,
+    ['G'] = MACRO_SHIFT | USB_HID_KEY_G, ['H'] = MACRO_SHIFT | USB_HID_KEY_H,
+    ['I'] = MACRO_SHIFT | USB_HID_KEY_I, ['J'] = MACRO_SHIFT | USB_HID_KEY_J,
+    ['K'] = MACRO_SHIFT | USB_HID_KEY_K, ['L'] = MACRO_SHIFT | USB_HID_KEY_L,
+    ['M'] = MACRO_SHIFT | USB_HID_KEY_M, ['N'] = MACRO_SHIFT | USB_HID_KEY_N,
+    ['O'] = MACRO_SHIFT | USB_HID_KEY_O, ['P'] = MACRO_SHIFT | USB_HID_KEY_P,
+    ['Q'] = MACRO_SHIFT | USB_HID_KEY_Q, ['R'] = MACRO_SHIFT | USB_HID_KEY_R,
+    ['S'] = MACRO_SHIFT | USB_HID_KEY_S, ['T'] = MACRO_SHIFT | USB_HID_KEY_T,
+    ['U'] = MACRO_SHIFT | USB_HID_KEY_U, ['V'] = MACRO_SHIFT | USB_HID_KEY_V,
+    ['W'] = MACRO_SHIFT | USB_HID_KEY_W, ['X'] = MACRO_SHIFT | USB_HID_KEY_X,
+    ['Y'] = MACRO_SHIFT | USB_HID_KEY_Y, ['Z'] = MACRO_SHIFT | USB_HID_KEY_Z,
+
+    /* Digits and their shifted symbols */
+    ['1'] = USB_HID_KEY_1, ['2'] = USB_HID_KEY_2, ['3'] = USB_HID_KEY_3, ['4'] = USB_HID_KEY_4,
+    ['5'] = USB_HID_KEY_5, ['6'] = USB_HID_KEY_6, ['7'] = USB_HID_KEY_7, ['8'] = USB_HID_KEY_8,
+    ['9'] = USB_HID_KEY_9, ['0'] = USB_HID_KEY_0,
+    ['!'] = MACRO_SHIFT | USB_HID_KEY_1, ['@'] = MACRO_SHIFT | USB_HID_KEY_2,
+    ['#'] = MACRO_SHIFT | USB_HID_KEY_3, ['$'] = MACRO_SHIFT | USB_HID_KEY_4,
+    ['%'] = MACRO_SHIFT | USB_HID_KEY_5, ['^'] = MACRO_SHIFT | USB_HID_KEY_6,
+    ['&'] = MACRO_SHIFT | USB_HID_KEY_7, ['*'] = MACRO_SHIFT | USB_HID_KEY_8,
+    ['('] = MACRO_SHIFT | USB_HID_KEY_9, [')'] = MACRO_SHIFT | USB_HID_KEY_0,
+
+    /* Punctuation */
+    ['-'] = USB_HID_KEY_MINUS,         ['_'] = MACRO_SHIFT | USB_HID_KEY_MINUS,
+    ['='] = USB_HID_KEY_EQUAL,         ['+'] = MACRO_SHIFT | USB_HID_KEY_EQUAL,
+    ['['] = USB_HID_KEY_LEFT_BRACKET,  ['{'] = MACRO_SHIFT | USB_HID_KEY_LEFT_BRACKET,
+    [']'] = USB_HID_KEY_RIGHT_BRACKET, ['}'] = MACRO_SHIFT | USB_HID_KEY_RIGHT_BRACKET,
+    ['\\'] = USB_HID_KEY_BACKSLASH,    ['|'] = MACRO_SHIFT | USB_HID_KEY_BACKSLASH,
+    [';'] = USB_HID_KEY_SEMICOLON,     [':'] = MACRO_SHIFT | USB_HID_KEY_SEMICOLON,
+    ['\''] = USB_HID_KEY_APOSTROPHE,   ['"'] = MACRO_SHIFT | USB_HID_KEY_APOSTROPHE,
+    ['`'] = USB_HID_KEY_GRAVE,         ['~'] = MACRO_SHIFT | USB_HID_KEY_GRAVE,
+    [','] = USB_HID_KEY_COMMA,         ['<'] = MACRO_SHIFT | USB_HID_KEY_COMMA,
+    ['.'] = USB_HID_KEY_PERIOD,        ['>'] = MACRO_SHIFT | USB_HID_KEY_PERIOD,
+    ['/'] = USB_HID_KEY_SLASH,         ['?'] = MACRO_SHIFT | USB_HID_KEY_SLASH
+};
+
+/* Private function prototypes -----------------------------------------------*/
+static uint8_t macro_engine_modifiers(uint8_t change, uint8_t press, PS2_ScanCode_t *scancodes);
+
+/* Exported functions --------------------------------------------------------*/
+
+/**
+ * @brief  Initialize the macro engine
+ * @retval None
+ */
+void macro_engine_init(void)
+{
+    macro_position = NULL;
+}
+
+/**
+ * @brief  Start typing a macro
+ * @note   The macro must stay in memory until typed, normally a flash table
+ * @param  macro: Macro bytes ending with MACRO_END
+ * @retval MACRO_OK if started, MACRO_BUSY while another macro types, MACRO_ERROR otherwise
+ */
+MacroStatus_t macro_engine_start(const uint8_t *macro)
+{
+    if (macro == NULL) {
+        return MACRO_ERROR;
+    }
+
+    if (macro_position != NULL) {
+        return MACRO_BUSY;
+    }
+
+    macro_position = macro;
+    return MACRO_OK;
+}
+
+/**
+ * @brief  Stop typing the current macro
+ * @note   Characters already queued are still sent
+ * @retval None
+ */
+void macro_engine_cancel(void)
+{
+    macro_position = NULL;
+}
+
+/**
+ * @brief  Queue the next characters of the running macro
+ * @note   Called on every main loop pass. Queues characters while the PS/2
+ *         queue holds fewer than MACRO_LOOKAHEAD_BYTES and is not
+ *         congested; nothing while the host has scanning disabled.
+ * @retval Number of characters queued
+ */
+uint8_t macro_engine_service(void)
+{
+    PS2_ScanCode_t scancodes[MACRO_MAX_SCANCODES];
+    uint8_t queued = 0;
+
+    while (macro_position != NULL && ps2_queue_count() < MACRO_LOOKAHEAD_BYTES && !ps2_queue_congested() &&
+           ps2_command_scanning_enabled()) {
+        const uint8_t *next = macro_position;
+        uint8_t held = scancode_translator_get_modifiers();
+        uint8_t modifiers, usage;
+        uint8_t count = 0;
+
+        if (*next == MACRO_END) {
+            macro_position = NULL;
+            break;
+        }
+
+        if (*next == MACRO_CODE_KEY) {
+            modifiers = next[1];
+            usage = next[2];
+            next += 3;
+        } else {
+            uint8_t entry = (*next < sizeof(ascii_usage_table)) ? ascii_usage_table[*next] : 0;
+
+            modifiers = (entry & MACRO_SHIFT) ? USB_HID_MODIFIER_LEFT_SHIFT : 0;
+            usage = entry & MACRO_USAGE_MASK;
+            next++;
+        }
+
+        /* Take the modifiers from what the host holds to what the key needs and back */
+        count += macro_engine_modifiers((uint8_t)(held & ~modifiers), 0, &scancodes[count]);
+        count += macro_engine_modifiers((uint8_t)(modifiers & ~held), 1, &scancodes[count]);
+        count += scancode_translator_translate(usage, 1, modifiers, &scancodes[count]);
+        count += scancode_translator_translate(usage, 0, modifiers, &scancodes[count]);
+        count += macro_engine_modifiers((uint8_t)(modifiers & ~held), 0, &scancodes[count]);
+        count += macro_engine_modifiers((uint8_t)(held & ~modifiers), 1, &scancodes[count]);
+
+        if (count > 0 && ps2_queue_push_scancodes(scancodes, count, PS2_QUEUE_CLASS_INJECT) != PS2_QUEUE_OK) {
+            /* No room - retry this character on the next pass */
+            break;
+        }
+
+        macro_position = next;
+        queued++;
+    }
+
+    return queued;
+}
+
+/**
+ * @brief  Check if a macro is typing
+ * @retval 1 while characters remain to be queued, 0 otherwise
+ */
+uint8_t macro_engine_busy(void)
+{
+    return macro_position != NULL;
+}
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+ * @brief  Translate presses or releases of modifier keys
+ * @param  change: HID modifier bits to press or release
+ * @param  press: Non-zero to press, zero to release
+ * @param  scancodes: Array of at least USB_HID_MODIFIER_COUNT scan codes
+ * @retval Number of scan codes stored
+ */
+static uint8_t macro_engine_modifiers(uint8_t change, uint8_t press, PS2_ScanCode_t *scancodes)
+{
+    uint8_t count = 0;
+
+    for (uint8_t bit = 0; bit < USB_HID_MODIFIER_COUNT; bit++) {
+        if (change & (1U << bit)) {
+            count += scancode_translator_translate((uint8_t)(USB_HID_MODIFIER_USAGE + bit), press, 0,
+                                                   &scancodes[count]);
+        }
+    }
+
+    return count;
+}
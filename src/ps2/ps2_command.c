@@ -0,0 +1,312 @@
+/**
+ ******************************************************************************
+ * @file    ps2_command.c
+ * @brief   PS/2 host-to-keyboard command handling for STM32F411
+ * @author  STM32F411 USB-PS2 Project
+ * @version 1.0.0
+ * @date    2024
+ *
+ * @description
+ * Interprets bytes received from the PS/2 host and queues the keyboard
+ * responses ahead of any pending scan codes.
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include "ps2_command.h"
+#include "ps2_init.h"
+#include "ps2_protocol.h"
+#include "ps2_queue.h"
+#include "ps2_shadow.h"
+
+/* Private typedef -----------------------------------------------------------*/
+
+/* Private define ------------------------------------------------------------*/
+#define PS2_KEYBOARD_ID_1           0xAB   ///< First keyboard ID byte
+#define PS2_KEYBOARD_ID_2           0x83   ///< Second keyboard ID byte (MF2)
+#define PS2_NO_PENDING_COMMAND      0x00   ///< No command waiting for its argument
+#define PS2_TYPEMATIC_DEFAULT       0x2B   ///< 500 ms delay, 10.9 characters per second
+#define PS2_TYPEMATIC_MASK          0x7F   ///< Delay in bits 5-6, rate in bits 0-4
+
+/* Private macro -------------------------------------------------------------*/
+
+/* Private variables ---------------------------------------------------------*/
+static uint8_t pending_command = PS2_NO_PENDING_COMMAND;
+static uint8_t led_state = 0;
+static uint8_t scanning_enabled = 1;
+static uint8_t typematic = PS2_TYPEMATIC_DEFAULT;
+static uint8_t default_scan_code_set = PS2_DEFAULT_SCAN_CODE_SET;
+
+/* Private function prototypes -----------------------------------------------*/
+static PS2_CommandStatus_t ps2_command_respond(const uint8_t *data, uint8_t length);
+static PS2_CommandStatus_t ps2_command_process_argument(uint8_t command, uint8_t argument);
+static void ps2_command_set_defaults(void);
+
+/* Exported functions --------------------------------------------------------*/
+
+/**
+ * @brief  Initialize PS/2 command handler
+ * @retval PS2_COMMAND_OK
+ */
+PS2_CommandStatus_t ps2_command_init(void)
+{
+    pending_command = PS2_NO_PENDING_COMMAND;
+    led_state = 0;
+    default_scan_code_set = PS2_DEFAULT_SCAN_CODE_SET;
+    ps2_command_set_defaults();
+    return PS2_COMMAND_OK;
+}
+
+/**
+ * @brief  Process a byte received from the PS/2 host
+ * @note   A byte that arrives while a command waits for its argument is
+ *         taken as the argument unless it is itself a command
+ * @param  byte: Received byte
+ * @retval PS2_COMMAND_OK if handled, PS2_COMMAND_ERROR if the response could not be queued
+ */
+PS2_CommandStatus_t ps2_command_process(uint8_t byte)
+{
+    static const uint8_t ack[] = { PS2_SCANCODE_ACK };
+    uint8_t response[3];
+
+    if (pending_command != PS2_NO_PENDING_COMMAND && byte < PS2_CMD_SET_LEDS) {
+        return ps2_command_process_argument(pending_command, byte);
+    }
+
+    pending_command = PS2_NO_PENDING_COMMAND;
+
+    switch (byte) {
+        case PS2_CMD_RESEND:
+            /* Repeat the last byte sent, no acknowledge */
+            response[0] = ps2_get_last_byte();
+            return ps2_command_respond(response, 1);
+
+        case PS2_CMD_ECHO:
+            response[0] = PS2_SCANCODE_ECHO;
+            return ps2_command_respond(response, 1);
+
+        case PS2_CMD_RESET:
+            /* Host forgets all held keys on reset */
+            ps2_queue_flush();
+            ps2_shadow_clear();
+            led_state = 0;
+            ps2_command_set_defaults();
+            response[0] = PS2_SCANCODE_ACK;
+            response[1] = PS2_SCANCODE_BAT_SUCCESS;
+            return ps2_command_respond(response, 2);
+
+        case PS2_CMD_IDENTIFY:
+            response[0] = PS2_SCANCODE_ACK;
+            response[1] = PS2_KEYBOARD_ID_1;
+            response[2] = PS2_KEYBOARD_ID_2;
+            return ps2_command_respond(response, 3);
+
+        case PS2_CMD_ENABLE:
+            ps2_queue_flush();
+            scanning_enabled = 1;
+            return ps2_command_respond(ack, 1);
+
+        case PS2_CMD_DISABLE:
+            ps2_command_set_defaults();
+            scanning_enabled = 0;
+            return ps2_command_respond(ack, 1);
+
+        case PS2_CMD_SET_DEFAULT:
+            ps2_command_set_defaults();
+            return ps2_command_respond(ack, 1);
+
+        case PS2_CMD_SET_LEDS:
+        case PS2_CMD_SCAN_CODE_SET:
+        case PS2_CMD_SET_TYPEMATIC:
+        case PS2_CMD_SET_KEY_TYPEMATIC:
+        case PS2_CMD_SET_KEY_MAKE_BREAK:
+        case PS2_CMD_SET_KEY_MAKE:
+            pending_command = byte;
+            return ps2_command_respond(ack, 1);
+
+        case PS2_CMD_SET_ALL_TYPEMATIC:
+            ps2_set3_set_all_attributes(PS2_SET3_ATTR_TYPEMATIC);
+            return ps2_command_respond(ack, 1);
+
+        case PS2_CMD_SET_ALL_MAKE_BREAK:
+            ps2_set3_set_all_attributes(PS2_SET3_ATTR_BREAK);
+            return ps2_command_respond(ack, 1);
+
+        case PS2_CMD_SET_ALL_MAKE:
+            ps2_set3_set_all_attributes(0);
+            return ps2_command_respond(ack, 1);
+
+        case PS2_CMD_SET_ALL_TMB:
+            ps2_set3_set_all_attributes(PS2_SET3_ATTR_BREAK | PS2_SET3_ATTR_TYPEMATIC);
+            return ps2_command_respond(ack, 1);
+
+        default:
+            /* Unknown command */
+            response[0] = PS2_SCANCODE_RESEND;
+            return ps2_command_respond(response, 1);
+    }
+}
+
+/**
+ * @brief  Handle a host byte received with a parity or framing error
+ * @retval PS2_COMMAND_OK if the resend request was queued
+ */
+PS2_CommandStatus_t ps2_command_receive_error(void)
+{
+    static const uint8_t resend[] = { PS2_SCANCODE_RESEND };
+
+    return ps2_command_respond(resend, 1);
+}
+
+/**
+ * @brief  Get keyboard LED state set by the host
+ * @retval PS2_LED_* bitmask
+ */
+uint8_t ps2_command_get_leds(void)
+{
+    return led_state;
+}
+
+/**
+ * @brief  Check if the host has scanning enabled
+ * @retval 1 if scan codes may be sent, 0 after a Disable command
+ */
+uint8_t ps2_command_scanning_enabled(void)
+{
+    return scanning_enabled;
+}
+
+/**
+ * @brief  Get the typematic delay and repeat period set by the host
+ * @note   Decodes the Set Typematic argument: delay (bits 5-6 + 1) * 250 ms,
+ *         period (8 + bits 0-2) * 2^(bits 3-4) * 4.17 ms
+ * @param  delay_ms: Pointer to store the delay before the first repeat
+ * @param  period_ms: Pointer to store the time between repeats
+ * @retval None
+ */
+void ps2_command_get_typematic(uint16_t *delay_ms, uint16_t *period_ms)
+{
+    uint8_t setting = typematic;
+
+    *delay_ms = (uint16_t)((((setting >> 5) & 0x03U) + 1U) * 250U);
+    *period_ms = (uint16_t)((((8U + (setting & 0x07U)) << ((setting >> 3) & 0x03U)) * 417U) / 100U);
+}
+
+/**
+ * @brief  Switch the scan code set
+ * @note   Queued scan codes and the shadow belong to the old set and are
+ *         dropped; reconciliation then presses the keys still down in the
+ *         new set. Used by the host command 0xF0 and converter hotkeys;
+ *         a hotkey waits for ps2_queue_in_progress() to clear so no scan
+ *         code is cut off.
+ * @param  set: PS2_SCAN_CODE_SET_1, PS2_SCAN_CODE_SET_2 or PS2_SCAN_CODE_SET_3
+ * @retval None
+ */
+void ps2_command_select_set(uint8_t set)
+{
+    if (set == ps2_get_scan_code_set()) {
+        return;
+    }
+
+    ps2_queue_flush();
+    ps2_shadow_clear();
+    (void)ps2_set_scan_code_set(set);
+}
+
+/**
+ * @brief  Change the scan code set restored by a reset, and switch to it
+ * @note   Used for the stored setting; PS2_DEFAULT_SCAN_CODE_SET until then
+ * @param  set: PS2_SCAN_CODE_SET_1, PS2_SCAN_CODE_SET_2 or PS2_SCAN_CODE_SET_3,
+ *         anything else is ignored
+ * @retval None
+ */
+void ps2_command_set_default_set(uint8_t set)
+{
+    if (set != PS2_SCAN_CODE_SET_1 && set != PS2_SCAN_CODE_SET_2 && set != PS2_SCAN_CODE_SET_3) {
+        return;
+    }
+
+    default_scan_code_set = set;
+    ps2_command_select_set(set);
+}
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+ * @brief  Queue a response ahead of pending scan codes
+ * @param  data: Response bytes
+ * @param  length: Number of bytes
+ * @retval PS2_COMMAND_OK if queued, PS2_COMMAND_ERROR otherwise
+ */
+static PS2_CommandStatus_t ps2_command_respond(const uint8_t *data, uint8_t length)
+{
+    if (ps2_queue_push_response(data, length) != PS2_QUEUE_OK) {
+        return PS2_COMMAND_ERROR;
+    }
+
+    return PS2_COMMAND_OK;
+}
+
+/**
+ * @brief  Handle the argument byte of a command
+ * @param  command: Command waiting for its argument
+ * @param  argument: Received argument
+ * @retval PS2_COMMAND_OK if handled, PS2_COMMAND_ERROR otherwise
+ */
+static PS2_CommandStatus_t ps2_command_process_argument(uint8_t command, uint8_t argument)
+{
+    uint8_t response[2] = { PS2_SCANCODE_ACK, 0 };
+
+    switch (command) {
+        case PS2_CMD_SET_LEDS:
+            led_state = argument & (PS2_LED_SCROLL_LOCK | PS2_LED_NUM_LOCK | PS2_LED_CAPS_LOCK);
+            break;
+
+        case PS2_CMD_SCAN_CODE_SET:
+            if (argument == 0) {
+                response[1] = ps2_get_scan_code_set();
+                pending_command = PS2_NO_PENDING_COMMAND;
+                return ps2_command_respond(response, 2);
+            }
+            if (argument == PS2_SCAN_CODE_SET_1 || argument == PS2_SCAN_CODE_SET_2 ||
+                argument == PS2_SCAN_CODE_SET_3) {
+                ps2_command_select_set(argument);
+            }
+            break;
+
+        case PS2_CMD_SET_TYPEMATIC:
+            typematic = argument & PS2_TYPEMATIC_MASK;
+            break;
+
+        case PS2_CMD_SET_KEY_TYPEMATIC:
+            /* Key lists continue until the next command */
+            ps2_set3_set_key_attributes(argument, PS2_SET3_ATTR_TYPEMATIC);
+            return ps2_command_respond(response, 1);
+
+        case PS2_CMD_SET_KEY_MAKE_BREAK:
+            ps2_set3_set_key_attributes(argument, PS2_SET3_ATTR_BREAK);
+            return ps2_command_respond(response, 1);
+
+        case PS2_CMD_SET_KEY_MAKE:
+            ps2_set3_set_key_attributes(argument, 0);
+            return ps2_command_respond(response, 1);
+
+        default:
+            break;
+    }
+
+    pending_command = PS2_NO_PENDING_COMMAND;
+    return ps2_command_respond(response, 1);
+}
+
+/**
+ * @brief  Restore keyboard defaults
+ * @retval None
+ */
+static void ps2_command_set_defaults(void)
+{
+    ps2_command_select_set(default_scan_code_set);
+    ps2_set3_default_attributes();
+    typematic = PS2_TYPEMATIC_DEFAULT;
+    scanning_enabled = 1;
+}
@@ -10,15 +10,38 @@
 
 /* Includes ------------------------------------------------------------------*/
 #include "ps2_init.h"
+#include "ps2_queue.h"
+#include "ps2_command.h"
+#include "ps2_shadow.h"
 #include "main.h"
+#include <string.h>
+#ifdef PS2_HOST_SIM
+#include "ps2_line_sim.h"
+#endif
 
 /* Private typedef -----------------------------------------------------------*/
+/**
+ * @brief Transfer outcomes fed to the link auto-tuner
+ */
+typedef enum {
+    PS2_TUNE_BYTE_OK = 0,       ///< Byte clocked out completely
+    PS2_TUNE_ABORT,             ///< Frame aborted by a host inhibit
+    PS2_TUNE_LINK_ERROR         ///< Host asked for a resend or sent a corrupted byte
+} PS2_TuneEvent_t;
 
 /* Private define ------------------------------------------------------------*/
-#define PS2_CLOCK_FREQ_HZ       12000   ///< PS/2 clock frequency (10-16.7 kHz range)
-#define PS2_BIT_PERIOD_US       83      ///< Bit period in microseconds (1/12kHz)
 #define PS2_START_BIT           0       ///< PS/2 start bit value
 #define PS2_STOP_BIT            1       ///< PS/2 stop bit value
+#define PS2_FRAME_BITS          11      ///< Start, 8 data, parity, stop
+#define PS2_RX_FRAME_BITS       10      ///< 8 data, parity, stop (start is the request)
+#define PS2_LINE_SAMPLE_US      5       ///< Delay before reading back a released clock
+#define PS2_BUS_IDLE_US         50      ///< Clock high time required before transmitting
+#define PS2_LINE_POLL_US        5       ///< Line polling interval while waiting for idle
+#define PS2_IDLE_WAIT_MAX_US    2000    ///< Max wait for an idle bus per ps2_process() call
+#define PS2_TUNE_WINDOW_BYTES   64      ///< Bytes per auto-tune evaluation window
+#define PS2_TUNE_STEP_HZ        500     ///< Auto-tune clock increase per clean window
+#define PS2_TUNE_BACKOFF_HZ     1000    ///< Auto-tune clock decrease per link error
+#define PS2_TUNE_GAP_STEP_US    50      ///< Auto-tune gap change once the clock is at a limit
 
 /* Private macro -------------------------------------------------------------*/
 
@@ -26,11 +49,35 @@
 static PS2_Status_t ps2_status = PS2_INIT;
 static TIM_HandleTypeDef htim_ps2;
 static volatile uint8_t ps2_timer_active = 0;
+static PS2_Stats_t ps2_stats;
+static uint8_t last_sent_byte = 0;
+static uint8_t inhibit_active = 0;
+static uint16_t bus_idle_required_us = PS2_BUS_IDLE_US;
+static uint8_t retransmit_pending = 0;
+static volatile uint8_t process_active = 0;
+static PS2_LinkConfig_t link_config;
+static uint16_t tune_base_gap_us = 0;
+static uint16_t tune_window_bytes = 0;
+static uint16_t tune_window_aborts = 0;
+static uint16_t tune_last_aborts = 0;
+static uint8_t tune_stepped_up = 0;
+
+/* Bit timing derived from link_config.clock_freq_hz */
+static uint16_t clock_low_us;
+static uint16_t data_setup_us;
+static uint16_t data_hold_us;
 
 /* Private function prototypes -----------------------------------------------*/
 static void PS2_GPIO_Config(void);
 static void PS2_Timer_Config(void);
 static void PS2_Reset_Lines(void);
+static void ps2_process_slice(void);
+static PS2_Status_t ps2_wait_bus_idle(void);
+static void ps2_handle_host_request(void);
+static void ps2_note_inhibit(void);
+static uint8_t ps2_odd_parity(uint8_t data);
+static void ps2_apply_clock_rate(uint16_t clock_freq_hz);
+static void ps2_tune_link(PS2_TuneEvent_t event);
 
 /* Exported functions --------------------------------------------------------*/
 
@@ -52,6 +99,23 @@ PS2_Status_t ps2_init(void)
     /* Reset PS/2 lines to idle state */
     PS2_Reset_Lines();
     
+    /* Reset transmit queue, host command state and statistics */
+    ps2_queue_init();
+    ps2_command_init();
+    ps2_shadow_init();
+    ps2_clear_stats();
+    last_sent_byte = 0;
+    inhibit_active = 0;
+    bus_idle_required_us = PS2_BUS_IDLE_US;
+    retransmit_pending = 0;
+    
+    /* Default link timing */
+    link_config.clock_freq_hz = PS2_CLOCK_FREQ_DEFAULT_HZ;
+    link_config.byte_gap_us = 0;
+    link_config.scancode_gap_us = 0;
+    link_config.auto_tune = 0;
+    ps2_set_link_config(&link_config);
+    
     /* Small delay to ensure lines are stable */
     HAL_Delay(10);
     
@@ -110,7 +174,10 @@ static void PS2_Reset_Lines(void)
 
 /**
  * @brief  Send PS/2 scan code
- * @note   Transmits a scan code using PS/2 protocol timing
+ * @note   Queues the scan code and runs one ps2_process() slice, so it
+ *         blocks for at most about PS2_PROCESS_SLICE_US. The rest of the
+ *         queue and bytes interrupted by a host inhibit are sent by later
+ *         ps2_process() calls.
  * @param  scancode: Pointer to PS/2 scan code structure
  * @retval PS2_OK if successful, PS2_ERROR otherwise
  */
@@ -120,74 +187,206 @@ PS2_Status_t ps2_send_scancode(const PS2_ScanCode_t *scancode)
         return PS2_ERROR;
     }
     
-    ps2_status = PS2_TRANSMITTING;
+    /* Nothing to send, or host has disabled scanning */
+    if (scancode->length == 0 || !ps2_command_scanning_enabled()) {
+        return PS2_OK;
+    }
     
-    /* Send each byte in the scan code */
-    for (uint8_t i = 0; i < scancode->length; i++) {
-        if (ps2_send_byte(scancode->data[i]) != PS2_OK) {
-            ps2_status = PS2_ERROR;
-            return PS2_ERROR;
-        }
+    if (ps2_queue_push(scancode->data, scancode->length) != PS2_QUEUE_OK) {
+        return PS2_ERROR;
     }
     
-    ps2_status = PS2_READY;
+    ps2_process();
     return PS2_OK;
 }
 
+/**
+ * @brief  Process the PS/2 link
+ * @note   Handles host requests-to-send and drains the transmit queue while
+ *         the bus is idle. Returns after PS2_PROCESS_SLICE_US of transmitting
+ *         so the main loop keeps moving USB reports into the queue during a
+ *         long burst. Should be called regularly from main loop; a call that
+ *         interrupts a running one (see ps2_kick()) returns at once.
+ * @retval None
+ */
+void ps2_process(void)
+{
+    if (ps2_status != PS2_READY || process_active) {
+        return;
+    }
+    
+    process_active = 1;
+    ps2_process_slice();
+    process_active = 0;
+}
+
+/**
+ * @brief  Start transmitting without waiting for the main loop
+ * @note   Pends PendSV, the lowest-priority exception, whose handler runs
+ *         ps2_process() as soon as the calling interrupt returns. The
+ *         caller never waits on the PS/2 lines, so the USB completion
+ *         interrupt stays short. The host simulation has no exceptions and
+ *         processes the link directly.
+ * @retval None
+ */
+void ps2_kick(void)
+{
+#ifdef PS2_HOST_SIM
+    ps2_process();
+#else
+    SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
+#endif
+}
+
 /**
  * @brief  Send a single byte via PS/2 protocol
- * @note   Transmits one byte with proper PS/2 framing (start, data, parity, stop)
+ * @note   Transmits one byte with proper PS/2 framing (start, data, parity, stop).
+ *         The lines are sampled before the start bit and the clock is read
+ *         back during every clock-high phase; if the host pulls the clock
+ *         low before the 11th clock the frame is aborted and both lines
+ *         are released.
  * @param  data: Byte to transmit
- * @retval PS2_OK if successful, PS2_ERROR otherwise
+ * @retval PS2_OK if the frame was clocked out, PS2_INHIBITED if the host
+ *         inhibited the bus, PS2_HOST_REQUEST if the host wants to send
  */
 PS2_Status_t ps2_send_byte(uint8_t data)
 {
-    uint8_t parity = 1;  /* Odd parity calculation */
+    uint16_t frame;
+    uint8_t clock_state, data_state;
     uint8_t bit_count;
     
-    /* Calculate odd parity */
-    for (bit_count = 0; bit_count < 8; bit_count++) {
-        if (data & (1 << bit_count)) {
-            parity ^= 1;
-        }
+    /* Sample the lines: host may be inhibiting or requesting to send */
+    ps2_read_lines(&clock_state, &data_state);
+    if (!clock_state) {
+        ps2_note_inhibit();
+        return PS2_INHIBITED;
     }
-    
-    /* Start bit (0) */
-    ps2_send_bit(0);
-    
-    /* Data bits (LSB first) */
-    for (bit_count = 0; bit_count < 8; bit_count++) {
-        ps2_send_bit((data >> bit_count) & 1);
+    if (!data_state) {
+        return PS2_HOST_REQUEST;
     }
     
-    /* Parity bit */
-    ps2_send_bit(parity);
+    /* Start bit (0), data bits (LSB first), odd parity, stop bit (1) */
+    frame = (uint16_t)(PS2_START_BIT | ((uint16_t)data << 1) |
+                       ((uint16_t)ps2_odd_parity(data) << 9) | (PS2_STOP_BIT << 10));
     
-    /* Stop bit (1) */
-    ps2_send_bit(1);
+    for (bit_count = 0; bit_count < PS2_FRAME_BITS; bit_count++) {
+        if (ps2_send_bit((frame >> bit_count) & 1U) != PS2_OK) {
+            /* Host inhibit before the 11th clock: abort and release the bus */
+            PS2_Reset_Lines();
+            ps2_note_inhibit();
+            if (bit_count > 0) {
+                ps2_stats.aborts++;
+            }
+            return PS2_INHIBITED;
+        }
+    }
     
     return PS2_OK;
 }
 
 /**
  * @brief  Send a single bit via PS/2 protocol
- * @note   Transmits one bit with proper PS/2 timing
+ * @note   Transmits one bit with proper PS/2 timing. The clock is checked
+ *         before the falling edge and read back after the rising edge, so
+ *         a host inhibit is seen within one clock-low phase.
  * @param  bit_value: Bit value to transmit (0 or 1)
- * @retval None
+ * @retval PS2_OK if the bit was clocked out, PS2_INHIBITED if the host held
+ *         the clock low and the bit was not clocked
  */
-void ps2_send_bit(uint8_t bit_value)
+PS2_Status_t ps2_send_bit(uint8_t bit_value)
 {
-    /* Set data line to bit value */
+    uint8_t clock_state;
+    
+    /* Host may have pulled the clock low during the previous high phase */
+    ps2_read_lines(&clock_state, NULL);
+    if (!clock_state) {
+        return PS2_INHIBITED;
+    }
+    
+    /* Set data line to bit value in the middle of the clock high phase */
     HAL_GPIO_WritePin(PS2_DATA_GPIO_Port, PS2_DATA_Pin, 
                      bit_value ? GPIO_PIN_SET : GPIO_PIN_RESET);
+    ps2_delay_us(data_setup_us);
     
-    /* Clock low for half bit period */
+    ps2_read_lines(&clock_state, NULL);
+    if (!clock_state) {
+        return PS2_INHIBITED;
+    }
+    
+    /* Clock low for half bit period - host samples data on the falling edge */
     HAL_GPIO_WritePin(PS2_CLK_GPIO_Port, PS2_CLK_Pin, GPIO_PIN_RESET);
-    ps2_delay_us(PS2_BIT_PERIOD_US / 2);
+    ps2_delay_us(clock_low_us);
     
-    /* Clock high for half bit period */
+    /* Clock high, read it back, hold data until the next bit */
     HAL_GPIO_WritePin(PS2_CLK_GPIO_Port, PS2_CLK_Pin, GPIO_PIN_SET);
-    ps2_delay_us(PS2_BIT_PERIOD_US / 2);
+    ps2_delay_us(PS2_LINE_SAMPLE_US);
+    
+    ps2_read_lines(&clock_state, NULL);
+    if (clock_state) {
+        ps2_delay_us(data_hold_us - PS2_LINE_SAMPLE_US);
+    }
+    
+    return PS2_OK;
+}
+
+/**
+ * @brief  Receive a byte from the PS/2 host
+ * @note   Called after a request-to-send (data low, clock high). The device
+ *         generates the clock, samples data while the clock is high and
+ *         acknowledges a valid stop bit by holding data low for the 11th clock.
+ * @param  data: Pointer to store the received byte
+ * @retval PS2_OK if received, PS2_ERROR on parity/stop bit error,
+ *         PS2_INHIBITED if the host aborted the transfer
+ */
+PS2_Status_t ps2_receive_byte(uint8_t *data)
+{
+    uint16_t frame = 0;
+    uint8_t clock_state, data_state;
+    uint8_t bit_count;
+    
+    if (data == NULL) {
+        return PS2_ERROR;
+    }
+    
+    /* Data bits, parity and stop bit - host changes data while clock is low */
+    for (bit_count = 0; bit_count < PS2_RX_FRAME_BITS; bit_count++) {
+        ps2_delay_us(data_setup_us);
+        
+        ps2_read_lines(&clock_state, NULL);
+        if (!clock_state) {
+            PS2_Reset_Lines();
+            return PS2_INHIBITED;
+        }
+        
+        HAL_GPIO_WritePin(PS2_CLK_GPIO_Port, PS2_CLK_Pin, GPIO_PIN_RESET);
+        ps2_delay_us(clock_low_us);
+        HAL_GPIO_WritePin(PS2_CLK_GPIO_Port, PS2_CLK_Pin, GPIO_PIN_SET);
+        ps2_delay_us(data_hold_us);
+        
+        ps2_read_lines(NULL, &data_state);
+        frame |= (uint16_t)(data_state ? 1U : 0U) << bit_count;
+    }
+    
+    if ((frame & (1U << 9)) == 0) {
+        /* Stop bit missing - no acknowledge */
+        return PS2_ERROR;
+    }
+    
+    /* Acknowledge: data low during the 11th clock pulse */
+    HAL_GPIO_WritePin(PS2_DATA_GPIO_Port, PS2_DATA_Pin, GPIO_PIN_RESET);
+    ps2_delay_us(data_setup_us);
+    HAL_GPIO_WritePin(PS2_CLK_GPIO_Port, PS2_CLK_Pin, GPIO_PIN_RESET);
+    ps2_delay_us(clock_low_us);
+    HAL_GPIO_WritePin(PS2_CLK_GPIO_Port, PS2_CLK_Pin, GPIO_PIN_SET);
+    ps2_delay_us(data_hold_us);
+    HAL_GPIO_WritePin(PS2_DATA_GPIO_Port, PS2_DATA_Pin, GPIO_PIN_SET);
+    
+    *data = (uint8_t)(frame & 0xFFU);
+    if (((frame >> 8) & 1U) != ps2_odd_parity(*data)) {
+        return PS2_ERROR;
+    }
+    
+    return PS2_OK;
 }
 
 /**
@@ -198,6 +397,10 @@ void ps2_send_bit(uint8_t bit_value)
  */
 void ps2_delay_us(uint32_t microseconds)
 {
+#ifdef PS2_HOST_SIM
+    /* Host simulation: advance virtual time on the simulated lines */
+    ps2_sim_delay_us(microseconds);
+#else
     /* Simple delay loop - not cycle-perfect but adequate for PS/2 timing */
     /* At 84 MHz, approximately 84 cycles per microsecond */
     volatile uint32_t cycles = microseconds * 21; /* Approximate cycles for delay */
@@ -205,6 +408,22 @@ void ps2_delay_us(uint32_t microseconds)
     while (cycles--) {
         __NOP();
     }
+#endif
+}
+
+/**
+ * @brief  Get a free-running microsecond timestamp
+ * @note   Millisecond resolution on target (SysTick based); used for
+ *         queueing statistics and bandwidth budgets, not bit timing
+ * @retval Time in microseconds, wraps around
+ */
+uint32_t ps2_get_time_us(void)
+{
+#ifdef PS2_HOST_SIM
+    return ps2_sim_get_time_us();
+#else
+    return HAL_GetTick() * 1000U;
+#endif
 }
 
 /**
@@ -216,6 +435,76 @@ PS2_Status_t ps2_get_status(void)
     return ps2_status;
 }
 
+/**
+ * @brief  Get the last byte transmitted completely
+ * @note   Used to answer the host Resend command
+ * @retval Last byte sent
+ */
+uint8_t ps2_get_last_byte(void)
+{
+    return last_sent_byte;
+}
+
+/**
+ * @brief  Get PS/2 link statistics
+ * @param  stats: Pointer to store statistics
+ * @retval None
+ */
+void ps2_get_stats(PS2_Stats_t *stats)
+{
+    if (stats != NULL) {
+        *stats = ps2_stats;
+    }
+}
+
+/**
+ * @brief  Clear PS/2 link statistics
+ * @retval None
+ */
+void ps2_clear_stats(void)
+{
+    memset(&ps2_stats, 0, sizeof(PS2_Stats_t));
+}
+
+/**
+ * @brief  Set PS/2 link timing
+ * @note   The clock rate is clamped to the 10-16.7 kHz spec range. With
+ *         auto_tune set the configured rate is the starting point and the
+ *         configured gap is the lower bound for the tuner. The scan code
+ *         gap is never tuned, so it is a guaranteed minimum.
+ * @param  config: Link configuration
+ * @retval PS2_OK if applied, PS2_ERROR on invalid parameters
+ */
+PS2_Status_t ps2_set_link_config(const PS2_LinkConfig_t *config)
+{
+    if (config == NULL || config->byte_gap_us > PS2_BYTE_GAP_MAX_US ||
+        config->scancode_gap_us > PS2_SCANCODE_GAP_MAX_US) {
+        return PS2_ERROR;
+    }
+    
+    link_config = *config;
+    tune_base_gap_us = config->byte_gap_us;
+    tune_window_bytes = 0;
+    tune_window_aborts = 0;
+    tune_last_aborts = 0;
+    tune_stepped_up = 0;
+    ps2_apply_clock_rate(config->clock_freq_hz);
+    return PS2_OK;
+}
+
+/**
+ * @brief  Get current PS/2 link timing
+ * @note   Reports the rate and gap currently in use, including auto-tune changes
+ * @param  config: Pointer to store link configuration
+ * @retval None
+ */
+void ps2_get_link_config(PS2_LinkConfig_t *config)
+{
+    if (config != NULL) {
+        *config = link_config;
+    }
+}
+
 /**
  * @brief  PS/2 tick function for timing
  * @note   Called from system tick to update PS/2 timing
@@ -272,4 +561,263 @@ void ps2_set_lines(uint8_t clock_state, uint8_t data_state)
                      clock_state ? GPIO_PIN_SET : GPIO_PIN_RESET);
     HAL_GPIO_WritePin(PS2_DATA_GPIO_Port, PS2_DATA_Pin,
                      data_state ? GPIO_PIN_SET : GPIO_PIN_RESET);
-}
\ No newline at end of file
+}
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+ * @brief  Run one ps2_process() time slice
+ * @note   Sends queued bytes for up to PS2_PROCESS_SLICE_US and answers
+ *         host requests-to-send in between
+ * @retval None
+ */
+static void ps2_process_slice(void)
+{
+    PS2_Status_t result;
+    uint8_t clock_state, data_state;
+    uint8_t data;
+    uint32_t aborts;
+    uint32_t start_us = ps2_get_time_us();
+    
+    while ((ps2_get_time_us() - start_us) < PS2_PROCESS_SLICE_US) {
+        ps2_read_lines(&clock_state, &data_state);
+        
+        if (clock_state && !data_state) {
+            ps2_handle_host_request();
+            continue;
+        }
+        
+        if (ps2_queue_peek(&data) != PS2_QUEUE_OK) {
+            if (clock_state) {
+                inhibit_active = 0;
+            } else {
+                ps2_note_inhibit();
+                bus_idle_required_us = PS2_BUS_IDLE_US;
+            }
+            return;
+        }
+        
+        result = ps2_wait_bus_idle();
+        if (result == PS2_HOST_REQUEST) {
+            continue;
+        }
+        if (result != PS2_OK) {
+            /* Still inhibited - retry on the next call */
+            return;
+        }
+        
+        aborts = ps2_stats.aborts;
+        ps2_status = PS2_TRANSMITTING;
+        result = ps2_send_byte(data);
+        ps2_status = PS2_READY;
+        
+        if (result == PS2_OK) {
+            if (ps2_queue_peek_tag() == PS2_QUEUE_TAG_SCANCODE) {
+                ps2_shadow_byte_sent(data);
+            }
+            /* Wider gap after the last byte of a scan code, if configured */
+            bus_idle_required_us = link_config.byte_gap_us;
+            if (ps2_queue_pop() && link_config.scancode_gap_us > bus_idle_required_us) {
+                bus_idle_required_us = link_config.scancode_gap_us;
+            }
+            last_sent_byte = data;
+            ps2_stats.bytes_sent++;
+            if (retransmit_pending) {
+                ps2_stats.retransmits++;
+                retransmit_pending = 0;
+            }
+            ps2_tune_link(PS2_TUNE_BYTE_OK);
+        } else {
+            /* Byte stays at the queue head until the bus is idle again */
+            if (ps2_stats.aborts != aborts) {
+                retransmit_pending = 1;
+                ps2_tune_link(PS2_TUNE_ABORT);
+            }
+            bus_idle_required_us = PS2_BUS_IDLE_US;
+        }
+    }
+}
+
+/**
+ * @brief  Wait for the bus to become idle before transmitting
+ * @note   After an inhibit or a host transfer the clock must be high for
+ *         PS2_BUS_IDLE_US before the device may start a frame. The wait
+ *         limit is extended by the required idle time so a long scan code
+ *         gap is never cut short.
+ * @retval PS2_OK if idle, PS2_HOST_REQUEST if the host wants to send,
+ *         PS2_INHIBITED if the clock stayed low for PS2_IDLE_WAIT_MAX_US
+ */
+static PS2_Status_t ps2_wait_bus_idle(void)
+{
+    uint32_t idle_us = 0;
+    uint32_t waited_us = 0;
+    uint32_t wait_max_us = PS2_IDLE_WAIT_MAX_US + bus_idle_required_us;
+    uint8_t clock_state, data_state;
+    
+    while (waited_us < wait_max_us) {
+        ps2_read_lines(&clock_state, &data_state);
+        
+        if (!clock_state) {
+            ps2_note_inhibit();
+            if (bus_idle_required_us < PS2_BUS_IDLE_US) {
+                bus_idle_required_us = PS2_BUS_IDLE_US;
+            }
+            idle_us = 0;
+        } else {
+            inhibit_active = 0;
+            if (!data_state) {
+                return PS2_HOST_REQUEST;
+            }
+            if (idle_us >= bus_idle_required_us) {
+                bus_idle_required_us = 0;
+                return PS2_OK;
+            }
+            idle_us += PS2_LINE_POLL_US;
+        }
+        
+        ps2_delay_us(PS2_LINE_POLL_US);
+        waited_us += PS2_LINE_POLL_US;
+    }
+    
+    return PS2_INHIBITED;
+}
+
+/**
+ * @brief  Receive and dispatch a byte from the host
+ * @retval None
+ */
+static void ps2_handle_host_request(void)
+{
+    uint8_t data;
+    PS2_Status_t result;
+    
+    ps2_status = PS2_TRANSMITTING;
+    result = ps2_receive_byte(&data);
+    ps2_status = PS2_READY;
+    bus_idle_required_us = PS2_BUS_IDLE_US;
+    
+    if (result == PS2_OK) {
+        ps2_stats.host_requests++;
+        if (data == PS2_CMD_RESEND) {
+            /* Host did not receive our last byte cleanly */
+            ps2_tune_link(PS2_TUNE_LINK_ERROR);
+        }
+        ps2_command_process(data);
+    } else if (result == PS2_ERROR) {
+        ps2_stats.receive_errors++;
+        ps2_tune_link(PS2_TUNE_LINK_ERROR);
+        ps2_command_receive_error();
+    }
+}
+
+/**
+ * @brief  Count a host inhibit period once
+ * @retval None
+ */
+static void ps2_note_inhibit(void)
+{
+    if (!inhibit_active) {
+        inhibit_active = 1;
+        ps2_stats.inhibits++;
+    }
+}
+
+/**
+ * @brief  Compute the PS/2 odd parity bit for a byte
+ * @param  data: Data byte
+ * @retval Parity bit value
+ */
+static uint8_t ps2_odd_parity(uint8_t data)
+{
+    uint8_t parity = 1;
+    
+    for (uint8_t bit_count = 0; bit_count < 8; bit_count++) {
+        parity ^= (data >> bit_count) & 1U;
+    }
+    
+    return parity;
+}
+
+/**
+ * @brief  Derive bit timing from a clock rate
+ * @note   The clock is low for half a bit period; data changes in the middle
+ *         of the clock-high phase, giving equal setup and hold times
+ * @param  clock_freq_hz: Requested clock rate
+ * @retval None
+ */
+static void ps2_apply_clock_rate(uint16_t clock_freq_hz)
+{
+    uint32_t bit_period_us;
+    
+    if (clock_freq_hz < PS2_CLOCK_FREQ_MIN_HZ) {
+        clock_freq_hz = PS2_CLOCK_FREQ_MIN_HZ;
+    } else if (clock_freq_hz > PS2_CLOCK_FREQ_MAX_HZ) {
+        clock_freq_hz = PS2_CLOCK_FREQ_MAX_HZ;
+    }
+    
+    bit_period_us = (1000000U + clock_freq_hz / 2U) / clock_freq_hz;
+    
+    link_config.clock_freq_hz = clock_freq_hz;
+    clock_low_us = (uint16_t)(bit_period_us / 2U);
+    data_setup_us = (uint16_t)((bit_period_us - clock_low_us) / 2U);
+    data_hold_us = (uint16_t)(bit_period_us - clock_low_us - data_setup_us);
+}
+
+/**
+ * @brief  Auto-tune the link after each transfer outcome
+ * @note   Outcomes are evaluated per window of PS2_TUNE_WINDOW_BYTES bytes.
+ *         A clean window shortens the gap back towards the configured value,
+ *         then raises the clock rate. A window with more aborts than the one
+ *         before a rate increase undoes the increase; aborts that do not
+ *         depend on the rate (host busy) leave it alone. A resend request or
+ *         a corrupted host byte lowers the rate at once, then lengthens the
+ *         gap once the rate is at the spec minimum.
+ * @param  event: Transfer outcome
+ * @retval None
+ */
+static void ps2_tune_link(PS2_TuneEvent_t event)
+{
+    if (!link_config.auto_tune) {
+        return;
+    }
+    
+    if (event == PS2_TUNE_LINK_ERROR) {
+        if (link_config.clock_freq_hz > PS2_CLOCK_FREQ_MIN_HZ) {
+            ps2_apply_clock_rate((uint16_t)(link_config.clock_freq_hz - PS2_TUNE_BACKOFF_HZ));
+        } else if (link_config.byte_gap_us + PS2_TUNE_GAP_STEP_US <= PS2_BYTE_GAP_MAX_US) {
+            link_config.byte_gap_us += PS2_TUNE_GAP_STEP_US;
+        }
+        tune_window_bytes = 0;
+        tune_window_aborts = 0;
+        tune_stepped_up = 0;
+        return;
+    }
+    
+    if (event == PS2_TUNE_ABORT) {
+        tune_window_aborts++;
+        return;
+    }
+    
+    if (++tune_window_bytes < PS2_TUNE_WINDOW_BYTES) {
+        return;
+    }
+    
+    if (tune_stepped_up && tune_window_aborts > tune_last_aborts) {
+        /* Faster clock made things worse - step back */
+        ps2_apply_clock_rate((uint16_t)(link_config.clock_freq_hz - PS2_TUNE_STEP_HZ));
+        tune_stepped_up = 0;
+    } else if (tune_window_aborts == 0 && link_config.byte_gap_us > tune_base_gap_us) {
+        link_config.byte_gap_us = (link_config.byte_gap_us - tune_base_gap_us > PS2_TUNE_GAP_STEP_US) ?
+                                  (uint16_t)(link_config.byte_gap_us - PS2_TUNE_GAP_STEP_US) : tune_base_gap_us;
+        tune_stepped_up = 0;
+    } else if (tune_window_aborts == 0 && link_config.clock_freq_hz < PS2_CLOCK_FREQ_MAX_HZ) {
+        ps2_apply_clock_rate((uint16_t)(link_config.clock_freq_hz + PS2_TUNE_STEP_HZ));
+        tune_stepped_up = 1;
+    } else {
+        tune_stepped_up = 0;
+    }
+    
+    tune_last_aborts = tune_window_aborts;
+    tune_window_bytes = 0;
+    tune_window_aborts = 0;
+}
@@ -5,19 +5,37 @@
  * @author  STM32F411 USB-PS2 Project
  * @version 1.0.0
  * @date    2024
+ *
+ * @description
+ * Builds and classifies scan codes in the scan code set the host selected.
+ * Sets 2 and 3 release a key with an F0 prefix; Set 1 sends the make code
+ * with bit 7 set. Key codes passed in and returned are those of the current
+ * set.
+ *
+ * Set 3 keys each have a break and a typematic attribute, kept as two
+ * bitmaps indexed by key code so either decision is a single bit test.
  ******************************************************************************
  */
 
 /* Includes ------------------------------------------------------------------*/
 #include "ps2_protocol.h"
+#include <string.h>
 
 /* Private typedef -----------------------------------------------------------*/
 
 /* Private define ------------------------------------------------------------*/
+#define PS2_SET3_MAP_BYTES          32     ///< One bit per Set 3 key code
 
 /* Private macro -------------------------------------------------------------*/
+#define PS2_SET3_BIT(map, code)     (((map)[(code) >> 3] >> ((code) & 7U)) & 1U)
 
 /* Private variables ---------------------------------------------------------*/
+static uint8_t scan_code_set = PS2_DEFAULT_SCAN_CODE_SET;
+static uint8_t set3_break_map[PS2_SET3_MAP_BYTES];      ///< Set 3 keys sending a break code
+static uint8_t set3_typematic_map[PS2_SET3_MAP_BYTES];  ///< Set 3 keys repeating while held
+
+/* Set 3 Left Ctrl, Left Shift, Left Alt, Left GUI, Right Ctrl, Right Shift, Right Alt, Right GUI */
+static const uint8_t set3_modifier_codes[] = { 0x11, 0x12, 0x19, 0x8B, 0x58, 0x59, 0x39, 0x8C };
 
 /* Private function prototypes -----------------------------------------------*/
 
@@ -81,6 +99,12 @@ PS2_ProtocolStatus_t ps2_create_break_code(PS2_ScanCode_t *scancode, uint8_t key
         return PS2_PROTOCOL_ERROR;
     }
     
+    if (scan_code_set == PS2_SCAN_CODE_SET_1) {
+        scancode->data[0] = key_code | PS2_SET1_BREAK_BIT;
+        scancode->length = 1;
+        return PS2_PROTOCOL_OK;
+    }
+    
     /* Break code is 0xF0 followed by the key code */
     scancode->data[0] = PS2_BREAK_CODE_PREFIX;
     scancode->data[1] = key_code;
@@ -123,6 +147,13 @@ PS2_ProtocolStatus_t ps2_create_extended_break_code(PS2_ScanCode_t *scancode, ui
         return PS2_PROTOCOL_ERROR;
     }
     
+    if (scan_code_set == PS2_SCAN_CODE_SET_1) {
+        scancode->data[0] = PS2_EXTENDED_CODE_PREFIX;
+        scancode->data[1] = key_code | PS2_SET1_BREAK_BIT;
+        scancode->length = 2;
+        return PS2_PROTOCOL_OK;
+    }
+    
     /* Extended break code is 0xE0, 0xF0, followed by the key code */
     scancode->data[0] = PS2_EXTENDED_CODE_PREFIX;
     scancode->data[1] = PS2_BREAK_CODE_PREFIX;
@@ -274,4 +305,183 @@ PS2_ProtocolStatus_t ps2_copy_scancode(PS2_ScanCode_t *dest, const PS2_ScanCode_
     }
     
     return PS2_PROTOCOL_OK;
-}
\ No newline at end of file
+}
+
+/**
+ * @brief  Check if a scan code is a break code
+ * @param  scancode: Pointer to scan code
+ * @retval 1 if the scan code releases a key, 0 otherwise
+ */
+uint8_t ps2_is_break_code(const PS2_ScanCode_t *scancode)
+{
+    if (scancode == NULL || scancode->length == 0) {
+        return 0;
+    }
+    
+    if (scan_code_set == PS2_SCAN_CODE_SET_1) {
+        return (scancode->data[scancode->length - 1] & PS2_SET1_BREAK_BIT) ? 1 : 0;
+    }
+    
+    for (uint8_t i = 0; i < scancode->length; i++) {
+        if (scancode->data[i] == PS2_BREAK_CODE_PREFIX) {
+            return 1;
+        }
+    }
+    
+    return 0;
+}
+
+/**
+ * @brief  Check if a scan code belongs to a modifier key
+ * @note   Covers both Shift, Ctrl, Alt and GUI keys, make or break
+ * @param  scancode: Pointer to scan code
+ * @retval 1 if modifier key, 0 otherwise
+ */
+uint8_t ps2_is_modifier_code(const PS2_ScanCode_t *scancode)
+{
+    uint8_t code;
+    
+    if (scancode == NULL || scancode->length == 0) {
+        return 0;
+    }
+    
+    code = ps2_get_key_code(scancode);
+    
+    if (scan_code_set == PS2_SCAN_CODE_SET_3) {
+        for (uint8_t i = 0; i < sizeof(set3_modifier_codes); i++) {
+            if (set3_modifier_codes[i] == code) {
+                return 1;
+            }
+        }
+        return 0;
+    }
+    
+    if (scan_code_set == PS2_SCAN_CODE_SET_1) {
+        if (scancode->data[0] == PS2_EXTENDED_CODE_PREFIX) {
+            /* Right Ctrl, Right Alt, Left GUI, Right GUI */
+            return (code == 0x1D || code == 0x38 || code == 0x5B || code == 0x5C);
+        }
+        /* Left Shift, Right Shift, Left Ctrl, Left Alt */
+        return (code == 0x2A || code == 0x36 || code == 0x1D || code == 0x38);
+    }
+    
+    if (scancode->data[0] == PS2_EXTENDED_CODE_PREFIX) {
+        /* Right Ctrl, Right Alt, Left GUI, Right GUI */
+        return (code == 0x14 || code == 0x11 || code == 0x1F || code == 0x27);
+    }
+    
+    /* Left Shift, Right Shift, Left Ctrl, Left Alt */
+    return (code == 0x12 || code == 0x59 || code == 0x14 || code == 0x11);
+}
+
+/**
+ * @brief  Get the key code of a make or break code
+ * @param  scancode: Pointer to scan code
+ * @retval Key code without prefixes or Set 1 break bit, 0 if none
+ */
+uint8_t ps2_get_key_code(const PS2_ScanCode_t *scancode)
+{
+    uint8_t code;
+    
+    if (scancode == NULL || scancode->length == 0) {
+        return 0;
+    }
+    
+    code = scancode->data[scancode->length - 1];
+    if (scan_code_set == PS2_SCAN_CODE_SET_1) {
+        code &= (uint8_t)~PS2_SET1_BREAK_BIT;
+    }
+    
+    return code;
+}
+
+/**
+ * @brief  Select the scan code set of all scan codes created from now on
+ * @param  set: PS2_SCAN_CODE_SET_1, PS2_SCAN_CODE_SET_2 or PS2_SCAN_CODE_SET_3
+ * @retval PS2_PROTOCOL_OK if supported, PS2_PROTOCOL_ERROR otherwise
+ */
+PS2_ProtocolStatus_t ps2_set_scan_code_set(uint8_t set)
+{
+    if (set != PS2_SCAN_CODE_SET_1 && set != PS2_SCAN_CODE_SET_2 && set != PS2_SCAN_CODE_SET_3) {
+        return PS2_PROTOCOL_ERROR;
+    }
+    
+    scan_code_set = set;
+    return PS2_PROTOCOL_OK;
+}
+
+/**
+ * @brief  Get the current scan code set
+ * @retval PS2_SCAN_CODE_SET_1, PS2_SCAN_CODE_SET_2 or PS2_SCAN_CODE_SET_3
+ */
+uint8_t ps2_get_scan_code_set(void)
+{
+    return scan_code_set;
+}
+
+/**
+ * @brief  Restore the power-up Set 3 key attributes
+ * @note   Modifier keys are make/break, all other keys typematic make only
+ * @retval None
+ */
+void ps2_set3_default_attributes(void)
+{
+    ps2_set3_set_all_attributes(PS2_SET3_ATTR_TYPEMATIC);
+    for (uint8_t i = 0; i < sizeof(set3_modifier_codes); i++) {
+        ps2_set3_set_key_attributes(set3_modifier_codes[i], PS2_SET3_ATTR_BREAK);
+    }
+}
+
+/**
+ * @brief  Set the attributes of every Set 3 key
+ * @param  attributes: PS2_SET3_ATTR_* bits
+ * @retval None
+ */
+void ps2_set3_set_all_attributes(uint8_t attributes)
+{
+    memset(set3_break_map, (attributes & PS2_SET3_ATTR_BREAK) ? 0xFF : 0x00, sizeof(set3_break_map));
+    memset(set3_typematic_map, (attributes & PS2_SET3_ATTR_TYPEMATIC) ? 0xFF : 0x00, sizeof(set3_typematic_map));
+}
+
+/**
+ * @brief  Set the attributes of one Set 3 key
+ * @param  key_code: Set 3 key code
+ * @param  attributes: PS2_SET3_ATTR_* bits
+ * @retval None
+ */
+void ps2_set3_set_key_attributes(uint8_t key_code, uint8_t attributes)
+{
+    uint8_t bit = (uint8_t)(1U << (key_code & 7U));
+    
+    if (attributes & PS2_SET3_ATTR_BREAK) {
+        set3_break_map[key_code >> 3] |= bit;
+    } else {
+        set3_break_map[key_code >> 3] &= (uint8_t)~bit;
+    }
+    
+    if (attributes & PS2_SET3_ATTR_TYPEMATIC) {
+        set3_typematic_map[key_code >> 3] |= bit;
+    } else {
+        set3_typematic_map[key_code >> 3] &= (uint8_t)~bit;
+    }
+}
+
+/**
+ * @brief  Check if a Set 3 key sends a break code
+ * @param  key_code: Set 3 key code
+ * @retval 1 if make/break, 0 if make only
+ */
+uint8_t ps2_set3_key_breaks(uint8_t key_code)
+{
+    return PS2_SET3_BIT(set3_break_map, key_code);
+}
+
+/**
+ * @brief  Check if a Set 3 key repeats while held
+ * @param  key_code: Set 3 key code
+ * @retval 1 if typematic, 0 otherwise
+ */
+uint8_t ps2_set3_key_repeats(uint8_t key_code)
+{
+    return PS2_SET3_BIT(set3_typematic_map, key_code);
+}
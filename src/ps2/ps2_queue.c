@@ -0,0 +1,829 @@
+/**
+ ******************************************************************************
+ * @file    ps2_queue.c
+ * @brief   PS/2 transmit byte queue for STM32F411
+ * @author  STM32F411 USB-PS2 Project
+ * @version 1.0.0
+ * @date    2024
+ *
+ * @description
+ * Queue between the scan code producers and the PS/2 transmitter. Each
+ * scan code is queued as one event in the FIFO of its priority class:
+ * releases and modifier changes, makes, typematic repeats, injected text.
+ * Host command responses have a FIFO of their own ahead of all classes.
+ *
+ * The transmitter always sends from the highest class that has an event
+ * and budget left, but never switches class in the middle of a scan code.
+ * A scan code that would overtake an earlier event of the same key, or a
+ * modifier change that would overtake a press (or the reverse), is placed
+ * in the lower class behind it instead, so the host sees the same key
+ * order the keyboard produced.
+ *
+ * Pooled sequences (Pause, Print Screen, navigation keys wrapped in fake
+ * Shift codes) are queued as one event holding only the descriptor and
+ * key; their bytes are read from the flash sequence pool as they are sent.
+ *
+ * A byte stays queued until the transmitter confirms it was clocked out
+ * completely, so a frame aborted by a host inhibit is retransmitted from
+ * the same position. Clearing the queue keeps a scan code or response
+ * whose first bytes are already out, so the host never sees a cut-off
+ * prefix; only host commands that reset the keyboard flush it all.
+ *
+ * The event pool is sized from PS2_QUEUE_RAM_BUDGET at build time, so a
+ * burst from a barcode scanner can be held in full while the link drains
+ * it at line rate. The byte capacity follows from the event count at
+ * PS2_QUEUE_AVG_SCANCODE_BYTES per event; whichever runs out first limits
+ * the queue.
+ *
+ * The queue depth also drives flow control towards USB: once the bytes or
+ * the events queued reach their high-water mark the queue reports
+ * congestion until both drain to their low-water mark, so the producers
+ * pause without oscillating per byte.
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include "ps2_queue.h"
+#include "ps2_init.h"
+#include "ps2_shadow.h"
+#include "ps2_sequence.h"
+#include "stm32f4xx_hal.h"
+#include <string.h>
+
+/* Private typedef -----------------------------------------------------------*/
+/**
+ * @brief Queued scan code or command response
+ */
+typedef struct {
+    uint8_t data[PS2_MAX_SCANCODE_LENGTH];  ///< Bytes to transmit, or the descriptor and key of a pooled sequence
+    uint8_t length;                         ///< Number of bytes
+    uint8_t sent;                           ///< Bytes already clocked out
+    uint8_t flags;                          ///< PS2_QUEUE_EVENT_* flags
+    uint8_t fifo;                           ///< FIFO the event is queued in
+    uint16_t next;                          ///< Next event in the same FIFO
+    uint16_t key;                           ///< Set 2 key index, for ordering
+    uint32_t enqueue_us;                    ///< Time the event was queued
+} PS2_QueueEvent_t;
+
+/**
+ * @brief Per-class bandwidth budget (token bucket)
+ */
+typedef struct {
+    uint16_t bytes_per_second;              ///< Sustained rate, 0 for unlimited
+    uint8_t burst_bytes;                    ///< Credit that can build up while idle
+    int32_t credit;                         ///< Byte credit x PS2_QUEUE_CREDIT_SCALE
+    uint32_t last_update_us;                ///< Time credit was last added
+} PS2_QueueBudget_t;
+
+/* Private define ------------------------------------------------------------*/
+#define PS2_QUEUE_NONE              0xFFFF  ///< No event
+#define PS2_QUEUE_NO_KEY            0xFFFF  ///< Event without a key (command response)
+#define PS2_QUEUE_FIFO_RESPONSE     PS2_QUEUE_CLASS_COUNT   ///< FIFO index of command responses
+#define PS2_QUEUE_FIFOS             (PS2_QUEUE_CLASS_COUNT + 1)
+#define PS2_QUEUE_EVENT_RELEASE     0x01    ///< Event is a break code
+#define PS2_QUEUE_EVENT_MODIFIER    0x02    ///< Event is a modifier make or break
+#define PS2_QUEUE_EVENT_RESPONSE    0x04    ///< Event is a command response
+#define PS2_QUEUE_EVENT_SEQUENCE    0x08    ///< Bytes come from the sequence pool, data[0-1] are descriptor and key
+#define PS2_QUEUE_CREDIT_SCALE      1000000 ///< Credit units per byte (1 byte/s for 1 us)
+#define PS2_QUEUE_MAX_REFILL_US     1000000 ///< Longest idle time credited at once
+
+/* Private macro -------------------------------------------------------------*/
+_Static_assert(sizeof(PS2_QueueEvent_t) == PS2_QUEUE_EVENT_BYTES, "PS2_QUEUE_EVENT_BYTES out of date");
+_Static_assert(PS2_QUEUE_EVENTS >= 2 * PS2_QUEUE_REPORT_HEADROOM, "PS2_QUEUE_RAM_BUDGET too small");
+_Static_assert(PS2_QUEUE_EVENTS < PS2_QUEUE_NONE, "PS2_QUEUE_RAM_BUDGET too large");
+
+/* Private variables ---------------------------------------------------------*/
+static PS2_QueueEvent_t queue_events[PS2_QUEUE_EVENTS];
+static uint16_t fifo_head[PS2_QUEUE_FIFOS];
+static uint16_t fifo_tail[PS2_QUEUE_FIFOS];
+static uint16_t free_head = PS2_QUEUE_NONE;
+static uint16_t free_count = 0;
+static uint16_t current_event = PS2_QUEUE_NONE;
+static uint8_t current_class = 0;
+static volatile uint16_t queue_count = 0;
+static volatile uint8_t queue_congested = 0;
+static uint16_t key_newest[PS2_SHADOW_KEYS];                ///< Newest queued event of each key
+static uint16_t class_presses[PS2_QUEUE_CLASS_COUNT];       ///< Queued events that are not releases
+static uint16_t class_modifiers[PS2_QUEUE_CLASS_COUNT];     ///< Queued modifier makes and breaks
+static PS2_QueueBudget_t class_budget[PS2_QUEUE_CLASS_COUNT];
+static PS2_QueueClassStats_t class_stats[PS2_QUEUE_CLASS_COUNT];
+
+/* Private function prototypes -----------------------------------------------*/
+static uint16_t ps2_queue_alloc(void);
+static void ps2_queue_append(uint8_t fifo, uint16_t index);
+static void ps2_queue_enqueue_scancode(const PS2_ScanCode_t *scancode, PS2_QueueClass_t queue_class);
+static uint8_t ps2_queue_scancode_length(const PS2_ScanCode_t *scancode);
+static uint8_t ps2_queue_event_byte(const PS2_QueueEvent_t *event);
+static uint8_t ps2_queue_fifo_conflicts(uint8_t fifo, const PS2_QueueEvent_t *event);
+static void ps2_queue_track(uint16_t index, int8_t delta);
+static uint16_t ps2_queue_select(void);
+static uint8_t ps2_queue_budget_ready(PS2_QueueClass_t queue_class, uint32_t now_us);
+static void ps2_queue_update_flow(void);
+static void ps2_queue_reset(uint16_t keep_response, uint16_t keep_scancode);
+
+/* Exported functions --------------------------------------------------------*/
+
+/**
+ * @brief  Initialize PS/2 transmit queue
+ * @note   Empties the queue, clears statistics and removes all budgets
+ * @retval PS2_QUEUE_OK
+ */
+PS2_QueueStatus_t ps2_queue_init(void)
+{
+    ps2_queue_flush();
+    ps2_queue_clear_stats();
+    memset(class_budget, 0, sizeof(class_budget));
+    return PS2_QUEUE_OK;
+}
+
+/**
+ * @brief  Append one scan code to the queue
+ * @note   Queued in the key press class; break codes and modifier changes
+ *         are promoted like for ps2_queue_push_scancodes()
+ * @param  data: Scan code bytes
+ * @param  length: Number of bytes, at most PS2_MAX_SCANCODE_LENGTH
+ * @retval PS2_QUEUE_OK if queued, PS2_QUEUE_FULL or PS2_QUEUE_ERROR otherwise
+ */
+PS2_QueueStatus_t ps2_queue_push(const uint8_t *data, uint8_t length)
+{
+    PS2_ScanCode_t scancode;
+
+    if (data == NULL || length == 0 || length > PS2_MAX_SCANCODE_LENGTH) {
+        return PS2_QUEUE_ERROR;
+    }
+
+    memcpy(scancode.data, data, length);
+    scancode.length = length;
+
+    return ps2_queue_push_scancodes(&scancode, 1, PS2_QUEUE_CLASS_MAKE);
+}
+
+/**
+ * @brief  Queue scan codes in a priority class
+ * @note   All scan codes are queued or none, so a report is never split by
+ *         a full queue. A scan code may stand for a pooled sequence (see
+ *         ps2_sequence_create()). With PS2_QUEUE_CLASS_MAKE, break codes and modifier
+ *         changes are promoted to PS2_QUEUE_CLASS_RELEASE. A scan code is
+ *         moved down to a lower class when it would otherwise overtake an
+ *         event there of the same key, or when a modifier change and a
+ *         press would swap.
+ * @param  scancodes: Scan codes in the order the host should see them
+ * @param  count: Number of scan codes
+ * @param  queue_class: Priority class
+ * @retval PS2_QUEUE_OK if queued, PS2_QUEUE_FULL or PS2_QUEUE_ERROR otherwise
+ */
+PS2_QueueStatus_t ps2_queue_push_scancodes(const PS2_ScanCode_t *scancodes, uint8_t count,
+                                           PS2_QueueClass_t queue_class)
+{
+    uint16_t length = 0;
+
+    if (scancodes == NULL || count == 0 || queue_class >= PS2_QUEUE_CLASS_COUNT) {
+        return PS2_QUEUE_ERROR;
+    }
+
+    for (uint8_t i = 0; i < count; i++) {
+        uint8_t scancode_length = ps2_queue_scancode_length(&scancodes[i]);
+
+        if (scancode_length == 0) {
+            return PS2_QUEUE_ERROR;
+        }
+        length += scancode_length;
+    }
+
+    __disable_irq();
+
+    if ((PS2_QUEUE_SIZE - queue_count) < length || free_count < count) {
+        __enable_irq();
+        return PS2_QUEUE_FULL;
+    }
+
+    for (uint8_t i = 0; i < count; i++) {
+        ps2_queue_enqueue_scancode(&scancodes[i], queue_class);
+    }
+
+    ps2_queue_update_flow();
+    __enable_irq();
+    return PS2_QUEUE_OK;
+}
+
+/**
+ * @brief  Queue a command response ahead of all scan codes
+ * @note   The host expects a response before any further scan codes.
+ *         Response bytes are tagged so they are not taken for key state.
+ * @param  data: Bytes to queue
+ * @param  length: Number of bytes, at most PS2_MAX_SCANCODE_LENGTH
+ * @retval PS2_QUEUE_OK if queued, PS2_QUEUE_FULL or PS2_QUEUE_ERROR otherwise
+ */
+PS2_QueueStatus_t ps2_queue_push_response(const uint8_t *data, uint8_t length)
+{
+    PS2_QueueEvent_t *event;
+    uint16_t index;
+
+    if (data == NULL || length == 0 || length > PS2_MAX_SCANCODE_LENGTH) {
+        return PS2_QUEUE_ERROR;
+    }
+
+    __disable_irq();
+
+    if ((PS2_QUEUE_SIZE - queue_count) < length || free_count == 0) {
+        __enable_irq();
+        return PS2_QUEUE_FULL;
+    }
+
+    index = ps2_queue_alloc();
+    event = &queue_events[index];
+    memcpy(event->data, data, length);
+    event->length = length;
+    event->flags = PS2_QUEUE_EVENT_RESPONSE;
+    event->key = PS2_QUEUE_NO_KEY;
+    event->enqueue_us = ps2_get_time_us();
+    ps2_queue_append(PS2_QUEUE_FIFO_RESPONSE, index);
+    queue_count += length;
+
+    ps2_queue_update_flow();
+    __enable_irq();
+    return PS2_QUEUE_OK;
+}
+
+/**
+ * @brief  Get the next byte to transmit without removing it
+ * @note   Picks the next scan code by priority once the previous one is
+ *         complete. Classes over their bandwidth budget are skipped.
+ * @param  data: Pointer to store the byte
+ * @retval PS2_QUEUE_OK if a byte is available, PS2_QUEUE_EMPTY otherwise
+ */
+PS2_QueueStatus_t ps2_queue_peek(uint8_t *data)
+{
+    uint16_t index;
+
+    if (data == NULL) {
+        return PS2_QUEUE_ERROR;
+    }
+
+    __disable_irq();
+
+    index = ps2_queue_select();
+    if (index == PS2_QUEUE_NONE) {
+        __enable_irq();
+        return PS2_QUEUE_EMPTY;
+    }
+
+    *data = ps2_queue_event_byte(&queue_events[index]);
+    __enable_irq();
+    return PS2_QUEUE_OK;
+}
+
+/**
+ * @brief  Get the kind of the next byte to transmit
+ * @retval Tag of the next byte, PS2_QUEUE_TAG_SCANCODE if there is none
+ */
+PS2_QueueTag_t ps2_queue_peek_tag(void)
+{
+    PS2_QueueTag_t tag = PS2_QUEUE_TAG_SCANCODE;
+    uint16_t index;
+
+    __disable_irq();
+
+    index = ps2_queue_select();
+    if (index != PS2_QUEUE_NONE && (queue_events[index].flags & PS2_QUEUE_EVENT_RESPONSE)) {
+        tag = PS2_QUEUE_TAG_RESPONSE;
+    }
+
+    __enable_irq();
+    return tag;
+}
+
+/**
+ * @brief  Remove the next byte after it was transmitted
+ * @retval 1 if the byte completed a scan code or response, 0 otherwise
+ */
+uint8_t ps2_queue_pop(void)
+{
+    PS2_QueueEvent_t *event;
+    uint16_t index;
+    uint8_t fifo;
+    uint8_t complete;
+
+    __disable_irq();
+
+    index = ps2_queue_select();
+    if (index == PS2_QUEUE_NONE) {
+        __enable_irq();
+        return 0;
+    }
+
+    event = &queue_events[index];
+    fifo = (event->flags & PS2_QUEUE_EVENT_RESPONSE) ? PS2_QUEUE_FIFO_RESPONSE : current_class;
+
+    if (fifo != PS2_QUEUE_FIFO_RESPONSE) {
+        class_stats[fifo].bytes++;
+    }
+
+    event->sent++;
+    queue_count--;
+    complete = (event->sent == event->length);
+
+    if (complete) {
+        /* Event complete - it is always the head of its FIFO */
+        fifo_head[fifo] = event->next;
+        if (fifo_head[fifo] == PS2_QUEUE_NONE) {
+            fifo_tail[fifo] = PS2_QUEUE_NONE;
+        }
+        event->next = free_head;
+        free_head = index;
+        free_count++;
+
+        if (fifo != PS2_QUEUE_FIFO_RESPONSE) {
+            class_stats[fifo].events++;
+            ps2_queue_track(index, -1);
+            current_event = PS2_QUEUE_NONE;
+        }
+    }
+
+    ps2_queue_update_flow();
+    __enable_irq();
+    return complete;
+}
+
+/**
+ * @brief  Discard all queued bytes not yet started
+ * @note   A scan code or response part way out is kept, so the host still
+ *         receives it whole. ps2_process() may return between any two
+ *         bytes, so this is what the main loop must use.
+ * @retval None
+ */
+void ps2_queue_clear(void)
+{
+    uint16_t response;
+    uint16_t scancode;
+
+    __disable_irq();
+
+    response = fifo_head[PS2_QUEUE_FIFO_RESPONSE];
+    if (response != PS2_QUEUE_NONE && queue_events[response].sent == 0) {
+        response = PS2_QUEUE_NONE;
+    }
+    scancode = current_event;
+    if (scancode != PS2_QUEUE_NONE && queue_events[scancode].sent == 0) {
+        scancode = PS2_QUEUE_NONE;
+    }
+
+    ps2_queue_reset(response, scancode);
+    __enable_irq();
+}
+
+/**
+ * @brief  Discard all queued bytes, including the rest of a scan code
+ * @note   For host commands after which a keyboard drops its output:
+ *         Reset, Enable and Select Set
+ * @retval None
+ */
+void ps2_queue_flush(void)
+{
+    __disable_irq();
+    ps2_queue_reset(PS2_QUEUE_NONE, PS2_QUEUE_NONE);
+    __enable_irq();
+}
+
+/**
+ * @brief  Check if a scan code or response is part way out
+ * @note   ps2_queue_flush() would cut it off; wait for this to clear first
+ * @retval 1 if some of its bytes are sent and the rest still queued, 0 otherwise
+ */
+uint8_t ps2_queue_in_progress(void)
+{
+    uint16_t response;
+    uint16_t scancode;
+    uint8_t in_progress;
+
+    __disable_irq();
+    response = fifo_head[PS2_QUEUE_FIFO_RESPONSE];
+    scancode = current_event;
+    in_progress = (response != PS2_QUEUE_NONE && queue_events[response].sent != 0) ||
+                  (scancode != PS2_QUEUE_NONE && queue_events[scancode].sent != 0);
+    __enable_irq();
+
+    return in_progress;
+}
+
+/**
+ * @brief  Get number of queued bytes
+ * @retval Queued byte count
+ */
+uint16_t ps2_queue_count(void)
+{
+    return queue_count;
+}
+
+/**
+ * @brief  Get free queue space
+ * @retval Free bytes
+ */
+uint16_t ps2_queue_free(void)
+{
+    return (uint16_t)(PS2_QUEUE_SIZE - queue_count);
+}
+
+/**
+ * @brief  Check if the queue is backlogged
+ * @note   Set when the depth reaches PS2_QUEUE_HIGH_WATER bytes or
+ *         PS2_QUEUE_EVENT_HIGH_WATER events and cleared when it falls to
+ *         both low-water marks. Producers should stop accepting new input
+ *         while set.
+ * @retval 1 if congested, 0 otherwise
+ */
+uint8_t ps2_queue_congested(void)
+{
+    return queue_congested;
+}
+
+/**
+ * @brief  Limit the bandwidth of a priority class
+ * @note   Token bucket: the class may send bytes_per_second on average and
+ *         up to burst_bytes at once after an idle period. A class over
+ *         budget waits even when the link is free.
+ * @param  queue_class: Priority class
+ * @param  bytes_per_second: Sustained rate, 0 to remove the limit
+ * @param  burst_bytes: Burst size, 0 for one scan code
+ * @retval PS2_QUEUE_OK if set, PS2_QUEUE_ERROR for an invalid class
+ */
+PS2_QueueStatus_t ps2_queue_set_class_budget(PS2_QueueClass_t queue_class, uint16_t bytes_per_second,
+                                             uint8_t burst_bytes)
+{
+    PS2_QueueBudget_t *budget;
+
+    if (queue_class >= PS2_QUEUE_CLASS_COUNT) {
+        return PS2_QUEUE_ERROR;
+    }
+
+    if (burst_bytes == 0) {
+        burst_bytes = PS2_MAX_SCANCODE_LENGTH;
+    }
+
+    __disable_irq();
+    budget = &class_budget[queue_class];
+    budget->bytes_per_second = bytes_per_second;
+    budget->burst_bytes = burst_bytes;
+    budget->credit = (int32_t)burst_bytes * PS2_QUEUE_CREDIT_SCALE;
+    budget->last_update_us = ps2_get_time_us();
+    __enable_irq();
+
+    return PS2_QUEUE_OK;
+}
+
+/**
+ * @brief  Get the statistics of a priority class
+ * @param  queue_class: Priority class
+ * @param  stats: Pointer to store statistics
+ * @retval PS2_QUEUE_OK if copied, PS2_QUEUE_ERROR otherwise
+ */
+PS2_QueueStatus_t ps2_queue_get_class_stats(PS2_QueueClass_t queue_class, PS2_QueueClassStats_t *stats)
+{
+    if (queue_class >= PS2_QUEUE_CLASS_COUNT || stats == NULL) {
+        return PS2_QUEUE_ERROR;
+    }
+
+    __disable_irq();
+    *stats = class_stats[queue_class];
+    __enable_irq();
+
+    return PS2_QUEUE_OK;
+}
+
+/**
+ * @brief  Clear the statistics of all priority classes
+ * @retval None
+ */
+void ps2_queue_clear_stats(void)
+{
+    __disable_irq();
+    memset(class_stats, 0, sizeof(class_stats));
+    __enable_irq();
+}
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+ * @brief  Take an event from the free list
+ * @note   Must be called with interrupts disabled and free_count > 0
+ * @retval Event index
+ */
+static uint16_t ps2_queue_alloc(void)
+{
+    uint16_t index = free_head;
+
+    free_head = queue_events[index].next;
+    free_count--;
+    queue_events[index].sent = 0;
+    queue_events[index].next = PS2_QUEUE_NONE;
+
+    return index;
+}
+
+/**
+ * @brief  Append an event to a FIFO
+ * @param  fifo: FIFO index
+ * @param  index: Event index
+ * @retval None
+ */
+static void ps2_queue_append(uint8_t fifo, uint16_t index)
+{
+    if (fifo_tail[fifo] == PS2_QUEUE_NONE) {
+        fifo_head[fifo] = index;
+    } else {
+        queue_events[fifo_tail[fifo]].next = index;
+    }
+    fifo_tail[fifo] = index;
+}
+
+/**
+ * @brief  Queue one scan code in the class that keeps key order
+ * @note   Must be called with interrupts disabled and room available
+ * @param  scancode: Scan code to queue
+ * @param  queue_class: Requested priority class
+ * @retval None
+ */
+static void ps2_queue_enqueue_scancode(const PS2_ScanCode_t *scancode, PS2_QueueClass_t queue_class)
+{
+    PS2_QueueEvent_t *event;
+    uint16_t index = ps2_queue_alloc();
+    uint8_t is_extended = (scancode->data[0] == PS2_EXTENDED_CODE_PREFIX);
+    uint8_t natural;
+    uint8_t fifo;
+
+    event = &queue_events[index];
+    if (ps2_sequence_is_code(scancode)) {
+        /* Keep descriptor and key only - the bytes stay in the pool */
+        event->data[0] = scancode->data[1];
+        event->data[1] = scancode->data[2];
+        event->length = ps2_queue_scancode_length(scancode);
+        event->flags = PS2_QUEUE_EVENT_SEQUENCE;
+        if (scancode->data[1] & PS2_SEQUENCE_BREAK) {
+            event->flags |= PS2_QUEUE_EVENT_RELEASE;
+        }
+        event->key = ps2_sequence_key(scancode->data[1], scancode->data[2]);
+    } else {
+        memcpy(event->data, scancode->data, scancode->length);
+        event->length = scancode->length;
+        event->flags = 0;
+        if (ps2_is_break_code(scancode)) {
+            event->flags |= PS2_QUEUE_EVENT_RELEASE;
+        }
+        if (ps2_is_modifier_code(scancode)) {
+            event->flags |= PS2_QUEUE_EVENT_MODIFIER;
+        }
+        event->key = PS2_SHADOW_INDEX(ps2_get_key_code(scancode), is_extended);
+    }
+    event->enqueue_us = ps2_get_time_us();
+
+    natural = (uint8_t)queue_class;
+    if (queue_class == PS2_QUEUE_CLASS_MAKE && (event->flags & (PS2_QUEUE_EVENT_RELEASE | PS2_QUEUE_EVENT_MODIFIER))) {
+        natural = PS2_QUEUE_CLASS_RELEASE;
+    }
+
+    /* Stay behind the lowest class holding an event this one must not pass */
+    fifo = natural;
+    for (uint8_t lower = (uint8_t)(natural + 1); lower < PS2_QUEUE_CLASS_COUNT; lower++) {
+        if (ps2_queue_fifo_conflicts(lower, event)) {
+            fifo = lower;
+        }
+    }
+    if (fifo != natural) {
+        class_stats[fifo].ordered++;
+    }
+
+    event->fifo = fifo;
+    ps2_queue_append(fifo, index);
+    ps2_queue_track(index, 1);
+    queue_count += event->length;
+}
+
+/**
+ * @brief  Get the number of bytes a scan code puts on the wire
+ * @param  scancode: Scan code, possibly standing for a pooled sequence
+ * @retval Number of bytes, 0 if the scan code is invalid
+ */
+static uint8_t ps2_queue_scancode_length(const PS2_ScanCode_t *scancode)
+{
+    if (ps2_sequence_is_code(scancode)) {
+        return ps2_sequence_length(scancode->data[1]);
+    }
+
+    if (scancode->length == 0 || scancode->length > PS2_MAX_SCANCODE_LENGTH) {
+        return 0;
+    }
+    return scancode->length;
+}
+
+/**
+ * @brief  Get the next byte of an event
+ * @param  event: Event with bytes left to send
+ * @retval Byte at position event->sent
+ */
+static uint8_t ps2_queue_event_byte(const PS2_QueueEvent_t *event)
+{
+    if (event->flags & PS2_QUEUE_EVENT_SEQUENCE) {
+        return ps2_sequence_byte(event->data[0], event->data[1], event->sent);
+    }
+
+    return event->data[event->sent];
+}
+
+/**
+ * @brief  Check if an event must stay behind any event of a FIFO
+ * @note   Events of the same key keep their order. Modifier changes keep
+ *         their order against everything but releases, so a press never
+ *         moves to the other side of a Shift change. Answered from the
+ *         per-key and per-class counts, without walking the FIFO. The
+ *         newest event of a key is in the lowest class holding that key,
+ *         so it alone decides for all of them.
+ * @param  fifo: FIFO to check
+ * @param  event: Event being queued
+ * @retval 1 if the event must be queued behind the FIFO, 0 otherwise
+ */
+static uint8_t ps2_queue_fifo_conflicts(uint8_t fifo, const PS2_QueueEvent_t *event)
+{
+    uint16_t newest = key_newest[event->key];
+
+    if (newest != PS2_QUEUE_NONE && queue_events[newest].fifo == fifo) {
+        return 1;
+    }
+    if ((event->flags & PS2_QUEUE_EVENT_MODIFIER) && class_presses[fifo] != 0) {
+        return 1;
+    }
+    if (class_modifiers[fifo] != 0 && !(event->flags & PS2_QUEUE_EVENT_RELEASE)) {
+        return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief  Count a scan code in or out of the ordering state
+ * @note   Must be called with interrupts disabled. Events of a key leave
+ *         in the order they were queued, so the newest is the last out.
+ * @param  index: Scan code event, queued in its FIFO
+ * @param  delta: 1 when queued, -1 when complete
+ * @retval None
+ */
+static void ps2_queue_track(uint16_t index, int8_t delta)
+{
+    const PS2_QueueEvent_t *event = &queue_events[index];
+
+    if (!(event->flags & PS2_QUEUE_EVENT_RELEASE)) {
+        class_presses[event->fifo] = (uint16_t)(class_presses[event->fifo] + delta);
+    }
+    if (event->flags & PS2_QUEUE_EVENT_MODIFIER) {
+        class_modifiers[event->fifo] = (uint16_t)(class_modifiers[event->fifo] + delta);
+    }
+
+    if (delta > 0) {
+        key_newest[event->key] = index;
+    } else if (key_newest[event->key] == index) {
+        key_newest[event->key] = PS2_QUEUE_NONE;
+    }
+}
+
+/**
+ * @brief  Pick the event the next byte comes from
+ * @note   Command responses first, then the scan code already in progress,
+ *         then the head of the highest class with budget left. Starting a
+ *         scan code ends its queueing delay. Must be called with
+ *         interrupts disabled, as it updates the budgets and statistics.
+ * @retval Event index, PS2_QUEUE_NONE if nothing may be sent now
+ */
+static uint16_t ps2_queue_select(void)
+{
+    uint32_t now_us;
+    uint32_t delay_us;
+
+    if (fifo_head[PS2_QUEUE_FIFO_RESPONSE] != PS2_QUEUE_NONE) {
+        return fifo_head[PS2_QUEUE_FIFO_RESPONSE];
+    }
+
+    if (current_event != PS2_QUEUE_NONE) {
+        return current_event;
+    }
+
+    now_us = ps2_get_time_us();
+
+    for (uint8_t queue_class = 0; queue_class < PS2_QUEUE_CLASS_COUNT; queue_class++) {
+        uint16_t index = fifo_head[queue_class];
+
+        if (index == PS2_QUEUE_NONE || !ps2_queue_budget_ready((PS2_QueueClass_t)queue_class, now_us)) {
+            continue;
+        }
+
+        if (class_budget[queue_class].bytes_per_second != 0) {
+            class_budget[queue_class].credit -= (int32_t)queue_events[index].length * PS2_QUEUE_CREDIT_SCALE;
+        }
+
+        delay_us = now_us - queue_events[index].enqueue_us;
+        class_stats[queue_class].total_delay_us += delay_us;
+        if (delay_us > class_stats[queue_class].max_delay_us) {
+            class_stats[queue_class].max_delay_us = delay_us;
+        }
+
+        current_event = index;
+        current_class = queue_class;
+        return index;
+    }
+
+    return PS2_QUEUE_NONE;
+}
+
+/**
+ * @brief  Refill a class budget and check if it may start a scan code
+ * @note   A scan code may start with any positive credit; its full length
+ *         is charged, so the class runs a short debt at most
+ * @param  queue_class: Priority class
+ * @param  now_us: Current time
+ * @retval 1 if the class may send, 0 if it is over budget
+ */
+static uint8_t ps2_queue_budget_ready(PS2_QueueClass_t queue_class, uint32_t now_us)
+{
+    PS2_QueueBudget_t *budget = &class_budget[queue_class];
+    uint32_t elapsed_us;
+    int64_t credit;
+    int64_t limit;
+
+    if (budget->bytes_per_second == 0) {
+        return 1;
+    }
+
+    elapsed_us = now_us - budget->last_update_us;
+    if (elapsed_us > PS2_QUEUE_MAX_REFILL_US) {
+        elapsed_us = PS2_QUEUE_MAX_REFILL_US;
+    }
+    budget->last_update_us = now_us;
+
+    credit = (int64_t)budget->credit + (int64_t)budget->bytes_per_second * elapsed_us;
+    limit = (int64_t)budget->burst_bytes * PS2_QUEUE_CREDIT_SCALE;
+    if (credit > limit) {
+        credit = limit;
+    }
+    budget->credit = (int32_t)credit;
+
+    return (budget->credit > 0);
+}
+
+/**
+ * @brief  Update the congestion flag from the queue depth
+ * @note   Must be called with interrupts disabled
+ * @retval None
+ */
+static void ps2_queue_update_flow(void)
+{
+    uint16_t events = (uint16_t)(PS2_QUEUE_EVENTS - free_count);
+
+    if (queue_count >= PS2_QUEUE_HIGH_WATER || events >= PS2_QUEUE_EVENT_HIGH_WATER) {
+        queue_congested = 1;
+    } else if (queue_count <= PS2_QUEUE_LOW_WATER && events <= PS2_QUEUE_EVENT_LOW_WATER) {
+        queue_congested = 0;
+    }
+}
+
+/**
+ * @brief  Empty the queue except for up to two events part way out
+ * @note   Must be called with interrupts disabled
+ * @param  keep_response: Response to keep at the head of its FIFO, or PS2_QUEUE_NONE
+ * @param  keep_scancode: Scan code to keep as the one in progress, or PS2_QUEUE_NONE
+ * @retval None
+ */
+static void ps2_queue_reset(uint16_t keep_response, uint16_t keep_scancode)
+{
+    for (uint8_t i = 0; i < PS2_QUEUE_FIFOS; i++) {
+        fifo_head[i] = PS2_QUEUE_NONE;
+        fifo_tail[i] = PS2_QUEUE_NONE;
+    }
+
+    free_head = PS2_QUEUE_NONE;
+    free_count = 0;
+    for (uint16_t i = PS2_QUEUE_EVENTS; i-- > 0;) {
+        if (i != keep_response && i != keep_scancode) {
+            queue_events[i].next = free_head;
+            free_head = i;
+            free_count++;
+        }
+    }
+
+    memset(key_newest, 0xFF, sizeof(key_newest));
+    memset(class_presses, 0, sizeof(class_presses));
+    memset(class_modifiers, 0, sizeof(class_modifiers));
+
+    queue_count = 0;
+    if (keep_response != PS2_QUEUE_NONE) {
+        queue_events[keep_response].next = PS2_QUEUE_NONE;
+        ps2_queue_append(PS2_QUEUE_FIFO_RESPONSE, keep_response);
+        queue_count += (uint16_t)(queue_events[keep_response].length - queue_events[keep_response].sent);
+    }
+    if (keep_scancode != PS2_QUEUE_NONE) {
+        queue_events[keep_scancode].next = PS2_QUEUE_NONE;
+        ps2_queue_append(current_class, keep_scancode);
+        ps2_queue_track(keep_scancode, 1);
+        queue_count += (uint16_t)(queue_events[keep_scancode].length - queue_events[keep_scancode].sent);
+    }
+    current_event = keep_scancode;
+
+    queue_congested = 0;
+}
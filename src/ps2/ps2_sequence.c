@@ -0,0 +1,303 @@
+/**
+ ******************************************************************************
+ * @file    ps2_sequence.c
+ * @brief   Pooled long scan code sequences for STM32F411
+ * @author  STM32F411 USB-PS2 Project
+ * @version 1.0.0
+ * @date    2024
+ *
+ * @description
+ * Pause and Print Screen send sequences longer than PS2_MAX_SCANCODE_LENGTH,
+ * and so do the E0 navigation keys once wrapped in fake Shift codes the
+ * way a native keyboard does under Num Lock or Shift. All of these bytes
+ * are precomputed in one const pool kept in flash. Each sequence is a
+ * template: a head and a tail span of the pool, optionally around the E0
+ * make or break of the wrapped key.
+ *
+ * A scan code of PS2_SEQUENCE_CODE, a descriptor and the wrapped key
+ * stands for a whole sequence: the queue stores only the descriptor and
+ * key, and the transmitter reads the bytes straight from the template.
+ *
+ * Set 1 and Set 2 have their own templates. A descriptor is created for
+ * the scan code set current at the time, so queued sequences keep it.
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include "ps2_sequence.h"
+#include "ps2_shadow.h"
+#include <string.h>
+
+/* Private typedef -----------------------------------------------------------*/
+/**
+ * @brief Location of bytes in the pool
+ */
+typedef struct {
+    uint8_t offset;         ///< First byte in sequence_pool
+    uint8_t length;         ///< Number of bytes
+} PS2_SequenceSpan_t;
+
+/**
+ * @brief Make or break template of one sequence
+ */
+typedef struct {
+    PS2_SequenceSpan_t head;    ///< Bytes before the wrapped key
+    PS2_SequenceSpan_t tail;    ///< Bytes after the wrapped key
+    uint8_t wraps_key;          ///< 1 if the E0 code of the key goes between
+} PS2_SequenceTemplate_t;
+
+/* Private define ------------------------------------------------------------*/
+#define PS2_SEQUENCE_SETS           2       ///< Template sets: Set 2, Set 1
+#define PS2_SEQUENCE_KEY_MAX_LENGTH 3       ///< E0 F0 key
+
+/* Private macro -------------------------------------------------------------*/
+#define PS2_SEQUENCE_INDEX(descriptor)  ((descriptor) & (uint8_t)~(PS2_SEQUENCE_BREAK | PS2_SEQUENCE_SET1))
+#define PS2_SEQUENCE_TEMPLATE_SET(descriptor) (((descriptor) & PS2_SEQUENCE_SET1) ? 1 : 0)
+
+/* Private variables ---------------------------------------------------------*/
+static const uint8_t sequence_pool[] = {
+    /* Set 2 */
+    /* 0: Print Screen make, starting with the fake Left Shift press */
+    0xE0, 0x12, 0xE0, 0x7C,
+    /* 4: Print Screen break, ending with the fake Left Shift release */
+    0xE0, 0xF0, 0x7C, 0xE0, 0xF0, 0x12,
+    /* 10: Pause make */
+    PS2_PAUSE_CODE_PREFIX, 0x14, 0x77, PS2_PAUSE_CODE_PREFIX, 0xF0, 0x14, 0xF0, 0x77,
+    /* 18: Fake Left and Right Shift release */
+    0xE0, 0xF0, 0x12, 0xE0, 0xF0, 0x59,
+    /* 24: Fake Left and Right Shift press */
+    0xE0, 0x12, 0xE0, 0x59,
+
+    /* Set 1 */
+    /* 28: Print Screen make, starting with the fake Left Shift press */
+    0xE0, 0x2A, 0xE0, 0x37,
+    /* 32: Print Screen break, ending with the fake Left Shift release */
+    0xE0, 0xB7, 0xE0, 0xAA,
+    /* 36: Pause make */
+    PS2_PAUSE_CODE_PREFIX, 0x1D, 0x45, PS2_PAUSE_CODE_PREFIX, 0x9D, 0xC5,
+    /* 42: Fake Left and Right Shift release */
+    0xE0, 0xAA, 0xE0, 0xB6,
+    /* 46: Fake Left and Right Shift press */
+    0xE0, 0x2A, 0xE0, 0x36
+};
+
+/* Make and break template of each sequence, Set 2 then Set 1 */
+static const PS2_SequenceTemplate_t sequence_templates[PS2_SEQUENCE_SETS][PS2_SEQUENCE_COUNT][2] = {
+    {
+        [PS2_SEQUENCE_PRINT_SCREEN] = { { { 0, 4 }, { 0, 0 }, 0 }, { { 4, 6 }, { 0, 0 }, 0 } },
+        [PS2_SEQUENCE_PAUSE]        = { { { 10, 8 }, { 0, 0 }, 0 }, { { 0, 0 }, { 0, 0 }, 0 } },
+        [PS2_SEQUENCE_NUM_LOCK]     = { { { 0, 2 }, { 0, 0 }, 1 }, { { 0, 0 }, { 7, 3 }, 1 } },
+        [PS2_SEQUENCE_LEFT_SHIFT]   = { { { 18, 3 }, { 0, 0 }, 1 }, { { 0, 0 }, { 24, 2 }, 1 } },
+        [PS2_SEQUENCE_RIGHT_SHIFT]  = { { { 21, 3 }, { 0, 0 }, 1 }, { { 0, 0 }, { 26, 2 }, 1 } },
+        [PS2_SEQUENCE_BOTH_SHIFTS]  = { { { 18, 6 }, { 0, 0 }, 1 }, { { 0, 0 }, { 24, 4 }, 1 } }
+    },
+    {
+        [PS2_SEQUENCE_PRINT_SCREEN] = { { { 28, 4 }, { 0, 0 }, 0 }, { { 32, 4 }, { 0, 0 }, 0 } },
+        [PS2_SEQUENCE_PAUSE]        = { { { 36, 6 }, { 0, 0 }, 0 }, { { 0, 0 }, { 0, 0 }, 0 } },
+        [PS2_SEQUENCE_NUM_LOCK]     = { { { 28, 2 }, { 0, 0 }, 1 }, { { 0, 0 }, { 34, 2 }, 1 } },
+        [PS2_SEQUENCE_LEFT_SHIFT]   = { { { 42, 2 }, { 0, 0 }, 1 }, { { 0, 0 }, { 46, 2 }, 1 } },
+        [PS2_SEQUENCE_RIGHT_SHIFT]  = { { { 44, 2 }, { 0, 0 }, 1 }, { { 0, 0 }, { 48, 2 }, 1 } },
+        [PS2_SEQUENCE_BOTH_SHIFTS]  = { { { 42, 4 }, { 0, 0 }, 1 }, { { 0, 0 }, { 46, 4 }, 1 } }
+    }
+};
+
+/* Key code of the fixed sequences, Set 2 then Set 1 */
+static const uint8_t sequence_key_codes[PS2_SEQUENCE_SETS][PS2_SEQUENCE_PAUSE + 1] = {
+    { [PS2_SEQUENCE_PRINT_SCREEN] = 0x7C, [PS2_SEQUENCE_PAUSE] = 0x77 },
+    { [PS2_SEQUENCE_PRINT_SCREEN] = 0x37, [PS2_SEQUENCE_PAUSE] = 0x45 }
+};
+
+/* Private function prototypes -----------------------------------------------*/
+static const PS2_SequenceTemplate_t *ps2_sequence_template(uint8_t descriptor);
+static uint8_t ps2_sequence_key_bytes(uint8_t descriptor, uint8_t key, uint8_t *data);
+
+/* Exported functions --------------------------------------------------------*/
+
+/**
+ * @brief  Create a scan code standing for a pooled sequence
+ * @note   The sequence is taken from the templates of the current scan
+ *         code set
+ * @param  scancode: Pointer to scan code structure
+ * @param  descriptor: Sequence descriptor
+ * @param  key: Code of the wrapped E0 key in the current set, ignored by fixed sequences
+ * @retval PS2_PROTOCOL_OK if successful, PS2_PROTOCOL_ERROR otherwise
+ */
+PS2_ProtocolStatus_t ps2_sequence_create(PS2_ScanCode_t *scancode, uint8_t descriptor, uint8_t key)
+{
+    if (ps2_get_scan_code_set() == PS2_SCAN_CODE_SET_1) {
+        descriptor |= PS2_SEQUENCE_SET1;
+    }
+
+    if (scancode == NULL || ps2_sequence_length(descriptor) == 0) {
+        return PS2_PROTOCOL_ERROR;
+    }
+
+    scancode->data[0] = PS2_SEQUENCE_CODE;
+    scancode->data[1] = descriptor;
+    scancode->data[2] = key;
+    scancode->length = PS2_SEQUENCE_CODE_LENGTH;
+
+    return PS2_PROTOCOL_OK;
+}
+
+/**
+ * @brief  Check if a scan code stands for a pooled sequence
+ * @param  scancode: Pointer to scan code
+ * @retval 1 if it was made by ps2_sequence_create(), 0 otherwise
+ */
+uint8_t ps2_sequence_is_code(const PS2_ScanCode_t *scancode)
+{
+    return (scancode != NULL && scancode->length == PS2_SEQUENCE_CODE_LENGTH &&
+            scancode->data[0] == PS2_SEQUENCE_CODE);
+}
+
+/**
+ * @brief  Get the number of bytes of a sequence
+ * @param  descriptor: Sequence descriptor
+ * @retval Number of bytes, 0 if the descriptor is invalid or sends nothing
+ */
+uint8_t ps2_sequence_length(uint8_t descriptor)
+{
+    const PS2_SequenceTemplate_t *sequence = ps2_sequence_template(descriptor);
+    uint8_t key_bytes[PS2_SEQUENCE_KEY_MAX_LENGTH];
+
+    if (sequence == NULL) {
+        return 0;
+    }
+
+    return (uint8_t)(sequence->head.length + sequence->tail.length +
+                     (sequence->wraps_key ? ps2_sequence_key_bytes(descriptor, 0, key_bytes) : 0));
+}
+
+/**
+ * @brief  Get one byte of a sequence
+ * @note   Called by the transmitter for every byte it sends
+ * @param  descriptor: Sequence descriptor
+ * @param  key: Code of the wrapped E0 key
+ * @param  position: Byte position, below ps2_sequence_length()
+ * @retval Byte at position
+ */
+uint8_t ps2_sequence_byte(uint8_t descriptor, uint8_t key, uint8_t position)
+{
+    const PS2_SequenceTemplate_t *sequence = ps2_sequence_template(descriptor);
+    uint8_t key_bytes[PS2_SEQUENCE_KEY_MAX_LENGTH];
+    uint8_t key_length;
+
+    if (sequence == NULL) {
+        return PS2_SCANCODE_ERROR;
+    }
+
+    if (position < sequence->head.length) {
+        return sequence_pool[sequence->head.offset + position];
+    }
+    position -= sequence->head.length;
+
+    if (sequence->wraps_key) {
+        key_length = ps2_sequence_key_bytes(descriptor, key, key_bytes);
+        if (position < key_length) {
+            return key_bytes[position];
+        }
+        position -= key_length;
+    }
+
+    return sequence_pool[sequence->tail.offset + position];
+}
+
+/**
+ * @brief  Copy a whole sequence
+ * @param  descriptor: Sequence descriptor
+ * @param  key: Code of the wrapped E0 key
+ * @param  data: Buffer of PS2_SEQUENCE_MAX_LENGTH bytes
+ * @retval Number of bytes copied
+ */
+uint8_t ps2_sequence_copy(uint8_t descriptor, uint8_t key, uint8_t *data)
+{
+    const PS2_SequenceTemplate_t *sequence = ps2_sequence_template(descriptor);
+    uint8_t length = 0;
+
+    if (sequence == NULL || data == NULL) {
+        return 0;
+    }
+
+    memcpy(&data[length], &sequence_pool[sequence->head.offset], sequence->head.length);
+    length += sequence->head.length;
+    if (sequence->wraps_key) {
+        length += ps2_sequence_key_bytes(descriptor, key, &data[length]);
+    }
+    memcpy(&data[length], &sequence_pool[sequence->tail.offset], sequence->tail.length);
+    length += sequence->tail.length;
+
+    return length;
+}
+
+/**
+ * @brief  Get the key index of a sequence
+ * @note   Shared by make and break, so the queue never lets the break of
+ *         a key overtake its make
+ * @param  descriptor: Sequence descriptor
+ * @param  key: Code of the wrapped E0 key
+ * @retval Key index in PS2_SHADOW_INDEX() space
+ */
+uint16_t ps2_sequence_key(uint8_t descriptor, uint8_t key)
+{
+    uint8_t set = PS2_SEQUENCE_TEMPLATE_SET(descriptor);
+
+    switch (PS2_SEQUENCE_INDEX(descriptor)) {
+        case PS2_SEQUENCE_PRINT_SCREEN:
+            return PS2_SHADOW_INDEX(sequence_key_codes[set][PS2_SEQUENCE_PRINT_SCREEN], 1);
+
+        case PS2_SEQUENCE_PAUSE:
+            return PS2_SHADOW_INDEX(sequence_key_codes[set][PS2_SEQUENCE_PAUSE], 0);
+
+        default:
+            return PS2_SHADOW_INDEX(key, 1);
+    }
+}
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+ * @brief  Look up the template of a descriptor
+ * @param  descriptor: Sequence descriptor
+ * @retval Make or break template, NULL if the descriptor sends nothing
+ */
+static const PS2_SequenceTemplate_t *ps2_sequence_template(uint8_t descriptor)
+{
+    const PS2_SequenceTemplate_t *sequence;
+
+    if (PS2_SEQUENCE_INDEX(descriptor) >= PS2_SEQUENCE_COUNT) {
+        return NULL;
+    }
+
+    sequence = &sequence_templates[PS2_SEQUENCE_TEMPLATE_SET(descriptor)][PS2_SEQUENCE_INDEX(descriptor)]
+                                  [(descriptor & PS2_SEQUENCE_BREAK) ? 1 : 0];
+    if (sequence->head.length == 0 && sequence->tail.length == 0 && !sequence->wraps_key) {
+        return NULL;
+    }
+
+    return sequence;
+}
+
+/**
+ * @brief  Build the E0 make or break code of a wrapped key
+ * @param  descriptor: Sequence descriptor
+ * @param  key: Code of the wrapped E0 key
+ * @param  data: Buffer of PS2_SEQUENCE_KEY_MAX_LENGTH bytes
+ * @retval Number of bytes
+ */
+static uint8_t ps2_sequence_key_bytes(uint8_t descriptor, uint8_t key, uint8_t *data)
+{
+    uint8_t length = 0;
+
+    data[length++] = PS2_EXTENDED_CODE_PREFIX;
+    if (descriptor & PS2_SEQUENCE_SET1) {
+        data[length++] = (descriptor & PS2_SEQUENCE_BREAK) ? (uint8_t)(key | PS2_SET1_BREAK_BIT) : key;
+    } else {
+        if (descriptor & PS2_SEQUENCE_BREAK) {
+            data[length++] = PS2_BREAK_CODE_PREFIX;
+        }
+        data[length++] = key;
+    }
+
+    return length;
+}
@@ -0,0 +1,181 @@
+/**
+ ******************************************************************************
+ * @file    ps2_shadow.c
+ * @brief   Host-believed PS/2 key state for STM32F411
+ * @author  STM32F411 USB-PS2 Project
+ * @version 1.0.0
+ * @date    2024
+ *
+ * @description
+ * Decodes the Set 2 scan code bytes the transmitter has confirmed as sent
+ * and keeps a bitmap of the keys the PS/2 host therefore believes are held.
+ * Bytes that are lost or never sent do not reach the shadow, so comparing
+ * it with the USB keyboard state reveals any drift between the two. The
+ * prefix state mirrors the host decoder, so a sequence cut short by a
+ * queue flush is misread here exactly as the host misreads it.
+ *
+ * The two codes following an E1 prefix belong to the Pause sequence and
+ * change no key state. Neither do the fake Shift codes (Set 2 E0 12 and
+ * E0 59) that wrap Print Screen and the navigation keys; the host ignores
+ * them. Bytes are decoded in the current scan code set; in Set 1 bit 7
+ * marks a release and key codes are stored without it. A Set 3 key the
+ * host made make-only is never held, as no break code will follow.
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include "ps2_shadow.h"
+#include "ps2_protocol.h"
+#include <string.h>
+
+/* Private typedef -----------------------------------------------------------*/
+
+/* Private define ------------------------------------------------------------*/
+#define PS2_SHADOW_PAUSE_CODES  2       ///< Codes after each E1 prefix
+
+/* Private macro -------------------------------------------------------------*/
+
+/* Private variables ---------------------------------------------------------*/
+static uint8_t shadow_state[PS2_SHADOW_BYTES];
+static uint8_t prefix_extended = 0;
+static uint8_t prefix_break = 0;
+static uint8_t prefix_pause = 0;
+
+/* Private function prototypes -----------------------------------------------*/
+static void ps2_shadow_decode_byte(uint8_t *state, uint8_t data, uint8_t *extended, uint8_t *release,
+                                   uint8_t *pause);
+
+/* Exported functions --------------------------------------------------------*/
+
+/**
+ * @brief  Initialize host key state shadow
+ * @retval None
+ */
+void ps2_shadow_init(void)
+{
+    ps2_shadow_clear();
+}
+
+/**
+ * @brief  Update the shadow with a scan code byte the host has received
+ * @note   Call only for scan code bytes, not for command responses
+ * @param  data: Byte confirmed sent
+ * @retval None
+ */
+void ps2_shadow_byte_sent(uint8_t data)
+{
+    ps2_shadow_decode_byte(shadow_state, data, &prefix_extended, &prefix_break, &prefix_pause);
+}
+
+/**
+ * @brief  Apply a complete scan code sequence to a key bitmap
+ * @note   Decodes like the shadow, without touching the shadow itself
+ * @param  state: Bitmap of PS2_SHADOW_BYTES bytes to update
+ * @param  data: Sequence bytes
+ * @param  length: Number of bytes
+ * @retval None
+ */
+void ps2_shadow_decode(uint8_t *state, const uint8_t *data, uint8_t length)
+{
+    uint8_t extended = 0;
+    uint8_t release = 0;
+    uint8_t pause = 0;
+
+    for (uint8_t i = 0; i < length; i++) {
+        ps2_shadow_decode_byte(state, data[i], &extended, &release, &pause);
+    }
+}
+
+/**
+ * @brief  Forget all held keys
+ * @note   Used when the host resets the keyboard
+ * @retval None
+ */
+void ps2_shadow_clear(void)
+{
+    memset(shadow_state, 0, sizeof(shadow_state));
+    prefix_extended = 0;
+    prefix_break = 0;
+    prefix_pause = 0;
+}
+
+/**
+ * @brief  Check if the host believes a key is held
+ * @param  code: Set 2 key code
+ * @param  extended: 1 for E0 codes
+ * @retval 1 if held, 0 otherwise
+ */
+uint8_t ps2_shadow_is_held(uint8_t code, uint8_t extended)
+{
+    uint16_t index = PS2_SHADOW_INDEX(code, extended);
+
+    return (shadow_state[index >> 3] >> (index & 7U)) & 1U;
+}
+
+/**
+ * @brief  Get the host key state bitmap
+ * @note   Bit PS2_SHADOW_INDEX(code, extended) is set for each held key
+ * @retval Pointer to PS2_SHADOW_BYTES bytes
+ */
+const uint8_t *ps2_shadow_get_state(void)
+{
+    return shadow_state;
+}
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+ * @brief  Decode one Set 2 byte into a key bitmap
+ * @param  state: Bitmap of PS2_SHADOW_BYTES bytes
+ * @param  data: Byte
+ * @param  extended: E0 prefix seen (input/output)
+ * @param  release: F0 prefix seen (input/output)
+ * @param  pause: Pause codes still expected (input/output)
+ * @retval None
+ */
+static void ps2_shadow_decode_byte(uint8_t *state, uint8_t data, uint8_t *extended, uint8_t *release,
+                                   uint8_t *pause)
+{
+    uint8_t set1 = (ps2_get_scan_code_set() == PS2_SCAN_CODE_SET_1);
+    uint16_t index;
+
+    if (data == PS2_EXTENDED_CODE_PREFIX) {
+        *extended = 1;
+        return;
+    }
+
+    if (data == PS2_BREAK_CODE_PREFIX && !set1) {
+        *release = 1;
+        return;
+    }
+
+    if (data == PS2_PAUSE_CODE_PREFIX) {
+        *pause = PS2_SHADOW_PAUSE_CODES;
+        return;
+    }
+
+    if (set1) {
+        *release = (data & PS2_SET1_BREAK_BIT) ? 1 : 0;
+        data &= (uint8_t)~PS2_SET1_BREAK_BIT;
+    }
+
+    if (*pause != 0) {
+        /* Part of the Pause sequence */
+        (*pause)--;
+    } else if (*extended && (set1 ? (data == PS2_SET1_LEFT_SHIFT_CODE || data == PS2_SET1_RIGHT_SHIFT_CODE)
+                                  : (data == PS2_LEFT_SHIFT_CODE || data == PS2_RIGHT_SHIFT_CODE))) {
+        /* Fake Shift around another key */
+    } else if (!*release && ps2_get_scan_code_set() == PS2_SCAN_CODE_SET_3 && !ps2_set3_key_breaks(data)) {
+        /* Set 3 make-only key: the host never sees it held */
+    } else {
+        index = PS2_SHADOW_INDEX(data, *extended);
+        if (*release) {
+            state[index >> 3] &= (uint8_t)~(1U << (index & 7U));
+        } else {
+            state[index >> 3] |= (uint8_t)(1U << (index & 7U));
+        }
+    }
+
+    *extended = 0;
+    *release = 0;
+}
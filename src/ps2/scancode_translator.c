@@ -11,7 +11,15 @@
 /* Includes ------------------------------------------------------------------*/
 #include "scancode_translator.h"
 #include "ps2_protocol.h"
+#include "ps2_queue.h"
+#include "ps2_command.h"
+#include "ps2_shadow.h"
+#include "ps2_sequence.h"
 #include "keyboard_handler.h"
+#include "key_remap.h"
+#include "macro_engine.h"
+#include "chord_detector.h"
+#include "stm32f4xx_hal.h"
 
 /* Private typedef -----------------------------------------------------------*/
 /**
@@ -20,17 +28,50 @@
 typedef struct {
     uint8_t usb_key;        ///< USB HID key code
     uint8_t ps2_key;        ///< PS/2 scan code
-    uint8_t is_extended;    ///< 1 if extended key, 0 otherwise
+    uint8_t flags;          ///< KEY_* flags
 } KeyMapping_t;
 
+/**
+ * @brief USB key sent as a pooled sequence
+ */
+typedef struct {
+    uint8_t usb_key;        ///< USB HID key code
+    uint8_t sequence;       ///< PS2_SEQUENCE_* number
+} SequenceMapping_t;
+
 /* Private define ------------------------------------------------------------*/
-#define MAX_TRANSLATION_BUFFER  8   ///< Maximum simultaneous key translations
+#define MAX_TRANSLATION_BUFFER  KEYBOARD_REPORT_MAX_EVENTS  ///< Maximum events and scan codes per report
+
+/* Key mapping flags */
+#define KEY_EXTENDED            0x01    ///< E0 prefixed key
+#define KEY_NAVIGATION          0x03    ///< E0 navigation key, wrapped in fake Shift codes
+#define KEY_SHIFTS              (USB_HID_MODIFIER_LEFT_SHIFT | USB_HID_MODIFIER_RIGHT_SHIFT)
+
+/* Set 1 mapping table entries: 7-bit code, bit 7 for E0 keys */
+#define SET1_EXTENDED           0x80
+#define SET1_KEYPAD_FIRST       0x47    ///< First E0 code shared with the numeric keypad (Home)
+#define SET1_KEYPAD_LAST        0x53    ///< Last E0 code shared with the numeric keypad (Delete)
 
 /* Private macro -------------------------------------------------------------*/
 
 /* Private variables ---------------------------------------------------------*/
 static TranslatorStatus_t translator_status = TRANSLATOR_INIT;
-static USB_HID_KeyboardData_t last_usb_state;
+static uint8_t usb_held[USB_HID_USAGE_BITMAP_SIZE];   ///< USB usages down, as last translated
+static uint8_t typematic_usage = 0;                   ///< Usage repeating while held, 0 if none
+static uint32_t typematic_due_ms = 0;                 ///< Tick of the next typematic repeat
+static volatile uint8_t release_pending = 0;          ///< A report overflowed the queue, held keys wait for release
+
+/* Modifier usages 0xE0-0xE7, indexed by modifier bit */
+static const KeyMapping_t modifier_mapping_table[USB_HID_MODIFIER_COUNT] = {
+    {0xE0, 0x14, 0},    /* Left Ctrl */
+    {0xE1, 0x12, 0},    /* Left Shift */
+    {0xE2, 0x11, 0},    /* Left Alt */
+    {0xE3, 0x1F, 1},    /* Left GUI */
+    {0xE4, 0x14, 1},    /* Right Ctrl */
+    {0xE5, 0x59, 0},    /* Right Shift */
+    {0xE6, 0x11, 1},    /* Right Alt */
+    {0xE7, 0x27, 1}     /* Right GUI */
+};
 
 /* USB HID to PS/2 scan code mapping table */
 static const KeyMapping_t key_mapping_table[] = {
@@ -56,31 +97,148 @@ static const KeyMapping_t key_mapping_table[] = {
     {USB_HID_KEY_BACKSPACE, 0x66, 0},   {USB_HID_KEY_TAB, 0x0D, 0},
     {USB_HID_KEY_SPACE, 0x29, 0},
     
+    /* Punctuation */
+    {USB_HID_KEY_MINUS, 0x4E, 0},         {USB_HID_KEY_EQUAL, 0x55, 0},
+    {USB_HID_KEY_LEFT_BRACKET, 0x54, 0},  {USB_HID_KEY_RIGHT_BRACKET, 0x5B, 0},
+    {USB_HID_KEY_BACKSLASH, 0x5D, 0},     {USB_HID_KEY_SEMICOLON, 0x4C, 0},
+    {USB_HID_KEY_APOSTROPHE, 0x52, 0},    {USB_HID_KEY_GRAVE, 0x0E, 0},
+    {USB_HID_KEY_COMMA, 0x41, 0},         {USB_HID_KEY_PERIOD, 0x49, 0},
+    {USB_HID_KEY_SLASH, 0x4A, 0},
+    
     /* Function keys */
     {USB_HID_KEY_F1, 0x05, 0},  {USB_HID_KEY_F2, 0x06, 0},  {USB_HID_KEY_F3, 0x04, 0},
     {USB_HID_KEY_F4, 0x0C, 0},  {USB_HID_KEY_F5, 0x03, 0},  {USB_HID_KEY_F6, 0x0B, 0},
     {USB_HID_KEY_F7, 0x83, 0},  {USB_HID_KEY_F8, 0x0A, 0},  {USB_HID_KEY_F9, 0x01, 0},
     {USB_HID_KEY_F10, 0x09, 0}, {USB_HID_KEY_F11, 0x78, 0}, {USB_HID_KEY_F12, 0x07, 0},
     
-    /* Extended keys */
-    {USB_HID_KEY_INSERT, 0x70, 1},      {USB_HID_KEY_HOME, 0x6C, 1},
-    {USB_HID_KEY_PAGE_UP, 0x7D, 1},     {USB_HID_KEY_DELETE, 0x71, 1},
-    {USB_HID_KEY_END, 0x69, 1},         {USB_HID_KEY_PAGE_DOWN, 0x7A, 1},
-    {USB_HID_KEY_RIGHT_ARROW, 0x74, 1}, {USB_HID_KEY_LEFT_ARROW, 0x6B, 1},
-    {USB_HID_KEY_DOWN_ARROW, 0x72, 1},  {USB_HID_KEY_UP_ARROW, 0x75, 1},
+    /* Navigation keys */
+    {USB_HID_KEY_INSERT, 0x70, KEY_NAVIGATION},      {USB_HID_KEY_HOME, 0x6C, KEY_NAVIGATION},
+    {USB_HID_KEY_PAGE_UP, 0x7D, KEY_NAVIGATION},     {USB_HID_KEY_DELETE, 0x71, KEY_NAVIGATION},
+    {USB_HID_KEY_END, 0x69, KEY_NAVIGATION},         {USB_HID_KEY_PAGE_DOWN, 0x7A, KEY_NAVIGATION},
+    {USB_HID_KEY_RIGHT_ARROW, 0x74, KEY_NAVIGATION}, {USB_HID_KEY_LEFT_ARROW, 0x6B, KEY_NAVIGATION},
+    {USB_HID_KEY_DOWN_ARROW, 0x72, KEY_NAVIGATION},  {USB_HID_KEY_UP_ARROW, 0x75, KEY_NAVIGATION},
     
     /* End of table marker */
     {0x00, 0x00, 0}
 };
 
+/* USB HID usage to Set 1 code, indexed by usage; 0 if unmapped */
+static const uint8_t set1_mapping_table[256] = {
+    /* Letters */
+    [USB_HID_KEY_A] = 0x1E, [USB_HID_KEY_B] = 0x30, [USB_HID_KEY_C] = 0x2E, [USB_HID_KEY_D] = 0x20,
+    [USB_HID_KEY_E] = 0x12, [USB_HID_KEY_F] = 0x21, [USB_HID_KEY_G] = 0x22, [USB_HID_KEY_H] = 0x23,
+    [USB_HID_KEY_I] = 0x17, [USB_HID_KEY_J] = 0x24, [USB_HID_KEY_K] = 0x25, [USB_HID_KEY_L] = 0x26,
+    [USB_HID_KEY_M] = 0x32, [USB_HID_KEY_N] = 0x31, [USB_HID_KEY_O] = 0x18, [USB_HID_KEY_P] = 0x19,
+    [USB_HID_KEY_Q] = 0x10, [USB_HID_KEY_R] = 0x13, [USB_HID_KEY_S] = 0x1F, [USB_HID_KEY_T] = 0x14,
+    [USB_HID_KEY_U] = 0x16, [USB_HID_KEY_V] = 0x2F, [USB_HID_KEY_W] = 0x11, [USB_HID_KEY_X] = 0x2D,
+    [USB_HID_KEY_Y] = 0x15, [USB_HID_KEY_Z] = 0x2C,
+    
+    /* Numbers */
+    [USB_HID_KEY_1] = 0x02, [USB_HID_KEY_2] = 0x03, [USB_HID_KEY_3] = 0x04, [USB_HID_KEY_4] = 0x05,
+    [USB_HID_KEY_5] = 0x06, [USB_HID_KEY_6] = 0x07, [USB_HID_KEY_7] = 0x08, [USB_HID_KEY_8] = 0x09,
+    [USB_HID_KEY_9] = 0x0A, [USB_HID_KEY_0] = 0x0B,
+    
+    /* Special keys */
+    [USB_HID_KEY_ENTER] = 0x1C,     [USB_HID_KEY_ESCAPE] = 0x01,
+    [USB_HID_KEY_BACKSPACE] = 0x0E, [USB_HID_KEY_TAB] = 0x0F,
+    [USB_HID_KEY_SPACE] = 0x39,
+    
+    /* Punctuation */
+    [USB_HID_KEY_MINUS] = 0x0C,        [USB_HID_KEY_EQUAL] = 0x0D,
+    [USB_HID_KEY_LEFT_BRACKET] = 0x1A, [USB_HID_KEY_RIGHT_BRACKET] = 0x1B,
+    [USB_HID_KEY_BACKSLASH] = 0x2B,    [USB_HID_KEY_SEMICOLON] = 0x27,
+    [USB_HID_KEY_APOSTROPHE] = 0x28,   [USB_HID_KEY_GRAVE] = 0x29,
+    [USB_HID_KEY_COMMA] = 0x33,        [USB_HID_KEY_PERIOD] = 0x34,
+    [USB_HID_KEY_SLASH] = 0x35,
+    
+    /* Function keys */
+    [USB_HID_KEY_F1] = 0x3B,  [USB_HID_KEY_F2] = 0x3C,  [USB_HID_KEY_F3] = 0x3D,  [USB_HID_KEY_F4] = 0x3E,
+    [USB_HID_KEY_F5] = 0x3F,  [USB_HID_KEY_F6] = 0x40,  [USB_HID_KEY_F7] = 0x41,  [USB_HID_KEY_F8] = 0x42,
+    [USB_HID_KEY_F9] = 0x43,  [USB_HID_KEY_F10] = 0x44, [USB_HID_KEY_F11] = 0x57, [USB_HID_KEY_F12] = 0x58,
+    
+    /* Navigation keys */
+    [USB_HID_KEY_INSERT] = SET1_EXTENDED | 0x52,      [USB_HID_KEY_HOME] = SET1_EXTENDED | 0x47,
+    [USB_HID_KEY_PAGE_UP] = SET1_EXTENDED | 0x49,     [USB_HID_KEY_DELETE] = SET1_EXTENDED | 0x53,
+    [USB_HID_KEY_END] = SET1_EXTENDED | 0x4F,         [USB_HID_KEY_PAGE_DOWN] = SET1_EXTENDED | 0x51,
+    [USB_HID_KEY_RIGHT_ARROW] = SET1_EXTENDED | 0x4D, [USB_HID_KEY_LEFT_ARROW] = SET1_EXTENDED | 0x4B,
+    [USB_HID_KEY_DOWN_ARROW] = SET1_EXTENDED | 0x50,  [USB_HID_KEY_UP_ARROW] = SET1_EXTENDED | 0x48,
+    
+    /* Modifiers, usages 0xE0-0xE7 */
+    [0xE0] = 0x1D,                  /* Left Ctrl */
+    [0xE1] = 0x2A,                  /* Left Shift */
+    [0xE2] = 0x38,                  /* Left Alt */
+    [0xE3] = SET1_EXTENDED | 0x5B,  /* Left GUI */
+    [0xE4] = SET1_EXTENDED | 0x1D,  /* Right Ctrl */
+    [0xE5] = 0x36,                  /* Right Shift */
+    [0xE6] = SET1_EXTENDED | 0x38,  /* Right Alt */
+    [0xE7] = SET1_EXTENDED | 0x5C   /* Right GUI */
+};
+
+/* USB HID usage to Set 3 code, indexed by usage; 0 if unmapped */
+static const uint8_t set3_mapping_table[256] = {
+    /* Letters */
+    [USB_HID_KEY_A] = 0x1C, [USB_HID_KEY_B] = 0x32, [USB_HID_KEY_C] = 0x21, [USB_HID_KEY_D] = 0x23,
+    [USB_HID_KEY_E] = 0x24, [USB_HID_KEY_F] = 0x2B, [USB_HID_KEY_G] = 0x34, [USB_HID_KEY_H] = 0x33,
+    [USB_HID_KEY_I] = 0x43, [USB_HID_KEY_J] = 0x3B, [USB_HID_KEY_K] = 0x42, [USB_HID_KEY_L] = 0x4B,
+    [USB_HID_KEY_M] = 0x3A, [USB_HID_KEY_N] = 0x31, [USB_HID_KEY_O] = 0x44, [USB_HID_KEY_P] = 0x4D,
+    [USB_HID_KEY_Q] = 0x15, [USB_HID_KEY_R] = 0x2D, [USB_HID_KEY_S] = 0x1B, [USB_HID_KEY_T] = 0x2C,
+    [USB_HID_KEY_U] = 0x3C, [USB_HID_KEY_V] = 0x2A, [USB_HID_KEY_W] = 0x1D, [USB_HID_KEY_X] = 0x22,
+    [USB_HID_KEY_Y] = 0x35, [USB_HID_KEY_Z] = 0x1A,
+    
+    /* Numbers */
+    [USB_HID_KEY_1] = 0x16, [USB_HID_KEY_2] = 0x1E, [USB_HID_KEY_3] = 0x26, [USB_HID_KEY_4] = 0x25,
+    [USB_HID_KEY_5] = 0x2E, [USB_HID_KEY_6] = 0x36, [USB_HID_KEY_7] = 0x3D, [USB_HID_KEY_8] = 0x3E,
+    [USB_HID_KEY_9] = 0x46, [USB_HID_KEY_0] = 0x45,
+    
+    /* Special keys */
+    [USB_HID_KEY_ENTER] = 0x5A,     [USB_HID_KEY_ESCAPE] = 0x08,
+    [USB_HID_KEY_BACKSPACE] = 0x66, [USB_HID_KEY_TAB] = 0x0D,
+    [USB_HID_KEY_SPACE] = 0x29,
+    [USB_HID_KEY_PRINT_SCREEN] = 0x57, [USB_HID_KEY_PAUSE] = 0x62,
+    
+    /* Punctuation */
+    [USB_HID_KEY_MINUS] = 0x4E,        [USB_HID_KEY_EQUAL] = 0x55,
+    [USB_HID_KEY_LEFT_BRACKET] = 0x54, [USB_HID_KEY_RIGHT_BRACKET] = 0x5B,
+    [USB_HID_KEY_BACKSLASH] = 0x5C,    [USB_HID_KEY_SEMICOLON] = 0x4C,
+    [USB_HID_KEY_APOSTROPHE] = 0x52,   [USB_HID_KEY_GRAVE] = 0x0E,
+    [USB_HID_KEY_COMMA] = 0x41,        [USB_HID_KEY_PERIOD] = 0x49,
+    [USB_HID_KEY_SLASH] = 0x4A,
+    
+    /* Function keys */
+    [USB_HID_KEY_F1] = 0x07,  [USB_HID_KEY_F2] = 0x0F,  [USB_HID_KEY_F3] = 0x17,  [USB_HID_KEY_F4] = 0x1F,
+    [USB_HID_KEY_F5] = 0x27,  [USB_HID_KEY_F6] = 0x2F,  [USB_HID_KEY_F7] = 0x37,  [USB_HID_KEY_F8] = 0x3F,
+    [USB_HID_KEY_F9] = 0x47,  [USB_HID_KEY_F10] = 0x4F, [USB_HID_KEY_F11] = 0x56, [USB_HID_KEY_F12] = 0x5E,
+    
+    /* Navigation keys */
+    [USB_HID_KEY_INSERT] = 0x67,      [USB_HID_KEY_HOME] = 0x6E,
+    [USB_HID_KEY_PAGE_UP] = 0x6F,     [USB_HID_KEY_DELETE] = 0x64,
+    [USB_HID_KEY_END] = 0x65,         [USB_HID_KEY_PAGE_DOWN] = 0x6D,
+    [USB_HID_KEY_RIGHT_ARROW] = 0x6A, [USB_HID_KEY_LEFT_ARROW] = 0x61,
+    [USB_HID_KEY_DOWN_ARROW] = 0x60,  [USB_HID_KEY_UP_ARROW] = 0x63,
+    
+    /* Modifiers, usages 0xE0-0xE7 */
+    [0xE0] = 0x11,  /* Left Ctrl */
+    [0xE1] = 0x12,  /* Left Shift */
+    [0xE2] = 0x19,  /* Left Alt */
+    [0xE3] = 0x8B,  /* Left GUI */
+    [0xE4] = 0x58,  /* Right Ctrl */
+    [0xE5] = 0x59,  /* Right Shift */
+    [0xE6] = 0x39,  /* Right Alt */
+    [0xE7] = 0x8C   /* Right GUI */
+};
+
+/* Keys whose scan codes do not fit a PS2_ScanCode_t */
+static const SequenceMapping_t sequence_mapping_table[] = {
+    {USB_HID_KEY_PRINT_SCREEN, PS2_SEQUENCE_PRINT_SCREEN},
+    {USB_HID_KEY_PAUSE, PS2_SEQUENCE_PAUSE}
+};
+
 /* Private function prototypes -----------------------------------------------*/
-static uint8_t find_ps2_scancode(uint8_t usb_key, uint8_t *ps2_key, uint8_t *is_extended);
-static TranslatorStatus_t translate_modifier_keys(uint8_t old_modifier, uint8_t new_modifier, 
-                                                 PS2_ScanCode_t *scancodes, uint8_t *count);
-static TranslatorStatus_t translate_regular_keys(const USB_HID_KeyboardData_t *old_state,
-                                                const USB_HID_KeyboardData_t *new_state,
-                                                PS2_ScanCode_t *scancodes, uint8_t *count);
-static uint8_t is_key_in_array(uint8_t key, const uint8_t *array, uint8_t array_size);
+static uint8_t find_ps2_scancode(uint8_t usb_key, uint8_t *ps2_key, uint8_t *flags);
+static uint8_t translate_event(uint8_t usage, uint8_t press, uint8_t modifiers, PS2_ScanCode_t *scancode);
+static uint8_t navigation_sequence(uint8_t modifiers);
+static uint8_t typematic_allowed(uint8_t usage);
+static void build_key_state(const uint8_t *usb_state, uint8_t *state);
 
 /* Exported functions --------------------------------------------------------*/
 
@@ -91,62 +249,326 @@ static uint8_t is_key_in_array(uint8_t key, const uint8_t *array, uint8_t array_
  */
 TranslatorStatus_t scancode_translator_init(void)
 {
-    /* Clear last USB state */
-    memset(&last_usb_state, 0, sizeof(USB_HID_KeyboardData_t));
+    /* No USB key down */
+    memset(usb_held, 0, sizeof(usb_held));
+    typematic_usage = 0;
+    release_pending = 0;
+    key_remap_init();
+    macro_engine_init();
+    chord_detector_init();
     
     translator_status = TRANSLATOR_READY;
     return TRANSLATOR_OK;
 }
 
 /**
- * @brief  Translate USB HID keyboard data to PS/2 scan code
- * @note   Converts USB keyboard state to PS/2 scan codes
- * @param  usb_data: Pointer to USB HID keyboard data
- * @param  ps2_scancode: Pointer to store PS/2 scan code
- * @retval TRANSLATOR_OK if successful, TRANSLATOR_ERROR otherwise
+ * @brief  Translate the key events of one report and queue the PS/2 scan codes
+ * @note   Every make and break code generated by the report is queued for
+ *         the PS/2 transmitter at once; the queue sends releases and
+ *         modifier changes ahead of presses. If the queue cannot take
+ *         them, the report is dropped and no further report is translated
+ *         until the main loop sees scancode_translator_check_overflow(),
+ *         resets the keyboard handler and releases all held keys. The
+ *         release clears the queue, which must not happen from the USB
+ *         interrupt while a byte is on the wire.
+ *         Events are checked for converter hotkey chords and go through
+ *         the key remap layers first, if the keymap has any; a key the
+ *         keymap binds to a macro starts typing it.
+ * @param  events: Key events from keyboard_handler_get_events()
+ * @param  count: Number of events, at most KEYBOARD_REPORT_MAX_EVENTS
+ * @retval TRANSLATOR_OK if queued, TRANSLATOR_ERROR otherwise
  */
-TranslatorStatus_t scancode_translator_usb_to_ps2(const USB_HID_KeyboardData_t *usb_data, 
-                                                  PS2_ScanCode_t *ps2_scancode)
+TranslatorStatus_t scancode_translator_process_events(const KeyboardEvent_t *events, uint8_t count)
 {
     PS2_ScanCode_t temp_scancodes[MAX_TRANSLATION_BUFFER];
+    KeyboardEvent_t chorded[MAX_TRANSLATION_BUFFER];
+    KeyboardEvent_t remapped[MAX_TRANSLATION_BUFFER];
     uint8_t scancode_count = 0;
+    uint8_t modifiers = usb_held[USB_HID_MODIFIER_USAGE >> 3];
     
-    if (usb_data == NULL || ps2_scancode == NULL) {
+    if (events == NULL || count > MAX_TRANSLATION_BUFFER || translator_status != TRANSLATOR_READY ||
+        release_pending) {
         return TRANSLATOR_ERROR;
     }
     
-    if (translator_status != TRANSLATOR_READY) {
-        return TRANSLATOR_ERROR;
+    if (chord_detector_active()) {
+        count = chord_detector_events(events, count, chorded);
+        events = chorded;
     }
     
-    /* Translate modifier key changes */
-    if (translate_modifier_keys(last_usb_state.modifier, usb_data->modifier, 
-                               temp_scancodes, &scancode_count) != TRANSLATOR_OK) {
-        return TRANSLATOR_ERROR;
+    count = key_remap_events(events, count, remapped);
+    events = remapped;
+    
+    if (ps2_command_scanning_enabled()) {
+        for (uint8_t i = 0; i < count; i++) {
+            uint8_t press = events[i].flags & KEYBOARD_EVENT_PRESS;
+            
+            if (press && (events[i].usage & (uint8_t)~KEY_REMAP_MACRO_MASK) == KEY_REMAP_MACRO_KEY) {
+                (void)macro_engine_start(key_remap_macros[events[i].usage & KEY_REMAP_MACRO_MASK]);
+                continue;
+            }
+            
+            scancode_count += translate_event(events[i].usage, press, modifiers, &temp_scancodes[scancode_count]);
+            
+            /* Later keys of the report see this modifier change */
+            if (events[i].usage >= USB_HID_MODIFIER_USAGE) {
+                uint8_t bit = (uint8_t)(1U << (events[i].usage - USB_HID_MODIFIER_USAGE));
+                
+                modifiers = press ? (uint8_t)(modifiers | bit) : (uint8_t)(modifiers & ~bit);
+            }
+        }
     }
+    /* else: host disabled scanning - track the state without sending */
     
-    /* Translate regular key changes */
-    if (translate_regular_keys(&last_usb_state, usb_data, 
-                              &temp_scancodes[scancode_count], 
-                              &scancode_count) != TRANSLATOR_OK) {
+    if (scancode_count > 0 &&
+        ps2_queue_push_scancodes(temp_scancodes, scancode_count, PS2_QUEUE_CLASS_MAKE) != PS2_QUEUE_OK) {
+        /* Overflow - the host would miss these changes; the main loop
+         * releases the held keys */
+        release_pending = 1;
         return TRANSLATOR_ERROR;
     }
     
-    /* For simplicity, return the first scan code if multiple are generated */
-    /* A more sophisticated implementation would queue multiple scan codes */
-    if (scancode_count > 0) {
-        ps2_copy_scancode(ps2_scancode, &temp_scancodes[0]);
-    } else {
-        /* No changes detected */
-        ps2_scancode->length = 0;
+    for (uint8_t i = 0; i < count; i++) {
+        uint8_t usage = events[i].usage;
+        
+        if (events[i].flags & KEYBOARD_EVENT_PRESS) {
+            usb_held[usage >> 3] |= (uint8_t)(1U << (usage & 7U));
+            typematic_usage = typematic_allowed(usage) ? usage : 0;
+            if (typematic_usage != 0) {
+                uint16_t delay_ms, period_ms;
+                
+                ps2_command_get_typematic(&delay_ms, &period_ms);
+                typematic_due_ms = HAL_GetTick() + delay_ms;
+            }
+        } else {
+            usb_held[usage >> 3] &= (uint8_t)~(1U << (usage & 7U));
+            if (usage == typematic_usage) {
+                typematic_usage = 0;
+            }
+        }
+    }
+    
+    return TRANSLATOR_OK;
+}
+
+/**
+ * @brief  Translate buffered keyboard reports into the PS/2 queue
+ * @note   Takes the key events of one report at a time from the keyboard
+ *         handler until the PS/2 queue is congested; the rest stay
+ *         buffered. Called from the main loop and, with PS2_ISR_FAST_PATH,
+ *         from the USB completion interrupt, where max_reports bounds the
+ *         time spent. Not reentrant: the main loop masks the USB interrupt
+ *         around it.
+ * @param  max_reports: Most reports to translate, TRANSLATOR_SERVICE_ALL for no limit
+ * @param  translated: Pointer to store the number of reports taken, may be NULL
+ * @retval TRANSLATOR_OK, or TRANSLATOR_ERROR if a report did not fit the
+ *         queue and held keys wait for release
+ */
+TranslatorStatus_t scancode_translator_service(uint8_t max_reports, uint8_t *translated)
+{
+    KeyboardEvent_t events[MAX_TRANSLATION_BUFFER];
+    TranslatorStatus_t status = TRANSLATOR_OK;
+    uint8_t event_count;
+    uint8_t count = 0;
+    
+    while ((max_reports == TRANSLATOR_SERVICE_ALL || count < max_reports) && !ps2_queue_congested() &&
+           !release_pending && (event_count = keyboard_handler_get_events(events, MAX_TRANSLATION_BUFFER)) != 0) {
+        if (scancode_translator_process_events(events, event_count) != TRANSLATOR_OK) {
+            status = TRANSLATOR_ERROR;
+        }
+        if (count < 0xFF) {
+            count++;
+        }
+    }
+    
+    if (translated != NULL) {
+        *translated = count;
+    }
+    
+    return status;
+}
+
+/**
+ * @brief  Check for a report that did not fit the PS/2 queue
+ * @note   Reports an overflow once; the caller is expected to reset the
+ *         keyboard handler and call scancode_translator_release_all() from
+ *         the main loop, with the USB interrupt masked. Translation
+ *         resumes after the call.
+ * @retval 1 if held keys must be released, 0 otherwise
+ */
+uint8_t scancode_translator_check_overflow(void)
+{
+    uint8_t overflow;
+    
+    __disable_irq();
+    overflow = release_pending;
+    release_pending = 0;
+    __enable_irq();
+    
+    return overflow;
+}
+
+/**
+ * @brief  Release every key the PS/2 host believes is held
+ * @note   Queues break codes for all keys and modifiers sent as pressed.
+ *         They go out in the release class ahead of queued presses, except
+ *         where a make code of the same key is still queued; that break
+ *         follows its make, so the host ends up with every key released.
+ *         Called from the main loop on USB disconnect, USB error and
+ *         input or queue overflow; it may clear the queue. Held
+ *         layer and chord keys are forgotten as well.
+ * @retval TRANSLATOR_OK if queued, TRANSLATOR_ERROR otherwise
+ */
+TranslatorStatus_t scancode_translator_release_all(void)
+{
+    PS2_ScanCode_t temp_scancodes[MAX_TRANSLATION_BUFFER];
+    uint8_t scancode_count = 0;
+    
+    /* Modifiers first, then keys - the order the host pressed them in.
+     * The keys are released with no modifier left down. */
+    for (uint16_t n = 0; n < 256U; n++) {
+        uint8_t usage = (uint8_t)(n + USB_HID_MODIFIER_USAGE);
+        
+        if (((usb_held[usage >> 3] >> (usage & 7U)) & 1U) && scancode_count < MAX_TRANSLATION_BUFFER) {
+            scancode_count += translate_event(usage, 0, 0, &temp_scancodes[scancode_count]);
+        }
     }
     
-    /* Update last USB state */
-    memcpy(&last_usb_state, usb_data, sizeof(USB_HID_KeyboardData_t));
+    memset(usb_held, 0, sizeof(usb_held));
+    typematic_usage = 0;
+    key_remap_reset();
+    chord_detector_reset();
+    macro_engine_cancel();
+    
+    if (scancode_count == 0) {
+        return TRANSLATOR_OK;
+    }
+    
+    if (ps2_queue_push_scancodes(temp_scancodes, scancode_count, PS2_QUEUE_CLASS_MAKE) != PS2_QUEUE_OK) {
+        /* No room - releases matter more than stale queued traffic */
+        ps2_queue_clear();
+        if (ps2_queue_push_scancodes(temp_scancodes, scancode_count, PS2_QUEUE_CLASS_MAKE) != PS2_QUEUE_OK) {
+            return TRANSLATOR_ERROR;
+        }
+    }
     
     return TRANSLATOR_OK;
 }
 
+/**
+ * @brief  Reconcile the host key state with the USB keyboard state
+ * @note   Runs only while the PS/2 queue is empty, so every byte has been
+ *         confirmed sent and the shadow is final. Queues a make code for
+ *         each key that is down but not held by the host and a break code
+ *         for each key the host holds that is up. Cheap enough to call on
+ *         every idle pass of the main loop.
+ * @retval Number of corrective scan codes queued
+ */
+uint8_t scancode_translator_reconcile(void)
+{
+    uint8_t desired[PS2_SHADOW_BYTES];
+    const uint8_t *held;
+    PS2_ScanCode_t scancode;
+    uint8_t corrections = 0;
+    
+    if (translator_status != TRANSLATOR_READY || ps2_queue_count() != 0 ||
+        !ps2_command_scanning_enabled()) {
+        return 0;
+    }
+    
+    build_key_state(usb_held, desired);
+    held = ps2_shadow_get_state();
+    
+    for (uint16_t i = 0; i < PS2_SHADOW_BYTES; i++) {
+        uint8_t diff = desired[i] ^ held[i];
+        
+        for (uint8_t bit = 0; diff != 0; bit++, diff >>= 1) {
+            uint16_t index = (uint16_t)(i * 8U + bit);
+            uint8_t code = (uint8_t)(index & 0xFFU);
+            uint8_t is_extended = (index >= 256U);
+            
+            if ((diff & 1U) == 0) {
+                continue;
+            }
+            
+            if ((desired[i] >> bit) & 1U) {
+                if (is_extended) {
+                    ps2_create_extended_make_code(&scancode, code);
+                } else {
+                    ps2_create_make_code(&scancode, code);
+                }
+            } else {
+                if (is_extended) {
+                    ps2_create_extended_break_code(&scancode, code);
+                } else {
+                    ps2_create_break_code(&scancode, code);
+                }
+            }
+            
+            if (ps2_queue_push(scancode.data, scancode.length) != PS2_QUEUE_OK) {
+                return corrections;
+            }
+            corrections++;
+        }
+    }
+    
+    return corrections;
+}
+
+/**
+ * @brief  Repeat the make code of the last key pressed while it is held
+ * @note   Like a native keyboard only the most recently pressed key
+ *         repeats, after the delay and at the rate set by the host. Repeats
+ *         go to the queue's repeat class and are skipped while it is
+ *         congested; a late repeat is dropped, not caught up. Called from
+ *         the same context as the translator.
+ * @retval 1 if a repeat was queued, 0 otherwise
+ */
+uint8_t scancode_translator_typematic(void)
+{
+    PS2_ScanCode_t scancode;
+    uint16_t delay_ms, period_ms;
+    uint32_t now = HAL_GetTick();
+    
+    if (typematic_usage == 0 || (int32_t)(now - typematic_due_ms) < 0) {
+        return 0;
+    }
+    
+    ps2_command_get_typematic(&delay_ms, &period_ms);
+    typematic_due_ms = now + period_ms;
+    
+    if (translator_status != TRANSLATOR_READY || !ps2_command_scanning_enabled() || ps2_queue_congested() ||
+        !translate_event(typematic_usage, 1, usb_held[USB_HID_MODIFIER_USAGE >> 3], &scancode)) {
+        return 0;
+    }
+    
+    return ps2_queue_push_scancodes(&scancode, 1, PS2_QUEUE_CLASS_REPEAT) == PS2_QUEUE_OK;
+}
+
+/**
+ * @brief  Translate one key event for another module
+ * @note   Uses the current scan code set and, for navigation keys, the
+ *         given modifiers; nothing is queued or tracked
+ * @param  usage: HID usage, modifiers as USB_HID_MODIFIER_USAGE + bit
+ * @param  press: Non-zero for a make code, zero for a break code
+ * @param  modifiers: HID modifier bits the host will see held
+ * @param  scancode: Pointer to store the scan code
+ * @retval 1 if the usage has a PS/2 scan code, 0 otherwise
+ */
+uint8_t scancode_translator_translate(uint8_t usage, uint8_t press, uint8_t modifiers, PS2_ScanCode_t *scancode)
+{
+    return translate_event(usage, press, modifiers, scancode);
+}
+
+/**
+ * @brief  Get the modifiers down on the keyboard
+ * @retval HID modifier bits, as last translated
+ */
+uint8_t scancode_translator_get_modifiers(void)
+{
+    return usb_held[USB_HID_MODIFIER_USAGE >> 3];
+}
+
 /**
  * @brief  Get translator status
  * @retval Current translator status
@@ -158,12 +580,12 @@ TranslatorStatus_t scancode_translator_get_status(void)
 
 /**
  * @brief  Reset translator state
- * @note   Clears internal state and reinitializes translator
+ * @note   Releases any held keys on the PS/2 side, then reinitializes translator
  * @retval None
  */
 void scancode_translator_reset(void)
 {
-    memset(&last_usb_state, 0, sizeof(USB_HID_KeyboardData_t));
+    scancode_translator_release_all();
     translator_status = TRANSLATOR_READY;
 }
 
@@ -174,15 +596,23 @@ void scancode_translator_reset(void)
  * @note   Searches mapping table for corresponding PS/2 scan code
  * @param  usb_key: USB HID key code
  * @param  ps2_key: Pointer to store PS/2 scan code
- * @param  is_extended: Pointer to store extended key flag
+ * @param  flags: Pointer to store the KEY_* flags
  * @retval 1 if found, 0 otherwise
  */
-static uint8_t find_ps2_scancode(uint8_t usb_key, uint8_t *ps2_key, uint8_t *is_extended)
+static uint8_t find_ps2_scancode(uint8_t usb_key, uint8_t *ps2_key, uint8_t *flags)
 {
+    if (usb_key >= USB_HID_MODIFIER_USAGE && usb_key < USB_HID_MODIFIER_USAGE + USB_HID_MODIFIER_COUNT) {
+        const KeyMapping_t *modifier = &modifier_mapping_table[usb_key - USB_HID_MODIFIER_USAGE];
+        
+        *ps2_key = modifier->ps2_key;
+        *flags = modifier->flags;
+        return 1;
+    }
+    
     for (uint16_t i = 0; key_mapping_table[i].usb_key != 0; i++) {
         if (key_mapping_table[i].usb_key == usb_key) {
             *ps2_key = key_mapping_table[i].ps2_key;
-            *is_extended = key_mapping_table[i].is_extended;
+            *flags = key_mapping_table[i].flags;
             return 1;
         }
     }
@@ -191,157 +621,148 @@ static uint8_t find_ps2_scancode(uint8_t usb_key, uint8_t *ps2_key, uint8_t *is_
 }
 
 /**
- * @brief  Translate modifier key changes
- * @note   Generates PS/2 scan codes for modifier key press/release events
- * @param  old_modifier: Previous modifier state
- * @param  new_modifier: Current modifier state
- * @param  scancodes: Array to store generated scan codes
- * @param  count: Pointer to scan code count (input/output)
- * @retval TRANSLATOR_OK if successful, TRANSLATOR_ERROR otherwise
+ * @brief  Translate one key event
+ * @note   Writes the bytes straight into the scan code slot of the report
+ *         being built: optional E0 prefix, optional F0 break prefix, key.
+ *         In Set 1 the code comes from the direct-indexed Set 1 table and
+ *         a break sets bit 7 instead of the F0 prefix.
+ *         Pause and Print Screen get a reference to their pooled sequence,
+ *         and so do navigation keys while Num Lock or Shift call for fake
+ *         Shift codes around them. Set 3 has a single code for every key;
+ *         a break of a key the host made make-only produces nothing.
+ * @param  usage: HID usage, modifiers as USB_HID_MODIFIER_USAGE + bit
+ * @param  press: Non-zero for a make code, zero for a break code
+ * @param  modifiers: HID modifier bits down at this event
+ * @param  scancode: Pointer to store the scan code
+ * @retval 1 if the usage has a PS/2 scan code, 0 otherwise
  */
-static TranslatorStatus_t translate_modifier_keys(uint8_t old_modifier, uint8_t new_modifier, 
-                                                 PS2_ScanCode_t *scancodes, uint8_t *count)
+static uint8_t translate_event(uint8_t usage, uint8_t press, uint8_t modifiers, PS2_ScanCode_t *scancode)
 {
-    uint8_t modifier_changes = old_modifier ^ new_modifier;
-    uint8_t initial_count = *count;
+    uint8_t ps2_key, flags, sequence;
+    uint8_t length = 0;
     
-    /* Check each modifier bit */
-    if (modifier_changes & USB_HID_MODIFIER_LEFT_CTRL) {
-        if (new_modifier & USB_HID_MODIFIER_LEFT_CTRL) {
-            ps2_create_make_code(&scancodes[*count], 0x14);
-        } else {
-            ps2_create_break_code(&scancodes[*count], 0x14);
+    if (ps2_get_scan_code_set() == PS2_SCAN_CODE_SET_3) {
+        ps2_key = set3_mapping_table[usage];
+        if (ps2_key == 0 || (!press && !ps2_set3_key_breaks(ps2_key))) {
+            return 0;
         }
-        (*count)++;
-    }
-    
-    if (modifier_changes & USB_HID_MODIFIER_LEFT_SHIFT) {
-        if (new_modifier & USB_HID_MODIFIER_LEFT_SHIFT) {
-            ps2_create_make_code(&scancodes[*count], 0x12);
-        } else {
-            ps2_create_break_code(&scancodes[*count], 0x12);
+        if (!press) {
+            scancode->data[length++] = PS2_BREAK_CODE_PREFIX;
         }
-        (*count)++;
+        scancode->data[length++] = ps2_key;
+        scancode->length = length;
+        return 1;
     }
     
-    if (modifier_changes & USB_HID_MODIFIER_LEFT_ALT) {
-        if (new_modifier & USB_HID_MODIFIER_LEFT_ALT) {
-            ps2_create_make_code(&scancodes[*count], 0x11);
-        } else {
-            ps2_create_break_code(&scancodes[*count], 0x11);
+    for (uint8_t i = 0; i < sizeof(sequence_mapping_table) / sizeof(sequence_mapping_table[0]); i++) {
+        if (sequence_mapping_table[i].usb_key == usage) {
+            /* Pause sends nothing on release */
+            return ps2_sequence_create(scancode, (uint8_t)(sequence_mapping_table[i].sequence |
+                                                           (press ? 0U : PS2_SEQUENCE_BREAK)), 0) == PS2_PROTOCOL_OK;
         }
-        (*count)++;
     }
     
-    if (modifier_changes & USB_HID_MODIFIER_RIGHT_SHIFT) {
-        if (new_modifier & USB_HID_MODIFIER_RIGHT_SHIFT) {
-            ps2_create_make_code(&scancodes[*count], 0x59);
-        } else {
-            ps2_create_break_code(&scancodes[*count], 0x59);
+    if (ps2_get_scan_code_set() == PS2_SCAN_CODE_SET_1) {
+        ps2_key = set1_mapping_table[usage];
+        if (ps2_key == 0) {
+            return 0;
         }
-        (*count)++;
-    }
-    
-    if (modifier_changes & USB_HID_MODIFIER_RIGHT_CTRL) {
-        if (new_modifier & USB_HID_MODIFIER_RIGHT_CTRL) {
-            ps2_create_extended_make_code(&scancodes[*count], 0x14);
-        } else {
-            ps2_create_extended_break_code(&scancodes[*count], 0x14);
+        flags = (ps2_key & SET1_EXTENDED) ? KEY_EXTENDED : 0;
+        ps2_key &= (uint8_t)~SET1_EXTENDED;
+        if (flags && ps2_key >= SET1_KEYPAD_FIRST && ps2_key <= SET1_KEYPAD_LAST) {
+            flags = KEY_NAVIGATION;
         }
-        (*count)++;
+    } else if (!find_ps2_scancode(usage, &ps2_key, &flags)) {
+        return 0;
     }
     
-    if (modifier_changes & USB_HID_MODIFIER_RIGHT_ALT) {
-        if (new_modifier & USB_HID_MODIFIER_RIGHT_ALT) {
-            ps2_create_extended_make_code(&scancodes[*count], 0x11);
-        } else {
-            ps2_create_extended_break_code(&scancodes[*count], 0x11);
-        }
-        (*count)++;
+    if ((flags & KEY_NAVIGATION) == KEY_NAVIGATION &&
+        (sequence = navigation_sequence(modifiers)) < PS2_SEQUENCE_COUNT) {
+        return ps2_sequence_create(scancode, (uint8_t)(sequence | (press ? 0U : PS2_SEQUENCE_BREAK)),
+                                   ps2_key) == PS2_PROTOCOL_OK;
     }
     
-    /* Check buffer overflow */
-    if (*count > MAX_TRANSLATION_BUFFER) {
-        *count = initial_count; /* Revert count */
-        return TRANSLATOR_ERROR;
+    if (flags & KEY_EXTENDED) {
+        scancode->data[length++] = PS2_EXTENDED_CODE_PREFIX;
+    }
+    if (ps2_get_scan_code_set() == PS2_SCAN_CODE_SET_1) {
+        scancode->data[length++] = press ? ps2_key : (uint8_t)(ps2_key | PS2_SET1_BREAK_BIT);
+    } else {
+        if (!press) {
+            scancode->data[length++] = PS2_BREAK_CODE_PREFIX;
+        }
+        scancode->data[length++] = ps2_key;
     }
+    scancode->length = length;
     
-    return TRANSLATOR_OK;
+    return 1;
 }
 
 /**
- * @brief  Translate regular key changes
- * @note   Generates PS/2 scan codes for regular key press/release events
- * @param  old_state: Previous keyboard state
- * @param  new_state: Current keyboard state
- * @param  scancodes: Array to store generated scan codes
- * @param  count: Pointer to scan code count (input/output)
- * @retval TRANSLATOR_OK if successful, TRANSLATOR_ERROR otherwise
+ * @brief  Choose the fake Shift wrapper of a navigation key
+ * @note   Matches a native keyboard: with a Shift key down the key is
+ *         wrapped in fake releases of the Shift keys held, otherwise with
+ *         Num Lock on (as last set by the host) in a fake Left Shift press
+ * @param  modifiers: HID modifier bits down
+ * @retval PS2_SEQUENCE_* number, PS2_SEQUENCE_COUNT for a bare E0 code
  */
-static TranslatorStatus_t translate_regular_keys(const USB_HID_KeyboardData_t *old_state,
-                                                const USB_HID_KeyboardData_t *new_state,
-                                                PS2_ScanCode_t *scancodes, uint8_t *count)
+static uint8_t navigation_sequence(uint8_t modifiers)
 {
-    uint8_t initial_count = *count;
-    uint8_t ps2_key, is_extended;
-    
-    /* Check for key releases (keys in old state but not in new state) */
-    for (uint8_t i = 0; i < old_state->key_count; i++) {
-        if (!is_key_in_array(old_state->keys[i], new_state->keys, new_state->key_count)) {
-            /* Key was released */
-            if (find_ps2_scancode(old_state->keys[i], &ps2_key, &is_extended)) {
-                if (is_extended) {
-                    ps2_create_extended_break_code(&scancodes[*count], ps2_key);
-                } else {
-                    ps2_create_break_code(&scancodes[*count], ps2_key);
-                }
-                (*count)++;
-                
-                if (*count >= MAX_TRANSLATION_BUFFER) {
-                    *count = initial_count;
-                    return TRANSLATOR_ERROR;
-                }
-            }
-        }
+    switch (modifiers & KEY_SHIFTS) {
+        case KEY_SHIFTS:
+            return PS2_SEQUENCE_BOTH_SHIFTS;
+            
+        case USB_HID_MODIFIER_LEFT_SHIFT:
+            return PS2_SEQUENCE_LEFT_SHIFT;
+            
+        case USB_HID_MODIFIER_RIGHT_SHIFT:
+            return PS2_SEQUENCE_RIGHT_SHIFT;
+            
+        default:
+            return (ps2_command_get_leds() & PS2_LED_NUM_LOCK) ? PS2_SEQUENCE_NUM_LOCK : PS2_SEQUENCE_COUNT;
     }
-    
-    /* Check for key presses (keys in new state but not in old state) */
-    for (uint8_t i = 0; i < new_state->key_count; i++) {
-        if (!is_key_in_array(new_state->keys[i], old_state->keys, old_state->key_count)) {
-            /* Key was pressed */
-            if (find_ps2_scancode(new_state->keys[i], &ps2_key, &is_extended)) {
-                if (is_extended) {
-                    ps2_create_extended_make_code(&scancodes[*count], ps2_key);
-                } else {
-                    ps2_create_make_code(&scancodes[*count], ps2_key);
-                }
-                (*count)++;
-                
-                if (*count >= MAX_TRANSLATION_BUFFER) {
-                    *count = initial_count;
-                    return TRANSLATOR_ERROR;
-                }
-            }
-        }
+}
+
+/**
+ * @brief  Check if a key repeats while held
+ * @note   In Set 3 the host chooses per key; otherwise every key but Pause
+ *         repeats
+ * @param  usage: HID usage
+ * @retval 1 if typematic, 0 otherwise
+ */
+static uint8_t typematic_allowed(uint8_t usage)
+{
+    if (ps2_get_scan_code_set() == PS2_SCAN_CODE_SET_3) {
+        return ps2_set3_key_repeats(set3_mapping_table[usage]);
     }
     
-    return TRANSLATOR_OK;
+    return usage != USB_HID_KEY_PAUSE;
 }
 
 /**
- * @brief  Check if key is in array
- * @note   Helper function to check if a key exists in an array
- * @param  key: Key to search for
- * @param  array: Array to search in
- * @param  array_size: Size of the array
- * @retval 1 if key found, 0 otherwise
+ * @brief  Build the Set 2 key bitmap for a USB key bitmap
+ * @note   Uses the normal translation of each key press, so the bitmap
+ *         matches exactly the make codes the translator emits
+ * @param  usb_state: USB usages down, USB_HID_USAGE_BITMAP_SIZE bytes
+ * @param  state: Output bitmap of PS2_SHADOW_BYTES bytes
+ * @retval None
  */
-static uint8_t is_key_in_array(uint8_t key, const uint8_t *array, uint8_t array_size)
+static void build_key_state(const uint8_t *usb_state, uint8_t *state)
 {
-    for (uint8_t i = 0; i < array_size; i++) {
-        if (array[i] == key) {
-            return 1;
+    PS2_ScanCode_t scancode;
+    
+    memset(state, 0, PS2_SHADOW_BYTES);
+    
+    for (uint16_t usage = 0; usage < 256U; usage++) {
+        if (((usb_state[usage >> 3] >> (usage & 7U)) & 1U) &&
+            translate_event((uint8_t)usage, 1, usb_state[USB_HID_MODIFIER_USAGE >> 3], &scancode)) {
+            if (ps2_sequence_is_code(&scancode)) {
+                uint8_t data[PS2_SEQUENCE_MAX_LENGTH];
+                
+                ps2_shadow_decode(state, data, ps2_sequence_copy(scancode.data[1], scancode.data[2], data));
+            } else {
+                ps2_shadow_decode(state, scancode.data, scancode.length);
+            }
         }
     }
-    return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,156 @@
+/**
+ ******************************************************************************
+ * @file    flash_sim.c
+ * @brief   Simulated configuration flash sector
+ * @author  STM32F411 USB-PS2 Project
+ * @version 1.0.0
+ * @date    2024
+ *
+ * @description
+ * Host-only replacement for the flash parts of the HAL, covering the
+ * configuration store sector. Programming can only clear bits, as on the
+ * chip, and an erase sets the whole sector to 0xFF. A power loss is
+ * modelled by letting a given number of words through and failing every
+ * program after them, leaving a record half written.
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include <string.h>
+#include "flash_sim.h"
+#include "config_store.h"
+#include "main.h"
+
+/* Private typedef -----------------------------------------------------------*/
+
+/* Private define ------------------------------------------------------------*/
+
+/* Private macro -------------------------------------------------------------*/
+
+/* Private variables ---------------------------------------------------------*/
+static uint32_t sector[CONFIG_STORE_SIZE / sizeof(uint32_t)];
+static uint8_t sector_ready = 0;
+static uint8_t unlocked = 0;
+static uint32_t words_until_power_loss = FLASH_SIM_POWER_ON;
+static uint32_t programmed_words = 0;
+
+/* Private function prototypes -----------------------------------------------*/
+
+/* Exported functions --------------------------------------------------------*/
+
+/**
+ * @brief  Get the simulated sector
+ * @note   Erased on first use
+ * @retval Sector contents, CONFIG_STORE_SIZE bytes
+ */
+const uint8_t *flash_sim_sector(void)
+{
+    if (!sector_ready) {
+        flash_sim_reset();
+    }
+
+    return (const uint8_t *)sector;
+}
+
+/**
+ * @brief  Erase the sector and restore power
+ * @retval None
+ */
+void flash_sim_reset(void)
+{
+    memset(sector, 0xFF, sizeof(sector));
+    sector_ready = 1;
+    unlocked = 0;
+    words_until_power_loss = FLASH_SIM_POWER_ON;
+    programmed_words = 0;
+}
+
+/**
+ * @brief  Fail every program after the next few words
+ * @param  words: Words still programmed, FLASH_SIM_POWER_ON to restore power
+ * @retval None
+ */
+void flash_sim_cut_power(uint32_t words)
+{
+    words_until_power_loss = words;
+}
+
+/**
+ * @brief  Get the number of words programmed since the last reset
+ * @retval Words
+ */
+uint32_t flash_sim_get_programmed_words(void)
+{
+    return programmed_words;
+}
+
+/* Simulated HAL -------------------------------------------------------------*/
+
+/**
+ * @brief  Unlock the flash control register (simulation)
+ * @retval HAL_OK
+ */
+HAL_StatusTypeDef HAL_FLASH_Unlock(void)
+{
+    unlocked = 1;
+    return HAL_OK;
+}
+
+/**
+ * @brief  Lock the flash control register (simulation)
+ * @retval HAL_OK
+ */
+HAL_StatusTypeDef HAL_FLASH_Lock(void)
+{
+    unlocked = 0;
+    return HAL_OK;
+}
+
+/**
+ * @brief  Program a word (simulation)
+ * @note   Only bits set in the flash can be cleared, as on the chip
+ * @param  TypeProgram: FLASH_TYPEPROGRAM_WORD
+ * @param  Address: Address inside the configuration store sector
+ * @param  Data: Word to program
+ * @retval HAL_OK if programmed, HAL_ERROR otherwise
+ */
+HAL_StatusTypeDef HAL_FLASH_Program(uint32_t TypeProgram, uint32_t Address, uint64_t Data)
+{
+    uint32_t offset = Address - CONFIG_STORE_ADDRESS;
+
+    (void)flash_sim_sector();
+
+    if (!unlocked || TypeProgram != FLASH_TYPEPROGRAM_WORD || Address < CONFIG_STORE_ADDRESS ||
+        offset >= CONFIG_STORE_SIZE || (offset & 3U) != 0 || words_until_power_loss == 0) {
+        return HAL_ERROR;
+    }
+
+    if (words_until_power_loss != FLASH_SIM_POWER_ON) {
+        words_until_power_loss--;
+    }
+
+    sector[offset / sizeof(uint32_t)] &= (uint32_t)Data;
+    programmed_words++;
+    return HAL_OK;
+}
+
+/**
+ * @brief  Erase sectors (simulation)
+ * @param  pEraseInit: FLASH_TYPEERASE_SECTORS of the configuration store sector
+ * @param  SectorError: Set to 0xFFFFFFFF on success, to the failing sector otherwise
+ * @retval HAL_OK if erased, HAL_ERROR otherwise
+ */
+HAL_StatusTypeDef HAL_FLASHEx_Erase(FLASH_EraseInitTypeDef *pEraseInit, uint32_t *SectorError)
+{
+    if (!unlocked || pEraseInit->TypeErase != FLASH_TYPEERASE_SECTORS ||
+        pEraseInit->Sector != FLASH_SECTOR_7 || pEraseInit->NbSectors != 1 ||
+        words_until_power_loss == 0) {
+        *SectorError = pEraseInit->Sector;
+        return HAL_ERROR;
+    }
+
+    memset(sector, 0xFF, sizeof(sector));
+    sector_ready = 1;
+    *SectorError = 0xFFFFFFFFU;
+    return HAL_OK;
+}
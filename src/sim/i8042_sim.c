@@ -0,0 +1,410 @@
+/**
+ ******************************************************************************
+ * @file    i8042_sim.c
+ * @brief   Simulated i8042 keyboard controller on the simulated PS/2 lines
+ * @author  STM32F411 USB-PS2 Project
+ * @version 1.0.0
+ * @date    2024
+ *
+ * @description
+ * Host side of the PS/2 link for the host simulation build. Runs from the
+ * ps2_line_sim host hook once per simulated microsecond and:
+ * - clocks in device frames on falling CLK edges, checking start, parity
+ *   and stop bits
+ * - sends host-to-device bytes (request-to-send, bits on falling CLK,
+ *   device acknowledge on the 11th clock)
+ * - inhibits the bus periodically and/or after every received byte, the
+ *   way a real controller holds CLK low until the CPU reads its buffer
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include <string.h>
+#include "i8042_sim.h"
+#include "ps2_line_sim.h"
+
+/* Private typedef -----------------------------------------------------------*/
+/**
+ * @brief i8042 model bus state
+ */
+typedef enum {
+    I8042_STATE_IDLE = 0,       ///< Bus released, waiting for device or command
+    I8042_STATE_RECEIVING,      ///< Clocking in a device frame
+    I8042_STATE_INHIBIT,        ///< Holding CLK low
+    I8042_STATE_RTS_CLOCK_LOW,  ///< Command: CLK low before request-to-send
+    I8042_STATE_RTS_WAIT,       ///< Command: DATA low, waiting for device clock
+    I8042_STATE_SENDING,        ///< Command: shifting bits out on device clock
+    I8042_STATE_WAIT_RELEASE    ///< Command: waiting for device to release lines
+} I8042_State_t;
+
+/**
+ * @brief Received byte log entry
+ */
+typedef struct {
+    uint8_t data;
+    uint32_t time_us;
+} I8042_RxEntry_t;
+
+/* Private define ------------------------------------------------------------*/
+#define I8042_FRAME_BITS        11U     ///< Start, 8 data, parity, stop
+#define I8042_FRAME_TIMEOUT_US  2000U   ///< Max time between clock edges in a frame
+#define I8042_SEND_TIMEOUT_US   2000U   ///< Max time for the device to clock a command
+
+/* Private macro -------------------------------------------------------------*/
+
+/* Private variables ---------------------------------------------------------*/
+static I8042_SimConfig_t sim_config;
+static I8042_SimStats_t sim_stats;
+static I8042_State_t sim_state = I8042_STATE_IDLE;
+static uint32_t state_deadline = 0;
+static uint32_t last_edge_us = 0;
+static uint32_t next_periodic_inhibit = 0;
+static uint8_t prev_clock = 1;
+static uint8_t bit_index = 0;
+static uint16_t frame_bits = 0;
+static uint8_t inhibit_after_rise = 0;
+static uint16_t tx_frame = 0;
+
+static uint8_t cmd_queue[I8042_SIM_CMD_QUEUE_SIZE];
+static uint8_t cmd_head = 0;
+static uint8_t cmd_count = 0;
+
+static I8042_RxEntry_t rx_log[I8042_SIM_RX_LOG_SIZE];
+static uint32_t rx_head = 0;
+static uint32_t rx_tail = 0;
+
+/* Private function prototypes -----------------------------------------------*/
+static void i8042_hook(uint32_t now);
+static void i8042_start_inhibit(uint32_t now, uint32_t duration);
+static void i8042_sample_frame_bit(uint32_t now);
+static uint8_t i8042_odd_parity(uint8_t data);
+
+/* Exported functions --------------------------------------------------------*/
+
+/**
+ * @brief  Initialize the i8042 model
+ * @param  config: Model configuration, NULL for a controller that never inhibits
+ * @retval None
+ */
+void i8042_sim_init(const I8042_SimConfig_t *config)
+{
+    memset(&sim_config, 0, sizeof(I8042_SimConfig_t));
+    if (config != NULL) {
+        memcpy(&sim_config, config, sizeof(I8042_SimConfig_t));
+    }
+    if (sim_config.response_timeout_us == 0) {
+        sim_config.response_timeout_us = I8042_SIM_DEFAULT_TIMEOUT_US;
+    }
+
+    memset(&sim_stats, 0, sizeof(I8042_SimStats_t));
+    sim_state = I8042_STATE_IDLE;
+    next_periodic_inhibit = sim_config.inhibit_offset_us;
+    prev_clock = 1;
+    bit_index = 0;
+    inhibit_after_rise = 0;
+    cmd_head = 0;
+    cmd_count = 0;
+    rx_head = 0;
+    rx_tail = 0;
+
+    ps2_sim_drive(PS2_SIM_DRIVER_HOST, PS2_SIM_LINE_CLOCK, 1);
+    ps2_sim_drive(PS2_SIM_DRIVER_HOST, PS2_SIM_LINE_DATA, 1);
+}
+
+/**
+ * @brief  Attach the model to the simulated lines
+ * @retval None
+ */
+void i8042_sim_attach(void)
+{
+    prev_clock = ps2_sim_get_line(PS2_SIM_LINE_CLOCK);
+    ps2_sim_set_host_hook(i8042_hook);
+}
+
+/**
+ * @brief  Detach the model and release both lines
+ * @retval None
+ */
+void i8042_sim_detach(void)
+{
+    ps2_sim_set_host_hook(NULL);
+    ps2_sim_drive(PS2_SIM_DRIVER_HOST, PS2_SIM_LINE_CLOCK, 1);
+    ps2_sim_drive(PS2_SIM_DRIVER_HOST, PS2_SIM_LINE_DATA, 1);
+}
+
+/**
+ * @brief  Queue a host-to-device byte
+ * @param  command: Byte to send (command or argument)
+ * @retval I8042_SIM_OK if queued, I8042_SIM_ERROR if the queue is full
+ */
+I8042_SimStatus_t i8042_sim_send_command(uint8_t command)
+{
+    if (cmd_count >= I8042_SIM_CMD_QUEUE_SIZE) {
+        return I8042_SIM_ERROR;
+    }
+
+    cmd_queue[(cmd_head + cmd_count) % I8042_SIM_CMD_QUEUE_SIZE] = command;
+    cmd_count++;
+    return I8042_SIM_OK;
+}
+
+/**
+ * @brief  Read the next byte accepted from the device
+ * @param  data: Pointer to store the byte
+ * @param  time_us: Pointer to store the acceptance time, may be NULL
+ * @retval I8042_SIM_OK if a byte was read, I8042_SIM_EMPTY otherwise
+ */
+I8042_SimStatus_t i8042_sim_read_byte(uint8_t *data, uint32_t *time_us)
+{
+    if (data == NULL) {
+        return I8042_SIM_ERROR;
+    }
+
+    if (rx_tail == rx_head) {
+        return I8042_SIM_EMPTY;
+    }
+
+    *data = rx_log[rx_tail].data;
+    if (time_us != NULL) {
+        *time_us = rx_log[rx_tail].time_us;
+    }
+    rx_tail = (rx_tail + 1) % I8042_SIM_RX_LOG_SIZE;
+    return I8042_SIM_OK;
+}
+
+/**
+ * @brief  Get model statistics
+ * @param  stats: Pointer to store statistics
+ * @retval None
+ */
+void i8042_sim_get_stats(I8042_SimStats_t *stats)
+{
+    if (stats != NULL) {
+        memcpy(stats, &sim_stats, sizeof(I8042_SimStats_t));
+    }
+}
+
+/**
+ * @brief  Get sustained accepted byte rate
+ * @note   Measured from the first to the last accepted byte
+ * @retval Bytes per second, 0 if fewer than two bytes were accepted
+ */
+uint32_t i8042_sim_get_bytes_per_second(void)
+{
+    uint32_t span = sim_stats.last_byte_us - sim_stats.first_byte_us;
+
+    if (sim_stats.bytes_received < 2 || span == 0) {
+        return 0;
+    }
+
+    return (uint32_t)(((uint64_t)(sim_stats.bytes_received - 1) * 1000000U) / span);
+}
+
+/**
+ * @brief  Check if the model has nothing in progress
+ * @retval 1 if idle with no pending command, 0 otherwise
+ */
+uint8_t i8042_sim_is_idle(void)
+{
+    return (sim_state == I8042_STATE_IDLE && cmd_count == 0) ? 1 : 0;
+}
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+ * @brief  Per-microsecond host model step
+ * @param  now: Current virtual time in microseconds
+ * @retval None
+ */
+static void i8042_hook(uint32_t now)
+{
+    uint8_t clock = ps2_sim_get_line(PS2_SIM_LINE_CLOCK);
+    uint8_t fell = prev_clock && !clock;
+    uint8_t rose = !prev_clock && clock;
+    uint8_t periodic_due = (sim_config.inhibit_period_us != 0 && now >= next_periodic_inhibit);
+
+    prev_clock = clock;
+
+    switch (sim_state) {
+        case I8042_STATE_IDLE:
+            if (inhibit_after_rise) {
+                if (rose || clock) {
+                    inhibit_after_rise = 0;
+                    i8042_start_inhibit(now, sim_config.inhibit_after_byte_us);
+                }
+                break;
+            }
+            if (periodic_due) {
+                next_periodic_inhibit += sim_config.inhibit_period_us;
+                i8042_start_inhibit(now, sim_config.inhibit_duration_us);
+            } else if (fell) {
+                sim_state = I8042_STATE_RECEIVING;
+                bit_index = 0;
+                frame_bits = 0;
+                i8042_sample_frame_bit(now);
+            } else if (cmd_count > 0 && clock && ps2_sim_get_line(PS2_SIM_LINE_DATA)) {
+                /* Request-to-send: inhibit first, then pull DATA low */
+                ps2_sim_drive(PS2_SIM_DRIVER_HOST, PS2_SIM_LINE_CLOCK, 0);
+                sim_state = I8042_STATE_RTS_CLOCK_LOW;
+                state_deadline = now + I8042_SIM_RTS_CLOCK_LOW_US;
+            }
+            break;
+
+        case I8042_STATE_RECEIVING:
+            if (periodic_due) {
+                next_periodic_inhibit += sim_config.inhibit_period_us;
+                sim_stats.aborted_frames++;
+                i8042_start_inhibit(now, sim_config.inhibit_duration_us);
+            } else if (fell) {
+                i8042_sample_frame_bit(now);
+            } else if ((now - last_edge_us) > I8042_FRAME_TIMEOUT_US) {
+                sim_stats.aborted_frames++;
+                sim_state = I8042_STATE_IDLE;
+            }
+            break;
+
+        case I8042_STATE_INHIBIT:
+            if (now >= state_deadline) {
+                ps2_sim_drive(PS2_SIM_DRIVER_HOST, PS2_SIM_LINE_CLOCK, 1);
+                prev_clock = ps2_sim_get_line(PS2_SIM_LINE_CLOCK);
+                sim_state = I8042_STATE_IDLE;
+            }
+            break;
+
+        case I8042_STATE_RTS_CLOCK_LOW:
+            if (now >= state_deadline) {
+                uint8_t command = cmd_queue[cmd_head];
+
+                tx_frame = (uint16_t)command | ((uint16_t)i8042_odd_parity(command) << 8) | (1U << 9);
+                bit_index = 0;
+                sim_stats.commands_sent++;
+
+                ps2_sim_drive(PS2_SIM_DRIVER_HOST, PS2_SIM_LINE_DATA, 0);
+                ps2_sim_drive(PS2_SIM_DRIVER_HOST, PS2_SIM_LINE_CLOCK, 1);
+                prev_clock = ps2_sim_get_line(PS2_SIM_LINE_CLOCK);
+                sim_state = I8042_STATE_RTS_WAIT;
+                state_deadline = now + sim_config.response_timeout_us;
+            }
+            break;
+
+        case I8042_STATE_RTS_WAIT:
+        case I8042_STATE_SENDING:
+            if (fell) {
+                if (bit_index < 10) {
+                    /* Data bits, parity, then release DATA for the stop bit */
+                    ps2_sim_drive(PS2_SIM_DRIVER_HOST, PS2_SIM_LINE_DATA, (tx_frame >> bit_index) & 1U);
+                    bit_index++;
+                    sim_state = I8042_STATE_SENDING;
+                    state_deadline = now + I8042_SEND_TIMEOUT_US;
+                } else {
+                    /* 11th clock: device acknowledges by holding DATA low */
+                    if (!ps2_sim_get_line(PS2_SIM_LINE_DATA)) {
+                        sim_stats.commands_acked++;
+                    }
+                    cmd_head = (cmd_head + 1) % I8042_SIM_CMD_QUEUE_SIZE;
+                    cmd_count--;
+                    sim_state = I8042_STATE_WAIT_RELEASE;
+                    state_deadline = now + I8042_SEND_TIMEOUT_US;
+                }
+            } else if (now >= state_deadline) {
+                sim_stats.command_timeouts++;
+                cmd_head = (cmd_head + 1) % I8042_SIM_CMD_QUEUE_SIZE;
+                cmd_count--;
+                ps2_sim_drive(PS2_SIM_DRIVER_HOST, PS2_SIM_LINE_DATA, 1);
+                sim_state = I8042_STATE_IDLE;
+            }
+            break;
+
+        case I8042_STATE_WAIT_RELEASE:
+            if ((clock && ps2_sim_get_line(PS2_SIM_LINE_DATA)) || now >= state_deadline) {
+                sim_state = I8042_STATE_IDLE;
+            }
+            break;
+
+        default:
+            sim_state = I8042_STATE_IDLE;
+            break;
+    }
+}
+
+/**
+ * @brief  Pull CLK low for a fixed time
+ * @param  now: Current virtual time
+ * @param  duration: Inhibit length in microseconds
+ * @retval None
+ */
+static void i8042_start_inhibit(uint32_t now, uint32_t duration)
+{
+    if (duration == 0) {
+        sim_state = I8042_STATE_IDLE;
+        return;
+    }
+
+    ps2_sim_drive(PS2_SIM_DRIVER_HOST, PS2_SIM_LINE_CLOCK, 0);
+    prev_clock = 0;
+    sim_stats.inhibits++;
+    sim_state = I8042_STATE_INHIBIT;
+    state_deadline = now + duration;
+}
+
+/**
+ * @brief  Sample DATA on a falling device clock edge
+ * @note   Completes, validates and logs the byte on the 11th bit
+ * @param  now: Current virtual time
+ * @retval None
+ */
+static void i8042_sample_frame_bit(uint32_t now)
+{
+    frame_bits |= (uint16_t)ps2_sim_get_line(PS2_SIM_LINE_DATA) << bit_index;
+    bit_index++;
+    last_edge_us = now;
+
+    if (bit_index < I8042_FRAME_BITS) {
+        return;
+    }
+
+    sim_state = I8042_STATE_IDLE;
+
+    if ((frame_bits & 0x001U) != 0 || (frame_bits & 0x400U) == 0) {
+        sim_stats.framing_errors++;
+    } else {
+        uint8_t data = (uint8_t)(frame_bits >> 1);
+        uint8_t parity = (uint8_t)((frame_bits >> 9) & 1U);
+
+        if (parity != i8042_odd_parity(data)) {
+            sim_stats.parity_errors++;
+        } else {
+            if (sim_stats.bytes_received == 0) {
+                sim_stats.first_byte_us = now;
+            }
+            sim_stats.last_byte_us = now;
+            sim_stats.bytes_received++;
+
+            if (((rx_head + 1) % I8042_SIM_RX_LOG_SIZE) != rx_tail) {
+                rx_log[rx_head].data = data;
+                rx_log[rx_head].time_us = now;
+                rx_head = (rx_head + 1) % I8042_SIM_RX_LOG_SIZE;
+            }
+        }
+    }
+
+    if (sim_config.inhibit_after_byte_us != 0) {
+        inhibit_after_rise = 1;
+    }
+}
+
+/**
+ * @brief  Compute the PS/2 odd parity bit for a byte
+ * @param  data: Data byte
+ * @retval Parity bit value
+ */
+static uint8_t i8042_odd_parity(uint8_t data)
+{
+    uint8_t parity = 1;
+
+    for (uint8_t i = 0; i < 8; i++) {
+        parity ^= (data >> i) & 1U;
+    }
+
+    return parity;
+}
@@ -0,0 +1,517 @@
+/**
+ ******************************************************************************
+ * @file    ps2_line_sim.c
+ * @brief   Simulated PS/2 GPIO lines with edge capture and timing checks
+ * @author  STM32F411 USB-PS2 Project
+ * @version 1.0.0
+ * @date    2024
+ *
+ * @description
+ * Host-only replacement for the GPIO/tick parts of the HAL. PA0 (PS2_CLK)
+ * and PA1 (PS2_DATA) are modelled as open-drain lines with pull-ups: the
+ * bus level is the wired-AND of the firmware drive and the simulated host
+ * drive. Time is virtual and only advances through ps2_delay_us() and
+ * HAL_Delay(), so captures are exact and repeatable.
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdio.h>
+#include <string.h>
+#include "ps2_line_sim.h"
+#include "main.h"
+
+/* Private typedef -----------------------------------------------------------*/
+
+/* Private define ------------------------------------------------------------*/
+#define PS2_SIM_NO_TIME         0xFFFFFFFFU     ///< Marker for "no event yet"
+#define PS2_SIM_FRAME_BITS      11U             ///< Clock pulses per device frame
+
+/* Private macro -------------------------------------------------------------*/
+
+/* Private variables ---------------------------------------------------------*/
+static uint32_t sim_time_us = 0;
+static uint8_t line_drive[PS2_SIM_DRIVER_COUNT][PS2_SIM_LINE_COUNT];
+static PS2_SimEdge_t edge_log[PS2_SIM_MAX_EDGES];
+static uint32_t edge_count = 0;
+static uint8_t edge_overflow = 0;
+static PS2_SimHostHook_t host_hook = NULL;
+
+/* Private function prototypes -----------------------------------------------*/
+static void sim_record_edge(PS2_SimDriver_t driver, PS2_SimLine_t line, uint8_t level);
+static int sim_line_from_pin(GPIO_TypeDef *GPIOx, uint16_t pin, PS2_SimLine_t *line);
+
+/* Exported functions --------------------------------------------------------*/
+
+/**
+ * @brief  Reset the simulated bus
+ * @note   Releases both lines on both sides, clears the edge log and
+ *         rewinds virtual time to zero
+ * @retval None
+ */
+void ps2_sim_reset(void)
+{
+    sim_time_us = 0;
+    edge_count = 0;
+    edge_overflow = 0;
+
+    for (uint8_t d = 0; d < PS2_SIM_DRIVER_COUNT; d++) {
+        for (uint8_t l = 0; l < PS2_SIM_LINE_COUNT; l++) {
+            line_drive[d][l] = 1;
+        }
+    }
+}
+
+/**
+ * @brief  Advance virtual time
+ * @note   The host hook runs once per microsecond so a host model can
+ *         sample and drive the lines at bit-accurate instants
+ * @param  microseconds: Time to advance
+ * @retval None
+ */
+void ps2_sim_delay_us(uint32_t microseconds)
+{
+    while (microseconds--) {
+        sim_time_us++;
+        if (host_hook != NULL) {
+            host_hook(sim_time_us);
+        }
+    }
+}
+
+/**
+ * @brief  Get current virtual time
+ * @retval Time in microseconds since the last reset
+ */
+uint32_t ps2_sim_get_time_us(void)
+{
+    return sim_time_us;
+}
+
+/**
+ * @brief  Install the host model hook
+ * @param  hook: Function called every simulated microsecond, NULL to remove
+ * @retval None
+ */
+void ps2_sim_set_host_hook(PS2_SimHostHook_t hook)
+{
+    host_hook = hook;
+}
+
+/**
+ * @brief  Drive one side of a simulated line
+ * @param  driver: Bus side changing its drive
+ * @param  line: Line to drive
+ * @param  level: 0 to pull low, 1 to release
+ * @retval None
+ */
+void ps2_sim_drive(PS2_SimDriver_t driver, PS2_SimLine_t line, uint8_t level)
+{
+    level = level ? 1 : 0;
+
+    if (line_drive[driver][line] != level) {
+        line_drive[driver][line] = level;
+        sim_record_edge(driver, line, level);
+    }
+}
+
+/**
+ * @brief  Get the wired-AND level of a simulated line
+ * @param  line: Line to read
+ * @retval 1 if high, 0 if pulled low by either side
+ */
+uint8_t ps2_sim_get_line(PS2_SimLine_t line)
+{
+    return line_drive[PS2_SIM_DRIVER_DEVICE][line] & line_drive[PS2_SIM_DRIVER_HOST][line];
+}
+
+/**
+ * @brief  Get the drive level of one side of a line
+ * @param  driver: Bus side
+ * @param  line: Line
+ * @retval 1 if released, 0 if pulled low
+ */
+uint8_t ps2_sim_get_drive(PS2_SimDriver_t driver, PS2_SimLine_t line)
+{
+    return line_drive[driver][line];
+}
+
+/**
+ * @brief  Get number of recorded drive changes
+ * @retval Edge count
+ */
+uint32_t ps2_sim_get_edge_count(void)
+{
+    return edge_count;
+}
+
+/**
+ * @brief  Get the recorded drive changes
+ * @retval Pointer to the edge log (ps2_sim_get_edge_count() entries)
+ */
+const PS2_SimEdge_t *ps2_sim_get_edges(void)
+{
+    return edge_log;
+}
+
+/**
+ * @brief  Export the captured waveform as a Value Change Dump
+ * @note   Emits the bus levels plus each side's drive so GTKWave/sigrok
+ *         show who pulled a line low. Timescale is 1 us.
+ * @param  path: Output file path
+ * @retval PS2_SIM_OK if written, PS2_SIM_ERROR otherwise
+ */
+PS2_SimStatus_t ps2_sim_write_vcd(const char *path)
+{
+    static const char *const bus_id[PS2_SIM_LINE_COUNT] = { "c", "d" };
+    static const char *const drive_id[PS2_SIM_DRIVER_COUNT][PS2_SIM_LINE_COUNT] = {
+        { "C", "D" },   /* device */
+        { "h", "H" }    /* host */
+    };
+    uint8_t drive[PS2_SIM_DRIVER_COUNT][PS2_SIM_LINE_COUNT] = { { 1, 1 }, { 1, 1 } };
+    uint32_t last_time = PS2_SIM_NO_TIME;
+    FILE *vcd;
+
+    if (path == NULL) {
+        return PS2_SIM_ERROR;
+    }
+
+    vcd = fopen(path, "w");
+    if (vcd == NULL) {
+        return PS2_SIM_ERROR;
+    }
+
+    fprintf(vcd, "$version stm32f411-usb-host-ps2 ps2_line_sim $end\n");
+    fprintf(vcd, "$timescale 1us $end\n");
+    fprintf(vcd, "$scope module ps2 $end\n");
+    fprintf(vcd, "$var wire 1 c clk $end\n");
+    fprintf(vcd, "$var wire 1 d data $end\n");
+    fprintf(vcd, "$var wire 1 C clk_device $end\n");
+    fprintf(vcd, "$var wire 1 D data_device $end\n");
+    fprintf(vcd, "$var wire 1 h clk_host $end\n");
+    fprintf(vcd, "$var wire 1 H data_host $end\n");
+    fprintf(vcd, "$upscope $end\n");
+    fprintf(vcd, "$enddefinitions $end\n");
+    fprintf(vcd, "#0\n$dumpvars\n1c\n1d\n1C\n1D\n1h\n1H\n$end\n");
+
+    for (uint32_t i = 0; i < edge_count; i++) {
+        const PS2_SimEdge_t *edge = &edge_log[i];
+        uint8_t old_bus = drive[0][edge->line] & drive[1][edge->line];
+
+        if (edge->time_us != last_time) {
+            fprintf(vcd, "#%lu\n", (unsigned long)edge->time_us);
+            last_time = edge->time_us;
+        }
+
+        drive[edge->driver][edge->line] = edge->level;
+        fprintf(vcd, "%u%s\n", edge->level, drive_id[edge->driver][edge->line]);
+
+        if (edge->bus_level != old_bus) {
+            fprintf(vcd, "%u%s\n", edge->bus_level, bus_id[edge->line]);
+        }
+    }
+
+    fprintf(vcd, "#%lu\n", (unsigned long)sim_time_us);
+    fclose(vcd);
+
+    return PS2_SIM_OK;
+}
+
+/**
+ * @brief  Check captured device activity against PS/2 timing rules
+ * @note   Walks the edge log once. Device frames are checked for clock
+ *         period, clock phase, data setup before the falling edge and data
+ *         hold after the rising edge. When the host pulls CLK low while the
+ *         device is mid-frame, the device must release both lines within
+ *         PS2_SIM_MAX_INHIBIT_RESPONSE_US.
+ * @param  report: Pointer to store the check results
+ * @retval PS2_SIM_OK if no violation was found, PS2_SIM_ERROR otherwise
+ */
+PS2_SimStatus_t ps2_sim_check_timing(PS2_SimTimingReport_t *report)
+{
+    uint8_t dev_clk = 1, dev_data = 1, host_clk = 1;
+    uint8_t in_frame = 0, frame_falls = 0, inhibited = 0;
+    uint32_t last_fall = PS2_SIM_NO_TIME;
+    uint32_t last_rise = PS2_SIM_NO_TIME;
+    uint32_t last_data_change = PS2_SIM_NO_TIME;
+    uint32_t inhibit_start = 0;
+    uint32_t inhibit_release = PS2_SIM_NO_TIME;
+
+    if (report == NULL) {
+        return PS2_SIM_ERROR;
+    }
+
+    memset(report, 0, sizeof(PS2_SimTimingReport_t));
+    report->min_clock_period_us = PS2_SIM_NO_TIME;
+    report->log_overflow = edge_overflow;
+
+    for (uint32_t i = 0; i <= edge_count; i++) {
+        /* One extra pass closes an inhibit still open at the end of the log */
+        uint8_t end_of_log = (i == edge_count);
+        const PS2_SimEdge_t *edge = end_of_log ? NULL : &edge_log[i];
+        uint32_t t = end_of_log ? sim_time_us : edge->time_us;
+
+        /* Host side: inhibit start and end */
+        if (end_of_log ||
+            (edge->driver == PS2_SIM_DRIVER_HOST && edge->line == PS2_SIM_LINE_CLOCK)) {
+            uint8_t level = end_of_log ? 1 : edge->level;
+
+            if (level == 0 && !end_of_log) {
+                host_clk = 0;
+                if (in_frame || !dev_clk || !dev_data) {
+                    inhibited = 1;
+                    inhibit_start = t;
+                    inhibit_release = (dev_clk && dev_data) ? t : PS2_SIM_NO_TIME;
+                    report->inhibits++;
+                }
+                in_frame = 0;
+            } else if (host_clk == 0 || end_of_log) {
+                if (inhibited) {
+                    uint32_t response = (inhibit_release == PS2_SIM_NO_TIME) ?
+                                        (t - inhibit_start) : (inhibit_release - inhibit_start);
+                    if (response > report->max_inhibit_response_us) {
+                        report->max_inhibit_response_us = response;
+                    }
+                    if (response > PS2_SIM_MAX_INHIBIT_RESPONSE_US) {
+                        report->inhibit_response_violations++;
+                    }
+                    inhibited = 0;
+                }
+                host_clk = 1;
+            }
+            continue;
+        }
+
+        if (edge->driver != PS2_SIM_DRIVER_DEVICE) {
+            continue;
+        }
+
+        /* Device activity while inhibited only counts towards release time */
+        if (inhibited) {
+            if (edge->line == PS2_SIM_LINE_CLOCK) {
+                dev_clk = edge->level;
+            } else {
+                dev_data = edge->level;
+            }
+            inhibit_release = (dev_clk && dev_data) ? t : PS2_SIM_NO_TIME;
+            continue;
+        }
+
+        if (edge->line == PS2_SIM_LINE_DATA) {
+            dev_data = edge->level;
+            if (in_frame) {
+                if (!dev_clk) {
+                    report->data_hold_violations++;
+                } else if (last_rise != PS2_SIM_NO_TIME &&
+                           (t - last_rise) < PS2_SIM_MIN_DATA_HOLD_US) {
+                    report->data_hold_violations++;
+                }
+            }
+            last_data_change = t;
+            continue;
+        }
+
+        dev_clk = edge->level;
+
+        if (edge->level == 0) {
+            /* Falling clock edge: host samples data here */
+            if (!in_frame || last_fall == PS2_SIM_NO_TIME ||
+                (t - last_fall) > (2U * PS2_SIM_MAX_CLOCK_PERIOD_US)) {
+                in_frame = 1;
+                frame_falls = 0;
+                report->frames++;
+            } else {
+                uint32_t period = t - last_fall;
+                uint32_t high = t - last_rise;
+
+                if (period < report->min_clock_period_us) {
+                    report->min_clock_period_us = period;
+                }
+                if (period > report->max_clock_period_us) {
+                    report->max_clock_period_us = period;
+                }
+                if (period < PS2_SIM_MIN_CLOCK_PERIOD_US || period > PS2_SIM_MAX_CLOCK_PERIOD_US) {
+                    report->clock_period_violations++;
+                }
+                if (high < PS2_SIM_MIN_CLOCK_PHASE_US || high > PS2_SIM_MAX_CLOCK_PHASE_US) {
+                    report->clock_phase_violations++;
+                }
+            }
+
+            if (last_data_change != PS2_SIM_NO_TIME &&
+                (t - last_data_change) < PS2_SIM_MIN_DATA_SETUP_US) {
+                report->data_setup_violations++;
+            }
+
+            frame_falls++;
+            report->clock_edges++;
+            last_fall = t;
+        } else {
+            /* Rising clock edge */
+            if (in_frame && last_fall != PS2_SIM_NO_TIME) {
+                uint32_t low = t - last_fall;
+                if (low < PS2_SIM_MIN_CLOCK_PHASE_US || low > PS2_SIM_MAX_CLOCK_PHASE_US) {
+                    report->clock_phase_violations++;
+                }
+            }
+            last_rise = t;
+
+            if (frame_falls >= PS2_SIM_FRAME_BITS) {
+                in_frame = 0;
+            }
+        }
+    }
+
+    if (report->min_clock_period_us == PS2_SIM_NO_TIME) {
+        report->min_clock_period_us = 0;
+    }
+
+    if (report->clock_period_violations || report->clock_phase_violations ||
+        report->data_setup_violations || report->data_hold_violations ||
+        report->inhibit_response_violations || report->log_overflow) {
+        return PS2_SIM_ERROR;
+    }
+
+    return PS2_SIM_OK;
+}
+
+/* Simulated HAL -------------------------------------------------------------*/
+
+/**
+ * @brief  HAL initialization (simulation)
+ * @retval HAL_OK
+ */
+HAL_StatusTypeDef HAL_Init(void)
+{
+    ps2_sim_reset();
+    return HAL_OK;
+}
+
+/**
+ * @brief  Get tick in milliseconds (simulation)
+ * @retval Virtual time in milliseconds
+ */
+uint32_t HAL_GetTick(void)
+{
+    return sim_time_us / 1000U;
+}
+
+/**
+ * @brief  Millisecond delay (simulation)
+ * @param  Delay: Delay in milliseconds
+ * @retval None
+ */
+void HAL_Delay(uint32_t Delay)
+{
+    ps2_sim_delay_us(Delay * 1000U);
+}
+
+/**
+ * @brief  GPIO initialization (simulation)
+ * @note   Pin configuration has no effect on the simulated bus
+ * @retval None
+ */
+void HAL_GPIO_Init(GPIO_TypeDef *GPIOx, GPIO_InitTypeDef *GPIO_Init)
+{
+    (void)GPIOx;
+    (void)GPIO_Init;
+}
+
+/**
+ * @brief  GPIO de-initialization (simulation)
+ * @retval None
+ */
+void HAL_GPIO_DeInit(GPIO_TypeDef *GPIOx, uint32_t GPIO_Pin)
+{
+    (void)GPIOx;
+    (void)GPIO_Pin;
+}
+
+/**
+ * @brief  Write GPIO pin (simulation)
+ * @note   PS/2 pins become device-side drive changes; other pins are ignored
+ * @retval None
+ */
+void HAL_GPIO_WritePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState)
+{
+    PS2_SimLine_t line;
+
+    if (sim_line_from_pin(GPIOx, GPIO_Pin & PS2_CLK_Pin, &line)) {
+        ps2_sim_drive(PS2_SIM_DRIVER_DEVICE, line, PinState == GPIO_PIN_SET);
+    }
+    if (sim_line_from_pin(GPIOx, GPIO_Pin & PS2_DATA_Pin, &line)) {
+        ps2_sim_drive(PS2_SIM_DRIVER_DEVICE, line, PinState == GPIO_PIN_SET);
+    }
+}
+
+/**
+ * @brief  Read GPIO pin (simulation)
+ * @note   PS/2 pins read the wired-AND bus level
+ * @retval Pin state
+ */
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin)
+{
+    PS2_SimLine_t line;
+
+    if (sim_line_from_pin(GPIOx, GPIO_Pin, &line)) {
+        return ps2_sim_get_line(line) ? GPIO_PIN_SET : GPIO_PIN_RESET;
+    }
+
+    return GPIO_PIN_RESET;
+}
+
+/**
+ * @brief  Toggle GPIO pin (simulation)
+ * @retval None
+ */
+void HAL_GPIO_TogglePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin)
+{
+    (void)GPIOx;
+    (void)GPIO_Pin;
+}
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+ * @brief  Append a drive change to the edge log
+ * @param  driver: Bus side that changed
+ * @param  line: Line that changed
+ * @param  level: New drive level
+ * @retval None
+ */
+static void sim_record_edge(PS2_SimDriver_t driver, PS2_SimLine_t line, uint8_t level)
+{
+    if (edge_count >= PS2_SIM_MAX_EDGES) {
+        edge_overflow = 1;
+        return;
+    }
+
+    edge_log[edge_count].time_us = sim_time_us;
+    edge_log[edge_count].line = (uint8_t)line;
+    edge_log[edge_count].driver = (uint8_t)driver;
+    edge_log[edge_count].level = level;
+    edge_log[edge_count].bus_level = ps2_sim_get_line(line);
+    edge_count++;
+}
+
+/**
+ * @brief  Map a GPIO port/pin to a simulated PS/2 line
+ * @param  GPIOx: GPIO port
+ * @param  pin: Single pin mask
+ * @param  line: Pointer to store the line
+ * @retval 1 if the pin is a PS/2 line, 0 otherwise
+ */
+static int sim_line_from_pin(GPIO_TypeDef *GPIOx, uint16_t pin, PS2_SimLine_t *line)
+{
+    if (GPIOx == PS2_CLK_GPIO_Port && pin == PS2_CLK_Pin) {
+        *line = PS2_SIM_LINE_CLOCK;
+        return 1;
+    }
+
+    if (GPIOx == PS2_DATA_GPIO_Port && pin == PS2_DATA_Pin) {
+        *line = PS2_SIM_LINE_DATA;
+        return 1;
+    }
+
+    return 0;
+}
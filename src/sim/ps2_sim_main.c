@@ -0,0 +1,2789 @@
+/**
+ ******************************************************************************
+ * @file    ps2_sim_main.c
+ * @brief   Host entry point for the PS/2 link simulation
+ * @author  STM32F411 USB-PS2 Project
+ * @version 1.0.0
+ * @date    2024
+ *
+ * @description
+ * Runs the firmware PS/2 transmit path against the simulated GPIO layer.
+ *
+ *   ps2_sim capture [out.vcd]   Send a short key sequence, export the
+ *                               waveform and run the timing checker
+ *   ps2_sim i8042 [options]     Stream typing traffic into the simulated
+ *                               i8042 and report sustained bytes/s
+ *       -n <bytes>              Bytes to send (default 1000)
+ *       -p <us> -d <us>         Periodic inhibit every p us for d us
+ *       -a <us>                 Inhibit for a us after every received byte
+ *       -c <hex>                Host command to issue (repeatable)
+ *       -o <file.vcd>           Also export the waveform
+ *   ps2_sim unplug              Hold keys, then unplug the keyboard and
+ *                               overflow the report buffer; checks that
+ *                               the host ends with no key held and never
+ *                               gets a cut-off scan code
+ *   ps2_sim desync              Drop queued make and break codes; checks
+ *                               that reconciliation heals the host state
+ *   ps2_sim burst               Type a tap burst faster than it is
+ *                               serviced; checks that no tap is lost
+ *   ps2_sim priority            Release a key behind a burst of presses
+ *                               and inject budget-limited text; reports
+ *                               the queueing delay of each class
+ *   ps2_sim flood               Type chords faster than the link drains
+ *                               while the host stalls it, with and
+ *                               without USB backpressure; checks that
+ *                               backpressure avoids queue overflows
+ *   ps2_sim scan64 [options]    Replay a 64-character barcode scan at USB
+ *                               poll rate; checks that every character
+ *                               arrives in order at close to line rate
+ *       -g <us>                 Minimum gap between bytes
+ *       -k <us>                 Minimum gap between scan codes
+ *   ps2_sim latency             Tap keys with reports translated by the
+ *                               main loop and by the USB interrupt fast
+ *                               path; reports report-to-host latency
+ *   ps2_sim hidkeys             Compare the packed key array kernels with
+ *                               the portable versions on random reports
+ *   ps2_sim rollover            Hold keys through ErrorRollOver reports
+ *                               that also press Shift; checks that the
+ *                               host sees no phantom release
+ *   ps2_sim modifiers           Hand one modifier on to the next through
+ *                               all eight, GUI keys included; checks each
+ *                               release reaches the host before the press
+ *   ps2_sim sequences           Hold and tap Print Screen and Pause; checks
+ *                               the exact bytes and that reconciliation
+ *                               leaves them alone
+ *   ps2_sim navkeys             Tap navigation keys under Num Lock and
+ *                               Shift; checks the fake Shift wrappers
+ *   ps2_sim set1                Select Set 1 from the host and tap keys,
+ *                               modifiers and sequences; checks the bytes
+ *   ps2_sim set3                Select Set 3 and change per-key attributes;
+ *                               checks the bytes and typematic repeats
+ *   ps2_sim remap               Use the example keymap's Caps Lock and Fn
+ *                               layer; checks the bytes and that a key
+ *                               releases what it pressed
+ *   ps2_sim macros              Type the example keymap's Fn+A macro, alone
+ *                               and with Shift held; checks the bytes
+ *   ps2_sim chords              Use the example keymap's converter hotkeys;
+ *                               checks that chords act and never reach
+ *                               the host
+ *   ps2_sim taphold             Tap and hold the example keymap's dual-role
+ *                               and one-shot keys; checks the bytes
+ *   ps2_sim config              Save settings with a hotkey, power-cycle,
+ *                               wear the flash sector round and tear a
+ *                               record; checks what boot loads
+ *   ps2_sim hotswap             Publish new remap tables while keys are
+ *                               down, during a report and between every
+ *                               report; checks the bytes and that keys
+ *                               release what they pressed
+ *
+ * The exit status is non-zero when the timing checker reports a violation
+ * or, for i8042, when a byte did not arrive intact.
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ps2_init.h"
+#include "ps2_protocol.h"
+#include "ps2_queue.h"
+#include "ps2_command.h"
+#include "ps2_shadow.h"
+#include "scancode_translator.h"
+#include "keyboard_handler.h"
+#include "hid_keys.h"
+#include "key_remap.h"
+#include "macro_engine.h"
+#include "chord_detector.h"
+#include "tap_hold.h"
+#include "config_store.h"
+#include "flash_sim.h"
+#include "ps2_line_sim.h"
+#include "i8042_sim.h"
+
+/* Private typedef -----------------------------------------------------------*/
+/**
+ * @brief Result of one flood run
+ */
+typedef struct {
+    uint32_t polls;                 ///< Keyboard polls that delivered a report
+    uint32_t skipped_polls;         ///< Polls held back by backpressure
+    uint32_t reports;               ///< Reports that changed the keyboard state
+    uint32_t overflows;             ///< PS/2 queue overflows (keys force-released)
+    uint32_t peak_depth;            ///< Deepest PS/2 queue seen
+    uint32_t held;                  ///< Keys the host holds at the end
+} SimFloodResult_t;
+
+/**
+ * @brief Result of one latency run
+ */
+typedef struct {
+    uint32_t taps;                  ///< Taps whose make code reached the host
+    uint32_t min_latency_us;        ///< Shortest report-to-host latency
+    uint32_t max_latency_us;        ///< Longest report-to-host latency
+    uint32_t total_latency_us;      ///< Sum of latencies
+    uint32_t held;                  ///< Keys the host holds at the end
+} SimLatencyResult_t;
+
+/* Private define ------------------------------------------------------------*/
+#define SIM_DEFAULT_VCD_PATH    "ps2_capture.vcd"
+#define SIM_DEFAULT_BENCH_BYTES 1000U
+#define SIM_DRAIN_TIME_US       20000U  ///< Idle time to let pending commands finish
+#define SIM_POLL_INTERVAL_US    100U    ///< Main loop period while draining
+#define SIM_HID_REPORT_SIZE     8U      ///< Boot protocol keyboard report size
+#define SIM_FLOOD_REPORTS       40U     ///< Reports queued without servicing, beyond the handler buffer
+#define SIM_BURST_DRAIN_US      200000U ///< Time to let a coalesced burst drain
+#define SIM_BYTE_STALL_US       10000U  ///< Host inhibit after each byte, so ps2_process() sends one
+#define SIM_BURST_REPEAT_KEYS   20U     ///< Keys tapped twice in a row by the scanner burst
+#define SIM_HEAL_LIMIT_US       10000U  ///< Longest acceptable time to heal a desync
+#define SIM_SET2_KEYS           512U    ///< Set 2 codes tracked by the decoder (normal + E0)
+#define SIM_USB_POLL_US         1000U   ///< Keyboard interrupt IN interval
+#define SIM_INJECT_KEYS         40U     ///< Keys tapped by injected text
+#define SIM_INJECT_BUDGET       200U    ///< Injected text budget in bytes/s
+#define SIM_INJECT_BURST        8U      ///< Injected text burst in bytes
+#define SIM_PRIORITY_RUN_US     1000000U ///< Time to let the injected text drain
+#define SIM_FLOOD_CHORDS        150U    ///< Three-key chords typed, one every two polls
+#define SIM_FLOOD_STALL_PERIOD_US 50000U ///< Host stalls the link this often
+#define SIM_FLOOD_STALL_US      30000U  ///< Length of each host stall
+#define SIM_SCAN_CHARS          64U     ///< Characters in the simulated barcode scan
+#define SIM_DRAIN_LIMIT_US      2000000U ///< Longest time allowed for a deep queue to drain
+#define SIM_SCAN_MIN_EFFICIENCY 90U     ///< Required share of the link limit, in percent
+#define SIM_MAKE_LOG_SIZE       256U    ///< Make codes logged in arrival order
+#define SIM_MAKE_SHIFTED        0x8000U ///< Make log flag: a Shift key was held
+#define SIM_SET2_LEFT_SHIFT     0x12U
+#define SIM_SET2_RIGHT_SHIFT    0x59U
+#define SIM_LATENCY_TAPS        50U     ///< Keys tapped per latency run
+#define SIM_LATENCY_PERIOD_US   7300U   ///< Tap interval, not a multiple of the loop period
+#define SIM_LATENCY_HOLD_US     3000U   ///< Time each key is held
+#define SIM_MAIN_LOOP_DELAY_US  1000U   ///< Firmware main loop idle delay (MAIN_LOOP_DELAY_MS)
+#define SIM_FAST_PATH_REPORTS   2U      ///< Reports translated per USB interrupt on the fast path
+#define SIM_HIDKEYS_ROUNDS      200000U ///< Random key array pairs checked
+#define SIM_HIDKEYS_SEED        0x2545F491UL
+#define SIM_ROLLOVER_REPORTS    5U      ///< ErrorRollOver reports sent while keys are held
+#define SIM_BYTE_LOG_SIZE       64U     ///< Bytes logged in arrival order
+#define SIM_TYPEMATIC_HOLD_US   400000U ///< Key hold in the typematic check, past the 250 ms delay
+#define SIM_MACRO_TIME_US       100000U ///< Time to type the example macro, about 60 bytes
+#define SIM_DIAGNOSTICS_TIME_US 1000000U ///< Time to type the diagnostics line
+#define SIM_TAPPING_TERM_US     300000U ///< Hold longer than the example tapping term
+#define SIM_CONFIG_TORN_WORDS   5U      ///< Words of a record written before the power loss
+#define SIM_HOTSWAP_REPORTS     60U     ///< Reports with new tables published before each
+#define SIM_CONFIG_MAX_PROBES   13U     ///< Slots boot may read: binary search, a torn record, the record used
+#define SIM_PAUSE_CODES         2U      ///< Codes following an E1 prefix
+
+/* Private macro -------------------------------------------------------------*/
+
+/* Private variables ---------------------------------------------------------*/
+static uint8_t sim_held[SIM_SET2_KEYS];         ///< Keys the simulated host holds
+static uint32_t sim_make_count[SIM_SET2_KEYS];  ///< Make codes received per key
+static uint8_t sim_flow_control = 1;            ///< Main loop honours PS/2 queue congestion
+static uint32_t sim_overflows;                  ///< Reports whose scan codes did not fit the queue
+static uint16_t sim_make_log[SIM_MAKE_LOG_SIZE]; ///< Set 2 key index of each make, SIM_MAKE_SHIFTED if shifted
+static uint32_t sim_make_log_count;             ///< Make codes logged
+static uint32_t sim_held_count;                 ///< Keys the simulated host holds now
+static uint32_t sim_held_peak;                  ///< Most keys held at once
+static uint8_t sim_byte_log[SIM_BYTE_LOG_SIZE]; ///< Raw bytes received by the host
+static uint32_t sim_byte_log_count;             ///< Raw bytes logged
+static uint32_t sim_last_tick_ms;               ///< Tick the SysTick hook last ran at
+static uint32_t sim_hotswap_failures;           ///< key_remap_edit_begin() calls with no free buffer
+static uint8_t sim_hotswap_preempt_at;          ///< Remap preemption point the swap fires at, 0 for none
+static uint8_t sim_hotswap_preempt_calls;       ///< Remap preemption points passed
+
+/* Barcode payload: runs of repeated digits, then shifted letters, then alternating Shift */
+static const char sim_scan_text[SIM_SCAN_CHARS + 1] =
+    "0001112223334445556667778889990ABCDEFGHIJKLMNOPQRSTUVWXYZ7Q7Q7Q7";
+
+/* Set 2 make codes of '0'..'9' and 'A'..'Z' */
+static const uint8_t sim_set2_digits[10] = {
+    0x45, 0x16, 0x1E, 0x26, 0x25, 0x2E, 0x36, 0x3D, 0x3E, 0x46
+};
+static const uint8_t sim_set2_letters[26] = {
+    0x1C, 0x32, 0x21, 0x23, 0x24, 0x2B, 0x34, 0x33, 0x43, 0x3B, 0x42, 0x4B, 0x3A,
+    0x31, 0x44, 0x4D, 0x15, 0x2D, 0x1B, 0x2C, 0x3C, 0x2A, 0x1D, 0x22, 0x35, 0x1A
+};
+
+/* Private function prototypes -----------------------------------------------*/
+static int sim_cmd_capture(const char *vcd_path);
+static int sim_cmd_i8042(int argc, char **argv);
+static int sim_cmd_unplug(void);
+static int sim_cmd_desync(void);
+static int sim_cmd_burst(void);
+static void sim_burst_report(uint8_t key);
+static int sim_cmd_priority(void);
+static void sim_print_class_stats(void);
+static int sim_cmd_flood(void);
+static int sim_flood_run(uint8_t flow_control, SimFloodResult_t *result);
+static void sim_print_flood_result(const char *label, const SimFloodResult_t *result);
+static int sim_cmd_scan64(int argc, char **argv);
+static void sim_scan_report(uint32_t report);
+static int sim_cmd_latency(void);
+static int sim_latency_run(uint8_t fast_path, SimLatencyResult_t *result);
+static void sim_latency_deliver(uint8_t fast_path, uint32_t start_us, uint32_t *next_report, uint32_t *press_us);
+static void sim_print_latency_result(const char *label, const SimLatencyResult_t *result);
+static int sim_cmd_hidkeys(void);
+static uint8_t sim_hidkeys_random_key(uint32_t *seed, const uint8_t *other);
+static int sim_cmd_rollover(void);
+static int sim_cmd_modifiers(void);
+static int sim_cmd_sequences(void);
+static int sim_cmd_navkeys(void);
+static int sim_cmd_set1(void);
+static int sim_cmd_set3(void);
+static int sim_cmd_remap(void);
+static int sim_cmd_macros(void);
+static int sim_cmd_chords(void);
+static int sim_cmd_taphold(void);
+static int sim_cmd_config(void);
+static int sim_config_boot(void);
+static int sim_cmd_hotswap(void);
+static void sim_hotswap_map(uint8_t layer, uint8_t usage, uint8_t entry);
+static void sim_hotswap_preempt(void);
+static void sim_run_reports(const uint8_t (*reports)[3], uint8_t count);
+static void sim_host_command(uint8_t command, uint8_t argument);
+static void sim_host_command_only(uint8_t command);
+static void sim_tap_keys(const uint8_t (*taps)[2], uint8_t count);
+static void sim_run_keyboard(uint32_t duration_us);
+static uint32_t sim_heal(uint32_t expected_held);
+static void sim_keyboard_report(uint8_t modifier, uint8_t key1, uint8_t key2, uint8_t key3);
+static void sim_keyboard_loop(uint8_t input_lost);
+static uint32_t sim_count_held_keys(void);
+static void sim_decode_host_bytes(void);
+static void sim_send_scancode(const PS2_ScanCode_t *scancode);
+static void sim_run_device(uint32_t duration_us);
+static void sim_print_timing_report(const PS2_SimTimingReport_t *report);
+static void sim_usage(const char *prog);
+
+/* Exported functions --------------------------------------------------------*/
+
+/**
+ * @brief  Simulation entry point
+ * @retval 0 on success, 1 on timing violation, 2 on usage error
+ */
+int main(int argc, char **argv)
+{
+    if (argc >= 2 && strcmp(argv[1], "capture") == 0) {
+        return sim_cmd_capture(argc >= 3 ? argv[2] : SIM_DEFAULT_VCD_PATH);
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "i8042") == 0) {
+        return sim_cmd_i8042(argc - 2, argv + 2);
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "unplug") == 0) {
+        return sim_cmd_unplug();
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "desync") == 0) {
+        return sim_cmd_desync();
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "burst") == 0) {
+        return sim_cmd_burst();
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "priority") == 0) {
+        return sim_cmd_priority();
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "flood") == 0) {
+        return sim_cmd_flood();
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "scan64") == 0) {
+        return sim_cmd_scan64(argc - 2, argv + 2);
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "latency") == 0) {
+        return sim_cmd_latency();
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "hidkeys") == 0) {
+        return sim_cmd_hidkeys();
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "rollover") == 0) {
+        return sim_cmd_rollover();
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "modifiers") == 0) {
+        return sim_cmd_modifiers();
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "sequences") == 0) {
+        return sim_cmd_sequences();
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "navkeys") == 0) {
+        return sim_cmd_navkeys();
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "set1") == 0) {
+        return sim_cmd_set1();
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "set3") == 0) {
+        return sim_cmd_set3();
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "remap") == 0) {
+        return sim_cmd_remap();
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "macros") == 0) {
+        return sim_cmd_macros();
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "chords") == 0) {
+        return sim_cmd_chords();
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "taphold") == 0) {
+        return sim_cmd_taphold();
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "config") == 0) {
+        return sim_cmd_config();
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "hotswap") == 0) {
+        return sim_cmd_hotswap();
+    }
+
+    sim_usage(argv[0]);
+    return 2;
+}
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+ * @brief  Capture a key sequence and check its timing
+ * @note   Sends make/break for 'A' and for the extended Right Arrow key
+ * @param  vcd_path: VCD output path
+ * @retval 0 if the capture conforms, 1 otherwise
+ */
+static int sim_cmd_capture(const char *vcd_path)
+{
+    PS2_ScanCode_t scancode;
+    PS2_SimTimingReport_t report;
+    PS2_SimStatus_t status;
+
+    ps2_sim_reset();
+    if (ps2_init() != PS2_OK) {
+        fprintf(stderr, "ps2_init failed\n");
+        return 1;
+    }
+
+    ps2_create_make_code(&scancode, ps2_get_common_key_scancode(PS2_KEY_A));
+    ps2_send_scancode(&scancode);
+    ps2_create_break_code(&scancode, ps2_get_common_key_scancode(PS2_KEY_A));
+    ps2_send_scancode(&scancode);
+    ps2_create_extended_make_code(&scancode, 0x74);
+    ps2_send_scancode(&scancode);
+    ps2_create_extended_break_code(&scancode, 0x74);
+    ps2_send_scancode(&scancode);
+    sim_run_device(1000);
+
+    if (ps2_sim_write_vcd(vcd_path) != PS2_SIM_OK) {
+        fprintf(stderr, "cannot write %s\n", vcd_path);
+        return 1;
+    }
+    printf("wrote %lu edges to %s\n", (unsigned long)ps2_sim_get_edge_count(), vcd_path);
+
+    status = ps2_sim_check_timing(&report);
+    sim_print_timing_report(&report);
+
+    return (status == PS2_SIM_OK) ? 0 : 1;
+}
+
+/**
+ * @brief  Benchmark the PS/2 link against the simulated i8042
+ * @note   Runs the -c host commands, then types make/break codes for
+ *         'a'..'z' until the byte budget is reached and reports what the
+ *         controller accepted
+ * @param  argc: Option count
+ * @param  argv: Options
+ * @retval 0 if every byte arrived intact with conforming timing, 1 otherwise
+ */
+static int sim_cmd_i8042(int argc, char **argv)
+{
+    static const PS2_CommonKey_t keys[] = {
+        PS2_KEY_A, PS2_KEY_B, PS2_KEY_C, PS2_KEY_D, PS2_KEY_E, PS2_KEY_F, PS2_KEY_G,
+        PS2_KEY_H, PS2_KEY_I, PS2_KEY_J, PS2_KEY_K, PS2_KEY_L, PS2_KEY_M, PS2_KEY_N,
+        PS2_KEY_O, PS2_KEY_P, PS2_KEY_Q, PS2_KEY_R, PS2_KEY_S, PS2_KEY_T, PS2_KEY_U,
+        PS2_KEY_V, PS2_KEY_W, PS2_KEY_X, PS2_KEY_Y, PS2_KEY_Z
+    };
+    I8042_SimConfig_t config;
+    I8042_SimStats_t stats;
+    PS2_SimTimingReport_t report;
+    PS2_ScanCode_t scancode;
+    PS2_LinkConfig_t link;
+    const char *vcd_path = NULL;
+    uint32_t byte_budget = SIM_DEFAULT_BENCH_BYTES;
+    uint32_t bytes_sent = 0;
+    uint32_t start_us;
+    int result = 0;
+
+    memset(&config, 0, sizeof(I8042_SimConfig_t));
+
+    ps2_sim_reset();
+    if (ps2_init() != PS2_OK) {
+        fprintf(stderr, "ps2_init failed\n");
+        return 1;
+    }
+    ps2_get_link_config(&link);
+
+    for (int i = 0; i < argc; i++) {
+        const char *value = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+        if (value == NULL) {
+            sim_usage("ps2_sim");
+            return 2;
+        }
+
+        if (strcmp(argv[i], "-n") == 0) {
+            byte_budget = (uint32_t)strtoul(value, NULL, 0);
+        } else if (strcmp(argv[i], "-p") == 0) {
+            config.inhibit_period_us = (uint32_t)strtoul(value, NULL, 0);
+            config.inhibit_offset_us = config.inhibit_period_us;
+        } else if (strcmp(argv[i], "-d") == 0) {
+            config.inhibit_duration_us = (uint32_t)strtoul(value, NULL, 0);
+        } else if (strcmp(argv[i], "-a") == 0) {
+            config.inhibit_after_byte_us = (uint32_t)strtoul(value, NULL, 0);
+        } else if (strcmp(argv[i], "-f") == 0) {
+            if (strcmp(value, "auto") == 0) {
+                link.auto_tune = 1;
+            } else {
+                link.clock_freq_hz = (uint16_t)strtoul(value, NULL, 0);
+            }
+        } else if (strcmp(argv[i], "-g") == 0) {
+            link.byte_gap_us = (uint16_t)strtoul(value, NULL, 0);
+        } else if (strcmp(argv[i], "-o") == 0) {
+            vcd_path = value;
+        } else if (strcmp(argv[i], "-c") != 0) {
+            sim_usage("ps2_sim");
+            return 2;
+        }
+        i++;
+    }
+
+    if (ps2_set_link_config(&link) != PS2_OK) {
+        fprintf(stderr, "invalid link configuration\n");
+        return 2;
+    }
+
+    /* Periodic inhibits are relative to the start of the traffic */
+    start_us = ps2_sim_get_time_us();
+    config.inhibit_offset_us += start_us;
+    i8042_sim_init(&config);
+
+    for (int i = 0; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "-c") == 0) {
+            i8042_sim_send_command((uint8_t)strtoul(argv[i + 1], NULL, 16));
+        }
+    }
+
+    i8042_sim_attach();
+
+    /* Let the commands finish first: a scan code set change discards queued scan codes */
+    sim_run_device(SIM_DRAIN_TIME_US);
+
+    for (uint32_t k = 0; bytes_sent < byte_budget; k++) {
+        uint8_t code = ps2_get_common_key_scancode(keys[k % (sizeof(keys) / sizeof(keys[0]))]);
+
+        ps2_create_make_code(&scancode, code);
+        sim_send_scancode(&scancode);
+        bytes_sent += scancode.length;
+        /* One byte in Set 1, two otherwise */
+        ps2_create_break_code(&scancode, code);
+        sim_send_scancode(&scancode);
+        bytes_sent += scancode.length;
+    }
+    sim_run_device(SIM_DRAIN_TIME_US);
+
+    i8042_sim_detach();
+    i8042_sim_get_stats(&stats);
+    ps2_get_link_config(&link);
+
+    printf("bytes sent:             %lu\n", (unsigned long)bytes_sent);
+    printf("bytes accepted:         %lu\n", (unsigned long)stats.bytes_received);
+    printf("parity errors:          %lu\n", (unsigned long)stats.parity_errors);
+    printf("framing errors:         %lu\n", (unsigned long)stats.framing_errors);
+    printf("aborted frames:         %lu\n", (unsigned long)stats.aborted_frames);
+    printf("host inhibits:          %lu\n", (unsigned long)stats.inhibits);
+    printf("commands sent/acked:    %lu/%lu (%lu timed out)\n",
+           (unsigned long)stats.commands_sent, (unsigned long)stats.commands_acked,
+           (unsigned long)stats.command_timeouts);
+    printf("elapsed:                %lu us\n", (unsigned long)(stats.last_byte_us - start_us));
+    printf("sustained rate:         %lu bytes/s\n", (unsigned long)i8042_sim_get_bytes_per_second());
+    printf("link clock/gap:         %u Hz / %u us%s\n", (unsigned)link.clock_freq_hz,
+           (unsigned)link.byte_gap_us, link.auto_tune ? " (auto-tuned)" : "");
+
+    if (vcd_path != NULL && ps2_sim_write_vcd(vcd_path) != PS2_SIM_OK) {
+        fprintf(stderr, "cannot write %s\n", vcd_path);
+        result = 1;
+    }
+
+    if (ps2_sim_check_timing(&report) != PS2_SIM_OK) {
+        result = 1;
+    }
+    sim_print_timing_report(&report);
+
+    /* Command responses are received in addition to the scan codes */
+    if (stats.bytes_received < bytes_sent) {
+        result = 1;
+    }
+
+    return result;
+}
+
+/**
+ * @brief  Check that no key stays held when USB input is lost
+ * @note   Holds Shift + A + Right Arrow, unplugs while the make codes are
+ *         still queued, then repeats while a report burst is still buffered.
+ *         Last it holds Shift + Ctrl and unplugs with the queue full and
+ *         only the E0 of a Right Arrow make sent, so the releases have to
+ *         clear the queue.
+ * @retval 0 if the host ends with every key released and received the
+ *         Right Arrow make whole, 1 otherwise
+ */
+static int sim_cmd_unplug(void)
+{
+    static const uint8_t right_arrow[] = { PS2_EXTENDED_CODE_PREFIX, 0x74 };
+    I8042_SimConfig_t config;
+    uint32_t held_after_unplug;
+    uint32_t held_after_burst;
+    uint32_t held_after_cut;
+    uint8_t finished;
+
+    ps2_sim_reset();
+    if (ps2_init() != PS2_OK || keyboard_handler_init() != KEYBOARD_HANDLER_OK ||
+        scancode_translator_init() != TRANSLATOR_OK) {
+        fprintf(stderr, "init failed\n");
+        return 1;
+    }
+    i8042_sim_init(NULL);
+    i8042_sim_attach();
+
+    /* Disconnect right after the report, with make codes still queued */
+    sim_keyboard_report(USB_HID_MODIFIER_LEFT_SHIFT, USB_HID_KEY_A, USB_HID_KEY_RIGHT_ARROW, 0);
+    sim_keyboard_loop(0);
+    sim_keyboard_loop(1);
+    sim_run_keyboard(SIM_DRAIN_TIME_US);
+    held_after_unplug = sim_count_held_keys();
+
+    /* Flood the report buffer, then unplug part way through the burst */
+    for (uint8_t i = 0; i < SIM_FLOOD_REPORTS; i++) {
+        sim_keyboard_report(USB_HID_MODIFIER_LEFT_SHIFT, (uint8_t)(USB_HID_KEY_C + (i & 1U)), 0, 0);
+    }
+    sim_keyboard_loop(0);
+    ps2_process();
+    sim_keyboard_loop(1);
+    sim_run_keyboard(SIM_BURST_DRAIN_US);
+    held_after_burst = sim_count_held_keys();
+
+    /* Fill the queue, send one byte and unplug: the host stalls after each byte */
+    sim_keyboard_report(USB_HID_MODIFIER_LEFT_SHIFT | USB_HID_MODIFIER_LEFT_CTRL, 0, 0, 0);
+    sim_run_keyboard(SIM_DRAIN_TIME_US);
+    i8042_sim_detach();
+    memset(&config, 0, sizeof(config));
+    config.inhibit_after_byte_us = SIM_BYTE_STALL_US;
+    i8042_sim_init(&config);
+    i8042_sim_attach();
+    while (ps2_queue_push(right_arrow, sizeof(right_arrow)) == PS2_QUEUE_OK) {
+    }
+    ps2_process();
+    sim_decode_host_bytes();
+    sim_byte_log_count = 0;
+    sim_keyboard_loop(1);
+    sim_run_keyboard(SIM_BURST_DRAIN_US);
+    held_after_cut = sim_count_held_keys();
+    finished = (sim_byte_log_count != 0 && sim_byte_log[0] == right_arrow[1]);
+
+    i8042_sim_detach();
+
+    printf("held after unplug:      %lu\n", (unsigned long)held_after_unplug);
+    printf("held after burst:       %lu\n", (unsigned long)held_after_burst);
+    printf("held after cut:         %lu\n", (unsigned long)held_after_cut);
+    printf("cut scan code finished: %s\n", finished ? "yes" : "no");
+
+    return (held_after_unplug == 0 && held_after_burst == 0 && held_after_cut == 0 && finished) ? 0 : 1;
+}
+
+/**
+ * @brief  Check that lost scan codes are healed by reconciliation
+ * @note   Drops the queued make codes of a three-key chord, then drops the
+ *         break codes, and measures how long the host state takes
+ *         to match the keyboard again
+ * @retval 0 if both desyncs healed within SIM_HEAL_LIMIT_US, 1 otherwise
+ */
+static int sim_cmd_desync(void)
+{
+    uint32_t heal_press_us;
+    uint32_t heal_release_us;
+
+    ps2_sim_reset();
+    if (ps2_init() != PS2_OK || keyboard_handler_init() != KEYBOARD_HANDLER_OK ||
+        scancode_translator_init() != TRANSLATOR_OK) {
+        fprintf(stderr, "init failed\n");
+        return 1;
+    }
+    i8042_sim_init(NULL);
+    i8042_sim_attach();
+
+    /* Press Ctrl + A + Right Arrow and lose every queued byte */
+    sim_keyboard_report(USB_HID_MODIFIER_LEFT_CTRL, USB_HID_KEY_A, USB_HID_KEY_RIGHT_ARROW, 0);
+    sim_keyboard_loop(0);
+    ps2_queue_clear();
+    heal_press_us = sim_heal(3);
+
+    /* Release everything and lose the break codes */
+    sim_keyboard_report(0, 0, 0, 0);
+    sim_keyboard_loop(0);
+    ps2_queue_clear();
+    heal_release_us = sim_heal(0);
+
+    i8042_sim_detach();
+
+    printf("lost makes healed in:   %lu us\n", (unsigned long)heal_press_us);
+    printf("lost breaks healed in:  %lu us\n", (unsigned long)heal_release_us);
+
+    return (heal_press_us <= SIM_HEAL_LIMIT_US && heal_release_us <= SIM_HEAL_LIMIT_US) ? 0 : 1;
+}
+
+/**
+ * @brief  Check that a tap burst survives report buffer saturation
+ * @note   Taps SIM_FLOOD_REPORTS keys, one report each, before the main
+ *         loop gets to run, so most reports are coalesced. Then types
+ *         SIM_BURST_REPEAT_KEYS letters twice each, like a scanner reading
+ *         "aabb..", with the main loop only running while polling is
+ *         paused for a held report.
+ * @retval 0 if every tapped key reached the host, each repeated letter
+ *         twice, and none is left held
+ */
+static int sim_cmd_burst(void)
+{
+    KeyboardHandlerStats_t stats;
+    uint32_t keys_seen = 0;
+    uint32_t doubled = 0;
+    uint32_t makes = 0;
+    uint32_t held;
+
+    ps2_sim_reset();
+    if (ps2_init() != PS2_OK || keyboard_handler_init() != KEYBOARD_HANDLER_OK ||
+        scancode_translator_init() != TRANSLATOR_OK) {
+        fprintf(stderr, "init failed\n");
+        return 1;
+    }
+    i8042_sim_init(NULL);
+    i8042_sim_attach();
+
+    for (uint8_t i = 0; i < SIM_FLOOD_REPORTS; i++) {
+        sim_burst_report((uint8_t)(USB_HID_KEY_A + i));
+    }
+    sim_burst_report(0);
+    sim_run_keyboard(SIM_BURST_DRAIN_US);
+
+    held = sim_count_held_keys();
+    for (uint32_t i = 0; i < SIM_SET2_KEYS; i++) {
+        keys_seen += (sim_make_count[i] != 0);
+    }
+
+    /* Repeated letters, press and release in reports of their own */
+    memset(sim_make_count, 0, sizeof(sim_make_count));
+    for (uint8_t i = 0; i < SIM_BURST_REPEAT_KEYS; i++) {
+        for (uint8_t tap = 0; tap < 2U; tap++) {
+            sim_burst_report((uint8_t)(USB_HID_KEY_A + i));
+            sim_burst_report(0);
+        }
+    }
+    sim_run_keyboard(SIM_BURST_DRAIN_US);
+
+    held += sim_count_held_keys();
+    for (uint32_t i = 0; i < SIM_SET2_KEYS; i++) {
+        doubled += (sim_make_count[i] == 2U);
+        makes += sim_make_count[i];
+    }
+
+    i8042_sim_detach();
+    keyboard_handler_get_stats(&stats);
+
+    printf("reports:                %lu (%lu coalesced, %lu held)\n",
+           (unsigned long)stats.reports, (unsigned long)stats.coalesced_reports,
+           (unsigned long)stats.held_reports);
+    printf("keys reaching host:     %lu of %u\n", (unsigned long)keys_seen, (unsigned)SIM_FLOOD_REPORTS);
+    printf("letters typed twice:    %lu of %u (%lu makes)\n", (unsigned long)doubled,
+           (unsigned)SIM_BURST_REPEAT_KEYS, (unsigned long)makes);
+    printf("held at end:            %lu\n", (unsigned long)held);
+
+    return (keys_seen == SIM_FLOOD_REPORTS && doubled == SIM_BURST_REPEAT_KEYS &&
+            makes == 2U * SIM_BURST_REPEAT_KEYS && held == 0) ? 0 : 1;
+}
+
+/**
+ * @brief  Deliver one burst report as soon as the keyboard is polled
+ * @note   Runs the main loop only while the handler holds a report, as
+ *         the USB host does not poll the keyboard then
+ * @param  key: Key down in the report, 0 for none
+ * @retval None
+ */
+static void sim_burst_report(uint8_t key)
+{
+    while (keyboard_handler_congested()) {
+        sim_keyboard_loop(0);
+        ps2_process();
+        ps2_delay_us(SIM_POLL_INTERVAL_US);
+    }
+    sim_keyboard_report(0, key, 0, 0);
+}
+
+/**
+ * @brief  Check release-first scheduling and the injected text budget
+ * @note   Holds Z, then presses five more keys and releases Z before the
+ *         link runs, so the break of Z competes with five make codes.
+ *         Then injects SIM_INJECT_KEYS taps limited to SIM_INJECT_BUDGET
+ *         bytes/s while the keyboard stays idle.
+ * @retval 0 if the break overtook the makes, the injected text kept to
+ *         its budget and no key is left held, 1 otherwise
+ */
+static int sim_cmd_priority(void)
+{
+    static const PS2_CommonKey_t keys[] = {
+        PS2_KEY_A, PS2_KEY_B, PS2_KEY_C, PS2_KEY_D, PS2_KEY_E, PS2_KEY_F, PS2_KEY_G, PS2_KEY_H
+    };
+    PS2_QueueClassStats_t release_stats;
+    PS2_QueueClassStats_t make_stats;
+    PS2_QueueClassStats_t inject_stats;
+    PS2_ScanCode_t tap[2];
+    uint32_t inject_start_us;
+    uint32_t inject_end_us = 0;
+    uint32_t inject_rate;
+    uint32_t inject_allowed;
+    uint32_t held;
+
+    ps2_sim_reset();
+    if (ps2_init() != PS2_OK || keyboard_handler_init() != KEYBOARD_HANDLER_OK ||
+        scancode_translator_init() != TRANSLATOR_OK) {
+        fprintf(stderr, "init failed\n");
+        return 1;
+    }
+    i8042_sim_init(NULL);
+    i8042_sim_attach();
+
+    /* Z held and sent, then five presses and the release of Z at once */
+    sim_keyboard_report(0, USB_HID_KEY_Z, 0, 0);
+    sim_run_keyboard(SIM_DRAIN_TIME_US);
+    ps2_queue_clear_stats();
+    sim_keyboard_report(0, USB_HID_KEY_Z, USB_HID_KEY_A, USB_HID_KEY_B);
+    sim_keyboard_loop(0);
+    sim_keyboard_report(0, USB_HID_KEY_A, USB_HID_KEY_B, USB_HID_KEY_C);
+    sim_keyboard_loop(0);
+    sim_keyboard_report(0, 0, 0, 0);
+    sim_run_keyboard(SIM_DRAIN_TIME_US);
+    ps2_queue_get_class_stats(PS2_QUEUE_CLASS_RELEASE, &release_stats);
+    ps2_queue_get_class_stats(PS2_QUEUE_CLASS_MAKE, &make_stats);
+    printf("release behind presses:\n");
+    sim_print_class_stats();
+
+    /* Injected text, limited to its budget */
+    ps2_queue_clear_stats();
+    ps2_queue_set_class_budget(PS2_QUEUE_CLASS_INJECT, SIM_INJECT_BUDGET, SIM_INJECT_BURST);
+    inject_start_us = ps2_sim_get_time_us();
+    for (uint32_t i = 0; i < SIM_INJECT_KEYS; i++) {
+        uint8_t code = ps2_get_common_key_scancode(keys[i % (sizeof(keys) / sizeof(keys[0]))]);
+
+        ps2_create_make_code(&tap[0], code);
+        ps2_create_break_code(&tap[1], code);
+        while (ps2_queue_push_scancodes(tap, 2, PS2_QUEUE_CLASS_INJECT) != PS2_QUEUE_OK) {
+            sim_run_keyboard(SIM_POLL_INTERVAL_US);
+        }
+    }
+    while (ps2_queue_count() != 0 &&
+           ps2_sim_get_time_us() - inject_start_us < SIM_PRIORITY_RUN_US) {
+        sim_run_keyboard(SIM_POLL_INTERVAL_US);
+    }
+    inject_end_us = ps2_sim_get_time_us();
+    ps2_queue_get_class_stats(PS2_QUEUE_CLASS_INJECT, &inject_stats);
+    printf("injected text:\n");
+    sim_print_class_stats();
+
+    held = sim_count_held_keys();
+    i8042_sim_detach();
+
+    inject_rate = (uint32_t)((uint64_t)inject_stats.bytes * 1000000U /
+                             (inject_end_us - inject_start_us));
+    /* Burst plus budget over the run, plus the debt of one scan code */
+    inject_allowed = SIM_INJECT_BURST + PS2_MAX_SCANCODE_LENGTH +
+                     (uint32_t)((uint64_t)SIM_INJECT_BUDGET * (inject_end_us - inject_start_us) / 1000000U);
+    printf("inject rate:            %lu bytes/s (budget %u)\n",
+           (unsigned long)inject_rate, (unsigned)SIM_INJECT_BUDGET);
+    printf("held at end:            %lu\n", (unsigned long)held);
+
+    return (release_stats.events == 1 && release_stats.max_delay_us < make_stats.max_delay_us &&
+            inject_stats.bytes == SIM_INJECT_KEYS * 3U && inject_stats.bytes <= inject_allowed &&
+            held == 0) ? 0 : 1;
+}
+
+/**
+ * @brief  Print the queue statistics of every priority class
+ * @retval None
+ */
+static void sim_print_class_stats(void)
+{
+    static const char *const names[PS2_QUEUE_CLASS_COUNT] = { "release", "make", "repeat", "inject" };
+    PS2_QueueClassStats_t stats;
+
+    for (uint8_t i = 0; i < PS2_QUEUE_CLASS_COUNT; i++) {
+        ps2_queue_get_class_stats((PS2_QueueClass_t)i, &stats);
+        if (stats.events == 0) {
+            continue;
+        }
+        printf("  %-8s %3lu codes %4lu bytes  delay avg %6lu us  max %6lu us  ordered %lu\n",
+               names[i], (unsigned long)stats.events, (unsigned long)stats.bytes,
+               (unsigned long)(stats.total_delay_us / stats.events),
+               (unsigned long)stats.max_delay_us, (unsigned long)stats.ordered);
+    }
+}
+
+/**
+ * @brief  Compare a chord flood with and without USB backpressure
+ * @note   The host stalls the link for SIM_FLOOD_STALL_US out of every
+ *         SIM_FLOOD_STALL_PERIOD_US while chords arrive at USB poll rate
+ * @retval 0 if backpressure kept the queue from overflowing and no key
+ *         is left held, 1 otherwise
+ */
+static int sim_cmd_flood(void)
+{
+    SimFloodResult_t open_loop;
+    SimFloodResult_t backpressure;
+
+    if (sim_flood_run(0, &open_loop) != 0 || sim_flood_run(1, &backpressure) != 0) {
+        fprintf(stderr, "init failed\n");
+        return 1;
+    }
+
+    sim_print_flood_result("without backpressure", &open_loop);
+    sim_print_flood_result("with backpressure", &backpressure);
+
+    return (backpressure.overflows == 0 && backpressure.held == 0) ? 0 : 1;
+}
+
+/**
+ * @brief  Type the chord flood once
+ * @note   The simulated keyboard only reports its latest state, and only
+ *         when it is polled, like a device whose interrupt IN endpoint
+ *         is not re-armed
+ * @param  flow_control: 1 to pause polling while the PS/2 queue is congested
+ * @param  result: Pointer to store the outcome
+ * @retval 0 if the run completed, 1 if initialization failed
+ */
+static int sim_flood_run(uint8_t flow_control, SimFloodResult_t *result)
+{
+    I8042_SimConfig_t config;
+    KeyboardHandlerStats_t stats;
+    uint32_t start_us;
+    uint32_t last_poll_us;
+    uint32_t end_us;
+
+    memset(result, 0, sizeof(SimFloodResult_t));
+    memset(sim_held, 0, sizeof(sim_held));
+    memset(sim_make_count, 0, sizeof(sim_make_count));
+    sim_flow_control = flow_control;
+    sim_overflows = 0;
+
+    ps2_sim_reset();
+    if (ps2_init() != PS2_OK || keyboard_handler_init() != KEYBOARD_HANDLER_OK ||
+        scancode_translator_init() != TRANSLATOR_OK) {
+        return 1;
+    }
+
+    start_us = ps2_sim_get_time_us();
+    memset(&config, 0, sizeof(I8042_SimConfig_t));
+    config.inhibit_offset_us = start_us + SIM_FLOOD_STALL_PERIOD_US / 2U;
+    config.inhibit_period_us = SIM_FLOOD_STALL_PERIOD_US;
+    config.inhibit_duration_us = SIM_FLOOD_STALL_US;
+    i8042_sim_init(&config);
+    i8042_sim_attach();
+
+    last_poll_us = start_us;
+    end_us = start_us + SIM_FLOOD_CHORDS * 2U * SIM_USB_POLL_US + SIM_BURST_DRAIN_US;
+
+    /* Keep polling while a deep queue drains through the host stalls */
+    while (ps2_sim_get_time_us() < end_us ||
+           (ps2_queue_count() != 0 && ps2_sim_get_time_us() - end_us < SIM_DRAIN_LIMIT_US)) {
+        uint32_t now_us = ps2_sim_get_time_us();
+
+        if (now_us - last_poll_us >= SIM_USB_POLL_US) {
+            uint32_t tick = (now_us - start_us) / SIM_USB_POLL_US;
+            uint32_t chord = tick / 2U;
+
+            last_poll_us = now_us;
+            if (flow_control && ps2_queue_congested()) {
+                result->skipped_polls++;
+            } else if (chord < SIM_FLOOD_CHORDS && (tick & 1U) == 0) {
+                sim_keyboard_report(0, (uint8_t)(USB_HID_KEY_A + (chord * 3U) % 26U),
+                                    (uint8_t)(USB_HID_KEY_A + (chord * 3U + 1U) % 26U),
+                                    (uint8_t)(USB_HID_KEY_A + (chord * 3U + 2U) % 26U));
+                result->polls++;
+            } else {
+                sim_keyboard_report(0, 0, 0, 0);
+                result->polls++;
+            }
+        }
+
+        sim_keyboard_loop(0);
+        if (ps2_queue_count() > result->peak_depth) {
+            result->peak_depth = ps2_queue_count();
+        }
+        ps2_process();
+        ps2_delay_us(SIM_POLL_INTERVAL_US);
+    }
+
+    result->held = sim_count_held_keys();
+    i8042_sim_detach();
+
+    keyboard_handler_get_stats(&stats);
+    result->reports = stats.reports;
+    result->overflows = sim_overflows;
+    sim_flow_control = 1;
+
+    return 0;
+}
+
+/**
+ * @brief  Print the outcome of a flood run
+ * @param  label: Run description
+ * @param  result: Outcome to print
+ * @retval None
+ */
+static void sim_print_flood_result(const char *label, const SimFloodResult_t *result)
+{
+    printf("%s:\n", label);
+    printf("  polls with report:    %lu (%lu skipped)\n",
+           (unsigned long)result->polls, (unsigned long)result->skipped_polls);
+    printf("  state changes:        %lu\n", (unsigned long)result->reports);
+    printf("  queue overflows:      %lu\n", (unsigned long)result->overflows);
+    printf("  peak queue depth:     %lu of %u\n", (unsigned long)result->peak_depth, (unsigned)PS2_QUEUE_SIZE);
+    printf("  held at end:          %lu\n", (unsigned long)result->held);
+}
+
+/**
+ * @brief  Check the packed key array kernels against the portable ones
+ * @note   Random arrays are biased towards none/ErrorRollOver bytes,
+ *         duplicates and keys shared with the other array, the cases
+ *         where lane handling can go wrong
+ * @retval 0 if every result matched, 1 otherwise
+ */
+static int sim_cmd_hidkeys(void)
+{
+    uint32_t seed = SIM_HIDKEYS_SEED;
+    uint32_t mismatches = 0;
+    uint8_t keys[HID_KEYS_COUNT];
+    uint8_t other[HID_KEYS_COUNT];
+
+    for (uint32_t round = 0; round < SIM_HIDKEYS_ROUNDS; round++) {
+        for (uint8_t i = 0; i < HID_KEYS_COUNT; i++) {
+            other[i] = sim_hidkeys_random_key(&seed, NULL);
+        }
+        for (uint8_t i = 0; i < HID_KEYS_COUNT; i++) {
+            keys[i] = sim_hidkeys_random_key(&seed, other);
+        }
+
+        if (hid_keys_valid_mask(keys) != hid_keys_valid_mask_c(keys) ||
+            hid_keys_match_mask(keys, other, hid_keys_valid_mask_c(keys)) !=
+                hid_keys_match_mask_c(keys, other, hid_keys_valid_mask_c(keys)) ||
+            hid_keys_rollover(keys) != hid_keys_rollover_c(keys)) {
+            if (mismatches == 0) {
+                printf("first mismatch: keys %02X %02X %02X %02X %02X %02X, other %02X %02X %02X %02X %02X %02X\n",
+                       keys[0], keys[1], keys[2], keys[3], keys[4], keys[5],
+                       other[0], other[1], other[2], other[3], other[4], other[5]);
+            }
+            mismatches++;
+        }
+    }
+
+    printf("key array pairs checked: %u\n", (unsigned)SIM_HIDKEYS_ROUNDS);
+    printf("mismatches:              %lu\n", (unsigned long)mismatches);
+
+    return mismatches == 0 ? 0 : 1;
+}
+
+/**
+ * @brief  Draw one key byte for the kernel check
+ * @param  seed: LCG state
+ * @param  other: Array to copy keys from, or NULL
+ * @retval Key byte
+ */
+static uint8_t sim_hidkeys_random_key(uint32_t *seed, const uint8_t *other)
+{
+    uint32_t r;
+
+    *seed = *seed * 1664525UL + 1013904223UL;
+    r = *seed >> 8;
+
+    switch (r & 0x07U) {
+    case 0:
+        return 0x00;
+    case 1:
+        return 0x01;
+    case 2:
+        return (uint8_t)(0x02 + ((r >> 3) & 0x03U));
+    case 3:
+    case 4:
+        return other != NULL ? other[(r >> 3) % HID_KEYS_COUNT] : (uint8_t)(r >> 3);
+    default:
+        return (uint8_t)(r >> 3);
+    }
+}
+
+/**
+ * @brief  Check that ErrorRollOver reports hold the previous keys
+ * @note   Holds A + B + C, sends phantom reports that also press Left
+ *         Shift, then returns to a normal report with the same keys
+ * @retval 0 if no held key was released or re-pressed and Shift arrived
+ */
+static int sim_cmd_rollover(void)
+{
+    static const uint8_t held_codes[] = { 0x1C, 0x32, 0x21 };  /* Set 2 A, B, C */
+    uint8_t phantom[SIM_HID_REPORT_SIZE] = { USB_HID_MODIFIER_LEFT_SHIFT, 0, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01 };
+    KeyboardHandlerStats_t stats;
+    uint32_t held_during;
+    uint32_t held_end;
+    uint8_t remade = 0;
+
+    ps2_sim_reset();
+    if (ps2_init() != PS2_OK || keyboard_handler_init() != KEYBOARD_HANDLER_OK ||
+        scancode_translator_init() != TRANSLATOR_OK) {
+        fprintf(stderr, "init failed\n");
+        return 1;
+    }
+    i8042_sim_init(NULL);
+    i8042_sim_attach();
+
+    sim_keyboard_report(0, USB_HID_KEY_A, USB_HID_KEY_B, USB_HID_KEY_C);
+    sim_run_keyboard(SIM_DRAIN_TIME_US);
+
+    for (uint8_t i = 0; i < SIM_ROLLOVER_REPORTS; i++) {
+        (void)keyboard_handler_process_report(phantom, sizeof(phantom));
+        sim_run_keyboard(SIM_USB_POLL_US);
+    }
+    sim_run_keyboard(SIM_DRAIN_TIME_US);
+    held_during = sim_count_held_keys();
+
+    sim_keyboard_report(USB_HID_MODIFIER_LEFT_SHIFT, USB_HID_KEY_A, USB_HID_KEY_B, USB_HID_KEY_C);
+    sim_run_keyboard(SIM_DRAIN_TIME_US);
+    for (uint8_t i = 0; i < sizeof(held_codes); i++) {
+        remade |= (sim_make_count[held_codes[i]] != 1);
+    }
+
+    sim_keyboard_report(0, 0, 0, 0);
+    sim_run_keyboard(SIM_DRAIN_TIME_US);
+    held_end = sim_count_held_keys();
+
+    i8042_sim_detach();
+    keyboard_handler_get_stats(&stats);
+
+    printf("rollover entries:       %lu (%lu reports held)\n", (unsigned long)stats.rollover_events,
+           (unsigned long)stats.rollover_reports);
+    printf("held during rollover:   %lu of 4\n", (unsigned long)held_during);
+    printf("held keys re-pressed:   %s\n", remade ? "yes" : "no");
+    printf("held at end:            %lu\n", (unsigned long)held_end);
+
+    return (held_during == 4 && !remade && held_end == 0 && stats.rollover_events == 1 &&
+            stats.rollover_reports == SIM_ROLLOVER_REPORTS) ? 0 : 1;
+}
+
+/**
+ * @brief  Check modifier translation and ordering
+ * @note   Each report releases the previous modifier and presses the next,
+ *         Left Ctrl through Right GUI
+ * @retval 0 if every modifier arrived once and no two were held at once
+ */
+static int sim_cmd_modifiers(void)
+{
+    /* Set 2 index (E0 codes + 256) of modifier bits 0-7 */
+    static const uint16_t modifier_codes[USB_HID_MODIFIER_COUNT] = {
+        0x14, 0x12, 0x11, 256U + 0x1F, 256U + 0x14, 0x59, 256U + 0x11, 256U + 0x27
+    };
+    uint32_t arrived = 0;
+    uint32_t held_end;
+
+    ps2_sim_reset();
+    if (ps2_init() != PS2_OK || keyboard_handler_init() != KEYBOARD_HANDLER_OK ||
+        scancode_translator_init() != TRANSLATOR_OK) {
+        fprintf(stderr, "init failed\n");
+        return 1;
+    }
+    i8042_sim_init(NULL);
+    i8042_sim_attach();
+
+    for (uint8_t bit = 0; bit < USB_HID_MODIFIER_COUNT; bit++) {
+        sim_keyboard_report((uint8_t)(1U << bit), 0, 0, 0);
+        sim_run_keyboard(SIM_DRAIN_TIME_US);
+    }
+    sim_keyboard_report(0, 0, 0, 0);
+    sim_run_keyboard(SIM_DRAIN_TIME_US);
+    held_end = sim_count_held_keys();
+
+    for (uint8_t bit = 0; bit < USB_HID_MODIFIER_COUNT; bit++) {
+        arrived += (sim_make_count[modifier_codes[bit]] == 1);
+    }
+
+    i8042_sim_detach();
+
+    printf("modifiers reaching host: %lu of %u\n", (unsigned long)arrived, (unsigned)USB_HID_MODIFIER_COUNT);
+    printf("most held at once:       %lu\n", (unsigned long)sim_held_peak);
+    printf("held at end:             %lu\n", (unsigned long)held_end);
+
+    return (arrived == USB_HID_MODIFIER_COUNT && sim_held_peak == 1 && held_end == 0) ? 0 : 1;
+}
+
+/**
+ * @brief  Check the pooled Print Screen and Pause sequences
+ * @note   Print Screen is held across several idle passes so that
+ *         reconciliation would resend it if the shadow did not decode the
+ *         pooled bytes; Pause is tapped and sends nothing on release
+ * @retval 0 if the host received exactly the Set 2 sequences once
+ */
+static int sim_cmd_sequences(void)
+{
+    static const uint8_t expected[] = {
+        0xE0, 0x12, 0xE0, 0x7C,
+        0xE0, 0xF0, 0x7C, 0xE0, 0xF0, 0x12,
+        0xE1, 0x14, 0x77, 0xE1, 0xF0, 0x14, 0xF0, 0x77
+    };
+    uint32_t held_during;
+    uint32_t held_end;
+    uint8_t intact;
+
+    ps2_sim_reset();
+    if (ps2_init() != PS2_OK || keyboard_handler_init() != KEYBOARD_HANDLER_OK ||
+        scancode_translator_init() != TRANSLATOR_OK) {
+        fprintf(stderr, "init failed\n");
+        return 1;
+    }
+    i8042_sim_init(NULL);
+    i8042_sim_attach();
+
+    sim_keyboard_report(0, USB_HID_KEY_PRINT_SCREEN, 0, 0);
+    sim_run_keyboard(SIM_DRAIN_TIME_US);
+    held_during = sim_count_held_keys();
+    sim_keyboard_report(0, 0, 0, 0);
+    sim_run_keyboard(SIM_DRAIN_TIME_US);
+    sim_keyboard_report(0, USB_HID_KEY_PAUSE, 0, 0);
+    sim_run_keyboard(SIM_DRAIN_TIME_US);
+    sim_keyboard_report(0, 0, 0, 0);
+    sim_run_keyboard(SIM_DRAIN_TIME_US);
+    held_end = sim_count_held_keys();
+
+    i8042_sim_detach();
+
+    intact = (sim_byte_log_count == sizeof(expected) &&
+              memcmp(sim_byte_log, expected, sizeof(expected)) == 0);
+
+    printf("bytes received:          %lu of %u\n", (unsigned long)sim_byte_log_count, (unsigned)sizeof(expected));
+    printf("sequences intact:        %s\n", intact ? "yes" : "no");
+    printf("held with Print Screen:  %lu\n", (unsigned long)held_during);
+    printf("held at end:             %lu\n", (unsigned long)held_end);
+
+    return (intact && held_during == 1 && held_end == 0) ? 0 : 1;
+}
+
+/**
+ * @brief  Check the fake Shift wrappers of navigation keys
+ * @note   Taps Up under Num Lock, Up with Left Shift, Home with both Shift
+ *         keys and Up with Num Lock off, like a native keyboard would send
+ * @retval 0 if the host received exactly the native byte stream
+ */
+static int sim_cmd_navkeys(void)
+{
+    static const uint8_t expected[] = {
+        /* Num Lock on: Up */
+        0xE0, 0x12, 0xE0, 0x75, 0xE0, 0xF0, 0x75, 0xE0, 0xF0, 0x12,
+        /* Left Shift + Up */
+        0x12, 0xE0, 0xF0, 0x12, 0xE0, 0x75, 0xE0, 0xF0, 0x75, 0xE0, 0x12, 0xF0, 0x12,
+        /* Both Shift keys + Home */
+        0x12, 0x59, 0xE0, 0xF0, 0x12, 0xE0, 0xF0, 0x59, 0xE0, 0x6C,
+        0xE0, 0xF0, 0x6C, 0xE0, 0x12, 0xE0, 0x59, 0xF0, 0x12, 0xF0, 0x59,
+        /* Num Lock off: Up */
+        0xE0, 0x75, 0xE0, 0xF0, 0x75
+    };
+    static const uint8_t taps[][2] = {
+        { 0, USB_HID_KEY_UP_ARROW },
+        { USB_HID_MODIFIER_LEFT_SHIFT, USB_HID_KEY_UP_ARROW },
+        { USB_HID_MODIFIER_LEFT_SHIFT | USB_HID_MODIFIER_RIGHT_SHIFT, USB_HID_KEY_HOME }
+    };
+    uint32_t held_end;
+    uint8_t intact;
+
+    ps2_sim_reset();
+    if (ps2_init() != PS2_OK || keyboard_handler_init() != KEYBOARD_HANDLER_OK ||
+        scancode_translator_init() != TRANSLATOR_OK) {
+        fprintf(stderr, "init failed\n");
+        return 1;
+    }
+    i8042_sim_init(NULL);
+    i8042_sim_attach();
+
+    sim_host_command(PS2_CMD_SET_LEDS, PS2_LED_NUM_LOCK);
+    sim_tap_keys(taps, (uint8_t)(sizeof(taps) / sizeof(taps[0])));
+    sim_host_command(PS2_CMD_SET_LEDS, 0);
+    sim_keyboard_report(0, USB_HID_KEY_UP_ARROW, 0, 0);
+    sim_run_keyboard(SIM_DRAIN_TIME_US);
+    sim_keyboard_report(0, 0, 0, 0);
+    sim_run_keyboard(SIM_DRAIN_TIME_US);
+    held_end = sim_count_held_keys();
+
+    i8042_sim_detach();
+
+    intact = (sim_byte_log_count == sizeof(expected) &&
+              memcmp(sim_byte_log, expected, sizeof(expected)) == 0);
+
+    printf("bytes received:          %lu of %u\n", (unsigned long)sim_byte_log_count, (unsigned)sizeof(expected));
+    printf("wrappers intact:         %s\n", intact ? "yes" : "no");
+    printf("held at end:             %lu\n", (unsigned long)held_end);
+
+    return (intact && held_end == 0) ? 0 : 1;
+}
+
+/**
+ * @brief  Check Set 1 output
+ * @note   The host selects Set 1 and turns Num Lock on, then a letter, a
+ *         wrapped navigation key with and without Shift, Print Screen,
+ *         Pause and an E0 modifier are tapped
+ * @retval 0 if the host received exactly the Set 1 byte stream and the
+ *         shadow ends with no key held
+ */
+static int sim_cmd_set1(void)
+{
+    static const uint8_t expected[] = {
+        /* A */
+        0x1E, 0x9E,
+        /* Num Lock on: Up */
+        0xE0, 0x2A, 0xE0, 0x48, 0xE0, 0xC8, 0xE0, 0xAA,
+        /* Left Shift + Up */
+        0x2A, 0xE0, 0xAA, 0xE0, 0x48, 0xE0, 0xC8, 0xE0, 0x2A, 0xAA,
+        /* Print Screen */
+        0xE0, 0x2A, 0xE0, 0x37, 0xE0, 0xB7, 0xE0, 0xAA,
+        /* Pause */
+        0xE1, 0x1D, 0x45, 0xE1, 0x9D, 0xC5,
+        /* Right Ctrl */
+        0xE0, 0x1D, 0xE0, 0x9D
+    };
+    static const uint8_t taps[][2] = {
+        { 0, USB_HID_KEY_A },
+        { 0, USB_HID_KEY_UP_ARROW },
+        { USB_HID_MODIFIER_LEFT_SHIFT, USB_HID_KEY_UP_ARROW },
+        { 0, USB_HID_KEY_PRINT_SCREEN },
+        { 0, USB_HID_KEY_PAUSE },
+        { USB_HID_MODIFIER_RIGHT_CTRL, 0 }
+    };
+    const uint8_t *held;
+    uint32_t held_end = 0;
+    uint8_t intact;
+
+    ps2_sim_reset();
+    if (ps2_init() != PS2_OK || keyboard_handler_init() != KEYBOARD_HANDLER_OK ||
+        scancode_translator_init() != TRANSLATOR_OK) {
+        fprintf(stderr, "init failed\n");
+        return 1;
+    }
+    i8042_sim_init(NULL);
+    i8042_sim_attach();
+
+    sim_host_command(PS2_CMD_SCAN_CODE_SET, PS2_SCAN_CODE_SET_1);
+    sim_host_command(PS2_CMD_SET_LEDS, PS2_LED_NUM_LOCK);
+    sim_tap_keys(taps, (uint8_t)(sizeof(taps) / sizeof(taps[0])));
+
+    /* The Set 2 decoder only collects the raw bytes here */
+    sim_decode_host_bytes();
+    held = ps2_shadow_get_state();
+    for (uint16_t i = 0; i < PS2_SHADOW_BYTES; i++) {
+        held_end += (held[i] != 0);
+    }
+
+    i8042_sim_detach();
+
+    intact = (sim_byte_log_count == sizeof(expected) &&
+              memcmp(sim_byte_log, expected, sizeof(expected)) == 0);
+
+    printf("scan code set:           %u\n", (unsigned)ps2_get_scan_code_set());
+    printf("bytes received:          %lu of %u\n", (unsigned long)sim_byte_log_count, (unsigned)sizeof(expected));
+    printf("set 1 bytes intact:      %s\n", intact ? "yes" : "no");
+    printf("held at end:             %lu\n", (unsigned long)held_end);
+
+    return (ps2_get_scan_code_set() == PS2_SCAN_CODE_SET_1 && intact && held_end == 0) ? 0 : 1;
+}
+
+/**
+ * @brief  Check Set 3 output and per-key attributes
+ * @note   The host selects Set 3. With the power-up attributes a letter and
+ *         Print Screen are make only and Left Shift make/break; the host
+ *         then makes A make/break, all keys make only and all keys
+ *         make/break. Finally A is held with the fastest typematic setting,
+ *         once typematic/make/break and once make/break only.
+ * @retval 0 if the host received exactly the Set 3 byte stream, A repeated
+ *         only while typematic and the shadow ends with no key held
+ */
+static int sim_cmd_set3(void)
+{
+    static const uint8_t expected[] = {
+        /* A, make only */
+        0x1C,
+        /* Left Shift */
+        0x12, 0xF0, 0x12,
+        /* Print Screen, make only */
+        0x57,
+        /* A after 0xFC 1C */
+        0x1C, 0xF0, 0x1C,
+        /* Left Shift after 0xF9 */
+        0x12,
+        /* Up after 0xF8 */
+        0x63, 0xF0, 0x63
+    };
+    static const uint8_t taps[][2] = {
+        { 0, USB_HID_KEY_A },
+        { USB_HID_MODIFIER_LEFT_SHIFT, 0 },
+        { 0, USB_HID_KEY_PRINT_SCREEN }
+    };
+    static const uint8_t tap_a[][2] = { { 0, USB_HID_KEY_A } };
+    static const uint8_t tap_shift[][2] = { { USB_HID_MODIFIER_LEFT_SHIFT, 0 } };
+    static const uint8_t tap_up[][2] = { { 0, USB_HID_KEY_UP_ARROW } };
+    const uint8_t *held;
+    uint32_t held_end = 0;
+    uint32_t makes_typematic, makes_make_break;
+    uint8_t intact;
+
+    ps2_sim_reset();
+    if (ps2_init() != PS2_OK || keyboard_handler_init() != KEYBOARD_HANDLER_OK ||
+        scancode_translator_init() != TRANSLATOR_OK) {
+        fprintf(stderr, "init failed\n");
+        return 1;
+    }
+    i8042_sim_init(NULL);
+    i8042_sim_attach();
+
+    sim_host_command(PS2_CMD_SCAN_CODE_SET, PS2_SCAN_CODE_SET_3);
+    sim_tap_keys(taps, (uint8_t)(sizeof(taps) / sizeof(taps[0])));
+    sim_host_command(PS2_CMD_SET_KEY_MAKE_BREAK, 0x1C);
+    sim_tap_keys(tap_a, 1);
+    sim_host_command_only(PS2_CMD_SET_ALL_MAKE);
+    sim_tap_keys(tap_shift, 1);
+    sim_host_command_only(PS2_CMD_SET_ALL_MAKE_BREAK);
+    sim_tap_keys(tap_up, 1);
+
+    /* The Set 2 decoder reads Set 3 break codes the same way */
+    sim_decode_host_bytes();
+    intact = (sim_byte_log_count == sizeof(expected) &&
+              memcmp(sim_byte_log, expected, sizeof(expected)) == 0);
+
+    /* 250 ms delay, 30 repeats per second */
+    sim_host_command(PS2_CMD_SET_TYPEMATIC, 0x00);
+    sim_host_command_only(PS2_CMD_SET_ALL_TMB);
+    makes_typematic = sim_make_count[0x1C];
+    sim_keyboard_report(0, USB_HID_KEY_A, 0, 0);
+    sim_run_keyboard(SIM_TYPEMATIC_HOLD_US);
+    sim_keyboard_report(0, 0, 0, 0);
+    sim_run_keyboard(SIM_DRAIN_TIME_US);
+    sim_decode_host_bytes();
+    makes_typematic = sim_make_count[0x1C] - makes_typematic;
+
+    sim_host_command(PS2_CMD_SET_KEY_MAKE_BREAK, 0x1C);
+    makes_make_break = sim_make_count[0x1C];
+    sim_keyboard_report(0, USB_HID_KEY_A, 0, 0);
+    sim_run_keyboard(SIM_TYPEMATIC_HOLD_US);
+    sim_keyboard_report(0, 0, 0, 0);
+    sim_run_keyboard(SIM_DRAIN_TIME_US);
+    sim_decode_host_bytes();
+    makes_make_break = sim_make_count[0x1C] - makes_make_break;
+
+    held = ps2_shadow_get_state();
+    for (uint16_t i = 0; i < PS2_SHADOW_BYTES; i++) {
+        held_end += (held[i] != 0);
+    }
+
+    i8042_sim_detach();
+
+    printf("scan code set:           %u\n", (unsigned)ps2_get_scan_code_set());
+    printf("set 3 bytes intact:      %s\n", intact ? "yes" : "no");
+    printf("typematic makes:         %lu\n", (unsigned long)makes_typematic);
+    printf("make/break makes:        %lu\n", (unsigned long)makes_make_break);
+    printf("held at end:             %lu\n", (unsigned long)held_end);
+
+    return (ps2_get_scan_code_set() == PS2_SCAN_CODE_SET_3 && intact && makes_typematic > 1 &&
+            makes_make_break == 1 && held_end == 0) ? 0 : 1;
+}
+
+/**
+ * @brief  Check key remapping with the example keymap
+ * @note   Taps Caps Lock (Left Ctrl in the base layer), H with the Fn layer
+ *         held on the Application key, H pressed in the Fn layer and
+ *         released after it, then H on its own
+ * @retval 0 if the host received exactly the remapped Set 2 bytes, the
+ *         base layer is back in use and the shadow ends with no key held
+ */
+static int sim_cmd_remap(void)
+{
+    static const uint8_t expected[] = {
+        /* Caps Lock as Left Ctrl */
+        0x14, 0xF0, 0x14,
+        /* Fn + H as Left Arrow */
+        0xE0, 0x6B, 0xE0, 0xF0, 0x6B,
+        /* Fn released first: H still releases Left Arrow */
+        0xE0, 0x6B, 0xE0, 0xF0, 0x6B,
+        /* H */
+        0x33, 0xF0, 0x33
+    };
+    static const uint8_t taps[][2] = {
+        { 0, USB_HID_KEY_CAPS_LOCK }
+    };
+    static const uint8_t tap_h[][2] = {
+        { 0, USB_HID_KEY_H }
+    };
+    /* Key bytes of each report, Application key first */
+    static const uint8_t reports[][2] = {
+        { USB_HID_KEY_APPLICATION, 0 },
+        { USB_HID_KEY_APPLICATION, USB_HID_KEY_H },
+        { USB_HID_KEY_APPLICATION, 0 },
+        { 0, 0 },
+        { USB_HID_KEY_APPLICATION, 0 },
+        { USB_HID_KEY_APPLICATION, USB_HID_KEY_H },
+        { USB_HID_KEY_H, 0 },
+        { 0, 0 }
+    };
+    const uint8_t *held;
+    uint32_t held_end = 0;
+    uint8_t intact;
+
+    ps2_sim_reset();
+    if (ps2_init() != PS2_OK || keyboard_handler_init() != KEYBOARD_HANDLER_OK ||
+        scancode_translator_init() != TRANSLATOR_OK) {
+        fprintf(stderr, "init failed\n");
+        return 1;
+    }
+    i8042_sim_init(NULL);
+    i8042_sim_attach();
+
+    sim_tap_keys(taps, (uint8_t)(sizeof(taps) / sizeof(taps[0])));
+    for (uint8_t i = 0; i < sizeof(reports) / sizeof(reports[0]); i++) {
+        sim_keyboard_report(0, reports[i][0], reports[i][1], 0);
+        sim_run_keyboard(SIM_DRAIN_TIME_US);
+    }
+    sim_tap_keys(tap_h, 1);
+
+    sim_decode_host_bytes();
+    held = ps2_shadow_get_state();
+    for (uint16_t i = 0; i < PS2_SHADOW_BYTES; i++) {
+        held_end += (held[i] != 0);
+    }
+
+    i8042_sim_detach();
+
+    intact = (sim_byte_log_count == sizeof(expected) &&
+              memcmp(sim_byte_log, expected, sizeof(expected)) == 0);
+
+    printf("keymap layers:           %u\n", (unsigned)key_remap_layer_count);
+    printf("bytes received:          %lu of %u\n", (unsigned long)sim_byte_log_count, (unsigned)sizeof(expected));
+    printf("remapped bytes intact:   %s\n", intact ? "yes" : "no");
+    printf("layer at end:            %u\n", (unsigned)key_remap_get_layer());
+    printf("held at end:             %lu\n", (unsigned long)held_end);
+
+    return (intact && key_remap_get_layer() == 0 && held_end == 0) ? 0 : 1;
+}
+
+/**
+ * @brief  Check macro typing with the example keymap
+ * @note   Presses Fn+A, which types "Admin{TAB}", then does it again with
+ *         Left Shift held on the USB keyboard: the macro lifts the live
+ *         Shift for its lower case letters and Tab and restores it after
+ * @retval 0 if the host received exactly the macro's Set 2 bytes, the
+ *         engine is idle and the shadow ends with no key held
+ */
+static int sim_cmd_macros(void)
+{
+    static const uint8_t expected[] = {
+        /* Admin{TAB} */
+        0x12, 0x1C, 0xF0, 0x1C, 0xF0, 0x12,
+        0x23, 0xF0, 0x23, 0x3A, 0xF0, 0x3A, 0x43, 0xF0, 0x43, 0x31, 0xF0, 0x31,
+        0x0D, 0xF0, 0x0D,
+        /* Left Shift held */
+        0x12,
+        /* Admin{TAB} with Shift lifted around the lower case keys */
+        0x1C, 0xF0, 0x1C,
+        0xF0, 0x12, 0x23, 0xF0, 0x23, 0x12,
+        0xF0, 0x12, 0x3A, 0xF0, 0x3A, 0x12,
+        0xF0, 0x12, 0x43, 0xF0, 0x43, 0x12,
+        0xF0, 0x12, 0x31, 0xF0, 0x31, 0x12,
+        0xF0, 0x12, 0x0D, 0xF0, 0x0D, 0x12,
+        /* Left Shift released */
+        0xF0, 0x12
+    };
+    /* Modifier byte and key bytes of each report, Application key first */
+    static const uint8_t reports[][3] = {
+        { 0, USB_HID_KEY_APPLICATION, 0 },
+        { 0, USB_HID_KEY_APPLICATION, USB_HID_KEY_A },
+        { 0, USB_HID_KEY_APPLICATION, 0 },
+        { 0, 0, 0 },
+        { USB_HID_MODIFIER_LEFT_SHIFT, 0, 0 },
+        { USB_HID_MODIFIER_LEFT_SHIFT, USB_HID_KEY_APPLICATION, 0 },
+        { USB_HID_MODIFIER_LEFT_SHIFT, USB_HID_KEY_APPLICATION, USB_HID_KEY_A },
+        { USB_HID_MODIFIER_LEFT_SHIFT, USB_HID_KEY_APPLICATION, 0 },
+        { USB_HID_MODIFIER_LEFT_SHIFT, 0, 0 },
+        { 0, 0, 0 }
+    };
+    const uint8_t *held;
+    uint32_t held_end = 0;
+    uint8_t intact;
+
+    ps2_sim_reset();
+    if (ps2_init() != PS2_OK || keyboard_handler_init() != KEYBOARD_HANDLER_OK ||
+        scancode_translator_init() != TRANSLATOR_OK) {
+        fprintf(stderr, "init failed\n");
+        return 1;
+    }
+    i8042_sim_init(NULL);
+    i8042_sim_attach();
+
+    for (uint8_t i = 0; i < sizeof(reports) / sizeof(reports[0]); i++) {
+        sim_keyboard_report(reports[i][0], reports[i][1], reports[i][2], 0);
+        sim_run_keyboard(reports[i][2] == USB_HID_KEY_A ? SIM_MACRO_TIME_US : SIM_DRAIN_TIME_US);
+    }
+
+    sim_decode_host_bytes();
+    held = ps2_shadow_get_state();
+    for (uint16_t i = 0; i < PS2_SHADOW_BYTES; i++) {
+        held_end += (held[i] != 0);
+    }
+
+    i8042_sim_detach();
+
+    intact = (sim_byte_log_count == sizeof(expected) &&
+              memcmp(sim_byte_log, expected, sizeof(expected)) == 0);
+
+    printf("bytes received:          %lu of %u\n", (unsigned long)sim_byte_log_count, (unsigned)sizeof(expected));
+    printf("macro bytes intact:      %s\n", intact ? "yes" : "no");
+    printf("macro busy at end:       %s\n", macro_engine_busy() ? "yes" : "no");
+    printf("held at end:             %lu\n", (unsigned long)held_end);
+
+    return (intact && !macro_engine_busy() && held_end == 0) ? 0 : 1;
+}
+
+/**
+ * @brief  Check converter hotkey chords with the example keymap
+ * @note   Left Ctrl + Right Ctrl + F locks and unlocks the Fn layer, around
+ *         taps of H; F on its own stays F. Left Ctrl + Right Ctrl + R
+ *         releases every key while A is held, + D types the diagnostics
+ *         line and + 3 / + 2 switch the scan code set.
+ * @retval 0 if the layer lock bytes are exact, the trigger keys never
+ *         reached the host, every action took effect and the shadow ends
+ *         with no key held
+ */
+static int sim_cmd_chords(void)
+{
+    static const uint8_t expected[] = {
+        /* Ctrl + Ctrl, F swallowed: Fn layer locked */
+        0x14, 0xE0, 0x14, 0xF0, 0x14, 0xE0, 0xF0, 0x14,
+        /* H as Left Arrow */
+        0xE0, 0x6B, 0xE0, 0xF0, 0x6B,
+        /* Ctrl + Ctrl, F swallowed: Fn layer unlocked */
+        0x14, 0xE0, 0x14, 0xF0, 0x14, 0xE0, 0xF0, 0x14,
+        /* H, then F on its own */
+        0x33, 0xF0, 0x33, 0x2B, 0xF0, 0x2B
+    };
+    static const uint8_t ctrls = USB_HID_MODIFIER_LEFT_CTRL | USB_HID_MODIFIER_RIGHT_CTRL;
+    /* Modifier byte and key bytes of each report */
+    static const uint8_t lock_reports[][3] = {
+        { USB_HID_MODIFIER_LEFT_CTRL, 0, 0 }, { ctrls, 0, 0 },
+        { ctrls, USB_HID_KEY_F, 0 }, { ctrls, 0, 0 }, { 0, 0, 0 },
+        { 0, USB_HID_KEY_H, 0 }, { 0, 0, 0 },
+        { USB_HID_MODIFIER_LEFT_CTRL, 0, 0 }, { ctrls, 0, 0 },
+        { ctrls, USB_HID_KEY_F, 0 }, { ctrls, 0, 0 }, { 0, 0, 0 },
+        { 0, USB_HID_KEY_H, 0 }, { 0, 0, 0 },
+        { 0, USB_HID_KEY_F, 0 }, { 0, 0, 0 }
+    };
+    static const uint8_t release_reports[][3] = {
+        { 0, USB_HID_KEY_A, 0 }, { USB_HID_MODIFIER_LEFT_CTRL, USB_HID_KEY_A, 0 },
+        { ctrls, USB_HID_KEY_A, 0 }, { ctrls, USB_HID_KEY_A, USB_HID_KEY_R },
+        { ctrls, USB_HID_KEY_A, USB_HID_KEY_R }, { ctrls, USB_HID_KEY_A, 0 },
+        { 0, 0, 0 }
+    };
+    static const uint8_t set3_reports[][3] = {
+        { USB_HID_MODIFIER_LEFT_CTRL, 0, 0 }, { ctrls, 0, 0 },
+        { ctrls, USB_HID_KEY_3, 0 }, { ctrls, 0, 0 }
+    };
+    static const uint8_t set2_reports[][3] = {
+        { ctrls, USB_HID_KEY_2, 0 }, { ctrls, 0, 0 }, { 0, 0, 0 }
+    };
+    const uint8_t *held;
+    uint32_t held_end = 0;
+    uint32_t lock_bytes;
+    uint32_t makes_a;
+    uint32_t triggers_sent;
+    I8042_SimConfig_t config;
+    uint8_t intact, typed, set_switched, finished;
+
+    ps2_sim_reset();
+    if (ps2_init() != PS2_OK || keyboard_handler_init() != KEYBOARD_HANDLER_OK ||
+        scancode_translator_init() != TRANSLATOR_OK) {
+        fprintf(stderr, "init failed\n");
+        return 1;
+    }
+    i8042_sim_init(NULL);
+    i8042_sim_attach();
+
+    /* Layer lock: exact bytes */
+    sim_run_reports(lock_reports, (uint8_t)(sizeof(lock_reports) / sizeof(lock_reports[0])));
+    sim_decode_host_bytes();
+    lock_bytes = sim_byte_log_count;
+    intact = (sim_byte_log_count == sizeof(expected) &&
+              memcmp(sim_byte_log, expected, sizeof(expected)) == 0);
+
+    /* Release all while A is held: A released and pressed again, R never sent */
+    makes_a = sim_make_count[0x1C];
+    triggers_sent = sim_make_count[0x2D];
+    sim_run_reports(release_reports, (uint8_t)(sizeof(release_reports) / sizeof(release_reports[0])));
+    sim_decode_host_bytes();
+    makes_a = sim_make_count[0x1C] - makes_a;
+    triggers_sent = sim_make_count[0x2D] - triggers_sent;
+
+    /* Diagnostics: the status line types through the macro engine */
+    sim_keyboard_report(USB_HID_MODIFIER_LEFT_CTRL, 0, 0, 0);
+    sim_run_keyboard(SIM_DRAIN_TIME_US);
+    sim_keyboard_report(ctrls, 0, 0, 0);
+    sim_run_keyboard(SIM_DRAIN_TIME_US);
+    sim_keyboard_report(ctrls, USB_HID_KEY_D, 0, 0);
+    sim_run_keyboard(SIM_POLL_INTERVAL_US * 10U);
+    typed = macro_engine_busy();
+    sim_keyboard_report(0, 0, 0, 0);
+    sim_run_keyboard(SIM_DIAGNOSTICS_TIME_US);
+    typed = typed && !macro_engine_busy();
+    sim_decode_host_bytes();
+
+    /* Scan code set 3 and back to 2; 2 and 3 have the same codes in both sets */
+    triggers_sent -= sim_make_count[0x1E] + sim_make_count[0x26];
+    sim_run_reports(set3_reports, (uint8_t)(sizeof(set3_reports) / sizeof(set3_reports[0])));
+    set_switched = (ps2_get_scan_code_set() == PS2_SCAN_CODE_SET_3);
+    sim_run_reports(set2_reports, (uint8_t)(sizeof(set2_reports) / sizeof(set2_reports[0])));
+    set_switched = set_switched && ps2_get_scan_code_set() == PS2_SCAN_CODE_SET_2;
+    sim_decode_host_bytes();
+    triggers_sent += sim_make_count[0x1E] + sim_make_count[0x26];
+
+    /* Set 3 chord with only the E0 of Right Ctrl's make sent: the host stalls after each byte */
+    i8042_sim_detach();
+    memset(&config, 0, sizeof(config));
+    config.inhibit_after_byte_us = SIM_BYTE_STALL_US;
+    i8042_sim_init(&config);
+    i8042_sim_attach();
+    sim_keyboard_report(USB_HID_MODIFIER_LEFT_CTRL, 0, 0, 0);
+    sim_run_keyboard(SIM_DRAIN_TIME_US);
+    sim_keyboard_report(ctrls, 0, 0, 0);
+    sim_keyboard_loop(0);
+    ps2_process();
+    sim_decode_host_bytes();
+    sim_byte_log_count = 0;
+    sim_keyboard_report(ctrls, USB_HID_KEY_3, 0, 0);
+    sim_run_keyboard(SIM_DRAIN_TIME_US);
+    sim_decode_host_bytes();
+    finished = (sim_byte_log_count != 0 && sim_byte_log[0] == 0x14 &&
+                ps2_get_scan_code_set() == PS2_SCAN_CODE_SET_3);
+    i8042_sim_detach();
+    i8042_sim_init(NULL);
+    i8042_sim_attach();
+    sim_run_reports(set2_reports, (uint8_t)(sizeof(set2_reports) / sizeof(set2_reports[0])));
+    sim_decode_host_bytes();
+
+    held = ps2_shadow_get_state();
+    for (uint16_t i = 0; i < PS2_SHADOW_BYTES; i++) {
+        held_end += (held[i] != 0);
+    }
+
+    i8042_sim_detach();
+
+    printf("chords:                  %u\n", (unsigned)chord_count);
+    printf("layer lock bytes:        %lu of %u\n", (unsigned long)lock_bytes, (unsigned)sizeof(expected));
+    printf("layer lock bytes intact: %s\n", intact ? "yes" : "no");
+    printf("A pressed again:         %lu\n", (unsigned long)makes_a);
+    printf("triggers sent:           %lu\n", (unsigned long)triggers_sent);
+    printf("diagnostics typed:       %s\n", typed ? "yes" : "no");
+    printf("scan code set switched:  %s\n", set_switched ? "yes" : "no");
+    printf("scan code finished:      %s\n", finished ? "yes" : "no");
+    printf("held at end:             %lu\n", (unsigned long)held_end);
+
+    return (intact && makes_a == 2 && triggers_sent == 0 && typed && set_switched && finished &&
+            held_end == 0) ? 0 : 1;
+}
+
+/**
+ * @brief  Check dual-role keys and one-shot modifiers with the example keymap
+ * @note   Space tapped, then held around H (Fn layer Left Arrow), then held
+ *         past the tapping term on its own; Escape held around C as Left
+ *         Ctrl; Scroll Lock tapped before A as a one-shot Left Shift
+ * @retval 0 if the bytes are exact and the shadow ends with no key held
+ */
+static int sim_cmd_taphold(void)
+{
+    static const uint8_t expected[] = {
+        /* Space tapped */
+        0x29, 0xF0, 0x29,
+        /* Space held: H as Left Arrow, Space release sends nothing */
+        0xE0, 0x6B, 0xE0, 0xF0, 0x6B,
+        /* Escape held: Ctrl + C */
+        0x14, 0x21, 0xF0, 0x21, 0xF0, 0x14,
+        /* Scroll Lock tapped: Shift + A, Shift released with A */
+        0x12, 0x1C, 0xF0, 0x1C, 0xF0, 0x12
+    };
+    /* Modifier byte and key bytes of each report */
+    static const uint8_t tap_reports[][3] = {
+        { 0, USB_HID_KEY_SPACE, 0 }, { 0, 0, 0 },
+        { 0, USB_HID_KEY_SPACE, 0 }, { 0, USB_HID_KEY_SPACE, USB_HID_KEY_H },
+        { 0, USB_HID_KEY_SPACE, 0 }, { 0, 0, 0 }
+    };
+    static const uint8_t hold_reports[][3] = {
+        { 0, USB_HID_KEY_ESCAPE, 0 }, { 0, USB_HID_KEY_ESCAPE, USB_HID_KEY_C },
+        { 0, USB_HID_KEY_ESCAPE, 0 }, { 0, 0, 0 },
+        { 0, USB_HID_KEY_SCROLL_LOCK, 0 }, { 0, 0, 0 },
+        { 0, USB_HID_KEY_A, 0 }, { 0, 0, 0 }
+    };
+    const uint8_t *held;
+    uint32_t held_end = 0;
+    uint8_t intact, timed_out;
+
+    ps2_sim_reset();
+    if (ps2_init() != PS2_OK || keyboard_handler_init() != KEYBOARD_HANDLER_OK ||
+        scancode_translator_init() != TRANSLATOR_OK) {
+        fprintf(stderr, "init failed\n");
+        return 1;
+    }
+    i8042_sim_init(NULL);
+    i8042_sim_attach();
+
+    sim_run_reports(tap_reports, (uint8_t)(sizeof(tap_reports) / sizeof(tap_reports[0])));
+
+    /* Space held past the tapping term: decided by the tick, not a release */
+    sim_keyboard_report(0, USB_HID_KEY_SPACE, 0, 0);
+    sim_run_keyboard(SIM_TAPPING_TERM_US);
+    timed_out = !tap_hold_pending();
+    sim_keyboard_report(0, 0, 0, 0);
+    sim_run_keyboard(SIM_DRAIN_TIME_US);
+
+    sim_run_reports(hold_reports, (uint8_t)(sizeof(hold_reports) / sizeof(hold_reports[0])));
+    sim_decode_host_bytes();
+    intact = (sim_byte_log_count == sizeof(expected) &&
+              memcmp(sim_byte_log, expected, sizeof(expected)) == 0);
+
+    held = ps2_shadow_get_state();
+    for (uint16_t i = 0; i < PS2_SHADOW_BYTES; i++) {
+        held_end += (held[i] != 0);
+    }
+
+    i8042_sim_detach();
+
+    printf("dual-role keys:          %u\n", (unsigned)tap_hold_count);
+    printf("tapping term:            %u ms\n", (unsigned)tap_hold_term_ms);
+    printf("bytes received:          %lu of %u\n", (unsigned long)sim_byte_log_count, (unsigned)sizeof(expected));
+    printf("tap-hold bytes intact:   %s\n", intact ? "yes" : "no");
+    printf("held past term decided:  %s\n", timed_out ? "yes" : "no");
+    printf("held at end:             %lu\n", (unsigned long)held_end);
+
+    return (intact && timed_out && held_end == 0) ? 0 : 1;
+}
+
+/**
+ * @brief  Check the flash settings store
+ * @note   Locks the Fn layer, selects Set 3 and saves with the example
+ *         keymap's hotkeys, then boots again and checks the settings came
+ *         back, also after a host reset. Then commits more records than the
+ *         sector holds, and cuts the power in the middle of a record.
+ * @retval 0 if every boot loads the last complete record within
+ *         SIM_CONFIG_MAX_PROBES slot reads, the sector was erased once
+ *         and the torn record was skipped
+ */
+static int sim_cmd_config(void)
+{
+    static const uint8_t ctrls = USB_HID_MODIFIER_LEFT_CTRL | USB_HID_MODIFIER_RIGHT_CTRL;
+    /* Modifier byte and key bytes of each report */
+    static const uint8_t save_reports[][3] = {
+        { USB_HID_MODIFIER_LEFT_CTRL, 0, 0 }, { ctrls, 0, 0 },
+        { ctrls, USB_HID_KEY_F, 0 }, { ctrls, 0, 0 },
+        { ctrls, USB_HID_KEY_3, 0 }, { ctrls, 0, 0 },
+        { ctrls, USB_HID_KEY_S, 0 }, { ctrls, 0, 0 }, { 0, 0, 0 }
+    };
+    ConfigStoreStats_t stats;
+    const uint8_t *sector;
+    const uint8_t *record;
+    uint32_t commits = CONFIG_STORE_SLOTS + 10U;
+    uint32_t max_probes;
+    uint32_t clock_hz = 0;
+    uint32_t torn_slot;
+    uint32_t erases;
+    uint8_t defaults, restored, in_place, kept_by_reset, worn, torn_skipped;
+
+    flash_sim_reset();
+    sector = flash_sim_sector();
+
+    /* Empty sector: compile-time defaults */
+    if (sim_config_boot() != 0) {
+        return 1;
+    }
+    config_store_get_stats(&stats);
+    max_probes = stats.probes;
+    defaults = (config_store_get_record() == NULL && ps2_get_scan_code_set() == PS2_DEFAULT_SCAN_CODE_SET &&
+                key_remap_get_locked_layers() == 0);
+
+    /* Fn layer locked, Set 3, saved */
+    sim_run_reports(save_reports, (uint8_t)(sizeof(save_reports) / sizeof(save_reports[0])));
+    i8042_sim_detach();
+
+    /* Power cycle */
+    if (sim_config_boot() != 0) {
+        return 1;
+    }
+    config_store_get_stats(&stats);
+    max_probes = (stats.probes > max_probes) ? stats.probes : max_probes;
+    record = (const uint8_t *)config_store_get_record();
+    in_place = (record >= sector && record < sector + CONFIG_STORE_SIZE);
+    restored = (ps2_get_scan_code_set() == PS2_SCAN_CODE_SET_3 && key_remap_get_layer() != 0);
+    sim_host_command_only(PS2_CMD_RESET);
+    kept_by_reset = (ps2_get_scan_code_set() == PS2_SCAN_CODE_SET_3);
+    i8042_sim_detach();
+
+    /* Wear the sector round from slot 1: one erase, then the records start over */
+    for (uint32_t i = 0; i < commits; i++) {
+        clock_hz = (i & 1U) ? 12500U : 13000U;
+        config_store_set(CONFIG_KEY_PS2_CLOCK_HZ, clock_hz);
+        if (config_store_commit() != CONFIG_STORE_OK) {
+            break;
+        }
+    }
+    config_store_get_stats(&stats);
+    erases = stats.erases;
+    worn = (erases == 1 && stats.appends == commits);
+    (void)config_store_init();
+    config_store_get_stats(&stats);
+    max_probes = (stats.probes > max_probes) ? stats.probes : max_probes;
+    worn = worn && stats.slot == commits - CONFIG_STORE_SLOTS &&
+           config_store_get(CONFIG_KEY_PS2_CLOCK_HZ, 0) == clock_hz &&
+           config_store_get(CONFIG_KEY_SCAN_CODE_SET, 0) == PS2_SCAN_CODE_SET_3;
+
+    /* Power lost part way through a record: the one before it is used */
+    torn_slot = stats.slot + 1U;
+    flash_sim_cut_power(SIM_CONFIG_TORN_WORDS);
+    config_store_set(CONFIG_KEY_PS2_CLOCK_HZ, 15000U);
+    torn_skipped = (config_store_commit() == CONFIG_STORE_ERROR);
+    flash_sim_cut_power(FLASH_SIM_POWER_ON);
+    (void)config_store_init();
+    config_store_get_stats(&stats);
+    max_probes = (stats.probes > max_probes) ? stats.probes : max_probes;
+    torn_skipped = torn_skipped && stats.torn_records == 1 && stats.slot == torn_slot - 1U &&
+                   config_store_get(CONFIG_KEY_PS2_CLOCK_HZ, 0) == clock_hz;
+
+    /* The next record goes after the torn one */
+    config_store_set(CONFIG_KEY_PS2_CLOCK_HZ, 15000U);
+    torn_skipped = torn_skipped && config_store_commit() == CONFIG_STORE_OK;
+    (void)config_store_init();
+    config_store_get_stats(&stats);
+    max_probes = (stats.probes > max_probes) ? stats.probes : max_probes;
+    torn_skipped = torn_skipped && stats.torn_records == 0 && stats.slot == torn_slot + 1U &&
+                   config_store_get(CONFIG_KEY_PS2_CLOCK_HZ, 0) == 15000U;
+
+    printf("record slots:            %lu\n", (unsigned long)CONFIG_STORE_SLOTS);
+    printf("defaults when empty:     %s\n", defaults ? "yes" : "no");
+    printf("settings restored:       %s\n", restored ? "yes" : "no");
+    printf("record used in place:    %s\n", in_place ? "yes" : "no");
+    printf("set kept by host reset:  %s\n", kept_by_reset ? "yes" : "no");
+    printf("commits, erases:         %lu, %lu\n", (unsigned long)commits, (unsigned long)erases);
+    printf("sector worn round:       %s\n", worn ? "yes" : "no");
+    printf("torn record skipped:     %s\n", torn_skipped ? "yes" : "no");
+    printf("most slots read at boot: %lu of %u\n", (unsigned long)max_probes, (unsigned)SIM_CONFIG_MAX_PROBES);
+
+    return (defaults && restored && in_place && kept_by_reset && worn && torn_skipped &&
+            max_probes <= SIM_CONFIG_MAX_PROBES) ? 0 : 1;
+}
+
+/**
+ * @brief  Power up the converter and load the stored settings
+ * @note   Attaches the host model, like main() followed by a host that
+ *         leaves the keyboard alone
+ * @retval 0 on success, 1 if a module failed to initialize
+ */
+static int sim_config_boot(void)
+{
+    ps2_sim_reset();
+    if (ps2_init() != PS2_OK || keyboard_handler_init() != KEYBOARD_HANDLER_OK ||
+        scancode_translator_init() != TRANSLATOR_OK || config_store_init() != CONFIG_STORE_OK) {
+        fprintf(stderr, "init failed\n");
+        return 1;
+    }
+    config_store_load_settings();
+    i8042_sim_init(NULL);
+    i8042_sim_attach();
+    return 0;
+}
+
+/**
+ * @brief  Check runtime remap table changes with the example keymap
+ * @note   A is remapped to B while A is held, H is remapped on the Fn layer
+ *         while the Fn key is held, and A is mapped back; A is tapped while
+ *         tables mapping it to B are built but not published. Tables are
+ *         published from the interrupt model while a report takes the
+ *         published pointer, and again part way through a report. Then new
+ *         tables are published before every report while A is tapped, the
+ *         mapping changing every third report. Last the keymap layers are
+ *         dropped and A, pressed with no tables, is released after tables
+ *         mapping it to B are published.
+ * @retval 0 if the bytes are exact, every edit found a free buffer, every
+ *         make was matched by its own break, A pressed without layers
+ *         released as A and the shadow ends with no key held
+ */
+static int sim_cmd_hotswap(void)
+{
+    static const uint8_t expected[] = {
+        /* A held across the swap, S pressed with the new tables */
+        0x1C, 0x1B, 0xF0, 0x1C, 0xF0, 0x1B,
+        /* A tapped as B */
+        0x32, 0xF0, 0x32,
+        /* Fn + H as Right Arrow */
+        0xE0, 0x74, 0xE0, 0xF0, 0x74,
+        /* A mapped back */
+        0x1C, 0xF0, 0x1C,
+        /* A while A to B is built but not published */
+        0x1C, 0xF0, 0x1C,
+        /* A to B published as the report takes the pointer */
+        0x32, 0xF0, 0x32,
+        /* A + S, S to D published after A: the report keeps its tables */
+        0x32, 0x1B, 0xF0, 0x32, 0xF0, 0x1B,
+        /* S tapped as D */
+        0x23, 0xF0, 0x23
+    };
+    /* Modifier byte and key bytes of each report */
+    static const uint8_t held_reports[][3] = {
+        { 0, USB_HID_KEY_A, USB_HID_KEY_S }, { 0, USB_HID_KEY_S, 0 }, { 0, 0, 0 },
+        { 0, USB_HID_KEY_A, 0 }, { 0, 0, 0 }
+    };
+    static const uint8_t layer_reports[][3] = {
+        { 0, USB_HID_KEY_APPLICATION, USB_HID_KEY_H }, { 0, USB_HID_KEY_APPLICATION, 0 }, { 0, 0, 0 }
+    };
+    static const uint8_t tap_reports[][3] = {
+        { 0, USB_HID_KEY_A, 0 }, { 0, 0, 0 }
+    };
+    static const uint8_t pair_reports[][3] = {
+        { 0, USB_HID_KEY_A, USB_HID_KEY_S }, { 0, 0, 0 }, { 0, USB_HID_KEY_S, 0 }, { 0, 0, 0 }
+    };
+    const uint8_t *held;
+    uint32_t held_end = 0;
+    uint32_t log_bytes;
+    uint32_t makes;
+    uint32_t breaks_matched = 1;
+    uint32_t bare_makes;
+    uint8_t bare_released;
+    uint8_t fn_layer;
+    uint8_t intact;
+
+    ps2_sim_reset();
+    if (ps2_init() != PS2_OK || keyboard_handler_init() != KEYBOARD_HANDLER_OK ||
+        scancode_translator_init() != TRANSLATOR_OK) {
+        fprintf(stderr, "init failed\n");
+        return 1;
+    }
+    i8042_sim_init(NULL);
+    i8042_sim_attach();
+    sim_hotswap_failures = 0;
+
+    /* A held while it is remapped to B */
+    sim_keyboard_report(0, USB_HID_KEY_A, 0, 0);
+    sim_run_keyboard(SIM_DRAIN_TIME_US);
+    sim_hotswap_map(0, USB_HID_KEY_A, USB_HID_KEY_B);
+    sim_run_reports(held_reports, (uint8_t)(sizeof(held_reports) / sizeof(held_reports[0])));
+
+    /* Fn layer changed while the Fn key is held */
+    sim_keyboard_report(0, USB_HID_KEY_APPLICATION, 0, 0);
+    sim_run_keyboard(SIM_DRAIN_TIME_US);
+    fn_layer = key_remap_get_layer();
+    sim_hotswap_map(fn_layer, USB_HID_KEY_H, USB_HID_KEY_RIGHT_ARROW);
+    sim_run_reports(layer_reports, (uint8_t)(sizeof(layer_reports) / sizeof(layer_reports[0])));
+
+    sim_hotswap_map(0, USB_HID_KEY_A, USB_HID_KEY_A);
+    sim_run_reports(tap_reports, (uint8_t)(sizeof(tap_reports) / sizeof(tap_reports[0])));
+
+    /* Tables being built are not in use */
+    if (!key_remap_edit_begin()) {
+        sim_hotswap_failures++;
+    }
+    key_remap_edit_map(0, USB_HID_KEY_A, USB_HID_KEY_B);
+    sim_run_reports(tap_reports, (uint8_t)(sizeof(tap_reports) / sizeof(tap_reports[0])));
+
+    /* Publish between loading the published pointer and claiming it */
+    key_remap_sim_set_hook(sim_hotswap_preempt);
+    sim_hotswap_preempt_calls = 0;
+    sim_hotswap_preempt_at = 1;
+    sim_run_reports(tap_reports, (uint8_t)(sizeof(tap_reports) / sizeof(tap_reports[0])));
+
+    /* Publish after the first event of a report */
+    sim_hotswap_preempt_calls = 0;
+    sim_hotswap_preempt_at = 2;
+    sim_run_reports(pair_reports, (uint8_t)(sizeof(pair_reports) / sizeof(pair_reports[0])));
+    key_remap_sim_set_hook(NULL);
+    sim_decode_host_bytes();
+    log_bytes = sim_byte_log_count;
+    intact = (fn_layer != 0 && sim_byte_log_count == sizeof(expected) &&
+              memcmp(sim_byte_log, expected, sizeof(expected)) == 0);
+
+    /* New tables before every report: a release goes out with the code of its press */
+    makes = sim_make_count[0x1C] + sim_make_count[0x32];
+    for (uint32_t i = 0; i < SIM_HOTSWAP_REPORTS; i++) {
+        uint8_t pressed = ((i & 1U) == 0) ? USB_HID_KEY_A : 0;
+
+        sim_hotswap_map(0, USB_HID_KEY_A, ((i / 3U) & 1U) ? USB_HID_KEY_B : USB_HID_KEY_A);
+        sim_keyboard_report(0, pressed, 0, 0);
+        sim_run_keyboard(SIM_DRAIN_TIME_US);
+        sim_decode_host_bytes();
+        if (pressed == 0 && (ps2_shadow_is_held(0x1C, 0) || ps2_shadow_is_held(0x32, 0))) {
+            breaks_matched = 0;
+        }
+    }
+    makes = sim_make_count[0x1C] + sim_make_count[0x32] - makes;
+
+    /* No keymap layers: A pressed as itself, released after A to B is published */
+    key_remap_sim_drop_keymap();
+    bare_makes = sim_make_count[0x32];
+    sim_keyboard_report(0, USB_HID_KEY_A, 0, 0);
+    sim_run_keyboard(SIM_DRAIN_TIME_US);
+    sim_hotswap_map(0, USB_HID_KEY_A, USB_HID_KEY_B);
+    sim_keyboard_report(0, 0, 0, 0);
+    sim_run_keyboard(SIM_DRAIN_TIME_US);
+    sim_decode_host_bytes();
+    bare_released = (!ps2_shadow_is_held(0x1C, 0) && sim_make_count[0x32] == bare_makes);
+
+    /* A release left in the handler would repeat by now */
+    sim_run_keyboard(SIM_DRAIN_TIME_US);
+    sim_decode_host_bytes();
+    held = ps2_shadow_get_state();
+    for (uint16_t i = 0; i < PS2_SHADOW_BYTES; i++) {
+        held_end += (held[i] != 0);
+    }
+
+    i8042_sim_detach();
+
+    printf("swap bytes:              %lu of %u\n", (unsigned long)log_bytes, (unsigned)sizeof(expected));
+    printf("swap bytes intact:       %s\n", intact ? "yes" : "no");
+    printf("edits without a buffer:  %lu\n", (unsigned long)sim_hotswap_failures);
+    printf("makes while swapping:    %lu of %u\n", (unsigned long)makes, (unsigned)(SIM_HOTSWAP_REPORTS / 2U));
+    printf("breaks matched:          %s\n", breaks_matched ? "yes" : "no");
+    printf("released without layers: %s\n", bare_released ? "yes" : "no");
+    printf("held at end:             %lu\n", (unsigned long)held_end);
+
+    return (intact && sim_hotswap_failures == 0 && makes == SIM_HOTSWAP_REPORTS / 2U &&
+            breaks_matched && bare_released && held_end == 0) ? 0 : 1;
+}
+
+/**
+ * @brief  Build and publish remap tables with one entry changed
+ * @param  layer: Layer number
+ * @param  usage: HID usage of the key
+ * @param  entry: Usage to send
+ * @retval None
+ */
+static void sim_hotswap_map(uint8_t layer, uint8_t usage, uint8_t entry)
+{
+    if (!key_remap_edit_begin()) {
+        sim_hotswap_failures++;
+        return;
+    }
+
+    key_remap_edit_map(layer, usage, entry);
+    key_remap_publish();
+}
+
+/**
+ * @brief  Interrupt model of the hotswap check
+ * @note   At the first preemption point, while a report holds the
+ *         published pointer unclaimed, publishes A to B and builds A to C
+ *         over the tables it loaded. At the second, after the first event
+ *         of a report, publishes S to D; both buffers are then in use, so
+ *         no further edit may start. Fires once.
+ * @retval None
+ */
+static void sim_hotswap_preempt(void)
+{
+    if (++sim_hotswap_preempt_calls != sim_hotswap_preempt_at) {
+        return;
+    }
+    sim_hotswap_preempt_at = 0;
+
+    if (sim_hotswap_preempt_calls == 1U) {
+        sim_hotswap_map(0, USB_HID_KEY_A, USB_HID_KEY_B);
+        if (!key_remap_edit_begin()) {
+            sim_hotswap_failures++;
+        }
+        key_remap_edit_map(0, USB_HID_KEY_A, USB_HID_KEY_C);
+    } else {
+        sim_hotswap_map(0, USB_HID_KEY_S, USB_HID_KEY_D);
+        if (key_remap_edit_begin()) {
+            /* The tables of the report being remapped were taken */
+            sim_hotswap_failures++;
+        }
+    }
+}
+
+/**
+ * @brief  Send keyboard reports, running the keyboard main loop after each
+ * @param  reports: Modifier byte and two key bytes of each report
+ * @param  count: Number of reports
+ * @retval None
+ */
+static void sim_run_reports(const uint8_t (*reports)[3], uint8_t count)
+{
+    for (uint8_t i = 0; i < count; i++) {
+        sim_keyboard_report(reports[i][0], reports[i][1], reports[i][2], 0);
+        sim_run_keyboard(SIM_DRAIN_TIME_US);
+    }
+}
+
+/**
+ * @brief  Send a host command that takes no argument and drain its acknowledge
+ * @param  command: Command byte
+ * @retval None
+ */
+static void sim_host_command_only(uint8_t command)
+{
+    uint8_t data;
+
+    sim_decode_host_bytes();
+    i8042_sim_send_command(command);
+    sim_run_keyboard(SIM_DRAIN_TIME_US);
+    while (i8042_sim_read_byte(&data, NULL) == I8042_SIM_OK) {
+        /* Acknowledges are not key codes */
+    }
+}
+
+/**
+ * @brief  Tap keys, each with its modifiers pressed before and released after
+ * @param  taps: Modifier bits and key usage (0 for none) of each tap
+ * @param  count: Number of taps
+ * @retval None
+ */
+static void sim_tap_keys(const uint8_t (*taps)[2], uint8_t count)
+{
+    for (uint8_t i = 0; i < count; i++) {
+        sim_keyboard_report(taps[i][0], 0, 0, 0);
+        sim_run_keyboard(SIM_DRAIN_TIME_US);
+        sim_keyboard_report(taps[i][0], taps[i][1], 0, 0);
+        sim_run_keyboard(SIM_DRAIN_TIME_US);
+        sim_keyboard_report(taps[i][0], 0, 0, 0);
+        sim_run_keyboard(SIM_DRAIN_TIME_US);
+        sim_keyboard_report(0, 0, 0, 0);
+        sim_run_keyboard(SIM_DRAIN_TIME_US);
+    }
+}
+
+/**
+ * @brief  Send a host command with one argument and drop the acknowledges
+ * @param  command: PS2_CMD_* command
+ * @param  argument: Argument byte
+ * @retval None
+ */
+static void sim_host_command(uint8_t command, uint8_t argument)
+{
+    uint8_t data;
+
+    sim_decode_host_bytes();
+    i8042_sim_send_command(command);
+    i8042_sim_send_command(argument);
+    sim_run_keyboard(SIM_DRAIN_TIME_US);
+    while (i8042_sim_read_byte(&data, NULL) == I8042_SIM_OK) {
+        /* Acknowledges are not key codes */
+    }
+}
+
+/**
+ * @brief  Replay a barcode scan and check it reaches the host intact
+ * @note   The scanner sends a press and a release report per character,
+ *         one per USB poll, and holds the rest in its own buffer while
+ *         polling is paused. The achieved rate is compared with the limit
+ *         set by the link clock and the configured gaps.
+ * @param  argc: Option count
+ * @param  argv: Options
+ * @retval 0 if every character arrived in order with the right Shift
+ *         state at SIM_SCAN_MIN_EFFICIENCY of the link limit, 1 otherwise
+ */
+static int sim_cmd_scan64(int argc, char **argv)
+{
+    I8042_SimStats_t stats;
+    PS2_LinkConfig_t link;
+    uint32_t reports_total = SIM_SCAN_CHARS * 2U;
+    uint32_t next_report = 0;
+    uint32_t skipped_polls = 0;
+    uint32_t peak_depth = 0;
+    uint32_t chars_intact = 0;
+    uint32_t chars_seen = 0;
+    uint32_t expected_bytes = 0;
+    uint32_t expected_scancodes = 0;
+    uint32_t start_us;
+    uint32_t last_poll_us;
+    uint32_t elapsed_us;
+    uint32_t limit_us;
+    uint32_t efficiency;
+    uint32_t held;
+
+    memset(sim_held, 0, sizeof(sim_held));
+    memset(sim_make_count, 0, sizeof(sim_make_count));
+    sim_make_log_count = 0;
+    sim_flow_control = 1;
+    sim_overflows = 0;
+
+    ps2_sim_reset();
+    if (ps2_init() != PS2_OK || keyboard_handler_init() != KEYBOARD_HANDLER_OK ||
+        scancode_translator_init() != TRANSLATOR_OK) {
+        fprintf(stderr, "init failed\n");
+        return 1;
+    }
+    ps2_get_link_config(&link);
+
+    for (int i = 0; i < argc; i += 2) {
+        const char *value = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+        if (value != NULL && strcmp(argv[i], "-g") == 0) {
+            link.byte_gap_us = (uint16_t)strtoul(value, NULL, 0);
+        } else if (value != NULL && strcmp(argv[i], "-k") == 0) {
+            link.scancode_gap_us = (uint16_t)strtoul(value, NULL, 0);
+        } else {
+            sim_usage("ps2_sim");
+            return 2;
+        }
+    }
+
+    if (ps2_set_link_config(&link) != PS2_OK) {
+        fprintf(stderr, "invalid link configuration\n");
+        return 2;
+    }
+
+    i8042_sim_init(NULL);
+    i8042_sim_attach();
+
+    start_us = ps2_sim_get_time_us();
+    last_poll_us = start_us - SIM_USB_POLL_US;
+
+    while (ps2_sim_get_time_us() - start_us < SIM_DRAIN_LIMIT_US) {
+        uint32_t now_us = ps2_sim_get_time_us();
+
+        /* Polls that fell due while ps2_process() was transmitting */
+        while (next_report < reports_total && now_us - last_poll_us >= SIM_USB_POLL_US) {
+            last_poll_us += SIM_USB_POLL_US;
+            if (ps2_queue_congested()) {
+                skipped_polls++;
+            } else {
+                sim_scan_report(next_report++);
+            }
+        }
+
+        sim_keyboard_loop(0);
+        if (ps2_queue_count() > peak_depth) {
+            peak_depth = ps2_queue_count();
+        }
+        ps2_process();
+
+        if (next_report == reports_total && ps2_queue_count() == 0) {
+            break;
+        }
+        ps2_delay_us(SIM_POLL_INTERVAL_US);
+    }
+
+    held = sim_count_held_keys();
+    i8042_sim_detach();
+    i8042_sim_get_stats(&stats);
+
+    /* Compare the logged makes, Shift excluded, with the payload */
+    for (uint32_t i = 0; i < sim_make_log_count; i++) {
+        uint16_t index = (uint16_t)(sim_make_log[i] & ~SIM_MAKE_SHIFTED);
+        char c;
+        uint16_t expected;
+
+        if (index == SIM_SET2_LEFT_SHIFT || index == SIM_SET2_RIGHT_SHIFT) {
+            continue;
+        }
+        if (chars_seen >= SIM_SCAN_CHARS) {
+            chars_seen++;
+            continue;
+        }
+
+        c = sim_scan_text[chars_seen++];
+        expected = (c >= 'A') ? (uint16_t)(sim_set2_letters[c - 'A'] | SIM_MAKE_SHIFTED) :
+                                (uint16_t)sim_set2_digits[c - '0'];
+        chars_intact += (sim_make_log[i] == expected);
+    }
+
+    /* Link limit: 11-bit frames plus the configured gaps */
+    for (uint32_t i = 0; i < SIM_SCAN_CHARS; i++) {
+        uint32_t shifted = (sim_scan_text[i] >= 'A');
+
+        expected_bytes += 3U + shifted * 3U;
+        expected_scancodes += 2U + shifted * 2U;
+    }
+    limit_us = expected_bytes * (11000000U / link.clock_freq_hz + link.byte_gap_us);
+    if (link.scancode_gap_us > link.byte_gap_us) {
+        limit_us += expected_scancodes * (uint32_t)(link.scancode_gap_us - link.byte_gap_us);
+    }
+    elapsed_us = stats.last_byte_us - start_us;
+    efficiency = (elapsed_us != 0) ? (uint32_t)((uint64_t)limit_us * 100U / elapsed_us) : 0;
+
+    printf("scan:                   %u chars, %lu reports\n", (unsigned)SIM_SCAN_CHARS,
+           (unsigned long)reports_total);
+    printf("queue:                  %u bytes (%u byte RAM budget)\n", (unsigned)PS2_QUEUE_SIZE,
+           (unsigned)PS2_QUEUE_RAM_BUDGET);
+    printf("peak queue depth:       %lu\n", (unsigned long)peak_depth);
+    printf("scanner polls held:     %lu\n", (unsigned long)skipped_polls);
+    printf("chars intact:           %lu of %u (%lu received)\n", (unsigned long)chars_intact,
+           (unsigned)SIM_SCAN_CHARS, (unsigned long)chars_seen);
+    printf("bytes received:         %lu of %lu\n", (unsigned long)stats.bytes_received,
+           (unsigned long)expected_bytes);
+    printf("elapsed:                %lu us (link limit %lu us)\n", (unsigned long)elapsed_us,
+           (unsigned long)limit_us);
+    printf("link rate:              %lu bytes/s (%lu%% of limit)\n",
+           (unsigned long)(elapsed_us != 0 ? (uint64_t)stats.bytes_received * 1000000U / elapsed_us : 0),
+           (unsigned long)efficiency);
+    printf("link clock/gaps:        %u Hz / %u us byte / %u us scan code\n", (unsigned)link.clock_freq_hz,
+           (unsigned)link.byte_gap_us, (unsigned)link.scancode_gap_us);
+    printf("held at end:            %lu\n", (unsigned long)held);
+
+    return (chars_intact == SIM_SCAN_CHARS && chars_seen == SIM_SCAN_CHARS &&
+            stats.bytes_received == expected_bytes && held == 0 &&
+            efficiency >= SIM_SCAN_MIN_EFFICIENCY) ? 0 : 1;
+}
+
+/**
+ * @brief  Send one report of the simulated barcode scan
+ * @note   Even reports press a character, with Left Shift for letters,
+ *         odd reports release everything
+ * @param  report: Report number, 0..2 * SIM_SCAN_CHARS - 1
+ * @retval None
+ */
+static void sim_scan_report(uint32_t report)
+{
+    char c = sim_scan_text[report / 2U];
+    uint8_t key;
+
+    if (report & 1U) {
+        sim_keyboard_report(0, 0, 0, 0);
+        return;
+    }
+
+    if (c >= 'A') {
+        key = (uint8_t)(USB_HID_KEY_A + (c - 'A'));
+        sim_keyboard_report(USB_HID_MODIFIER_LEFT_SHIFT, key, 0, 0);
+    } else {
+        key = (c == '0') ? USB_HID_KEY_0 : (uint8_t)(USB_HID_KEY_1 + (c - '1'));
+        sim_keyboard_report(0, key, 0, 0);
+    }
+}
+
+/**
+ * @brief  Compare report-to-host latency of the main loop and the fast path
+ * @note   Taps SIM_LATENCY_TAPS keys at an interval that sweeps the report
+ *         arrival across the main loop period
+ * @retval 0 if both paths deliver every tap with no key left held and
+ *         the fast path has the lower worst-case latency, 1 otherwise
+ */
+static int sim_cmd_latency(void)
+{
+    SimLatencyResult_t main_loop;
+    SimLatencyResult_t fast_path;
+
+    if (sim_latency_run(0, &main_loop) != 0 || sim_latency_run(1, &fast_path) != 0) {
+        fprintf(stderr, "init failed\n");
+        return 1;
+    }
+
+    sim_print_latency_result("main loop", &main_loop);
+    sim_print_latency_result("interrupt fast path", &fast_path);
+
+    return (main_loop.taps == SIM_LATENCY_TAPS && fast_path.taps == SIM_LATENCY_TAPS &&
+            main_loop.held == 0 && fast_path.held == 0 &&
+            fast_path.max_latency_us < main_loop.max_latency_us) ? 0 : 1;
+}
+
+/**
+ * @brief  Tap the keys once
+ * @note   Runs the firmware main loop including its idle delay. Reports
+ *         arrive like USB interrupts, also during the delay; on the fast
+ *         path they are translated and the transmitter kicked right away.
+ * @param  fast_path: 1 to translate in the simulated USB interrupt
+ * @param  result: Pointer to store the outcome
+ * @retval 0 if the run completed, 1 if initialization failed
+ */
+static int sim_latency_run(uint8_t fast_path, SimLatencyResult_t *result)
+{
+    static uint32_t press_us[SIM_LATENCY_TAPS];
+    uint32_t next_report = 0;
+    uint32_t start_us;
+    uint32_t end_us;
+    uint32_t time_us;
+    uint32_t makes = 0;
+    uint32_t breaks = 0;
+    uint8_t release = 0;
+    uint8_t data;
+
+    memset(result, 0, sizeof(SimLatencyResult_t));
+    result->min_latency_us = UINT32_MAX;
+    sim_flow_control = 1;
+
+    ps2_sim_reset();
+    if (ps2_init() != PS2_OK || keyboard_handler_init() != KEYBOARD_HANDLER_OK ||
+        scancode_translator_init() != TRANSLATOR_OK) {
+        return 1;
+    }
+    i8042_sim_init(NULL);
+    i8042_sim_attach();
+
+    start_us = ps2_sim_get_time_us();
+    end_us = start_us + SIM_LATENCY_TAPS * SIM_LATENCY_PERIOD_US + SIM_BURST_DRAIN_US;
+
+    while (ps2_sim_get_time_us() < end_us) {
+        sim_keyboard_loop(0);
+        ps2_process();
+
+        if (ps2_queue_count() == 0) {
+            for (uint32_t waited_us = 0; waited_us < SIM_MAIN_LOOP_DELAY_US; waited_us += SIM_POLL_INTERVAL_US) {
+                sim_latency_deliver(fast_path, start_us, &next_report, press_us);
+                ps2_delay_us(SIM_POLL_INTERVAL_US);
+            }
+        }
+        sim_latency_deliver(fast_path, start_us, &next_report, press_us);
+    }
+
+    i8042_sim_detach();
+
+    /* Match the n-th make code to the n-th press */
+    while (i8042_sim_read_byte(&data, &time_us) == I8042_SIM_OK) {
+        if (data == PS2_BREAK_CODE_PREFIX) {
+            release = 1;
+        } else if (data != PS2_EXTENDED_CODE_PREFIX) {
+            if (release) {
+                breaks++;
+            } else if (makes < SIM_LATENCY_TAPS) {
+                uint32_t latency_us = time_us - press_us[makes++];
+
+                result->total_latency_us += latency_us;
+                if (latency_us < result->min_latency_us) {
+                    result->min_latency_us = latency_us;
+                }
+                if (latency_us > result->max_latency_us) {
+                    result->max_latency_us = latency_us;
+                }
+            }
+            release = 0;
+        }
+    }
+
+    result->taps = makes;
+    result->held = makes - breaks;
+
+    return 0;
+}
+
+/**
+ * @brief  Deliver the keyboard reports that are due
+ * @note   Even reports press the next key, odd reports release it
+ * @param  fast_path: 1 to translate and kick the transmitter at once
+ * @param  start_us: Start of the run
+ * @param  next_report: Next report to deliver, updated
+ * @param  press_us: Delivery time of each press, updated
+ * @retval None
+ */
+static void sim_latency_deliver(uint8_t fast_path, uint32_t start_us, uint32_t *next_report, uint32_t *press_us)
+{
+    while (*next_report < SIM_LATENCY_TAPS * 2U) {
+        uint32_t tap = *next_report / 2U;
+        uint32_t due_us = start_us + tap * SIM_LATENCY_PERIOD_US + (*next_report & 1U) * SIM_LATENCY_HOLD_US;
+        uint8_t translated;
+
+        if (ps2_sim_get_time_us() - start_us < due_us - start_us) {
+            return;
+        }
+
+        if (*next_report & 1U) {
+            sim_keyboard_report(0, 0, 0, 0);
+        } else {
+            press_us[tap] = ps2_sim_get_time_us();
+            sim_keyboard_report(0, (uint8_t)(USB_HID_KEY_A + tap % 26U), 0, 0);
+        }
+        (*next_report)++;
+
+        if (fast_path) {
+            (void)scancode_translator_service(SIM_FAST_PATH_REPORTS, &translated);
+            if (translated != 0) {
+                ps2_kick();
+            }
+        }
+    }
+}
+
+/**
+ * @brief  Print the outcome of a latency run
+ * @param  label: Run description
+ * @param  result: Outcome to print
+ * @retval None
+ */
+static void sim_print_latency_result(const char *label, const SimLatencyResult_t *result)
+{
+    printf("%s:\n", label);
+    printf("  taps reaching host:   %lu of %u\n", (unsigned long)result->taps, (unsigned)SIM_LATENCY_TAPS);
+    printf("  latency min/avg/max:  %lu / %lu / %lu us\n", (unsigned long)result->min_latency_us,
+           (unsigned long)(result->taps != 0 ? result->total_latency_us / result->taps : 0),
+           (unsigned long)result->max_latency_us);
+    printf("  held at end:          %lu\n", (unsigned long)result->held);
+}
+
+/**
+ * @brief  Run the keyboard main loop for a while
+ * @param  duration_us: Virtual time to run
+ * @retval None
+ */
+static void sim_run_keyboard(uint32_t duration_us)
+{
+    uint32_t end_us = ps2_sim_get_time_us() + duration_us;
+
+    while (ps2_sim_get_time_us() < end_us) {
+        sim_keyboard_loop(0);
+        ps2_process();
+        ps2_delay_us(SIM_POLL_INTERVAL_US);
+    }
+}
+
+/**
+ * @brief  Run the keyboard main loop until the host holds a number of keys
+ * @param  expected_held: Number of keys the host should end up holding
+ * @retval Time taken in microseconds, or more than SIM_HEAL_LIMIT_US on timeout
+ */
+static uint32_t sim_heal(uint32_t expected_held)
+{
+    uint32_t start_us = ps2_sim_get_time_us();
+
+    while (sim_count_held_keys() != expected_held || ps2_queue_count() != 0) {
+        if (ps2_sim_get_time_us() - start_us > SIM_HEAL_LIMIT_US) {
+            break;
+        }
+        sim_keyboard_loop(0);
+        ps2_process();
+        ps2_delay_us(SIM_POLL_INTERVAL_US);
+    }
+
+    return ps2_sim_get_time_us() - start_us;
+}
+
+/**
+ * @brief  Feed a boot protocol keyboard report to the handler
+ * @param  modifier: Modifier byte
+ * @param  key1: First key code (0 for none)
+ * @param  key2: Second key code (0 for none)
+ * @param  key3: Third key code (0 for none)
+ * @retval None
+ */
+static void sim_keyboard_report(uint8_t modifier, uint8_t key1, uint8_t key2, uint8_t key3)
+{
+    uint8_t report[SIM_HID_REPORT_SIZE] = { modifier, 0, key1, key2, key3, 0, 0, 0 };
+
+    (void)keyboard_handler_process_report(report, sizeof(report));
+}
+
+/**
+ * @brief  One pass of the firmware main loop keyboard path
+ * @note   Runs the SysTick keyboard hook first when the virtual tick moved
+ * @param  input_lost: 1 to simulate a USB disconnect before this pass
+ * @retval None
+ */
+static void sim_keyboard_loop(uint8_t input_lost)
+{
+    KeyboardEvent_t events[KEYBOARD_REPORT_MAX_EVENTS];
+    uint8_t event_count;
+    uint8_t translated = 0;
+
+    if (HAL_GetTick() != sim_last_tick_ms) {
+        sim_last_tick_ms = HAL_GetTick();
+        keyboard_handler_tick();
+    }
+
+    if (input_lost || keyboard_handler_check_overflow() || scancode_translator_check_overflow()) {
+        keyboard_handler_reset();
+        scancode_translator_release_all();
+    }
+
+    if (!sim_flow_control) {
+        /* Open loop: translate regardless of congestion */
+        while ((event_count = keyboard_handler_get_events(events, KEYBOARD_REPORT_MAX_EVENTS)) != 0) {
+            if (scancode_translator_process_events(events, event_count) != TRANSLATOR_OK) {
+                sim_overflows++;
+            }
+            translated = 1;
+        }
+    } else if (ps2_queue_congested()) {
+        return;
+    } else if (scancode_translator_service(TRANSLATOR_SERVICE_ALL, &translated) != TRANSLATOR_OK) {
+        sim_overflows++;
+    }
+
+    if (translated == 0) {
+        (void)scancode_translator_reconcile();
+    }
+
+    (void)scancode_translator_typematic();
+    (void)macro_engine_service();
+    (void)chord_detector_service();
+}
+
+/**
+ * @brief  Count the keys the host believes are held
+ * @retval Number of held keys after decoding all bytes received so far
+ */
+static uint32_t sim_count_held_keys(void)
+{
+    uint32_t count = 0;
+
+    sim_decode_host_bytes();
+    for (uint32_t i = 0; i < SIM_SET2_KEYS; i++) {
+        count += sim_held[i];
+    }
+
+    return count;
+}
+
+/**
+ * @brief  Decode the Set 2 bytes the i8042 received
+ * @note   Tracks make/break codes including E0 extended codes, counts
+ *         the makes of each key and logs them in arrival order. The codes
+ *         after an E1 prefix (Pause) and fake Shift codes are skipped.
+ * @retval None
+ */
+static void sim_decode_host_bytes(void)
+{
+    static uint8_t extended = 0;
+    static uint8_t release = 0;
+    static uint8_t pause = 0;
+    uint32_t time_us;
+    uint8_t data;
+
+    while (i8042_sim_read_byte(&data, &time_us) == I8042_SIM_OK) {
+        if (sim_byte_log_count < SIM_BYTE_LOG_SIZE) {
+            sim_byte_log[sim_byte_log_count++] = data;
+        }
+        if (data == PS2_PAUSE_CODE_PREFIX) {
+            pause = SIM_PAUSE_CODES;
+        } else if (data == PS2_EXTENDED_CODE_PREFIX) {
+            extended = 1;
+        } else if (data == PS2_BREAK_CODE_PREFIX) {
+            release = 1;
+        } else if (pause != 0) {
+            pause--;
+            release = 0;
+        } else if (extended && (data == SIM_SET2_LEFT_SHIFT || data == SIM_SET2_RIGHT_SHIFT)) {
+            /* Fake Shift, ignored like a real host does */
+            extended = 0;
+            release = 0;
+        } else {
+            uint32_t index = (extended ? 256U : 0U) + data;
+
+            if (!release) {
+                sim_make_count[index]++;
+                if (sim_make_log_count < SIM_MAKE_LOG_SIZE) {
+                    uint8_t shifted = sim_held[SIM_SET2_LEFT_SHIFT] || sim_held[SIM_SET2_RIGHT_SHIFT];
+
+                    sim_make_log[sim_make_log_count++] = (uint16_t)(index | (shifted ? SIM_MAKE_SHIFTED : 0U));
+                }
+            }
+            if (release && sim_held[index]) {
+                sim_held_count--;
+            } else if (!release && !sim_held[index]) {
+                sim_held_count++;
+                if (sim_held_count > sim_held_peak) {
+                    sim_held_peak = sim_held_count;
+                }
+            }
+            sim_held[index] = release ? 0 : 1;
+            extended = 0;
+            release = 0;
+        }
+    }
+}
+
+/**
+ * @brief  Queue a scan code, waiting for queue space like the main loop would
+ * @param  scancode: Scan code to send
+ * @retval None
+ */
+static void sim_send_scancode(const PS2_ScanCode_t *scancode)
+{
+    while (ps2_send_scancode(scancode) != PS2_OK) {
+        sim_run_device(SIM_POLL_INTERVAL_US);
+    }
+}
+
+/**
+ * @brief  Run the device main loop for a while
+ * @note   Polls ps2_process() so queued bytes drain and host commands
+ *         are answered
+ * @param  duration_us: Virtual time to run
+ * @retval None
+ */
+static void sim_run_device(uint32_t duration_us)
+{
+    uint32_t end_us = ps2_sim_get_time_us() + duration_us;
+
+    while (ps2_sim_get_time_us() < end_us) {
+        ps2_process();
+        ps2_delay_us(SIM_POLL_INTERVAL_US);
+    }
+}
+
+/**
+ * @brief  Print a timing check report
+ * @param  report: Report to print
+ * @retval None
+ */
+static void sim_print_timing_report(const PS2_SimTimingReport_t *report)
+{
+    printf("frames:                 %lu\n", (unsigned long)report->frames);
+    printf("clock edges:            %lu\n", (unsigned long)report->clock_edges);
+    printf("clock period:           %lu..%lu us\n",
+           (unsigned long)report->min_clock_period_us,
+           (unsigned long)report->max_clock_period_us);
+    printf("clock period errors:    %lu\n", (unsigned long)report->clock_period_violations);
+    printf("clock phase errors:     %lu\n", (unsigned long)report->clock_phase_violations);
+    printf("data setup errors:      %lu\n", (unsigned long)report->data_setup_violations);
+    printf("data hold errors:       %lu\n", (unsigned long)report->data_hold_violations);
+    printf("inhibits:               %lu (slowest release %lu us)\n",
+           (unsigned long)report->inhibits,
+           (unsigned long)report->max_inhibit_response_us);
+    printf("inhibit response errors:%lu\n", (unsigned long)report->inhibit_response_violations);
+    if (report->log_overflow) {
+        printf("edge log overflowed - capture incomplete\n");
+    }
+}
+
+/**
+ * @brief  Print command line usage
+ * @param  prog: Program name
+ * @retval None
+ */
+static void sim_usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s capture [out.vcd]\n", prog);
+    fprintf(stderr, "       %s unplug\n", prog);
+    fprintf(stderr, "       %s desync\n", prog);
+    fprintf(stderr, "       %s burst\n", prog);
+    fprintf(stderr, "       %s priority\n", prog);
+    fprintf(stderr, "       %s flood\n", prog);
+    fprintf(stderr, "       %s scan64 [-g us] [-k us]\n", prog);
+    fprintf(stderr, "       %s latency\n", prog);
+    fprintf(stderr, "       %s hidkeys\n", prog);
+    fprintf(stderr, "       %s rollover\n", prog);
+    fprintf(stderr, "       %s modifiers\n", prog);
+    fprintf(stderr, "       %s sequences\n", prog);
+    fprintf(stderr, "       %s navkeys\n", prog);
+    fprintf(stderr, "       %s set1\n", prog);
+    fprintf(stderr, "       %s set3\n", prog);
+    fprintf(stderr, "       %s remap\n", prog);
+    fprintf(stderr, "       %s macros\n", prog);
+    fprintf(stderr, "       %s chords\n", prog);
+    fprintf(stderr, "       %s taphold\n", prog);
+    fprintf(stderr, "       %s config\n", prog);
+    fprintf(stderr, "       %s hotswap\n", prog);
+    fprintf(stderr, "       %s i8042 [-n bytes] [-f hz|auto] [-g us] [-p us -d us] [-a us]\n"
+                    "             [-c hex]... [-o out.vcd]\n", prog);
+}
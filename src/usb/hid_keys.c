@@ -0,0 +1,268 @@
+/**
+ ******************************************************************************
+ * @file    hid_keys.c
+ * @brief   Boot protocol key array kernels for STM32F411
+ * @author  STM32F411 USB-PS2 Project
+ * @version 1.0.0
+ * @date    2024
+ *
+ * @description
+ * Filters and compares the six key bytes of boot protocol keyboard
+ * reports. Results are bitmasks with bit i for key byte i, so callers
+ * keep the report order without searching arrays byte by byte.
+ *
+ * On cores with the DSP extension the six bytes are handled as two
+ * words: USUB8 compares four byte lanes at once and SEL turns the lane
+ * flags into byte masks. Matching one array against another compares
+ * all six lanes against each of the six rotations of the other array,
+ * instead of searching it once per key. Other targets use the portable
+ * C kernels, which are also exported so both can be checked against each
+ * other.
+ * The host simulation models USUB8/SEL in C to run the same kernel.
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include "hid_keys.h"
+#if defined(__ARM_FEATURE_DSP) && (__ARM_FEATURE_DSP == 1)
+#include "cmsis_compiler.h"
+#endif
+
+/* Private typedef -----------------------------------------------------------*/
+
+/* Private define ------------------------------------------------------------*/
+#if (defined(__ARM_FEATURE_DSP) && (__ARM_FEATURE_DSP == 1)) || defined(PS2_HOST_SIM)
+#define HID_KEYS_SIMD               1
+#else
+#define HID_KEYS_SIMD               0
+#endif
+
+#define HID_KEYS_BYTE_ONES          0x01010101UL   ///< Broadcasts a byte to all four lanes
+#define HID_KEYS_FIRST_USAGE_LANES  (HID_KEYS_FIRST_USAGE * HID_KEYS_BYTE_ONES)
+#define HID_KEYS_ROLLOVER_LANES     (HID_KEYS_ERROR_ROLLOVER * HID_KEYS_BYTE_ONES)
+#define HID_KEYS_HIGH_LANES         0x0000FFFFUL   ///< Lanes of the second word holding keys 4-5
+#define HID_KEYS_LANE_BITS          0x01010101UL   ///< Lowest bit of each lane
+#define HID_KEYS_GATHER             0x01020408UL   ///< Moves the lane bits to bits 24-27
+#define HID_KEYS_ALL                ((1U << HID_KEYS_COUNT) - 1U)
+
+/* Private macro -------------------------------------------------------------*/
+
+/* Private variables ---------------------------------------------------------*/
+
+/* Private function prototypes -----------------------------------------------*/
+#if HID_KEYS_SIMD
+static inline uint32_t hid_keys_ge8(uint32_t a, uint32_t b);
+static inline uint8_t hid_keys_lanes_to_bits(uint32_t lanes);
+static inline void hid_keys_load(const uint8_t *keys, uint32_t *low, uint32_t *high);
+static inline void hid_keys_rotate(uint32_t *low, uint32_t *high);
+#endif
+
+/* Exported functions --------------------------------------------------------*/
+
+/**
+ * @brief  Find the real key usages in a key array
+ * @param  keys: HID_KEYS_COUNT key bytes
+ * @retval Bit i set if keys[i] is neither 0x00 (none) nor 0x01 (ErrorRollOver)
+ */
+uint8_t hid_keys_valid_mask(const uint8_t *keys)
+{
+#if HID_KEYS_SIMD
+    uint32_t low, high;
+
+    hid_keys_load(keys, &low, &high);
+
+    return (uint8_t)(hid_keys_lanes_to_bits(hid_keys_ge8(low, HID_KEYS_FIRST_USAGE_LANES)) |
+                     (hid_keys_lanes_to_bits(hid_keys_ge8(high, HID_KEYS_FIRST_USAGE_LANES) &
+                                             HID_KEYS_HIGH_LANES) << 4));
+#else
+    return hid_keys_valid_mask_c(keys);
+#endif
+}
+
+/**
+ * @brief  Find the real key usages of one key array present in another
+ * @note   A release is a valid old key not matched in the new array, a
+ *         press a valid new key not matched in the old one. The caller
+ *         passes the valid keys it already knows, e.g. from
+ *         hid_keys_valid_mask() or a compacted key count.
+ * @param  keys: HID_KEYS_COUNT key bytes to look up
+ * @param  other: HID_KEYS_COUNT key bytes to search
+ * @param  valid: Bit i set if keys[i] is a real usage
+ * @retval Bit i set if keys[i] is a real usage found anywhere in other
+ */
+uint8_t hid_keys_match_mask(const uint8_t *keys, const uint8_t *other, uint8_t valid)
+{
+#if HID_KEYS_SIMD
+    uint32_t key_low, key_high;
+    uint32_t other_low, other_high;
+    uint32_t equal_low = 0;
+    uint32_t equal_high = 0;
+
+    hid_keys_load(keys, &key_low, &key_high);
+    hid_keys_load(other, &other_low, &other_high);
+
+    /* Lane i meets other[(i + n) % 6] in rotation n; equal lanes have
+     * key ^ other zero, i.e. 0 >= key ^ other */
+    for (uint8_t n = 0; n < HID_KEYS_COUNT; n++) {
+        equal_low |= hid_keys_ge8(0, key_low ^ other_low);
+        equal_high |= hid_keys_ge8(0, key_high ^ other_high);
+        hid_keys_rotate(&other_low, &other_high);
+    }
+
+    return (uint8_t)((hid_keys_lanes_to_bits(equal_low) |
+                      (hid_keys_lanes_to_bits(equal_high & HID_KEYS_HIGH_LANES) << 4)) & valid);
+#else
+    return hid_keys_match_mask_c(keys, other, valid);
+#endif
+}
+
+/**
+ * @brief  Detect a phantom (ErrorRollOver) report
+ * @note   The key bytes of such a report say nothing about which keys are
+ *         down; the modifier byte is still valid
+ * @param  keys: HID_KEYS_COUNT key bytes
+ * @retval 1 if any key byte is ErrorRollOver, 0 otherwise
+ */
+uint8_t hid_keys_rollover(const uint8_t *keys)
+{
+#if HID_KEYS_SIMD
+    uint32_t low, high;
+
+    hid_keys_load(keys, &low, &high);
+
+    return ((hid_keys_ge8(0, low ^ HID_KEYS_ROLLOVER_LANES) |
+             (hid_keys_ge8(0, high ^ HID_KEYS_ROLLOVER_LANES) & HID_KEYS_HIGH_LANES)) != 0) ? 1 : 0;
+#else
+    return hid_keys_rollover_c(keys);
+#endif
+}
+
+/**
+ * @brief  Portable version of hid_keys_valid_mask()
+ * @param  keys: HID_KEYS_COUNT key bytes
+ * @retval Bit i set if keys[i] is a real key usage
+ */
+uint8_t hid_keys_valid_mask_c(const uint8_t *keys)
+{
+    uint8_t valid = 0;
+
+    for (uint8_t i = 0; i < HID_KEYS_COUNT; i++) {
+        if (keys[i] >= HID_KEYS_FIRST_USAGE) {
+            valid |= (uint8_t)(1U << i);
+        }
+    }
+
+    return valid;
+}
+
+/**
+ * @brief  Portable version of hid_keys_match_mask()
+ * @param  keys: HID_KEYS_COUNT key bytes to look up
+ * @param  other: HID_KEYS_COUNT key bytes to search
+ * @param  valid: Bit i set if keys[i] is a real usage
+ * @retval Bit i set if keys[i] is a real usage found anywhere in other
+ */
+uint8_t hid_keys_match_mask_c(const uint8_t *keys, const uint8_t *other, uint8_t valid)
+{
+    uint8_t match = 0;
+
+    for (uint8_t i = 0; i < HID_KEYS_COUNT; i++) {
+        if ((valid & (1U << i)) == 0) {
+            continue;
+        }
+        for (uint8_t j = 0; j < HID_KEYS_COUNT; j++) {
+            if (other[j] == keys[i]) {
+                match |= (uint8_t)(1U << i);
+                break;
+            }
+        }
+    }
+
+    return (uint8_t)(match & HID_KEYS_ALL);
+}
+
+/**
+ * @brief  Portable version of hid_keys_rollover()
+ * @param  keys: HID_KEYS_COUNT key bytes
+ * @retval 1 if any key byte is ErrorRollOver, 0 otherwise
+ */
+uint8_t hid_keys_rollover_c(const uint8_t *keys)
+{
+    for (uint8_t i = 0; i < HID_KEYS_COUNT; i++) {
+        if (keys[i] == HID_KEYS_ERROR_ROLLOVER) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/* Private functions ---------------------------------------------------------*/
+
+#if HID_KEYS_SIMD
+/**
+ * @brief  Unsigned per-lane a >= b
+ * @note   USUB8 sets the GE flag of each byte lane, SEL expands the flags
+ *         to 0xFF/0x00 lanes
+ * @param  a: Four byte lanes
+ * @param  b: Four byte lanes
+ * @retval 0xFF in each lane where a >= b, 0x00 elsewhere
+ */
+static inline uint32_t hid_keys_ge8(uint32_t a, uint32_t b)
+{
+#if defined(__ARM_FEATURE_DSP) && (__ARM_FEATURE_DSP == 1)
+    (void)__USUB8(a, b);
+    return __SEL(0xFFFFFFFFUL, 0UL);
+#else
+    uint32_t lanes = 0;
+
+    for (uint8_t shift = 0; shift < 32; shift += 8) {
+        if (((a >> shift) & 0xFFU) >= ((b >> shift) & 0xFFU)) {
+            lanes |= 0xFFUL << shift;
+        }
+    }
+
+    return lanes;
+#endif
+}
+
+/**
+ * @brief  Compress 0xFF/0x00 lanes to four bits
+ * @note   One multiply moves the lowest bit of each lane to bits 24-27
+ *         without carries between the partial products
+ * @param  lanes: Lane mask
+ * @retval Bit n set if lane n is set
+ */
+static inline uint8_t hid_keys_lanes_to_bits(uint32_t lanes)
+{
+    return (uint8_t)((((lanes & HID_KEYS_LANE_BITS) * HID_KEYS_GATHER) >> 24) & 0x0FU);
+}
+
+/**
+ * @brief  Load six key bytes as two little-endian words
+ * @param  keys: HID_KEYS_COUNT key bytes
+ * @param  low: Pointer to store keys 0-3
+ * @param  high: Pointer to store keys 4-5 in the low half, zero above
+ * @retval None
+ */
+static inline void hid_keys_load(const uint8_t *keys, uint32_t *low, uint32_t *high)
+{
+    *low = (uint32_t)keys[0] | ((uint32_t)keys[1] << 8) |
+           ((uint32_t)keys[2] << 16) | ((uint32_t)keys[3] << 24);
+    *high = (uint32_t)keys[4] | ((uint32_t)keys[5] << 8);
+}
+
+/**
+ * @brief  Rotate six key lanes down by one
+ * @param  low: Lanes 0-3, lane 0 moves to lane 5
+ * @param  high: Lanes 4-5 in the low half, zero above
+ * @retval None
+ */
+static inline void hid_keys_rotate(uint32_t *low, uint32_t *high)
+{
+    uint32_t first = *low & 0xFFU;
+
+    *low = (*low >> 8) | ((*high & 0xFFU) << 24);
+    *high = (*high >> 8) | (first << 8);
+}
+#endif
@@ -0,0 +1,351 @@
+/**
+ ******************************************************************************
+ * @file    key_remap.c
+ * @brief   Key remapping and layers for STM32F411
+ * @author  STM32F411 USB-PS2 Project
+ * @version 1.0.0
+ * @date    2024
+ *
+ * @description
+ * Rewrites the usages of keyboard events before they reach the translator.
+ * Each layer is a direct-indexed table of 256 output usages generated at
+ * build time from the keymap file (cmake/keymap_gen.cmake), so a key costs
+ * one indexed load. The base layer is always in use; holding a layer key
+ * selects its layer, the highest one winning when several are held. A
+ * layer can also be locked on by a converter hotkey (chord_detector.c).
+ * Layers are resolved at build time: keys a layer leaves alone carry the
+ * base layer entry. A keymap without any remapping generates no layer and
+ * events pass through untouched, their presses still remembered so tables
+ * published later release them.
+ *
+ * The usage sent for each press is remembered, so a key released after
+ * its layer changed releases what it pressed. A key bound to a macro is
+ * passed on as usage KEY_REMAP_MACRO_KEY | n, a reserved HID usage.
+ *
+ * The tables can be changed at runtime without pausing translation. They
+ * are reached through one published pointer, taken once at the start of
+ * each report, so a report is remapped with the old tables or the new
+ * ones, never a mix. The report marks the tables it takes as being read
+ * before checking they are still the published ones, so a writer never
+ * reuses them under it. New tables are built in a spare RAM buffer
+ * (key_remap_edit_begin()) and published with a single pointer store
+ * (key_remap_publish()), from any context. A buffer is reused only once
+ * it is neither published nor held by a report being remapped; with the
+ * generated tables in flash and two buffers, one is always free between
+ * reports.
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include "key_remap.h"
+#include <string.h>
+
+/* Private typedef -----------------------------------------------------------*/
+/**
+ * @brief One set of layer tables
+ */
+typedef struct {
+    const uint8_t (*layers)[KEY_REMAP_TABLE_SIZE];  ///< Layer tables, the base layer first
+    uint8_t layer_count;                            ///< Layers, 0 to pass events through
+} KeyRemapTables_t;
+
+/* Private define ------------------------------------------------------------*/
+#define KEY_REMAP_LAYER_MASK        0x07    ///< Layer number in a layer key entry
+#define KEY_REMAP_EDIT_BUFFERS      2       ///< RAM table sets for runtime changes
+#define KEY_REMAP_GENERATED         0       ///< Table set of the generated tables
+#define KEY_REMAP_NO_EDIT           0xFF    ///< No table set being built
+
+/* Private macro -------------------------------------------------------------*/
+#ifdef PS2_HOST_SIM
+#define KEY_REMAP_SIM_PREEMPT()     do { if (sim_hook != NULL) { sim_hook(); } } while (0)
+#else
+#define KEY_REMAP_SIM_PREEMPT()     do { } while (0)
+#endif
+
+/* Private variables ---------------------------------------------------------*/
+static uint8_t edit_layers[KEY_REMAP_EDIT_BUFFERS][KEY_REMAP_MAX_LAYERS][KEY_REMAP_TABLE_SIZE];
+static KeyRemapTables_t table_sets[1 + KEY_REMAP_EDIT_BUFFERS];   ///< Generated tables, then the RAM buffers
+static const KeyRemapTables_t *volatile published = &table_sets[KEY_REMAP_GENERATED];  ///< Tables for the next report
+static const KeyRemapTables_t *volatile reading = NULL;    ///< Tables of the report being remapped
+static const KeyRemapTables_t *tables = NULL;          ///< Tables active_layer points into
+static uint8_t editing = KEY_REMAP_NO_EDIT;            ///< RAM buffer being built
+static const uint8_t *active_layer = NULL;             ///< Table in use, NULL without a keymap
+static uint8_t active_layer_number = 0;
+static uint8_t held_layers = 0;                         ///< Bit n set while the key of layer n is down
+static uint8_t locked_layers = 0;                       ///< Bit n set while layer n is locked on
+static uint8_t pressed_as[KEY_REMAP_TABLE_SIZE];        ///< Table entry each held usage was pressed with
+#ifdef PS2_HOST_SIM
+static KeyRemapSimHook_t sim_hook = NULL;               ///< Interrupt model, NULL for none
+#endif
+
+/* Private function prototypes -----------------------------------------------*/
+static void key_remap_select_layer(const KeyRemapTables_t *set);
+
+/* Exported functions --------------------------------------------------------*/
+
+/**
+ * @brief  Initialize key remapping
+ * @retval None
+ */
+void key_remap_init(void)
+{
+    table_sets[KEY_REMAP_GENERATED].layers = key_remap_layers;
+    table_sets[KEY_REMAP_GENERATED].layer_count = key_remap_layer_count;
+    published = &table_sets[KEY_REMAP_GENERATED];
+    reading = NULL;
+    editing = KEY_REMAP_NO_EDIT;
+    locked_layers = 0;
+    key_remap_reset();
+}
+
+/**
+ * @brief  Forget held keys and layers
+ * @note   Called when the host has been sent a release of every key; the
+ *         keyboard handler then presses the keys still down again. Locked
+ *         layers stay locked.
+ * @retval None
+ */
+void key_remap_reset(void)
+{
+    memset(pressed_as, KEY_REMAP_NONE, sizeof(pressed_as));
+    held_layers = 0;
+    key_remap_select_layer(published);
+}
+
+/**
+ * @brief  Remap the key events of one report
+ * @note   Layer keys and disabled keys produce no event. The whole report
+ *         uses the tables published when it starts.
+ * @param  events: Key events from the keyboard handler
+ * @param  count: Number of events
+ * @param  remapped: Array of at least count events to store the result
+ * @retval Number of events stored
+ */
+uint8_t key_remap_events(const KeyboardEvent_t *events, uint8_t count, KeyboardEvent_t *remapped)
+{
+    const KeyRemapTables_t *set;
+    uint8_t remapped_count = 0;
+
+    /* Claim the tables, then check no publish slipped in between */
+    do {
+        set = published;
+        KEY_REMAP_SIM_PREEMPT();
+        reading = set;
+    } while (set != published);
+
+    if (set != tables) {
+        key_remap_select_layer(set);
+    }
+
+    if (active_layer == NULL) {
+        /* Tables published while a key is down release what it pressed */
+        for (uint8_t i = 0; i < count; i++) {
+            pressed_as[events[i].usage] = (events[i].flags & KEYBOARD_EVENT_PRESS) ? events[i].usage : KEY_REMAP_NONE;
+        }
+        memcpy(remapped, events, (size_t)count * sizeof(KeyboardEvent_t));
+        reading = NULL;
+        return count;
+    }
+
+    for (uint8_t i = 0; i < count; i++) {
+        uint8_t usage = events[i].usage;
+        uint8_t entry;
+
+        if (events[i].flags & KEYBOARD_EVENT_PRESS) {
+            entry = active_layer[usage];
+            pressed_as[usage] = entry;
+        } else {
+            entry = pressed_as[usage];
+            pressed_as[usage] = KEY_REMAP_NONE;
+        }
+
+        if ((entry & (uint8_t)~KEY_REMAP_LAYER_MASK) == KEY_REMAP_LAYER_KEY) {
+            uint8_t bit = (uint8_t)(1U << (entry & KEY_REMAP_LAYER_MASK));
+
+            held_layers = (events[i].flags & KEYBOARD_EVENT_PRESS) ? (uint8_t)(held_layers | bit)
+                                                                   : (uint8_t)(held_layers & ~bit);
+            key_remap_select_layer(set);
+        } else if (entry != KEY_REMAP_NONE) {
+            remapped[remapped_count] = events[i];
+            remapped[remapped_count].usage = entry;
+            remapped_count++;
+        }
+        KEY_REMAP_SIM_PREEMPT();
+    }
+
+    reading = NULL;
+    return remapped_count;
+}
+
+/**
+ * @brief  Start building new tables from the published ones
+ * @note   Without a keymap the new tables start with a base layer that
+ *         changes nothing. Starting again drops the tables being built.
+ * @retval 1 if a buffer is ready for key_remap_edit_map(), 0 if none is
+ *         retired yet (the previous tables are still in use by a report)
+ */
+uint8_t key_remap_edit_begin(void)
+{
+    const KeyRemapTables_t *source = published;
+
+    for (uint8_t n = 0; n < KEY_REMAP_EDIT_BUFFERS; n++) {
+        KeyRemapTables_t *set = &table_sets[1 + n];
+
+        if (set == source || set == reading) {
+            continue;
+        }
+
+        if (set == tables) {
+            /* active_layer points into this buffer: select again on the next report */
+            tables = NULL;
+        }
+
+        if (source->layer_count == 0) {
+            for (uint16_t usage = 0; usage < KEY_REMAP_TABLE_SIZE; usage++) {
+                edit_layers[n][0][usage] = (usage < KEY_REMAP_MACRO_KEY) ? (uint8_t)usage : KEY_REMAP_NONE;
+            }
+            set->layer_count = 1;
+        } else {
+            memcpy(edit_layers[n], source->layers, (size_t)source->layer_count * KEY_REMAP_TABLE_SIZE);
+            set->layer_count = source->layer_count;
+        }
+        set->layers = (const uint8_t (*)[KEY_REMAP_TABLE_SIZE])edit_layers[n];
+        editing = n;
+        return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief  Change one entry of the tables being built
+ * @note   Only the given layer changes; higher layers keep the base
+ *         layer entries they were built with
+ * @param  layer: Layer number, below the layer count of the tables
+ * @param  usage: HID usage of the key
+ * @param  entry: Usage to send, KEY_REMAP_NONE, or a layer or macro key entry
+ * @retval None
+ */
+void key_remap_edit_map(uint8_t layer, uint8_t usage, uint8_t entry)
+{
+    if (editing == KEY_REMAP_NO_EDIT || layer >= table_sets[1 + editing].layer_count) {
+        return;
+    }
+
+    edit_layers[editing][layer][usage] = entry;
+}
+
+/**
+ * @brief  Publish the tables being built
+ * @note   One pointer store; the next report to start uses the new tables
+ *         and a report being remapped finishes with the old ones. Keys
+ *         down still release what they pressed.
+ * @retval None
+ */
+void key_remap_publish(void)
+{
+    if (editing == KEY_REMAP_NO_EDIT) {
+        return;
+    }
+
+    published = &table_sets[1 + editing];
+    editing = KEY_REMAP_NO_EDIT;
+}
+
+/**
+ * @brief  Lock a layer on, or unlock it
+ * @note   A locked layer is in use as if its key were held
+ * @param  layer: Layer number, 1 to the layer count - 1
+ * @retval None
+ */
+void key_remap_toggle_layer(uint8_t layer)
+{
+    if (layer == 0 || layer >= published->layer_count) {
+        return;
+    }
+
+    locked_layers ^= (uint8_t)(1U << layer);
+    key_remap_select_layer(published);
+}
+
+/**
+ * @brief  Lock exactly the given layers on
+ * @note   Used for the stored setting; bits of layers the keymap does not
+ *         define are ignored
+ * @param  layers: Bit n set to lock layer n
+ * @retval None
+ */
+void key_remap_set_locked_layers(uint8_t layers)
+{
+    uint8_t defined = (uint8_t)((1U << published->layer_count) - 1U);
+
+    locked_layers = (uint8_t)(layers & defined & ~1U);
+    key_remap_select_layer(published);
+}
+
+/**
+ * @brief  Get the layers locked on
+ * @retval Bit n set while layer n is locked
+ */
+uint8_t key_remap_get_locked_layers(void)
+{
+    return locked_layers;
+}
+
+/**
+ * @brief  Get the layer in use
+ * @retval Layer number, 0 for the base layer
+ */
+uint8_t key_remap_get_layer(void)
+{
+    return active_layer_number;
+}
+
+#ifdef PS2_HOST_SIM
+/**
+ * @brief  Set the interrupt model of the host simulation
+ * @note   The hook runs between taking the published pointer and marking
+ *         it read, and after each event of a report
+ * @param  hook: Function to call, NULL for none
+ * @retval None
+ */
+void key_remap_sim_set_hook(KeyRemapSimHook_t hook)
+{
+    sim_hook = hook;
+}
+
+/**
+ * @brief  Drop the generated layers, as if built with the default keymap
+ * @note   The simulation is built with the example keymap; key_remap_init()
+ *         brings its layers back
+ * @retval None
+ */
+void key_remap_sim_drop_keymap(void)
+{
+    table_sets[KEY_REMAP_GENERATED].layer_count = 0;
+    published = &table_sets[KEY_REMAP_GENERATED];
+    key_remap_reset();
+}
+#endif
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+ * @brief  Select the highest layer whose key is held or that is locked
+ * @param  set: Tables to select from
+ * @retval None
+ */
+static void key_remap_select_layer(const KeyRemapTables_t *set)
+{
+    uint8_t layer = 0;
+
+    for (uint8_t n = 1; n < set->layer_count; n++) {
+        if ((held_layers | locked_layers) & (1U << n)) {
+            layer = n;
+        }
+    }
+
+    tables = set;
+    active_layer_number = layer;
+    active_layer = (set->layer_count != 0) ? set->layers[layer] : NULL;
+}
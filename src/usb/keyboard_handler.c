@@ -10,36 +10,79 @@
 
 /* Includes ------------------------------------------------------------------*/
 #include "keyboard_handler.h"
+#include "hid_keys.h"
+#include "tap_hold.h"
 #include "usb_host_init.h"
 
 /* Private typedef -----------------------------------------------------------*/
+/**
+ * @brief Report coalescing state, all bitmaps indexed by HID usage
+ * @note   Modifiers are kept as usages 0xE0-0xE7 so they follow the same rules
+ */
+typedef struct {
+    uint8_t base[USB_HID_USAGE_BITMAP_SIZE];   ///< Last state placed in the buffer
+    uint8_t latest[USB_HID_USAGE_BITMAP_SIZE]; ///< Newest report
+    uint8_t taps[USB_HID_USAGE_BITMAP_SIZE];   ///< Up in base, pressed and released since
+    uint8_t gaps[USB_HID_USAGE_BITMAP_SIZE];   ///< Down in base, released and pressed again
+    uint8_t emitted[USB_HID_USAGE_BITMAP_SIZE]; ///< Last snapshot placed in the buffer
+    uint8_t phase;                              ///< Flush progress
+    uint16_t time_ms;                           ///< Tick of the newest folded report
+} KeyboardCoalesce_t;
 
 /* Private define ------------------------------------------------------------*/
 #define KEYBOARD_REPORT_SIZE        8       ///< Standard HID keyboard report size
 #define KEYBOARD_MODIFIER_OFFSET    0       ///< Offset of modifier byte in report
 #define KEYBOARD_KEY_OFFSET         2       ///< Offset of key data in report
 #define KEYBOARD_MAX_KEYS           6       ///< Maximum simultaneous keys
-#define KEYBOARD_BUFFER_SIZE        16      ///< Keyboard data buffer size
+#define KEYBOARD_EVENT_BUFFER_SIZE  64      ///< Key events buffered for the translator
+#define KEYBOARD_MODIFIER_USAGE     USB_HID_MODIFIER_USAGE
+#define KEYBOARD_FLUSH_RELEASE_GAPS 0       ///< Flush phase: release gapped keys
+#define KEYBOARD_FLUSH_TAPS         1       ///< Flush phase: press and release tapped keys in batches
+#define KEYBOARD_FLUSH_LATEST       2       ///< Flush phase: re-press gapped keys, then latest state
+#define KEYBOARD_TIMED_MAX_EVENTS   (KEYBOARD_REPORT_MAX_EVENTS + TAP_HOLD_EXTRA_EVENTS) ///< Events of a report after tap-hold
 
 /* Private macro -------------------------------------------------------------*/
+#define KEYBOARD_USAGE_GET(bitmap, usage)   (((bitmap)[(usage) >> 3] >> ((usage) & 7U)) & 1U)
+#define KEYBOARD_USAGE_SET(bitmap, usage)   ((bitmap)[(usage) >> 3] |= (uint8_t)(1U << ((usage) & 7U)))
+#define KEYBOARD_USAGE_CLEAR(bitmap, usage) ((bitmap)[(usage) >> 3] &= (uint8_t)~(1U << ((usage) & 7U)))
+
+_Static_assert(USB_HID_MAX_KEYS == HID_KEYS_COUNT, "key state arrays must match the hid_keys kernels");
+_Static_assert(KEYBOARD_EVENT_BUFFER_SIZE >= 2 * KEYBOARD_REPORT_MAX_EVENTS, "event buffer too small for a flush step");
+_Static_assert(KEYBOARD_TIMED_MAX_EVENTS <= KEYBOARD_EVENT_BUFFER_SIZE, "event buffer too small for a report after tap-hold");
 
 /* Private variables ---------------------------------------------------------*/
-static USB_HID_KeyboardData_t keyboard_buffer[KEYBOARD_BUFFER_SIZE];
+static KeyboardEvent_t event_buffer[KEYBOARD_EVENT_BUFFER_SIZE];
 static volatile uint8_t buffer_head = 0;
 static volatile uint8_t buffer_tail = 0;
 static volatile uint8_t buffer_count = 0;
 static USB_HID_KeyboardData_t last_keyboard_state;
+static uint8_t output_keys[USB_HID_USAGE_BITMAP_SIZE];  ///< Keys down as passed on, after tap-hold
 static KeyboardHandlerStatus_t handler_status = KEYBOARD_HANDLER_INIT;
+static volatile uint8_t buffer_overflow = 0;
+static KeyboardCoalesce_t coalesce;
+static volatile uint8_t coalesce_active = 0;
+static KeyboardEvent_t held_events[KEYBOARD_TIMED_MAX_EVENTS];  ///< Rest of a report that would repeat a coalesced tap
+static volatile uint8_t held_count = 0;
+static uint16_t held_time_ms = 0;
+static KeyboardHandlerStats_t handler_stats;
+static uint8_t rollover_active = 0;
 
 /* Private function prototypes -----------------------------------------------*/
 static void keyboard_parse_hid_report(const uint8_t *report, USB_HID_KeyboardData_t *keyboard_data);
-static uint8_t keyboard_buffer_is_full(void);
-static uint8_t keyboard_buffer_is_empty(void);
-static void keyboard_buffer_put(const USB_HID_KeyboardData_t *data);
-static void keyboard_buffer_get(USB_HID_KeyboardData_t *data);
-static void keyboard_compare_states(const USB_HID_KeyboardData_t *old_state, 
-                                   const USB_HID_KeyboardData_t *new_state,
-                                   USB_HID_KeyboardData_t *changes);
+static uint8_t keyboard_modifier_events(uint8_t old_modifier, uint8_t new_modifier, KeyboardEvent_t *events);
+static uint8_t keyboard_state_events(const USB_HID_KeyboardData_t *old_state,
+                                     const USB_HID_KeyboardData_t *new_state, KeyboardEvent_t *events);
+static uint8_t keyboard_bitmap_events(const uint8_t *old_bitmap, const uint8_t *new_bitmap,
+                                      KeyboardEvent_t *events);
+static void keyboard_buffer_events(KeyboardEvent_t *events, uint8_t count, uint16_t time_ms);
+static void keyboard_buffer_store(KeyboardEvent_t *events, uint8_t count, uint16_t time_ms);
+static uint8_t keyboard_coalesce_events(const KeyboardEvent_t *events, uint8_t count);
+static uint8_t keyboard_coalesce_repeats(const KeyboardEvent_t *event);
+static void keyboard_coalesce_fold(const uint8_t *next);
+static void keyboard_coalesce_flush(void);
+static void keyboard_coalesce_release_held(void);
+static void keyboard_coalesce_emit(const uint8_t *bitmap);
+static uint8_t keyboard_buffer_free(void);
 
 /* Exported functions --------------------------------------------------------*/
 
@@ -54,9 +97,13 @@ KeyboardHandlerStatus_t keyboard_handler_init(void)
     buffer_head = 0;
     buffer_tail = 0;
     buffer_count = 0;
+    held_count = 0;
     
     /* Clear last keyboard state */
     memset(&last_keyboard_state, 0, sizeof(USB_HID_KeyboardData_t));
+    memset(output_keys, 0, sizeof(output_keys));
+    rollover_active = 0;
+    tap_hold_reset();
     
     handler_status = KEYBOARD_HANDLER_READY;
     return KEYBOARD_HANDLER_OK;
@@ -64,7 +111,12 @@ KeyboardHandlerStatus_t keyboard_handler_init(void)
 
 /**
  * @brief  Process USB HID keyboard report
- * @note   Parses USB HID report and stores keyboard data
+ * @note   Parses the report, diffs it once against the last state and
+ *         buffers one key event per change: modifier changes, then
+ *         releases, then presses. An ErrorRollOver report keeps the keys
+ *         of the last good state and only applies its modifier byte, so
+ *         the host sees no phantom releases. Dual-role keys and one-shot
+ *         modifiers of the keymap are applied before buffering.
  * @param  report: Pointer to USB HID report data
  * @param  report_size: Size of HID report
  * @retval KEYBOARD_HANDLER_OK if successful, KEYBOARD_HANDLER_ERROR otherwise
@@ -72,50 +124,95 @@ KeyboardHandlerStatus_t keyboard_handler_init(void)
 KeyboardHandlerStatus_t keyboard_handler_process_report(const uint8_t *report, uint16_t report_size)
 {
     USB_HID_KeyboardData_t keyboard_data;
+    KeyboardEvent_t events[KEYBOARD_REPORT_MAX_EVENTS];
+    KeyboardEvent_t timed[KEYBOARD_TIMED_MAX_EVENTS];
+    uint16_t time_ms = (uint16_t)HAL_GetTick();
+    uint8_t event_count;
     
     if (report == NULL || report_size != KEYBOARD_REPORT_SIZE) {
         return KEYBOARD_HANDLER_ERROR;
     }
     
-    /* Parse HID report into keyboard data structure */
-    keyboard_parse_hid_report(report, &keyboard_data);
-    
-    /* Check if keyboard state has changed */
-    if (memcmp(&keyboard_data, &last_keyboard_state, sizeof(USB_HID_KeyboardData_t)) != 0) {
-        
-        /* Store new keyboard data if buffer has space */
-        if (!keyboard_buffer_is_full()) {
-            keyboard_buffer_put(&keyboard_data);
-            
-            /* Update last state */
-            memcpy(&last_keyboard_state, &keyboard_data, sizeof(USB_HID_KeyboardData_t));
-        } else {
-            /* Buffer full - could implement overflow handling here */
-            return KEYBOARD_HANDLER_BUFFER_FULL;
+    if (hid_keys_rollover(&report[KEYBOARD_KEY_OFFSET])) {
+        /* Phantom state - hold the last good keys */
+        if (!rollover_active) {
+            rollover_active = 1;
+            handler_stats.rollover_events++;
         }
+        handler_stats.rollover_reports++;
+        memcpy(&keyboard_data, &last_keyboard_state, sizeof(USB_HID_KeyboardData_t));
+        keyboard_data.modifier = report[KEYBOARD_MODIFIER_OFFSET];
+    } else {
+        rollover_active = 0;
+        
+        /* Parse HID report into keyboard data structure */
+        keyboard_parse_hid_report(report, &keyboard_data);
+    }
+    
+    /* No event - the keyboard state has not changed */
+    event_count = keyboard_state_events(&last_keyboard_state, &keyboard_data, events);
+    if (event_count == 0) {
+        return KEYBOARD_HANDLER_OK;
+    }
+    
+    handler_stats.reports++;
+    
+    __disable_irq();
+    
+    if (tap_hold_active()) {
+        /* May hold back a dual-role key or decide one */
+        event_count = tap_hold_events(events, event_count, time_ms, timed);
+        keyboard_buffer_events(timed, event_count, time_ms);
+    } else {
+        keyboard_buffer_events(events, event_count, time_ms);
     }
     
+    /* Update last state */
+    memcpy(&last_keyboard_state, &keyboard_data, sizeof(USB_HID_KeyboardData_t));
+    
+    __enable_irq();
+    
     return KEYBOARD_HANDLER_OK;
 }
 
 /**
- * @brief  Get keyboard data from buffer
- * @note   Retrieves next available keyboard data from internal buffer
- * @param  keyboard_data: Pointer to store keyboard data
- * @retval KEYBOARD_DATA_AVAILABLE if data available, KEYBOARD_NO_DATA otherwise
+ * @brief  Get the key events of the next report
+ * @note   Stops after the event flagged KEYBOARD_EVENT_LAST; a report with
+ *         more than max_events events continues on the next call
+ * @param  events: Array to store the events
+ * @param  max_events: Size of the events array
+ * @retval Number of events stored, 0 if none is buffered
  */
-KeyboardDataStatus_t keyboard_handler_get_data(USB_HID_KeyboardData_t *keyboard_data)
+uint8_t keyboard_handler_get_events(KeyboardEvent_t *events, uint8_t max_events)
 {
-    if (keyboard_data == NULL) {
-        return KEYBOARD_NO_DATA;
+    uint8_t count = 0;
+    
+    if (events == NULL) {
+        return 0;
+    }
+    
+    __disable_irq();
+    
+    while (buffer_count > 0 && count < max_events) {
+        events[count] = event_buffer[buffer_tail];
+        buffer_tail = (uint8_t)((buffer_tail + 1) % KEYBOARD_EVENT_BUFFER_SIZE);
+        buffer_count--;
+        if (events[count++].flags & KEYBOARD_EVENT_LAST) {
+            break;
+        }
     }
     
-    if (keyboard_buffer_is_empty()) {
-        return KEYBOARD_NO_DATA;
+    /* Room freed - release coalesced reports into the buffer */
+    if (count > 0 && coalesce_active) {
+        keyboard_coalesce_flush();
+    }
+    if (!coalesce_active && held_count != 0) {
+        keyboard_coalesce_release_held();
     }
     
-    keyboard_buffer_get(keyboard_data);
-    return KEYBOARD_DATA_AVAILABLE;
+    __enable_irq();
+    
+    return count;
 }
 
 /**
@@ -129,13 +226,27 @@ KeyboardHandlerStatus_t keyboard_handler_get_status(void)
 
 /**
  * @brief  Keyboard handler tick function
- * @note   Called from system tick for timing operations
+ * @note   Called from system tick; decides a dual-role key whose tapping
+ *         term has ended as held. One comparison while no key waits.
  * @retval None
  */
 void keyboard_handler_tick(void)
 {
-    /* Update handler timing if needed */
-    /* Could be used for timeout handling or periodic operations */
+    KeyboardEvent_t events[TAP_HOLD_TICK_EVENTS];
+    uint16_t time_ms;
+    uint8_t count;
+    
+    if (!tap_hold_pending() || held_count != 0) {
+        /* Nothing to decide, or a held report must go first */
+        return;
+    }
+    
+    time_ms = (uint16_t)HAL_GetTick();
+    
+    __disable_irq();
+    count = tap_hold_tick(time_ms, events);
+    keyboard_buffer_events(events, count, time_ms);
+    __enable_irq();
 }
 
 /**
@@ -149,9 +260,79 @@ void keyboard_handler_clear_buffer(void)
     buffer_head = 0;
     buffer_tail = 0;
     buffer_count = 0;
+    coalesce_active = 0;
+    held_count = 0;
+    __enable_irq();
+}
+
+/**
+ * @brief  Check for lost keyboard reports
+ * @note   Reports an overflow once; the caller is expected to resynchronize
+ *         with keyboard_handler_reset(). Coalescing keeps every change, so
+ *         this only fires when coalesced taps did not fit the key slots of
+ *         a flush step, a flush step did not fit the event buffer or a
+ *         report arrived while another was held.
+ * @retval 1 if a state change was dropped since the last call, 0 otherwise
+ */
+uint8_t keyboard_handler_check_overflow(void)
+{
+    uint8_t overflow;
+    
+    __disable_irq();
+    overflow = buffer_overflow;
+    buffer_overflow = 0;
+    __enable_irq();
+    
+    return overflow;
+}
+
+/**
+ * @brief  Check if the keyboard must not be polled
+ * @note   A report that would repeat a tap already coalesced is held until
+ *         the coalesced span has been flushed. The USB host stops re-arming
+ *         the interrupt IN transfer meanwhile, so the keyboard keeps its
+ *         later reports.
+ * @retval 1 while a report is held, 0 otherwise
+ */
+uint8_t keyboard_handler_congested(void)
+{
+    return (held_count != 0) ? 1 : 0;
+}
+
+/**
+ * @brief  Reset keyboard state tracking
+ * @note   Discards buffered reports and forgets the last keyboard state so
+ *         the next report is treated as new, re-pressing keys still held
+ * @retval None
+ */
+void keyboard_handler_reset(void)
+{
+    __disable_irq();
+    buffer_head = 0;
+    buffer_tail = 0;
+    buffer_count = 0;
+    buffer_overflow = 0;
+    coalesce_active = 0;
+    held_count = 0;
+    rollover_active = 0;
+    memset(&last_keyboard_state, 0, sizeof(USB_HID_KeyboardData_t));
+    memset(output_keys, 0, sizeof(output_keys));
+    tap_hold_reset();
     __enable_irq();
 }
 
+/**
+ * @brief  Get keyboard handler statistics
+ * @param  stats: Pointer to store statistics
+ * @retval None
+ */
+void keyboard_handler_get_stats(KeyboardHandlerStats_t *stats)
+{
+    if (stats != NULL) {
+        *stats = handler_stats;
+    }
+}
+
 /* Private functions ---------------------------------------------------------*/
 
 /**
@@ -163,105 +344,436 @@ void keyboard_handler_clear_buffer(void)
  */
 static void keyboard_parse_hid_report(const uint8_t *report, USB_HID_KeyboardData_t *keyboard_data)
 {
+    /* Null and error codes filtered in one pass over bytes 2-7 */
+    uint8_t valid = hid_keys_valid_mask(&report[KEYBOARD_KEY_OFFSET]);
+    
     /* Clear keyboard data structure */
     memset(keyboard_data, 0, sizeof(USB_HID_KeyboardData_t));
     
     /* Extract modifier keys (byte 0) */
     keyboard_data->modifier = report[KEYBOARD_MODIFIER_OFFSET];
     
-    /* Extract regular keys (bytes 2-7) */
-    keyboard_data->key_count = 0;
-    for (uint8_t i = 0; i < KEYBOARD_MAX_KEYS; i++) {
-        uint8_t key_code = report[KEYBOARD_KEY_OFFSET + i];
-        
-        if (key_code != 0 && key_code != 0x01) { /* Ignore null and error codes */
-            keyboard_data->keys[keyboard_data->key_count] = key_code;
-            keyboard_data->key_count++;
+    /* Compact the real key codes in report order */
+    for (uint8_t i = 0; valid != 0; i++, valid >>= 1) {
+        if (valid & 1U) {
+            keyboard_data->keys[keyboard_data->key_count++] = report[KEYBOARD_KEY_OFFSET + i];
         }
     }
 }
 
 /**
- * @brief  Check if keyboard buffer is full
- * @retval 1 if buffer is full, 0 otherwise
+ * @brief  Append the events of a modifier byte change
+ * @note   Walks the changed bits lowest first with count-trailing-zeros,
+ *         releases before presses
+ * @param  old_modifier: Modifier byte before
+ * @param  new_modifier: Modifier byte after
+ * @param  events: Array to append to
+ * @retval Number of events appended
  */
-static uint8_t keyboard_buffer_is_full(void)
+static uint8_t keyboard_modifier_events(uint8_t old_modifier, uint8_t new_modifier, KeyboardEvent_t *events)
 {
-    return (buffer_count >= KEYBOARD_BUFFER_SIZE);
+    uint32_t released = (uint32_t)(old_modifier & ~new_modifier);
+    uint32_t pressed = (uint32_t)(new_modifier & ~old_modifier);
+    uint8_t count = 0;
+    
+    while (released != 0) {
+        events[count].usage = (uint8_t)(KEYBOARD_MODIFIER_USAGE + __builtin_ctz(released));
+        events[count++].flags = 0;
+        released &= released - 1U;
+    }
+    
+    while (pressed != 0) {
+        events[count].usage = (uint8_t)(KEYBOARD_MODIFIER_USAGE + __builtin_ctz(pressed));
+        events[count++].flags = KEYBOARD_EVENT_PRESS;
+        pressed &= pressed - 1U;
+    }
+    
+    return count;
 }
 
 /**
- * @brief  Check if keyboard buffer is empty
- * @retval 1 if buffer is empty, 0 otherwise
+ * @brief  Diff two keyboard states into key events
+ * @note   Modifier changes first, then key releases, then key presses
+ * @param  old_state: State before the report
+ * @param  new_state: State after the report
+ * @param  events: Array of KEYBOARD_REPORT_MAX_EVENTS entries
+ * @retval Number of events
  */
-static uint8_t keyboard_buffer_is_empty(void)
+static uint8_t keyboard_state_events(const USB_HID_KeyboardData_t *old_state,
+                                     const USB_HID_KeyboardData_t *new_state, KeyboardEvent_t *events)
 {
-    return (buffer_count == 0);
+    uint8_t count = keyboard_modifier_events(old_state->modifier, new_state->modifier, events);
+    /* Parsed states hold their real keys first, so the count is the valid mask */
+    uint8_t old_valid = (uint8_t)((1U << old_state->key_count) - 1U);
+    uint8_t new_valid = (uint8_t)((1U << new_state->key_count) - 1U);
+    uint8_t released;
+    uint8_t pressed;
+    
+    /* Keys in one state but not in the other, one bit per key slot */
+    released = (uint8_t)(old_valid & ~hid_keys_match_mask(old_state->keys, new_state->keys, old_valid));
+    pressed = (uint8_t)(new_valid & ~hid_keys_match_mask(new_state->keys, old_state->keys, new_valid));
+    
+    for (uint8_t i = 0; released != 0; i++, released >>= 1) {
+        if (released & 1U) {
+            events[count].usage = old_state->keys[i];
+            events[count++].flags = 0;
+        }
+    }
+    
+    for (uint8_t i = 0; pressed != 0; i++, pressed >>= 1) {
+        if (pressed & 1U) {
+            events[count].usage = new_state->keys[i];
+            events[count++].flags = KEYBOARD_EVENT_PRESS;
+        }
+    }
+    
+    return count;
 }
 
 /**
- * @brief  Put keyboard data into buffer
- * @note   Adds keyboard data to circular buffer
- * @param  data: Pointer to keyboard data to store
+ * @brief  Diff two usage bitmaps into key events
+ * @note   Same order as keyboard_state_events(); used for coalesced
+ *         snapshots, which may hold more keys than a report
+ * @param  old_bitmap: Snapshot before
+ * @param  new_bitmap: Snapshot after
+ * @param  events: Array of KEYBOARD_EVENT_BUFFER_SIZE entries
+ * @retval Number of events
+ */
+static uint8_t keyboard_bitmap_events(const uint8_t *old_bitmap, const uint8_t *new_bitmap,
+                                      KeyboardEvent_t *events)
+{
+    uint8_t count = keyboard_modifier_events(old_bitmap[KEYBOARD_MODIFIER_USAGE >> 3],
+                                             new_bitmap[KEYBOARD_MODIFIER_USAGE >> 3], events);
+    
+    for (uint8_t press = 0; press <= KEYBOARD_EVENT_PRESS; press++) {
+        for (uint8_t i = 0; i < (KEYBOARD_MODIFIER_USAGE >> 3); i++) {
+            uint8_t changed = (uint8_t)((old_bitmap[i] ^ new_bitmap[i]) & (press ? new_bitmap[i] : old_bitmap[i]));
+            
+            for (uint8_t bit = 0; changed != 0; bit++, changed >>= 1) {
+                if ((changed & 1U) && count < KEYBOARD_EVENT_BUFFER_SIZE) {
+                    events[count].usage = (uint8_t)(i * 8U + bit);
+                    events[count++].flags = press;
+                }
+            }
+        }
+    }
+    
+    return count;
+}
+
+/**
+ * @brief  Pass on the events of one report
+ * @note   Buffers them, or folds them into a net delta while the buffer is
+ *         saturated. Events that would tap a key a second time within the
+ *         coalesced span are held instead and passed on once the span has
+ *         been flushed. Caller must have interrupts disabled.
+ * @param  events: Events to pass on
+ * @param  count: Number of events, none is a no-op
+ * @param  time_ms: Tick of the report
  * @retval None
  */
-static void keyboard_buffer_put(const USB_HID_KeyboardData_t *data)
+static void keyboard_buffer_events(KeyboardEvent_t *events, uint8_t count, uint16_t time_ms)
 {
-    __disable_irq();
+    uint8_t folded = count;
+    
+    if (count == 0) {
+        return;
+    }
+    
+    if (held_count != 0) {
+        /* Polled while a report was held - let the main loop resync */
+        buffer_overflow = 1;
+        return;
+    }
+    
+    if (coalesce_active || keyboard_buffer_free() < count) {
+        /* Buffer saturated - fold the report into a net delta */
+        coalesce.time_ms = time_ms;
+        folded = keyboard_coalesce_events(events, count);
+        if (folded < count) {
+            /* End the span here, the rest waits for the flush */
+            memcpy(held_events, &events[folded], (count - folded) * sizeof(KeyboardEvent_t));
+            held_count = (uint8_t)(count - folded);
+            held_time_ms = time_ms;
+            handler_stats.held_reports++;
+        }
+        keyboard_coalesce_flush();
+    } else {
+        keyboard_buffer_store(events, count, time_ms);
+    }
+    
+    for (uint8_t i = 0; i < folded; i++) {
+        if (events[i].flags & KEYBOARD_EVENT_PRESS) {
+            KEYBOARD_USAGE_SET(output_keys, events[i].usage);
+        } else {
+            KEYBOARD_USAGE_CLEAR(output_keys, events[i].usage);
+        }
+    }
+}
+
+/**
+ * @brief  Append the events of one report to the buffer
+ * @note   Flags the final event KEYBOARD_EVENT_LAST. The caller checks
+ *         the free space and must have interrupts disabled.
+ * @param  events: Events to store
+ * @param  count: Number of events, at least one
+ * @param  time_ms: Tick of the report
+ * @retval None
+ */
+static void keyboard_buffer_store(KeyboardEvent_t *events, uint8_t count, uint16_t time_ms)
+{
+    events[count - 1].flags |= KEYBOARD_EVENT_LAST;
     
-    if (!keyboard_buffer_is_full()) {
-        memcpy(&keyboard_buffer[buffer_head], data, sizeof(USB_HID_KeyboardData_t));
-        buffer_head = (buffer_head + 1) % KEYBOARD_BUFFER_SIZE;
+    for (uint8_t i = 0; i < count; i++) {
+        events[i].time_ms = time_ms;
+        event_buffer[buffer_head] = events[i];
+        buffer_head = (uint8_t)((buffer_head + 1) % KEYBOARD_EVENT_BUFFER_SIZE);
         buffer_count++;
     }
+}
+
+/**
+ * @brief  Fold the events of a report into the coalescing state
+ * @note   Starts coalescing against the last buffered state if needed.
+ *         A report changes each key once, except a tap decided by
+ *         tap-hold; its release is folded as a state of its own. Stops
+ *         at the first event that would repeat a tap or gap of the span.
+ *         Caller must have interrupts disabled.
+ * @param  events: Events of the report
+ * @param  count: Number of events
+ * @retval Number of events folded
+ */
+static uint8_t keyboard_coalesce_events(const KeyboardEvent_t *events, uint8_t count)
+{
+    uint8_t next[USB_HID_USAGE_BITMAP_SIZE];
     
-    __enable_irq();
+    if (!coalesce_active) {
+        memset(&coalesce, 0, sizeof(KeyboardCoalesce_t));
+        memcpy(coalesce.base, output_keys, USB_HID_USAGE_BITMAP_SIZE);
+        memcpy(coalesce.latest, coalesce.base, USB_HID_USAGE_BITMAP_SIZE);
+        memcpy(coalesce.emitted, coalesce.base, USB_HID_USAGE_BITMAP_SIZE);
+        coalesce.phase = KEYBOARD_FLUSH_RELEASE_GAPS;
+        coalesce_active = 1;
+    }
+    
+    handler_stats.coalesced_reports++;
+    memcpy(next, coalesce.latest, USB_HID_USAGE_BITMAP_SIZE);
+    
+    for (uint8_t i = 0; i < count; i++) {
+        uint8_t usage = events[i].usage;
+        
+        if (KEYBOARD_USAGE_GET(next, usage) != KEYBOARD_USAGE_GET(coalesce.latest, usage)) {
+            /* Second change of this key - fold the state so far first */
+            keyboard_coalesce_fold(next);
+        }
+        if (keyboard_coalesce_repeats(&events[i])) {
+            keyboard_coalesce_fold(next);
+            return i;
+        }
+        if (events[i].flags & KEYBOARD_EVENT_PRESS) {
+            KEYBOARD_USAGE_SET(next, usage);
+        } else {
+            KEYBOARD_USAGE_CLEAR(next, usage);
+        }
+    }
+    
+    keyboard_coalesce_fold(next);
+    return count;
 }
 
 /**
- * @brief  Get keyboard data from buffer
- * @note   Retrieves keyboard data from circular buffer
- * @param  data: Pointer to store retrieved keyboard data
+ * @brief  Check if an event would start a cycle the span cannot keep
+ * @note   A press of a key tapped in the span or a release of a key gapped
+ *         in it would need a second cycle of the key. A new tap once the
+ *         flush has moved past the taps, or a new gap once gapped keys
+ *         were released, would not be emitted either.
+ * @param  event: Event checked against the folded state
+ * @retval 1 if the event must wait for the span to be flushed, 0 otherwise
+ */
+static uint8_t keyboard_coalesce_repeats(const KeyboardEvent_t *event)
+{
+    uint8_t usage = event->usage;
+    
+    if (KEYBOARD_USAGE_GET(coalesce.base, usage)) {
+        if (event->flags & KEYBOARD_EVENT_PRESS) {
+            /* Gap */
+            return (uint8_t)(coalesce.phase != KEYBOARD_FLUSH_RELEASE_GAPS);
+        }
+        return (uint8_t)KEYBOARD_USAGE_GET(coalesce.gaps, usage);
+    }
+    
+    if (event->flags & KEYBOARD_EVENT_PRESS) {
+        return (uint8_t)KEYBOARD_USAGE_GET(coalesce.taps, usage);
+    }
+    /* Tap */
+    return (uint8_t)(coalesce.phase == KEYBOARD_FLUSH_LATEST);
+}
+
+/**
+ * @brief  Fold a keyboard state into the coalescing state
+ * @note   Every press or release is recorded relative to the base: keys
+ *         tapped (up-down-up) and keys gapped (down-up-down) survive even
+ *         though only the net state is kept. keyboard_coalesce_events()
+ *         never folds a second cycle of the same key. Caller must have
+ *         interrupts disabled.
+ * @param  next: New keyboard state as a usage bitmap
  * @retval None
  */
-static void keyboard_buffer_get(USB_HID_KeyboardData_t *data)
+static void keyboard_coalesce_fold(const uint8_t *next)
 {
-    __disable_irq();
+    for (uint8_t i = 0; i < USB_HID_USAGE_BITMAP_SIZE; i++) {
+        uint8_t changed = coalesce.latest[i] ^ next[i];
+        
+        for (uint8_t bit = 0; changed != 0; bit++, changed >>= 1) {
+            uint8_t usage = (uint8_t)(i * 8U + bit);
+            
+            if ((changed & 1U) == 0) {
+                continue;
+            }
+            
+            if (KEYBOARD_USAGE_GET(coalesce.latest, usage)) {
+                /* Released */
+                if (!KEYBOARD_USAGE_GET(coalesce.base, usage)) {
+                    KEYBOARD_USAGE_SET(coalesce.taps, usage);
+                }
+            } else if (KEYBOARD_USAGE_GET(coalesce.base, usage)) {
+                /* Pressed again */
+                KEYBOARD_USAGE_SET(coalesce.gaps, usage);
+            }
+        }
+    }
     
-    if (!keyboard_buffer_is_empty()) {
-        memcpy(data, &keyboard_buffer[buffer_tail], sizeof(USB_HID_KeyboardData_t));
-        buffer_tail = (buffer_tail + 1) % KEYBOARD_BUFFER_SIZE;
-        buffer_count--;
+    memcpy(coalesce.latest, next, USB_HID_USAGE_BITMAP_SIZE);
+}
+
+/**
+ * @brief  Move coalesced reports into the buffer
+ * @note   Emits as much as the free buffer space allows and resumes on the
+ *         next call: gapped keys released, then tapped keys pressed and
+ *         released in batches that fit a report, then the latest state,
+ *         which presses gapped keys again. Snapshots equal to their
+ *         predecessor are skipped. Caller must have interrupts disabled.
+ * @retval None
+ */
+static void keyboard_coalesce_flush(void)
+{
+    uint8_t rest[USB_HID_USAGE_BITMAP_SIZE];
+    uint8_t snapshot[USB_HID_USAGE_BITMAP_SIZE];
+    
+    while (coalesce_active) {
+        for (uint8_t i = 0; i < USB_HID_USAGE_BITMAP_SIZE; i++) {
+            rest[i] = (uint8_t)(coalesce.base[i] & ~coalesce.gaps[i]);
+        }
+        
+        if (coalesce.phase == KEYBOARD_FLUSH_RELEASE_GAPS) {
+            if (keyboard_buffer_free() < KEYBOARD_REPORT_MAX_EVENTS) {
+                return;
+            }
+            keyboard_coalesce_emit(rest);
+            coalesce.phase = KEYBOARD_FLUSH_TAPS;
+        } else if (coalesce.phase == KEYBOARD_FLUSH_TAPS) {
+            uint8_t room = USB_HID_MAX_KEYS;
+            uint8_t batched = 0;
+            
+            if (keyboard_buffer_free() < 2 * KEYBOARD_REPORT_MAX_EVENTS) {
+                return;
+            }
+            
+            for (uint16_t usage = 0; usage < KEYBOARD_MODIFIER_USAGE; usage++) {
+                if (KEYBOARD_USAGE_GET(rest, usage) && room > 0) {
+                    room--;
+                }
+            }
+            
+            /* Move a batch of taps that fits the remaining key slots */
+            memcpy(snapshot, rest, USB_HID_USAGE_BITMAP_SIZE);
+            for (uint16_t usage = 0; usage < 256U; usage++) {
+                if (!KEYBOARD_USAGE_GET(coalesce.taps, usage)) {
+                    continue;
+                }
+                if (usage < KEYBOARD_MODIFIER_USAGE) {
+                    if (room == 0) {
+                        continue;
+                    }
+                    room--;
+                }
+                KEYBOARD_USAGE_SET(snapshot, usage);
+                KEYBOARD_USAGE_CLEAR(coalesce.taps, usage);
+                batched++;
+            }
+            
+            if (batched == 0) {
+                for (uint8_t i = 0; i < USB_HID_USAGE_BITMAP_SIZE; i++) {
+                    if (coalesce.taps[i] != 0) {
+                        /* No key slot left for the remaining taps */
+                        memset(coalesce.taps, 0, USB_HID_USAGE_BITMAP_SIZE);
+                        buffer_overflow = 1;
+                        break;
+                    }
+                }
+                coalesce.phase = KEYBOARD_FLUSH_LATEST;
+                continue;
+            }
+            
+            keyboard_coalesce_emit(snapshot);
+            keyboard_coalesce_emit(rest);
+        } else {
+            if (keyboard_buffer_free() < 2 * KEYBOARD_REPORT_MAX_EVENTS) {
+                return;
+            }
+            
+            keyboard_coalesce_emit(coalesce.latest);
+            coalesce_active = 0;
+        }
     }
+}
+
+/**
+ * @brief  Pass on the held report once the coalesced span is flushed
+ * @note   Caller must have interrupts disabled
+ * @retval None
+ */
+static void keyboard_coalesce_release_held(void)
+{
+    KeyboardEvent_t events[KEYBOARD_TIMED_MAX_EVENTS];
+    uint8_t count = held_count;
     
-    __enable_irq();
+    memcpy(events, held_events, count * sizeof(KeyboardEvent_t));
+    held_count = 0;
+    keyboard_buffer_events(events, count, held_time_ms);
 }
 
 /**
- * @brief  Compare keyboard states and find changes
- * @note   Identifies which keys have been pressed or released
- * @param  old_state: Previous keyboard state
- * @param  new_state: Current keyboard state
- * @param  changes: Structure to store detected changes
+ * @brief  Store the events leading to one coalesced snapshot
+ * @note   A snapshot equal to its predecessor yields no events
+ * @param  bitmap: Snapshot to store
  * @retval None
  */
-static void keyboard_compare_states(const USB_HID_KeyboardData_t *old_state, 
-                                   const USB_HID_KeyboardData_t *new_state,
-                                   USB_HID_KeyboardData_t *changes)
+static void keyboard_coalesce_emit(const uint8_t *bitmap)
 {
-    /* Clear changes structure */
-    memset(changes, 0, sizeof(USB_HID_KeyboardData_t));
+    KeyboardEvent_t events[KEYBOARD_EVENT_BUFFER_SIZE];
+    uint8_t count = keyboard_bitmap_events(coalesce.emitted, bitmap, events);
     
-    /* Check modifier changes */
-    changes->modifier = old_state->modifier ^ new_state->modifier;
+    if (count == 0) {
+        return;
+    }
     
-    /* Check key changes */
-    /* This is a simplified implementation - a more sophisticated version
-       would track individual key press/release events */
-    changes->key_count = new_state->key_count;
-    for (uint8_t i = 0; i < new_state->key_count; i++) {
-        changes->keys[i] = new_state->keys[i];
+    if (count > keyboard_buffer_free()) {
+        /* Snapshot too far from its predecessor - let the main loop resync */
+        buffer_overflow = 1;
+    } else {
+        keyboard_buffer_store(events, count, coalesce.time_ms);
     }
+    memcpy(coalesce.emitted, bitmap, USB_HID_USAGE_BITMAP_SIZE);
+}
+
+/**
+ * @brief  Get free keyboard buffer entries
+ * @retval Number of free event entries
+ */
+static uint8_t keyboard_buffer_free(void)
+{
+    return (uint8_t)(KEYBOARD_EVENT_BUFFER_SIZE - buffer_count);
 }
 
 /**
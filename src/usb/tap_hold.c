@@ -0,0 +1,249 @@
+/**
+ ******************************************************************************
+ * @file    tap_hold.c
+ * @brief   Dual-role keys and one-shot modifiers for STM32F411
+ * @author  STM32F411 USB-PS2 Project
+ * @version 1.0.0
+ * @date    2024
+ *
+ * @description
+ * Gives keys from the keymap file a tap and a hold meaning, e.g. Space
+ * tapped for Space and held for the Fn layer key. The press of such a key
+ * is held back until it is decided:
+ *   - released within the tapping term, no other key pressed: tap, the
+ *     tap usage is pressed and released
+ *   - another key pressed: hold, decided the moment that key arrives and
+ *     sent ahead of it
+ *   - still down when the tapping term ends: hold, decided from the
+ *     SysTick hook (keyboard_handler_tick()) against a single deadline
+ * A key's delay is thus bounded by the tapping term, and keys without a
+ * second meaning pass through untouched.
+ *
+ * A one-shot key holds a modifier while held; tapped, it arms the
+ * modifier for the next key press instead, released with that key.
+ * Tapping it again disarms it.
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include "tap_hold.h"
+
+/* Private typedef -----------------------------------------------------------*/
+
+/* Private define ------------------------------------------------------------*/
+#define TAP_HOLD_NONE               0       ///< No key undecided
+
+/* Private macro -------------------------------------------------------------*/
+
+/* Private variables ---------------------------------------------------------*/
+static volatile uint8_t pending = TAP_HOLD_NONE;   ///< Definition number + 1 of the undecided key
+static uint16_t pending_deadline_ms = 0;            ///< Tick at which the undecided key counts as held
+static uint8_t holding = 0;                         ///< Bit n set while definition n is held
+static uint8_t modifiers_down = 0;                  ///< Modifier bits down on the keyboard
+static uint8_t one_shot_armed = 0;                  ///< Modifier bits waiting for the next key
+static uint8_t one_shot_applied = 0;                ///< Modifier bits pressed around one_shot_usage
+static uint8_t one_shot_usage = 0;                  ///< Key the applied one-shot modifiers belong to
+
+/* Private function prototypes -----------------------------------------------*/
+static uint8_t tap_hold_resolve_hold(KeyboardEvent_t *out);
+static uint8_t tap_hold_press(uint8_t usage, KeyboardEvent_t *out);
+static uint8_t tap_hold_release(uint8_t usage, KeyboardEvent_t *out);
+static uint8_t tap_hold_modifiers(uint8_t bits, uint8_t press, KeyboardEvent_t *out);
+
+/* Exported functions --------------------------------------------------------*/
+
+/**
+ * @brief  Forget undecided, held and one-shot keys
+ * @note   Called when the keyboard handler is reset; the host has been
+ *         sent a release of every key
+ * @retval None
+ */
+void tap_hold_reset(void)
+{
+    pending = TAP_HOLD_NONE;
+    holding = 0;
+    modifiers_down = 0;
+    one_shot_armed = 0;
+    one_shot_applied = 0;
+    one_shot_usage = 0;
+}
+
+/**
+ * @brief  Check if the keymap defines any dual-role key
+ * @retval 1 if events must go through tap_hold_events(), 0 otherwise
+ */
+uint8_t tap_hold_active(void)
+{
+    return tap_hold_count != 0;
+}
+
+/**
+ * @brief  Check if a key waits for its tapping term
+ * @retval 1 if tap_hold_tick() may decide a key, 0 otherwise
+ */
+uint8_t tap_hold_pending(void)
+{
+    return pending != TAP_HOLD_NONE;
+}
+
+/**
+ * @brief  Apply dual-role keys and one-shot modifiers to the events of a report
+ * @note   Caller must have interrupts disabled
+ * @param  events: Key events of the report
+ * @param  count: Number of events
+ * @param  time_ms: Tick of the report, starts the tapping term of a key pressed
+ * @param  out: Array of count + TAP_HOLD_EXTRA_EVENTS events for the result
+ * @retval Number of events stored
+ */
+uint8_t tap_hold_events(const KeyboardEvent_t *events, uint8_t count, uint16_t time_ms, KeyboardEvent_t *out)
+{
+    uint8_t out_count = 0;
+
+    for (uint8_t i = 0; i < count; i++) {
+        uint8_t usage = events[i].usage;
+        uint8_t key = tap_hold_keys[usage];
+
+        if (usage >= USB_HID_MODIFIER_USAGE) {
+            uint8_t bit = (uint8_t)(1U << (usage - USB_HID_MODIFIER_USAGE));
+
+            modifiers_down = (events[i].flags & KEYBOARD_EVENT_PRESS) ? (uint8_t)(modifiers_down | bit)
+                                                                      : (uint8_t)(modifiers_down & ~bit);
+        }
+
+        if (events[i].flags & KEYBOARD_EVENT_PRESS) {
+            /* A second key decides the undecided one as held */
+            if (pending != TAP_HOLD_NONE) {
+                out_count += tap_hold_resolve_hold(&out[out_count]);
+            }
+            if (key != TAP_HOLD_NONE) {
+                pending = key;
+                pending_deadline_ms = (uint16_t)(time_ms + tap_hold_term_ms);
+            } else {
+                out_count += tap_hold_press(usage, &out[out_count]);
+            }
+        } else if (key != TAP_HOLD_NONE) {
+            const TapHoldDefinition_t *definition = &tap_hold_definitions[key - 1U];
+            uint8_t bit = (uint8_t)(1U << (key - 1U));
+
+            if (pending == key) {
+                /* Tapped */
+                pending = TAP_HOLD_NONE;
+                if (definition->flags & TAP_HOLD_ONE_SHOT) {
+                    one_shot_armed ^= (uint8_t)(1U << (definition->hold - USB_HID_MODIFIER_USAGE));
+                } else {
+                    out_count += tap_hold_press(definition->tap, &out[out_count]);
+                    out_count += tap_hold_release(definition->tap, &out[out_count]);
+                }
+            } else if (holding & bit) {
+                holding &= (uint8_t)~bit;
+                out[out_count].usage = definition->hold;
+                out[out_count++].flags = 0;
+            }
+            /* else: pressed before a reset, nothing was sent */
+        } else {
+            out_count += tap_hold_release(usage, &out[out_count]);
+        }
+    }
+
+    return out_count;
+}
+
+/**
+ * @brief  Decide the undecided key as held once its tapping term is over
+ * @note   Called from the SysTick hook with interrupts disabled
+ * @param  time_ms: Current tick
+ * @param  out: Array of TAP_HOLD_TICK_EVENTS events for the result
+ * @retval Number of events stored
+ */
+uint8_t tap_hold_tick(uint16_t time_ms, KeyboardEvent_t *out)
+{
+    if (pending == TAP_HOLD_NONE || (int16_t)(time_ms - pending_deadline_ms) < 0) {
+        return 0;
+    }
+
+    return tap_hold_resolve_hold(out);
+}
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+ * @brief  Press the hold usage of the undecided key
+ * @param  out: Array to store the event
+ * @retval Number of events stored
+ */
+static uint8_t tap_hold_resolve_hold(KeyboardEvent_t *out)
+{
+    const TapHoldDefinition_t *definition = &tap_hold_definitions[pending - 1U];
+
+    holding |= (uint8_t)(1U << (pending - 1U));
+    pending = TAP_HOLD_NONE;
+
+    out[0].usage = definition->hold;
+    out[0].flags = KEYBOARD_EVENT_PRESS;
+    return 1;
+}
+
+/**
+ * @brief  Press a key, with the armed one-shot modifiers ahead of it
+ * @note   Modifier keys do not use up the one-shot modifiers
+ * @param  usage: Usage to press
+ * @param  out: Array to store the events
+ * @retval Number of events stored
+ */
+static uint8_t tap_hold_press(uint8_t usage, KeyboardEvent_t *out)
+{
+    uint8_t count = 0;
+
+    if (one_shot_armed != 0 && one_shot_applied == 0 && usage < USB_HID_MODIFIER_USAGE) {
+        one_shot_applied = (uint8_t)(one_shot_armed & ~modifiers_down);
+        one_shot_usage = usage;
+        one_shot_armed = 0;
+        count = tap_hold_modifiers(one_shot_applied, KEYBOARD_EVENT_PRESS, out);
+    }
+
+    out[count].usage = usage;
+    out[count++].flags = KEYBOARD_EVENT_PRESS;
+    return count;
+}
+
+/**
+ * @brief  Release a key, and the one-shot modifiers pressed for it
+ * @param  usage: Usage to release
+ * @param  out: Array to store the events
+ * @retval Number of events stored
+ */
+static uint8_t tap_hold_release(uint8_t usage, KeyboardEvent_t *out)
+{
+    uint8_t count = 1;
+
+    out[0].usage = usage;
+    out[0].flags = 0;
+
+    if (one_shot_applied != 0 && usage == one_shot_usage) {
+        count += tap_hold_modifiers(one_shot_applied, 0, &out[1]);
+        one_shot_applied = 0;
+    }
+
+    return count;
+}
+
+/**
+ * @brief  Store press or release events of modifier bits
+ * @param  bits: Modifier bits
+ * @param  press: KEYBOARD_EVENT_PRESS or 0
+ * @param  out: Array to store the events
+ * @retval Number of events stored
+ */
+static uint8_t tap_hold_modifiers(uint8_t bits, uint8_t press, KeyboardEvent_t *out)
+{
+    uint8_t count = 0;
+
+    for (uint8_t bit = 0; bits != 0; bit++, bits >>= 1) {
+        if (bits & 1U) {
+            out[count].usage = (uint8_t)(USB_HID_MODIFIER_USAGE + bit);
+            out[count++].flags = press;
+        }
+    }
+
+    return count;
+}
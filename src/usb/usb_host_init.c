@@ -10,6 +10,9 @@
 
 /* Includes ------------------------------------------------------------------*/
 #include "usb_host_init.h"
+#include "keyboard_handler.h"
+#include "scancode_translator.h"
+#include "ps2_init.h"
 #include "main.h"
 
 /* Private typedef -----------------------------------------------------------*/
@@ -17,6 +20,12 @@
 /* Private define ------------------------------------------------------------*/
 #define USB_HOST_MAX_RETRY_COUNT    3
 #define USB_HOST_RETRY_DELAY_MS     100
+#define USB_HOST_KEYBOARD_IN_CHANNEL 1      ///< Host channel of the keyboard interrupt IN endpoint
+#define USB_HOST_KEYBOARD_REPORT_SIZE 8     ///< Boot protocol keyboard report size
+#define USB_HOST_KEYBOARD_INTERVAL_MS 1     ///< Keyboard interrupt IN bInterval, one full-speed frame
+#define USB_HOST_DIRECTION_IN       1       ///< Channel direction: device to host
+#define USB_HOST_TOKEN_DATA         1       ///< PID token: data stage
+#define USB_HOST_FAST_PATH_REPORTS  2       ///< Reports translated per completion interrupt (PS2_ISR_FAST_PATH)
 
 /* Private macro -------------------------------------------------------------*/
 
@@ -25,10 +34,17 @@ static HCD_HandleTypeDef hhcd_USB_OTG_FS;
 static USB_HostStatus_t usb_host_status = USB_HOST_INIT;
 static uint8_t device_connected = 0;
 static uint32_t retry_count = 0;
+static volatile uint8_t input_lost = 0;
+static uint8_t keyboard_in_report[USB_HOST_KEYBOARD_REPORT_SIZE];
+static volatile uint8_t keyboard_in_armed = 0;
+static volatile uint8_t keyboard_in_paused = 0;
+static USB_HostFlowStats_t flow_stats;
+static uint32_t skipped_poll_ms = 0;        ///< Tick of the last poll counted as skipped
 
 /* Private function prototypes -----------------------------------------------*/
 static void MX_USB_OTG_FS_HCD_Init(void);
 static void USB_Host_Error_Handler(void);
+static void usb_host_arm_keyboard_in(void);
 
 /* Exported functions --------------------------------------------------------*/
 
@@ -115,11 +131,15 @@ void usb_host_process(void)
             if (device_connected) {
                 device_connected = 0;
                 usb_host_status = USB_HOST_READY;
+                input_lost = 1;
             }
         }
         
         last_check_time = current_time;
     }
+    
+    /* Resume polling once flow control releases the endpoint */
+    usb_host_arm_keyboard_in();
 }
 
 /**
@@ -140,6 +160,57 @@ uint8_t usb_host_device_connected(void)
     return device_connected;
 }
 
+/**
+ * @brief  Check if keyboard input was interrupted
+ * @note   Set by disconnect and transfer errors so the main loop can release
+ *         keys the PS/2 host still believes are held. Reports once.
+ * @retval 1 if input was lost since the last call, 0 otherwise
+ */
+uint8_t usb_host_check_input_lost(void)
+{
+    uint8_t lost;
+    
+    __disable_irq();
+    lost = input_lost;
+    input_lost = 0;
+    __enable_irq();
+    
+    return lost;
+}
+
+/**
+ * @brief  Pause or resume keyboard interrupt IN polling
+ * @note   Flow control from the PS/2 side. While paused the IN transfer is
+ *         not re-armed, so the keyboard NAKs the missing polls and keeps
+ *         its latest state until polling resumes. A transfer already in
+ *         flight still completes.
+ * @param  pause: 1 to stop re-arming, 0 to resume
+ * @retval None
+ */
+void usb_host_pause_keyboard_in(uint8_t pause)
+{
+    if (pause && !keyboard_in_paused) {
+        flow_stats.pauses++;
+    }
+    keyboard_in_paused = pause ? 1 : 0;
+    
+    if (!pause) {
+        usb_host_arm_keyboard_in();
+    }
+}
+
+/**
+ * @brief  Get keyboard polling flow control statistics
+ * @param  stats: Pointer to store statistics
+ * @retval None
+ */
+void usb_host_get_flow_stats(USB_HostFlowStats_t *stats)
+{
+    if (stats != NULL) {
+        *stats = flow_stats;
+    }
+}
+
 /**
  * @brief  USB Host URB change callback
  * @note   Called when USB URB (USB Request Block) state changes
@@ -150,10 +221,40 @@ uint8_t usb_host_device_connected(void)
  */
 void usb_host_urb_change_callback(HCD_HandleTypeDef *hhcd, uint8_t chnum, HCD_URBStateTypeDef urb_state)
 {
+    uint8_t keyboard_in = (chnum == USB_HOST_KEYBOARD_IN_CHANNEL);
+#ifdef PS2_ISR_FAST_PATH
+    uint8_t translated;
+#endif
+    
+    if (keyboard_in && urb_state != URB_IDLE) {
+        keyboard_in_armed = 0;
+    }
+    
     /* Handle URB state changes */
     switch (urb_state) {
         case URB_DONE:
             /* Transfer completed successfully */
+            if (keyboard_in) {
+                (void)keyboard_handler_process_report(keyboard_in_report,
+                                                      (uint16_t)HAL_HCD_HC_GetXferCount(hhcd, chnum));
+                flow_stats.reports++;
+#ifdef PS2_ISR_FAST_PATH
+                /* Translate here instead of in the main loop and start the
+                 * transmitter; bounded to a few reports, never waits on the
+                 * PS/2 lines (the kick runs at PendSV priority) */
+                (void)scancode_translator_service(USB_HOST_FAST_PATH_REPORTS, &translated);
+                if (translated != 0) {
+                    ps2_kick();
+                }
+#endif
+                retry_count = 0;
+                usb_host_arm_keyboard_in();
+            }
+            break;
+            
+        case URB_NOTREADY:
+            /* Keyboard NAKed - no change since the last report */
+            usb_host_arm_keyboard_in();
             break;
             
         case URB_ERROR:
@@ -161,15 +262,18 @@ void usb_host_urb_change_callback(HCD_HandleTypeDef *hhcd, uint8_t chnum, HCD_UR
             if (retry_count < USB_HOST_MAX_RETRY_COUNT) {
                 retry_count++;
                 /* Retry the transfer */
+                usb_host_arm_keyboard_in();
             } else {
                 usb_host_status = USB_HOST_ERROR;
                 retry_count = 0;
+                input_lost = 1;
             }
             break;
             
         case URB_STALL:
             /* Endpoint stalled */
             usb_host_status = USB_HOST_ERROR;
+            input_lost = 1;
             break;
             
         default:
@@ -211,11 +315,51 @@ USB_HostStatus_t usb_host_read_keyboard_data(uint8_t *data, uint16_t length)
 static void USB_Host_Error_Handler(void)
 {
     usb_host_status = USB_HOST_ERROR;
+    input_lost = 1;
     
     /* Additional error handling can be added here */
     /* For example: logging, LED indication, etc. */
 }
 
+/**
+ * @brief  Submit the keyboard interrupt IN transfer
+ * @note   Does nothing while a transfer is pending, while polling is
+ *         paused by flow control or the keyboard handler holds a report,
+ *         or without a keyboard. The main loop re-arms it every pass; a
+ *         poll held back counts as skipped once per poll interval, however
+ *         many passes find it held.
+ * @retval None
+ */
+static void usb_host_arm_keyboard_in(void)
+{
+    uint32_t now_ms;
+    
+    __disable_irq();
+    
+    if (!device_connected || keyboard_in_armed) {
+        __enable_irq();
+        return;
+    }
+    
+    if (keyboard_in_paused || keyboard_handler_congested()) {
+        now_ms = HAL_GetTick();
+        if ((now_ms - skipped_poll_ms) >= USB_HOST_KEYBOARD_INTERVAL_MS) {
+            flow_stats.skipped_polls++;
+            skipped_poll_ms = now_ms;
+        }
+        __enable_irq();
+        return;
+    }
+    
+    if (HAL_HCD_HC_SubmitRequest(&hhcd_USB_OTG_FS, USB_HOST_KEYBOARD_IN_CHANNEL,
+                                 USB_HOST_DIRECTION_IN, EP_TYPE_INTR, USB_HOST_TOKEN_DATA,
+                                 keyboard_in_report, USB_HOST_KEYBOARD_REPORT_SIZE, 0) == HAL_OK) {
+        keyboard_in_armed = 1;
+    }
+    
+    __enable_irq();
+}
+
 /* HAL Callback functions ----------------------------------------------------*/
 
 /**
@@ -252,6 +396,8 @@ void HAL_HCD_Connect_Callback(HCD_HandleTypeDef *hhcd)
 void HAL_HCD_Disconnect_Callback(HCD_HandleTypeDef *hhcd)
 {
     device_connected = 0;
+    keyboard_in_armed = 0;
+    input_lost = 1;
     usb_host_status = USB_HOST_READY;
     retry_count = 0;
 }